@@ -159,10 +159,10 @@ void * ngx_shm_search_array(ngx_shm_array_t *a, const void * key, ngx_shm_compar
     return res;
 }
 
-typedef struct {
+struct ngx_shm_hash_node_s {
     ngx_queue_t  hash_node;
     void        *data;
-} ngx_shm_hash_node_t;
+};
 
 
 ngx_shm_hash_t *ngx_shm_hash_create(ngx_shm_pool_t * pool,
@@ -200,20 +200,34 @@ ngx_shm_hash_t *ngx_shm_hash_create(ngx_shm_pool_t * pool,
     return table;
 }
 
+ngx_shm_hash_node_t *ngx_shm_hash_alloc_node(ngx_shm_hash_t * table)
+{
+    return ngx_shm_pool_calloc(table->pool, sizeof(ngx_shm_hash_node_t));
+}
+
+void ngx_shm_hash_add_node(ngx_shm_hash_t * table, ngx_shm_hash_node_t * node, void * elem)
+{
+    ngx_uint_t hash = 0;
+
+    node->data = elem;
+    hash = table->hash_func(elem);
+
+    /* the node is complete before the bucket points at it */
+    ngx_memory_barrier();
+
+    ngx_queue_insert_head(&table->buckets[hash % table->bucket_size], &node->hash_node);
+}
+
 ngx_int_t ngx_shm_hash_add(ngx_shm_hash_t * table, void * elem)
 {
     ngx_shm_hash_node_t * node = NULL;
-    ngx_uint_t hash = 0;
 
-    node = ngx_shm_pool_calloc(table->pool, sizeof(ngx_shm_hash_node_t));
+    node = ngx_shm_hash_alloc_node(table);
     if (node == NULL) {
         return NGX_ERROR;
     }
 
-    node->data = elem;
-    hash = table->hash_func(elem);
-
-    ngx_queue_insert_head(&table->buckets[hash % table->bucket_size], &node->hash_node);
+    ngx_shm_hash_add_node(table, node, elem);
 
     return NGX_OK;
 }
@@ -248,6 +262,40 @@ ngx_shm_hash_del(ngx_shm_hash_t * table, void * elem)
     return NGX_OK;
 }
 
+void * ngx_shm_hash_replace(ngx_shm_hash_t * table, void * elem)
+{
+    ngx_uint_t             hash;
+    ngx_queue_t           *slot;
+    ngx_queue_t           *q;
+    ngx_shm_hash_node_t   *node;
+    void                  *old;
+
+    if (table == NULL) {
+        return NULL;
+    }
+    hash = table->hash_func(elem);
+
+    slot = &table->buckets[hash % table->bucket_size];
+
+    for (q = ngx_queue_head(slot);
+         q != ngx_queue_sentinel(slot);
+         q = ngx_queue_next(q))
+    {
+        node = ngx_queue_data(q, ngx_shm_hash_node_t, hash_node);
+
+        if (table->compar_func(node->data, elem) == 0) {
+            old = node->data;
+
+            ngx_memory_barrier();
+            node->data = elem;
+
+            return old;
+        }
+    }
+
+    return NULL;
+}
+
 void * ngx_shm_hash_get(ngx_shm_hash_t * table, void * elem)
 {
     ngx_uint_t               hash;
@@ -223,6 +223,31 @@ ngx_shm_hash_t *ngx_shm_hash_create(ngx_shm_pool_t * pool,
     ngx_shm_hash_calc_func hash_func,
     ngx_shm_compar_func compar_func);
 
+/**
+ * @brief Hash table node, opaque
+ */
+typedef struct ngx_shm_hash_node_s  ngx_shm_hash_node_t;
+
+/**
+ * @brief Allocate a node for an element that is linked in later
+ * 
+ * @param table Hash table
+ * @return ngx_shm_hash_node_t* node
+ * @retval NULL allocation failed
+ * @note Lets a caller allocate everything up front, so that linking cannot fail
+ */
+ngx_shm_hash_node_t *ngx_shm_hash_alloc_node(ngx_shm_hash_t * table);
+
+/**
+ * @brief Add Hash element with a node allocated by ngx_shm_hash_alloc_node
+ * 
+ * @param table Hash table
+ * @param node node allocated from the same table
+ * @param elem element pointer
+ * @note The node is set up before it is linked, readers walking the bucket see the complete element
+ */
+void ngx_shm_hash_add_node(ngx_shm_hash_t * table, ngx_shm_hash_node_t * node, void * elem);
+
 /**
  * @brief Add Hash element
  * 
@@ -247,6 +272,17 @@ ngx_int_t ngx_shm_hash_add(ngx_shm_hash_t * table, void * elem);
 ngx_int_t
 ngx_shm_hash_del(ngx_shm_hash_t * table, void * elem);
 
+/**
+ * @brief Replace the Hash element that has the same key as elem
+ * 
+ * @param table Hash table
+ * @param elem the new element
+ * @return void* the replaced element
+ * @retval NULL no element has the key, nothing was replaced
+ * @note The replacement is a single pointer store, readers see either element
+ */
+void * ngx_shm_hash_replace(ngx_shm_hash_t * table, void * elem);
+
 /**
  * @brief Get the Hash element
  * 
@@ -0,0 +1,369 @@
+
+/*
+ * Copyright (C) 2017-2019 Alibaba Group Holding Limited
+ */
+
+
+/*
+ * Decode throughput of dubbo response payloads: the former path, which
+ * flattens the chain and decodes through hessian2_input into C++ objects,
+ * against the streaming decoder of ngx_dubbo_hessian2.c reading the chain
+ * in place.  Both must give the same result, and with lists, maps and
+ * objects added to the payload the streaming decoder must leave their
+ * entries out and give that result again.  It links the objects of a
+ * configured and built tree, from the top directory:
+ *
+ *     cc -O2 -o hessian2_bench modules/mod_dubbo/bench/hessian2_bench.c \
+ *         -I objs -I src/core -I src/event -I src/os/unix -I src/proc \
+ *         -I src/http -I src/http/modules -I src/http/v2 \
+ *         -I modules/ngx_http_upstream_check_module \
+ *         -I modules/ngx_multi_upstream_module -I modules/mod_dubbo \
+ *         objs/addon/mod_dubbo/ngx_dubbo_util.o \
+ *         objs/addon/mod_dubbo/ngx_dubbo_hessian2.o \
+ *         objs/addon/hessian2/hessian2_input.o \
+ *         objs/addon/hessian2/hessian2_output.o \
+ *         objs/addon/hessian2/hessian2_ext.o \
+ *         objs/addon/utils/objects.o objs/addon/utils/utils.o \
+ *         objs/src/core/ngx_palloc.o objs/src/core/ngx_array.o \
+ *         objs/src/core/ngx_string.o objs/src/os/unix/ngx_alloc.o \
+ *         -lstdc++
+ *     ./hessian2_bench [headers] [body size] [iterations]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <ngx_dubbo.h>
+
+#include <time.h>
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static u_char *
+put_str(u_char *p, const char *s)
+{
+    size_t  len, n, i;
+
+    len = ngx_strlen(s);
+
+    /* the length is in characters */
+
+    for (i = 0, n = 0; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            n++;
+        }
+    }
+
+    if (n < 32) {
+        *p++ = (u_char) n;
+
+    } else {
+        *p++ = 'S';
+        *p++ = (u_char) (n >> 8);
+        *p++ = (u_char) n;
+    }
+
+    return ngx_cpymem(p, s, len);
+}
+
+
+static u_char *
+put_int(u_char *p, int32_t n)
+{
+    *p++ = 'I';
+    *p++ = (u_char) (n >> 24);
+    *p++ = (u_char) (n >> 16);
+    *p++ = (u_char) (n >> 8);
+    *p++ = (u_char) n;
+
+    return p;
+}
+
+
+static u_char *
+put_bin(u_char *p, size_t len)
+{
+    size_t  n;
+
+    /* chunked as hessian2_output does */
+
+    while (len > 0x8000) {
+        *p++ = 'A';
+        *p++ = 0x80;
+        *p++ = 0x00;
+        ngx_memset(p, 'x', 0x8000);
+        p += 0x8000;
+        len -= 0x8000;
+    }
+
+    n = len;
+
+    *p++ = 'B';
+    *p++ = (u_char) (n >> 8);
+    *p++ = (u_char) n;
+    ngx_memset(p, 'x', n);
+
+    return p + n;
+}
+
+
+/* entries the result has no place for, each one as the key "x-skip-N" */
+
+static u_char *
+put_compound(u_char *p)
+{
+    ngx_uint_t  i;
+
+    static u_char  values[][48] = {
+
+        /* fixed-length untyped list: 2, "ab", 1.0 */
+        { 'X', 0x93, 0x92, 0x02, 'a', 'b', 0x5c },
+
+        /* variable-length typed list with a nested map */
+        { 'U', 0x04, '[', 'i', 'n', 't', 0x91,
+          'H', 0x01, 'k', 'W', 0x91, 'N', 'Z', 'Z', 'Z' },
+
+        /* typed map with a long and a date */
+        { 'M', 0x03, 'm', 'a', 'p', 0x01, 'l', 'L', 0, 0, 0, 0, 0, 0, 0, 1,
+          0x01, 'd', 'J', 0, 0, 0, 0, 0, 0, 0, 2, 'Z' },
+
+        /* class definition with two fields, and an object of it */
+        { 'C', 0x03, 'c', 'l', 's', 0x92, 0x01, 'a', 0x01, 'b',
+          'O', 0x90, 0x91, 'T' },
+
+        /* compact object of that class, typed short list, reference */
+        { 0x60, 0x05, 'v', 'a', 'l', 'u', 'e', 0x5d, 0xff },
+        { 0x72, 0x90, 'F', 0x21, 'x' },
+        { 'Q', 0x90 },
+    };
+
+    static size_t  sizes[] = { 7, 16, 28, 14, 9, 5, 2 };
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        *p++ = 0x08;
+        p = ngx_sprintf(p, "x-skip-%ui", i);
+        p = ngx_cpymem(p, values[i], sizes[i]);
+    }
+
+    return p;
+}
+
+
+static u_char *
+build(u_char *p, ngx_uint_t headers, size_t body, ngx_uint_t compound)
+{
+    char        name[32];
+    ngx_uint_t  i;
+
+    *p++ = 0x94;                    /* value with attachments */
+    *p++ = 'H';
+
+    p = put_str(p, "status");
+    p = put_str(p, "200");
+
+    if (compound) {
+        p = put_compound(p);
+    }
+
+    p = put_str(p, "code");
+    p = put_int(p, 200000);
+
+    for (i = 0; i < headers; i++) {
+        ngx_sprintf((u_char *) name, "x-header-%ui%Z", i);
+        p = put_str(p, name);
+        p = put_str(p, "a value of some thirty-two bytes.");
+    }
+
+    p = put_str(p, "x-utf8");
+    p = put_str(p, "\xe4\xb8\xad\xe6\x96\x87, \xc3\xa9t\xc3\xa9");
+
+    p = put_str(p, "body");
+    p = put_bin(p, body);
+
+    *p++ = 'Z';
+
+    return p;
+}
+
+
+static double
+now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ngx_int_t
+same(ngx_array_t *a, ngx_array_t *b)
+{
+    ngx_uint_t     i;
+    ngx_keyval_t  *x, *y;
+
+    if (a->nelts != b->nelts) {
+        return 0;
+    }
+
+    x = a->elts;
+    y = b->elts;
+
+    for (i = 0; i < a->nelts; i++) {
+        if (x[i].key.len != y[i].key.len
+            || x[i].value.len != y[i].value.len
+            || ngx_memcmp(x[i].key.data, y[i].key.data, x[i].key.len) != 0
+            || ngx_memcmp(x[i].value.data, y[i].value.data, x[i].value.len)
+               != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    u_char       *payload, *p, *flat;
+    size_t        len, half;
+    double        start, old, cur;
+    ngx_buf_t     b[2];
+    ngx_str_t     in;
+    ngx_log_t     log;
+    ngx_uint_t    i, headers, body, n;
+    ngx_pool_t   *pool;
+    ngx_chain_t   cl[2];
+    ngx_array_t  *a, *r, *c;
+
+    headers = argc > 1 ? (ngx_uint_t) atoi(argv[1]) : 8;
+    body = argc > 2 ? (ngx_uint_t) atoi(argv[2]) : 1024;
+    n = argc > 3 ? (ngx_uint_t) atoi(argv[3]) : 200000;
+
+    ngx_pagesize = getpagesize();
+    ngx_memzero(&log, sizeof(ngx_log_t));
+
+    payload = malloc(headers * 64 + body + body / 0x8000 * 3 + 512);
+    flat = malloc(headers * 64 + body + body / 0x8000 * 3 + 512);
+
+    if (payload == NULL || flat == NULL) {
+        return 1;
+    }
+
+    pool = ngx_create_pool(16384, &log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    /* the same payload with lists, maps and objects, in one buffer */
+
+    p = build(payload, headers, body, 1);
+
+    ngx_memzero(b, sizeof(b));
+
+    b[0].pos = payload;
+    b[0].last = p;
+
+    cl[0].buf = &b[0];
+    cl[0].next = NULL;
+
+    if (ngx_dubbo_decode_payload_map(pool, cl, p - payload, &c, &log)
+        != NGX_OK)
+    {
+        printf("decode with lists, maps and objects failed\n");
+        return 1;
+    }
+
+    p = build(payload, headers, body, 0);
+
+    len = p - payload;
+    half = len / 2;
+
+    /* the payload split across two buffers */
+
+    ngx_memzero(b, sizeof(b));
+
+    b[0].pos = payload;
+    b[0].last = payload + half;
+    b[1].pos = payload + half;
+    b[1].last = payload + len;
+
+    cl[0].buf = &b[0];
+    cl[0].next = &cl[1];
+    cl[1].buf = &b[1];
+    cl[1].next = NULL;
+
+    in.data = flat;
+    in.len = len;
+
+    ngx_memcpy(flat, payload, len);
+
+    if (ngx_dubbo_hessian2_decode_payload_map(pool, &in, &a, &log) != NGX_OK
+        || ngx_dubbo_decode_payload_map(pool, cl, len, &r, &log) != NGX_OK)
+    {
+        printf("decode failed\n");
+        return 1;
+    }
+
+    if (!same(a, r)) {
+        printf("results differ\n");
+        return 1;
+    }
+
+    if (!same(c, r)) {
+        printf("results differ with lists, maps and objects\n");
+        return 1;
+    }
+
+    ngx_reset_pool(pool);
+
+    start = now();
+
+    for (i = 0; i < n; i++) {
+        ngx_memcpy(flat, b[0].pos, half);
+        ngx_memcpy(flat + half, b[1].pos, len - half);
+
+        (void) ngx_dubbo_hessian2_decode_payload_map(pool, &in, &a, &log);
+
+        ngx_reset_pool(pool);
+    }
+
+    old = now() - start;
+
+    start = now();
+
+    for (i = 0; i < n; i++) {
+        (void) ngx_dubbo_decode_payload_map(pool, cl, len, &r, &log);
+
+        ngx_reset_pool(pool);
+    }
+
+    cur = now() - start;
+
+    printf("payload %zu bytes, %u headers, %u body, %u iterations\n",
+           len, (unsigned) headers, (unsigned) body, (unsigned) n);
+    printf("hessian2_input: %8.1f ns/op %8.1f MB/s\n",
+           old * 1e9 / n, len * n / old / 1e6);
+    printf("streaming:      %8.1f ns/op %8.1f MB/s\n",
+           cur * 1e9 / n, len * n / cur / 1e6);
+
+    ngx_destroy_pool(pool);
+
+    free(payload);
+    free(flat);
+
+    return 0;
+}
@@ -357,6 +357,22 @@ ngx_dubbo_decode_response(ngx_dubbo_connection_t *dubbo_c, ngx_chain_t *in)
 
                 break;
             case DUBBO_PARSE_READ_PAYLOAD:
+                //whole payload in the current buffer, no need to copy
+                for (cl = in; cl && ngx_buf_size(cl->buf) == 0; cl = cl->next) {
+                    /* void */
+                }
+
+                if (dubbo_c->remain == 0 && cl
+                    && (size_t)ngx_buf_size(cl->buf) >= resp->header.payloadlen)
+                {
+                    resp->data = cl->buf->pos;
+                    cl->buf->pos += resp->header.payloadlen;
+
+                    dubbo_c->parse_state = DUBBO_PARSE_READ_HEADER;
+
+                    return NGX_DONE;
+                }
+
                 if (resp->header.payloadlen > resp->payload_alloc || resp->payload == NULL) {
                     if (resp->payload != NULL) {
                         ngx_free(resp->payload);
@@ -375,6 +391,7 @@ ngx_dubbo_decode_response(ngx_dubbo_connection_t *dubbo_c, ngx_chain_t *in)
                     len -= resp->header.payloadlen - dubbo_c->remain;
 
                     dubbo_c->remain = 0;
+                    resp->data = resp->payload;
 
                     dubbo_c->parse_state = DUBBO_PARSE_READ_HEADER;
 
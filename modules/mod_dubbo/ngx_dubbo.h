@@ -58,6 +58,9 @@ typedef struct {
 
     u_char*  payload;
     size_t   payload_alloc; 
+
+    /* points into the read buffer or to payload */
+    u_char*  data;
 } ngx_dubbo_resp_t;
 
 #if (NGX_HAVE_PACK_PRAGMA)
@@ -131,6 +134,8 @@ ngx_int_t ngx_dubbo_hessian2_decode_str(ngx_pool_t *pool, ngx_str_t *in, ngx_str
 ngx_int_t ngx_dubbo_hessian2_decode_payload_map(ngx_pool_t *pool, ngx_str_t *in, ngx_array_t **result, ngx_log_t *log);
 ngx_int_t ngx_dubbo_hessian2_encode_payload_map(ngx_pool_t *pool, ngx_array_t *in, ngx_str_t *out);
 
+ngx_int_t ngx_dubbo_decode_payload_map(ngx_pool_t *pool, ngx_chain_t *in, size_t len, ngx_array_t **result, ngx_log_t *log);
+
 ngx_dubbo_connection_t* ngx_dubbo_create_connection(ngx_connection_t *c, ngx_event_handler_pt ping_handler);
 ngx_int_t ngx_dubbo_init_connection(ngx_dubbo_connection_t *dubbo_c, ngx_connection_t *c, ngx_event_handler_pt ping_handler);
 
@@ -0,0 +1,1024 @@
+/*
+ * Copyright (C) 2017-2019 Alibaba Group Holding Limited
+ */
+
+/*
+ * Streaming Hessian2 decoder for dubbo response payloads.
+ *
+ * The payload is read straight from a buffer chain and every value is
+ * emitted into pool memory: strings and binaries are scanned once to get
+ * their size across chunks and buffer boundaries, then copied once.
+ * Only scalar keys and values are emitted; lists, maps and objects are
+ * walked over, and their entries are left out of the result.
+ */
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <ngx_dubbo.h>
+
+
+#define NGX_DUBBO_HESSIAN2_MAX_DEPTH  32
+
+
+typedef struct {
+    ngx_chain_t                    *cl;
+    u_char                         *pos;
+    size_t                          left;
+
+    /* field counts of the class definitions seen so far */
+    ngx_array_t                    *classes;
+
+    ngx_pool_t                     *pool;
+    ngx_log_t                      *log;
+} ngx_dubbo_hessian2_t;
+
+
+static ngx_int_t ngx_dubbo_hessian2_peek(ngx_dubbo_hessian2_t *h, u_char *ch);
+static ngx_int_t ngx_dubbo_hessian2_byte(ngx_dubbo_hessian2_t *h, u_char *ch);
+static ngx_int_t ngx_dubbo_hessian2_read(ngx_dubbo_hessian2_t *h, u_char *dst,
+    size_t len);
+static ngx_int_t ngx_dubbo_hessian2_uint(ngx_dubbo_hessian2_t *h,
+    ngx_uint_t n, uint64_t *v);
+static ngx_int_t ngx_dubbo_hessian2_int32(ngx_dubbo_hessian2_t *h,
+    u_char tag, int32_t *n);
+static ngx_int_t ngx_dubbo_hessian2_string(ngx_dubbo_hessian2_t *h,
+    u_char tag, ngx_str_t *s);
+static ngx_int_t ngx_dubbo_hessian2_scan_string(ngx_dubbo_hessian2_t *h,
+    u_char tag, u_char *dst, size_t *size);
+static ngx_int_t ngx_dubbo_hessian2_binary(ngx_dubbo_hessian2_t *h,
+    u_char tag, ngx_str_t *s);
+static ngx_int_t ngx_dubbo_hessian2_scan_binary(ngx_dubbo_hessian2_t *h,
+    u_char tag, u_char *dst, size_t *size);
+static ngx_int_t ngx_dubbo_hessian2_scalar(ngx_dubbo_hessian2_t *h,
+    ngx_str_t *s);
+static ngx_int_t ngx_dubbo_hessian2_skip(ngx_dubbo_hessian2_t *h,
+    ngx_uint_t depth);
+static ngx_int_t ngx_dubbo_hessian2_skip_compound(ngx_dubbo_hessian2_t *h,
+    u_char tag, ngx_uint_t depth);
+static ngx_int_t ngx_dubbo_hessian2_skip_type(ngx_dubbo_hessian2_t *h);
+static ngx_int_t ngx_dubbo_hessian2_skip_int(ngx_dubbo_hessian2_t *h,
+    ngx_int_t *n);
+static ngx_int_t ngx_dubbo_hessian2_cmp_keyval(const void *one,
+    const void *two);
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_peek(ngx_dubbo_hessian2_t *h, u_char *ch)
+{
+    while (h->cl && h->pos == h->cl->buf->last) {
+        h->cl = h->cl->next;
+
+        if (h->cl) {
+            h->pos = h->cl->buf->pos;
+        }
+    }
+
+    if (h->left == 0 || h->cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    *ch = *h->pos;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_byte(ngx_dubbo_hessian2_t *h, u_char *ch)
+{
+    if (ngx_dubbo_hessian2_peek(h, ch) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    h->pos++;
+    h->left--;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_read(ngx_dubbo_hessian2_t *h, u_char *dst, size_t len)
+{
+    size_t  n;
+    u_char  ch;
+
+    if (len > h->left) {
+        return NGX_ERROR;
+    }
+
+    while (len) {
+        if (ngx_dubbo_hessian2_peek(h, &ch) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        n = ngx_min(len, (size_t) (h->cl->buf->last - h->pos));
+
+        if (dst) {
+            dst = ngx_cpymem(dst, h->pos, n);
+        }
+
+        h->pos += n;
+        h->left -= n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_uint(ngx_dubbo_hessian2_t *h, ngx_uint_t n, uint64_t *v)
+{
+    u_char  ch;
+
+    /* big endian, n bytes */
+
+    *v = 0;
+
+    while (n--) {
+        if (ngx_dubbo_hessian2_byte(h, &ch) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        *v = (*v << 8) | ch;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_int32(ngx_dubbo_hessian2_t *h, u_char tag, int32_t *n)
+{
+    uint64_t  v;
+
+    if (tag >= 0x80 && tag <= 0xbf) {
+        *n = tag - 0x90;
+        return NGX_OK;
+    }
+
+    if (tag >= 0xc0 && tag <= 0xcf) {
+        if (ngx_dubbo_hessian2_uint(h, 1, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        *n = (tag - 0xc8) * 256 + (int32_t) v;
+        return NGX_OK;
+    }
+
+    if (tag >= 0xd0 && tag <= 0xd7) {
+        if (ngx_dubbo_hessian2_uint(h, 2, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        *n = (tag - 0xd4) * 65536 + (int32_t) v;
+        return NGX_OK;
+    }
+
+    if (tag == 'I') {
+        if (ngx_dubbo_hessian2_uint(h, 4, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        *n = (int32_t) (uint32_t) v;
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_string(ngx_dubbo_hessian2_t *h, u_char tag, ngx_str_t *s)
+{
+    size_t                size;
+    ngx_dubbo_hessian2_t  save;
+
+    /* the length is in characters, so measure the string first */
+
+    save = *h;
+
+    if (ngx_dubbo_hessian2_scan_string(h, tag, NULL, &size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->data = ngx_pnalloc(h->pool, size);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = save;
+
+    return ngx_dubbo_hessian2_scan_string(h, tag, s->data, &s->len);
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_scan_string(ngx_dubbo_hessian2_t *h, u_char tag,
+    u_char *dst, size_t *size)
+{
+    size_t      n;
+    u_char      ch, *p, *end;
+    uint64_t    v;
+    ngx_uint_t  last, extra;
+
+    *size = 0;
+
+    for ( ;; ) {
+
+        last = 1;
+
+        if (tag <= 0x1f) {
+            n = tag;
+
+        } else if (tag >= 0x30 && tag <= 0x33) {
+            if (ngx_dubbo_hessian2_uint(h, 1, &v) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            n = ((tag - 0x30) << 8) + (size_t) v;
+
+        } else if (tag == 'S' || tag == 'R') {
+            if (ngx_dubbo_hessian2_uint(h, 2, &v) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            n = (size_t) v;
+            last = (tag == 'S');
+
+        } else {
+            ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                          "dubbo: hessian2 expected string but met 0x%02xd",
+                          tag);
+            return NGX_ERROR;
+        }
+
+        while (n) {
+            if (ngx_dubbo_hessian2_peek(h, &ch) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            /* a run of ascii characters in the current buffer */
+
+            p = h->pos;
+            end = ngx_min(h->cl->buf->last, p + h->left);
+
+            while (n && p < end && *p < 0x80) {
+                p++;
+                n--;
+            }
+
+            if (p != h->pos) {
+                if (dst) {
+                    dst = ngx_cpymem(dst, h->pos, p - h->pos);
+                }
+
+                *size += p - h->pos;
+                h->left -= p - h->pos;
+                h->pos = p;
+
+                continue;
+            }
+
+            if ((ch & 0xe0) == 0xc0) {
+                extra = 2;
+
+            } else if ((ch & 0xf0) == 0xe0) {
+                extra = 3;
+
+            } else {
+                ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                              "dubbo: hessian2 bad utf-8 encoding");
+                return NGX_ERROR;
+            }
+
+            if (ngx_dubbo_hessian2_read(h, dst, extra) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            if (dst) {
+                dst += extra;
+            }
+
+            *size += extra;
+            n--;
+        }
+
+        if (last) {
+            return NGX_OK;
+        }
+
+        if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_binary(ngx_dubbo_hessian2_t *h, u_char tag, ngx_str_t *s)
+{
+    size_t                size;
+    ngx_dubbo_hessian2_t  save;
+
+    save = *h;
+
+    if (ngx_dubbo_hessian2_scan_binary(h, tag, NULL, &size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->data = ngx_pnalloc(h->pool, size);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = save;
+
+    return ngx_dubbo_hessian2_scan_binary(h, tag, s->data, &s->len);
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_scan_binary(ngx_dubbo_hessian2_t *h, u_char tag,
+    u_char *dst, size_t *size)
+{
+    size_t      n;
+    uint64_t    v;
+    ngx_uint_t  last;
+
+    *size = 0;
+
+    for ( ;; ) {
+
+        last = 1;
+
+        if (tag >= 0x20 && tag <= 0x2f) {
+            n = tag - 0x20;
+
+        } else if (tag >= 0x34 && tag <= 0x37) {
+            if (ngx_dubbo_hessian2_uint(h, 1, &v) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            n = ((tag - 0x34) << 8) + (size_t) v;
+
+        } else if (tag == 'B' || tag == 'A') {
+            if (ngx_dubbo_hessian2_uint(h, 2, &v) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            n = (size_t) v;
+            last = (tag == 'B');
+
+        } else {
+            ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                          "dubbo: hessian2 expected binary but met 0x%02xd",
+                          tag);
+            return NGX_ERROR;
+        }
+
+        if (ngx_dubbo_hessian2_read(h, dst, n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (dst) {
+            dst += n;
+        }
+
+        *size += n;
+
+        if (last) {
+            return NGX_OK;
+        }
+
+        if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_scalar(ngx_dubbo_hessian2_t *h, ngx_str_t *s)
+{
+    u_char     tag, *p;
+    double     d;
+    int32_t    n;
+    int64_t    l;
+    uint64_t   v;
+    ngx_int_t  rc;
+
+    if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (tag <= 0x1f || (tag >= 0x30 && tag <= 0x33)
+        || tag == 'S' || tag == 'R')
+    {
+        return ngx_dubbo_hessian2_string(h, tag, s);
+    }
+
+    if ((tag >= 0x20 && tag <= 0x2f) || (tag >= 0x34 && tag <= 0x37)
+        || tag == 'B' || tag == 'A')
+    {
+        return ngx_dubbo_hessian2_binary(h, tag, s);
+    }
+
+    switch (tag) {
+
+    case 'N':
+        ngx_str_null(s);
+        return NGX_OK;
+
+    case 'T':
+        ngx_str_set(s, "true");
+        return NGX_OK;
+
+    case 'F':
+        ngx_str_set(s, "false");
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(h->pool, NGX_INT64_LEN + 8);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->data = p;
+
+    rc = ngx_dubbo_hessian2_int32(h, tag, &n);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        s->len = ngx_sprintf(p, "%D", n) - p;
+        return NGX_OK;
+    }
+
+    /* long, date and double */
+
+    if (tag >= 0xd8 && tag <= 0xef) {
+        l = tag - 0xe0;
+        goto integer;
+    }
+
+    if (tag >= 0xf0) {
+        if (ngx_dubbo_hessian2_uint(h, 1, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        l = (tag - 0xf8) * 256 + (int64_t) v;
+        goto integer;
+    }
+
+    if (tag >= 0x38 && tag <= 0x3f) {
+        if (ngx_dubbo_hessian2_uint(h, 2, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        l = (tag - 0x3c) * 65536 + (int64_t) v;
+        goto integer;
+    }
+
+    switch (tag) {
+
+    case 'Y':
+        if (ngx_dubbo_hessian2_uint(h, 4, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        l = (int32_t) (uint32_t) v;
+        goto integer;
+
+    case 'L':
+    case 'J':
+        if (ngx_dubbo_hessian2_uint(h, 8, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        l = (int64_t) v;
+        goto integer;
+
+    case 'K':
+        if (ngx_dubbo_hessian2_uint(h, 4, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        l = (int64_t) (int32_t) (uint32_t) v * 60000;
+        goto integer;
+
+    case 'D':
+        if (ngx_dubbo_hessian2_uint(h, 8, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(&d, &v, sizeof(double));
+        goto fraction;
+
+    case 0x5b:
+        d = 0.0;
+        goto fraction;
+
+    case 0x5c:
+        d = 1.0;
+        goto fraction;
+
+    case 0x5d:
+        if (ngx_dubbo_hessian2_uint(h, 1, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        d = (int8_t) v;
+        goto fraction;
+
+    case 0x5e:
+        if (ngx_dubbo_hessian2_uint(h, 2, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        d = (int16_t) v;
+        goto fraction;
+
+    case 0x5f:
+        if (ngx_dubbo_hessian2_uint(h, 4, &v) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        d = 0.001 * (int32_t) (uint32_t) v;
+        goto fraction;
+    }
+
+    /* lists, maps, objects and references have no string form */
+
+    if (ngx_dubbo_hessian2_skip_compound(h, tag, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_DECLINED;
+
+integer:
+
+    s->len = ngx_sprintf(p, "%L", l) - p;
+    return NGX_OK;
+
+fraction:
+
+    /* ngx_sprintf() takes the integral part as int64_t */
+
+    if (d > 9.2e18 || d < -9.2e18 || d != d) {
+        ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                      "dubbo: hessian2 double out of range");
+        return NGX_ERROR;
+    }
+
+    if (d < 0) {
+        *p++ = '-';
+        d = -d;
+    }
+
+    s->len = ngx_sprintf(p, "%.6f", d) - s->data;
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_skip(ngx_dubbo_hessian2_t *h, ngx_uint_t depth)
+{
+    u_char  tag;
+    size_t  size, n;
+
+    if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (tag <= 0x1f || (tag >= 0x30 && tag <= 0x33)
+        || tag == 'S' || tag == 'R')
+    {
+        return ngx_dubbo_hessian2_scan_string(h, tag, NULL, &size);
+    }
+
+    if ((tag >= 0x20 && tag <= 0x2f) || (tag >= 0x34 && tag <= 0x37)
+        || tag == 'B' || tag == 'A')
+    {
+        return ngx_dubbo_hessian2_scan_binary(h, tag, NULL, &size);
+    }
+
+    /* the bytes following the tag of a number */
+
+    if (tag >= 0x80) {
+        n = (tag <= 0xbf) ? 0
+            : (tag <= 0xcf) ? 1
+            : (tag <= 0xd7) ? 2
+            : (tag <= 0xef) ? 0
+            : 1;
+
+        return ngx_dubbo_hessian2_read(h, NULL, n);
+    }
+
+    if (tag >= 0x38 && tag <= 0x3f) {
+        return ngx_dubbo_hessian2_read(h, NULL, 2);
+    }
+
+    switch (tag) {
+
+    case 'N':
+    case 'T':
+    case 'F':
+    case 0x5b:
+    case 0x5c:
+        return NGX_OK;
+
+    case 0x5d:
+        return ngx_dubbo_hessian2_read(h, NULL, 1);
+
+    case 0x5e:
+        return ngx_dubbo_hessian2_read(h, NULL, 2);
+
+    case 'I':
+    case 'Y':
+    case 'K':
+    case 0x5f:
+        return ngx_dubbo_hessian2_read(h, NULL, 4);
+
+    case 'L':
+    case 'J':
+    case 'D':
+        return ngx_dubbo_hessian2_read(h, NULL, 8);
+    }
+
+    return ngx_dubbo_hessian2_skip_compound(h, tag, depth);
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_skip_compound(ngx_dubbo_hessian2_t *h, u_char tag,
+    ngx_uint_t depth)
+{
+    size_t       size;
+    ngx_int_t    n;
+    ngx_uint_t  *fields;
+
+    if (depth >= NGX_DUBBO_HESSIAN2_MAX_DEPTH) {
+        ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                      "dubbo: hessian2 values nested too deep");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h->log, 0,
+                   "dubbo: hessian2 skip value 0x%02xd", tag);
+
+    depth++;
+
+    switch (tag) {
+
+    case 'C':
+
+        /* a class definition: name, field count, field names, an object */
+
+        if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK
+            || ngx_dubbo_hessian2_scan_string(h, tag, NULL, &size) != NGX_OK
+            || ngx_dubbo_hessian2_skip_int(h, &n) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (h->classes == NULL) {
+            h->classes = ngx_array_create(h->pool, 4, sizeof(ngx_uint_t));
+            if (h->classes == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        fields = ngx_array_push(h->classes);
+        if (fields == NULL) {
+            return NGX_ERROR;
+        }
+
+        *fields = n;
+
+        while (n--) {
+            if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK
+                || ngx_dubbo_hessian2_scan_string(h, tag, NULL, &size)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        return ngx_dubbo_hessian2_skip(h, depth);
+
+    case 'O':
+        if (ngx_dubbo_hessian2_skip_int(h, &n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        goto object;
+
+    case 'Q':
+
+        /* a reference to an earlier list, map or object */
+
+        return ngx_dubbo_hessian2_skip_int(h, &n);
+
+    case 'U':
+        if (ngx_dubbo_hessian2_skip_type(h) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        goto values;
+
+    case 'V':
+        if (ngx_dubbo_hessian2_skip_type(h) != NGX_OK
+            || ngx_dubbo_hessian2_skip_int(h, &n) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        goto list;
+
+    case 'W':
+        goto values;
+
+    case 'X':
+        if (ngx_dubbo_hessian2_skip_int(h, &n) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        goto list;
+
+    case 'M':
+        if (ngx_dubbo_hessian2_skip_type(h) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        goto values;
+
+    case 'H':
+        goto values;
+    }
+
+    if (tag >= 0x60 && tag <= 0x6f) {
+        n = tag - 0x60;
+        goto object;
+    }
+
+    if (tag >= 0x70 && tag <= 0x77) {
+        if (ngx_dubbo_hessian2_skip_type(h) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        n = tag - 0x70;
+        goto list;
+    }
+
+    if (tag >= 0x78 && tag <= 0x7f) {
+        n = tag - 0x78;
+        goto list;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                  "dubbo: hessian2 unknown value 0x%02xd", tag);
+
+    return NGX_ERROR;
+
+object:
+
+    if (h->classes == NULL || n >= (ngx_int_t) h->classes->nelts) {
+        ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                      "dubbo: hessian2 object of unknown class %i", n);
+        return NGX_ERROR;
+    }
+
+    fields = h->classes->elts;
+    n = fields[n];
+
+list:
+
+    /* every value takes a byte at least, so the length is checked */
+
+    while (n--) {
+        if (ngx_dubbo_hessian2_skip(h, depth) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+
+values:
+
+    /* up to 'Z', map keys and values alike */
+
+    for ( ;; ) {
+        if (ngx_dubbo_hessian2_peek(h, &tag) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (tag == 'Z') {
+            return ngx_dubbo_hessian2_byte(h, &tag);
+        }
+
+        if (ngx_dubbo_hessian2_skip(h, depth) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_skip_type(ngx_dubbo_hessian2_t *h)
+{
+    u_char     tag;
+    size_t     size;
+    int32_t    n;
+    ngx_int_t  rc;
+
+    /* a type name, or a reference to an earlier one */
+
+    if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_dubbo_hessian2_int32(h, tag, &n);
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    return ngx_dubbo_hessian2_scan_string(h, tag, NULL, &size);
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_skip_int(ngx_dubbo_hessian2_t *h, ngx_int_t *n)
+{
+    u_char   tag;
+    int32_t  v;
+
+    if (ngx_dubbo_hessian2_byte(h, &tag) != NGX_OK
+        || ngx_dubbo_hessian2_int32(h, tag, &v) != NGX_OK
+        || v < 0)
+    {
+        ngx_log_error(NGX_LOG_ERR, h->log, 0,
+                      "dubbo: hessian2 bad length or index");
+        return NGX_ERROR;
+    }
+
+    *n = v;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_dubbo_decode_payload_map(ngx_pool_t *pool, ngx_chain_t *in, size_t len,
+    ngx_array_t **result, ngx_log_t *log)
+{
+    u_char                 tag;
+    int32_t                flag;
+    ngx_int_t              rc, rv;
+    ngx_str_t              type;
+    ngx_uint_t             i, n;
+    ngx_array_t           *pres;
+    ngx_keyval_t          *kv, tmp;
+    ngx_dubbo_hessian2_t   h;
+
+    if (in == NULL) {
+        return NGX_ERROR;
+    }
+
+    h.cl = in;
+    h.pos = in->buf->pos;
+    h.left = len;
+    h.classes = NULL;
+    h.pool = pool;
+    h.log = log;
+
+    /* response flag */
+
+    if (ngx_dubbo_hessian2_byte(&h, &tag) != NGX_OK
+        || ngx_dubbo_hessian2_int32(&h, tag, &flag) != NGX_OK)
+    {
+        goto invalid;
+    }
+
+    if (ngx_dubbo_hessian2_byte(&h, &tag) != NGX_OK) {
+        goto invalid;
+    }
+
+    if (tag == 'M') {
+        /* the type of the map does not matter */
+
+        if (ngx_dubbo_hessian2_scalar(&h, &type) != NGX_OK) {
+            goto invalid;
+        }
+
+    } else if (tag != 'H') {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "dubbo: hessian2 expected map but met 0x%02xd", tag);
+        return NGX_ERROR;
+    }
+
+    pres = ngx_array_create(pool, 8, sizeof(ngx_keyval_t));
+    if (pres == NULL) {
+        return NGX_ERROR;
+    }
+
+    for ( ;; ) {
+        if (ngx_dubbo_hessian2_peek(&h, &tag) != NGX_OK) {
+            goto invalid;
+        }
+
+        if (tag == 'Z') {
+            break;
+        }
+
+        kv = ngx_array_push(pres);
+        if (kv == NULL) {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_dubbo_hessian2_scalar(&h, &kv->key);
+        if (rc == NGX_ERROR) {
+            goto invalid;
+        }
+
+        rv = ngx_dubbo_hessian2_scalar(&h, &kv->value);
+        if (rv == NGX_ERROR) {
+            goto invalid;
+        }
+
+        /* an entry with a list, map or object in it is left out */
+
+        if (rc == NGX_DECLINED || rv == NGX_DECLINED) {
+            pres->nelts--;
+        }
+    }
+
+    /*
+     * keep the order and the "last one wins" of the former std::map:
+     * a stable insertion sort in place, ngx_sort() would allocate
+     */
+
+    kv = pres->elts;
+
+    for (i = 1; i < pres->nelts; i++) {
+        tmp = kv[i];
+
+        for (n = i;
+             n > 0 && ngx_dubbo_hessian2_cmp_keyval(&kv[n - 1], &tmp) > 0;
+             n--)
+        {
+            kv[n] = kv[n - 1];
+        }
+
+        kv[n] = tmp;
+    }
+
+    n = 0;
+
+    for (i = 0; i < pres->nelts; i++) {
+        if (i + 1 < pres->nelts
+            && ngx_dubbo_hessian2_cmp_keyval(&kv[i], &kv[i + 1]) == 0)
+        {
+            continue;
+        }
+
+        kv[n++] = kv[i];
+    }
+
+    pres->nelts = n;
+
+    *result = pres;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, log, 0,
+                  "dubbo: hessian2 invalid response payload");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_dubbo_hessian2_cmp_keyval(const void *one, const void *two)
+{
+    ngx_int_t            rc;
+    const ngx_keyval_t  *a, *b;
+
+    a = one;
+    b = two;
+
+    rc = ngx_memcmp(a->key.data, b->key.data, ngx_min(a->key.len, b->key.len));
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    return (ngx_int_t) a->key.len - (ngx_int_t) b->key.len;
+}
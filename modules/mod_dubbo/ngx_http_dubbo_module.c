@@ -26,6 +26,9 @@ typedef struct {
     ngx_flag_t                  ups_info;
 
     ngx_msec_t                  heartbeat_interval;
+
+    size_t                      send_batch_size;
+    ngx_msec_t                  send_batch_delay;
 } ngx_http_dubbo_loc_conf_t;
 
 typedef struct {
@@ -85,6 +88,8 @@ static char *ngx_http_dubbo_pass(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
 static char *ngx_http_dubbo_pass_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_dubbo_send_batch(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static ngx_int_t ngx_http_dubbo_add_response_header(ngx_http_request_t *r, ngx_str_t *name, ngx_str_t *value);
 
@@ -245,6 +250,13 @@ static ngx_command_t  ngx_http_dubbo_commands[] = {
       offsetof(ngx_http_dubbo_loc_conf_t, heartbeat_interval),
       NULL },
 
+    { ngx_string("dubbo_send_batch"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_dubbo_send_batch,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("dubbo_upstream_error_info"),
       NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_flag_slot,
@@ -514,6 +526,11 @@ ngx_http_dubbo_body_output_filter(void *data, ngx_chain_t *in)
             ll = &tmp->next;
         }
 
+        if (NGX_OK != ngx_multi_request_insert(multi_c, multi_r)) {
+            ngx_log_error(NGX_LOG_ERR, pc->log, 0, "dubbo: index request failed %p, %p", pc, r);
+            return NGX_ERROR;
+        }
+
         ngx_queue_insert_head(&multi_c->send_list, &multi_r->backend_queue);
 
         //init front list
@@ -530,7 +547,23 @@ ngx_http_dubbo_body_output_filter(void *data, ngx_chain_t *in)
         ngx_queue_insert_tail(r->backend_r, &multi_r->front_queue);
     }
 
-    rc = ngx_chain_writer(&fake_r->upstream->writer, out);
+    if (r != fake_r && dlcf->send_batch_size) {
+        //queue the request, the connection writes it out with the others
+        if (multi_c->batch.writer == NULL) {
+            ngx_multi_batch_init(multi_c, &fake_r->upstream->writer,
+                                 dlcf->send_batch_size, dlcf->send_batch_delay,
+                                 dlcf->upstream.send_timeout);
+        }
+
+        rc = ngx_multi_batch_write(multi_c, out);
+
+    } else if (out == NULL && multi_c->batch.writer) {
+        //nothing to add, the batch is written out by the connection
+        rc = NGX_OK;
+
+    } else {
+        rc = ngx_chain_writer(&fake_r->upstream->writer, out);
+    }
 
     ngx_chain_update_chains(fake_r->pool, &ctx->free, &ctx->busy, &out,
             (ngx_buf_tag_t) &ngx_http_dubbo_body_output_filter);
@@ -910,6 +943,8 @@ ngx_http_dubbo_create_loc_conf(ngx_conf_t *cf)
     conf->ups_info = NGX_CONF_UNSET;
     conf->args_in = NULL;
     conf->heartbeat_interval = NGX_CONF_UNSET_MSEC;
+    conf->send_batch_size = NGX_CONF_UNSET_SIZE;
+    conf->send_batch_delay = NGX_CONF_UNSET_MSEC;
 
     return conf;
 }
@@ -1027,6 +1062,11 @@ ngx_http_dubbo_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->heartbeat_interval,
                               prev->heartbeat_interval, 60000);
 
+    ngx_conf_merge_size_value(conf->send_batch_size,
+                              prev->send_batch_size, 0);
+    ngx_conf_merge_msec_value(conf->send_batch_delay,
+                              prev->send_batch_delay, 0);
+
     return NGX_CONF_OK;
 }
 
@@ -1157,6 +1197,78 @@ ngx_http_dubbo_pass_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
+static char *
+ngx_http_dubbo_send_batch(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_dubbo_loc_conf_t *dlcf = conf;
+
+    ngx_str_t                 *value, s;
+    ngx_uint_t                 i;
+
+    if (dlcf->send_batch_size != NGX_CONF_UNSET_SIZE) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        if (cf->args->nelts != 2) {
+            return "takes no parameters with \"off\"";
+        }
+
+        dlcf->send_batch_size = 0;
+        return NGX_CONF_OK;
+    }
+
+    dlcf->send_batch_delay = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+
+            s.len = value[i].len - 5;
+            s.data = &value[i].data[5];
+
+            dlcf->send_batch_size = ngx_parse_size(&s);
+            if (dlcf->send_batch_size == (size_t) NGX_ERROR
+                || dlcf->send_batch_size == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "delay=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = &value[i].data[6];
+
+            dlcf->send_batch_delay = ngx_parse_time(&s, 0);
+            if (dlcf->send_batch_delay == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (dlcf->send_batch_size == NGX_CONF_UNSET_SIZE) {
+        return "requires \"size\" parameter";
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
 static void
 ngx_http_dubbo_ping_handler(ngx_event_t *ev)
 {
@@ -1267,16 +1379,15 @@ ngx_http_dubbo_parse_filter(ngx_http_request_t *r)
 {
     ngx_http_request_t              *fake_r;
     ngx_http_upstream_t             *fake_u;
-    ngx_chain_t                      in;
+    ngx_chain_t                      in, cl;
+    ngx_buf_t                        payload;
     ngx_http_dubbo_ctx_t            *ctx, *fake_ctx;
     ngx_int_t                        ret;
     ngx_http_request_t              *real_r;
 
-    ngx_queue_t                     *q, *n;
-    ngx_multi_request_t             *multi_r, *tmp;
+    ngx_multi_request_t             *multi_r;
     ngx_dubbo_resp_t                *resp;
     ngx_str_t                        body;
-    ngx_flag_t                       find;
     ngx_dubbo_connection_t          *dubbo_c;
     ngx_multi_connection_t          *multi_c;
     ngx_connection_t                *pc;
@@ -1333,88 +1444,82 @@ ngx_http_dubbo_parse_filter(ngx_http_request_t *r)
                         continue;
                     }
 
-                    find = 0;
-                    for (q = ngx_queue_head(&multi_c->send_list);
-                            q != ngx_queue_sentinel(&multi_c->send_list);
-                            q = ngx_queue_next(q))
-                    {
-                        multi_r = ngx_queue_data(q, ngx_multi_request_t, backend_queue);
-                        if (multi_r->id == resp->header.reqid) { //find
-                            find = 1;
-                            ngx_queue_remove(q);
-
-                            //clean front list for multi_r 
-                            real_r = multi_r->data;
-                            if (real_r->backend_r) {
-                                for (n = ngx_queue_head(real_r->backend_r);
-                                        n != ngx_queue_sentinel(real_r->backend_r);
-                                        n = ngx_queue_next(n))
-                                {
-                                    tmp = ngx_queue_data(n, ngx_multi_request_t, front_queue); 
-                                    if (tmp == multi_r) {
-                                        ngx_queue_remove(n);
-                                        break;
-                                    }
-                                }
-                            } else {
-                                ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0, "dubbo: find dubbo_r but front list null");
-                                //free dubbo_r and pool
-                                ngx_destroy_pool(multi_r->pool);
-                                return NGX_ERROR;
-                            }
+                    multi_r = ngx_multi_request_lookup(multi_c, resp->header.reqid);
+                    if (multi_r == NULL) {
+                        ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0,
+                                      "dubbo: response cannot find request %ui", resp->header.reqid);
+                        continue;
+                    }
 
-                            body.data = resp->payload;
-                            body.len = resp->header.payloadlen;
-
-                            multi_c->cur = multi_r->data;
-
-                            if (NGX_OK != ngx_dubbo_hessian2_decode_payload_map(real_r->pool,
-                                        &body, &ctx->result, dubbo_c->log)) {
-
-                                ngx_log_error(NGX_LOG_WARN, dubbo_c->log,
-                                              0, "dubbo: response decode result failed %V", &body);
-
-                                dlcf = ngx_http_get_module_loc_conf(real_r, ngx_http_dubbo_module);
-                                if (dlcf->ups_info) {
-                                    ctx->result = ngx_array_create(real_r->pool, 2, sizeof(ngx_keyval_t));
-                                    if (ctx->result == NULL) {
-                                        return NGX_ERROR;
-                                    };
-                                    kv = (ngx_keyval_t*)ngx_array_push(ctx->result);
-                                    kv->key = ngx_http_dubbo_str_body;
-                                    kv->value = body;
-
-                                    kv = (ngx_keyval_t*)ngx_array_push(ctx->result);
-                                    kv->key = ngx_http_dubbo_content_type;
-                                    kv->value = ngx_http_dubbo_content_type_text;
-                                } else {
-                                    real_r->upstream->headers_in.status_n = NGX_HTTP_BAD_GATEWAY;
-                                    real_r->upstream->state->status = NGX_HTTP_BAD_GATEWAY;
-                                    ngx_destroy_pool(multi_r->pool);
-                                    return NGX_HTTP_UPSTREAM_PARSE_ERROR;
-                                }
-                            }
+                    ngx_queue_remove(&multi_r->backend_queue);
+                    ngx_multi_request_remove(multi_c, multi_r);
+
+                    //clean front list for multi_r 
+                    real_r = multi_r->data;
+                    if (real_r->backend_r == NULL) {
+                        ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0, "dubbo: find dubbo_r but front list null");
+                        //free dubbo_r and pool
+                        ngx_destroy_pool(multi_r->pool);
+                        return NGX_ERROR;
+                    }
+
+                    ngx_queue_remove(&multi_r->front_queue);
+
+                    body.data = resp->data;
+                    body.len = resp->header.payloadlen;
 
-                            if (NGX_OK != ngx_http_dubbo_response_handler(pc, real_r, ctx->result)) {
-                                ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0, "dubbo: response handler failed %V", &body);
-                                real_r->upstream->headers_in.status_n = NGX_HTTP_INTERNAL_SERVER_ERROR;
-                                real_r->upstream->state->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
-                                ngx_destroy_pool(multi_r->pool);
+                    ngx_memzero(&payload, sizeof(ngx_buf_t));
+                    payload.pos = body.data;
+                    payload.last = body.data + body.len;
+                    payload.memory = 1;
+
+                    cl.buf = &payload;
+                    cl.next = NULL;
+
+                    multi_c->cur = multi_r->data;
+
+                    if (NGX_OK != ngx_dubbo_decode_payload_map(real_r->pool,
+                                &cl, body.len, &ctx->result, dubbo_c->log)) {
+
+                        ngx_log_error(NGX_LOG_WARN, dubbo_c->log,
+                                      0, "dubbo: response decode result failed %V", &body);
+
+                        dlcf = ngx_http_get_module_loc_conf(real_r, ngx_http_dubbo_module);
+                        if (dlcf->ups_info) {
+                            ctx->result = ngx_array_create(real_r->pool, 2, sizeof(ngx_keyval_t));
+                            if (ctx->result == NULL) {
+                                return NGX_ERROR;
+                            };
+                            kv = (ngx_keyval_t*)ngx_array_push(ctx->result);
+                            kv->key = ngx_http_dubbo_str_body;
+                            kv->value.data = ngx_pstrdup(real_r->pool, &body);
+                            kv->value.len = body.len;
+                            if (kv->value.data == NULL) {
                                 return NGX_ERROR;
                             }
 
-                            ctx->state = ngx_http_dubbo_parse_st_payload;
+                            kv = (ngx_keyval_t*)ngx_array_push(ctx->result);
+                            kv->key = ngx_http_dubbo_content_type;
+                            kv->value = ngx_http_dubbo_content_type_text;
+                        } else {
+                            real_r->upstream->headers_in.status_n = NGX_HTTP_BAD_GATEWAY;
+                            real_r->upstream->state->status = NGX_HTTP_BAD_GATEWAY;
                             ngx_destroy_pool(multi_r->pool);
-                            return NGX_HTTP_UPSTREAM_HEADER_END;
+                            return NGX_HTTP_UPSTREAM_PARSE_ERROR;
                         }
                     }
 
-                    if (!find) {
-                        ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0,
-                                      "dubbo: response cannot find request %ui", resp->header.reqid);
+                    if (NGX_OK != ngx_http_dubbo_response_handler(pc, real_r, ctx->result)) {
+                        ngx_log_error(NGX_LOG_ERR, dubbo_c->log, 0, "dubbo: response handler failed %V", &body);
+                        real_r->upstream->headers_in.status_n = NGX_HTTP_INTERNAL_SERVER_ERROR;
+                        real_r->upstream->state->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+                        ngx_destroy_pool(multi_r->pool);
+                        return NGX_ERROR;
                     }
 
-                    continue;
+                    ctx->state = ngx_http_dubbo_parse_st_payload;
+                    ngx_destroy_pool(multi_r->pool);
+                    return NGX_HTTP_UPSTREAM_HEADER_END;
                 } else {
                     ngx_log_error(NGX_LOG_INFO, dubbo_c->log, 0, "dubbo: response parse again");
                     break;
@@ -14,6 +14,7 @@
 static char * ngx_http_strategy_init_main_conf(ngx_conf_t *cf, void *conf);
 static char * ngx_http_strategy_zone(ngx_conf_t *cf, void *conf);
 static ngx_int_t ngx_http_strategy_module_init(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_strategy_init_process(ngx_cycle_t *cycle);
 
 extern ngx_module_t ngx_proc_strategy_module;
 
@@ -42,7 +43,7 @@ ngx_module_t  ngx_http_strategy_module = {
     NGX_HTTP_MODULE,                        /* module type */
     NULL,                                   /* init master */
     ngx_http_strategy_module_init,          /* init module */
-    NULL,                                   /* init process */
+    ngx_http_strategy_init_process,         /* init process */
     NULL,                                   /* init thread */
     NULL,                                   /* exit thread */
     NULL,                                   /* exit process */
@@ -165,3 +166,10 @@ static ngx_int_t ngx_http_strategy_module_init(ngx_cycle_t *cycle)
 
     return NGX_OK;
 }
+
+static ngx_int_t ngx_http_strategy_init_process(ngx_cycle_t *cycle)
+{
+    ngx_strategy_slot_init_process(cycle);
+
+    return NGX_OK;
+}
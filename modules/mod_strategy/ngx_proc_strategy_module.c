@@ -6,6 +6,9 @@
 
 #include "ngx_proc_strategy_module.h"
 
+/* timer ticks a slot update waits for readers before going ahead anyway */
+#define NGX_STRATEGY_SLOT_MAX_DEFERRED      100
+
 static ngx_int_t ngx_proc_strategy_prepare(ngx_cycle_t *cycle);
 static void ngx_proc_strategy_exit_worker(ngx_cycle_t *cycle);
 static ngx_int_t ngx_proc_strategy_init_worker(ngx_cycle_t *cycle);
@@ -324,6 +327,7 @@ ngx_strategy_slot_init(ngx_strategy_frame_ctx_t * ctx,
         ngx_cycle_t *cycle, ngx_slab_pool_t * slab)
 {
     ngx_strategy_slot_app_t *slot_app;
+    ngx_core_conf_t         *ccf;
     ngx_int_t               rc, i;
 
     slot_app = ctx->data;
@@ -342,6 +346,21 @@ ngx_strategy_slot_init(ngx_strategy_frame_ctx_t * ctx,
 
     slot_app->shm_ctx->current = 0;
 
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    slot_app->shm_ctx->epoch = 1;
+    slot_app->shm_ctx->retired[0] = 0;
+    slot_app->shm_ctx->retired[1] = 0;
+    slot_app->shm_ctx->nreaders = ccf->worker_processes;
+
+    slot_app->shm_ctx->readers = ngx_slab_calloc(slab,
+                                    ccf->worker_processes * sizeof(ngx_atomic_t));
+    if (slot_app->shm_ctx->readers == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                "[strategy] slot_init: readers alloc failed: appname=%V", &ctx->name);
+        return NGX_ERROR;
+    }
+
     for (i = 0; i < 2; i++) {
         ngx_strategy_slot_ctx_t *current;
 
@@ -366,6 +385,24 @@ ngx_strategy_slot_init(ngx_strategy_frame_ctx_t * ctx,
     return NGX_OK;
 }
 
+/* whether a worker may still read a slot retired by an earlier switch */
+static ngx_int_t
+ngx_strategy_slot_in_use(ngx_strategy_slot_shm_ctx_t *shm_ctx, ngx_int_t slot)
+{
+    ngx_uint_t          i;
+    ngx_atomic_uint_t   epoch;
+
+    for (i = 0; i < shm_ctx->nreaders; i++) {
+        epoch = shm_ctx->readers[i];
+
+        if (epoch != 0 && epoch < shm_ctx->retired[slot]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 static ngx_int_t
 ngx_strategy_slot_callback(ngx_strategy_frame_ctx_t * ctx)
 {
@@ -373,6 +410,7 @@ ngx_strategy_slot_callback(ngx_strategy_frame_ctx_t * ctx)
     ngx_int_t                   rc;
     ngx_strategy_slot_ctx_t     *reserved;
     ngx_int_t                   need_update = 0;
+    ngx_int_t                   old;
 
     slot_app = ctx->data;
     if (slot_app == NULL || slot_app->shm_ctx == NULL) {
@@ -398,6 +436,23 @@ ngx_strategy_slot_callback(ngx_strategy_frame_ctx_t * ctx)
         }
     }
 
+    if (need_update
+        && ngx_strategy_slot_in_use(slot_app->shm_ctx, (slot_app->shm_ctx->current + 1) % 2))
+    {
+        if (++slot_app->deferred < NGX_STRATEGY_SLOT_MAX_DEFERRED) {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                    "[strategy] slot still in use, update deferred: appname=%V", &ctx->name);
+            return NGX_OK;
+        }
+
+        /* a reader that never leaves must not stall updates forever */
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                "[strategy] slot still in use after %ui deferrals, updating: appname=%V",
+                slot_app->deferred, &ctx->name);
+    }
+
+    slot_app->deferred = 0;
+
     if (need_update) {
         rc = slot_app->update((ngx_cycle_t *)ngx_cycle,
             slot_app->data, reserved->pool,
@@ -423,7 +478,12 @@ ngx_strategy_slot_callback(ngx_strategy_frame_ctx_t * ctx)
 
     /* 2. If there is an update switch the memory block */
     if (need_update) {
-        slot_app->shm_ctx->current = (slot_app->shm_ctx->current + 1) % 2;
+        old = slot_app->shm_ctx->current;
+        slot_app->shm_ctx->current = (old + 1) % 2;
+
+        /* readers entering from now on see the new slot */
+        slot_app->shm_ctx->retired[old] = ngx_atomic_fetch_add(&slot_app->shm_ctx->epoch, 1) + 1;
+
         ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
                  "[strategy] update area rule: appname=%V, current=%d",
                  &ctx->name, slot_app->shm_ctx->current);
@@ -503,6 +563,66 @@ void * ngx_strategy_get_current_slot(ngx_strategy_slot_app_t *app)
     return current->data;
 }
 
+void *
+ngx_strategy_slot_enter(ngx_strategy_slot_app_t *app)
+{
+    ngx_atomic_t                *reader;
+
+    if (app == NULL || app->shm_ctx == NULL) {
+        return NULL;
+    }
+
+    if ((ngx_process == NGX_PROCESS_WORKER || ngx_process == NGX_PROCESS_SINGLE)
+        && ngx_worker < app->shm_ctx->nreaders)
+    {
+        reader = &app->shm_ctx->readers[ngx_worker];
+
+        /* a locked store, so the slot is loaded only after it is visible */
+        (void) ngx_atomic_cmp_set(reader, *reader, app->shm_ctx->epoch);
+    }
+
+    return ngx_strategy_get_current_slot(app);
+}
+
+void
+ngx_strategy_slot_leave(ngx_strategy_slot_app_t *app)
+{
+    if (app == NULL || app->shm_ctx == NULL) {
+        return;
+    }
+
+    if ((ngx_process == NGX_PROCESS_WORKER || ngx_process == NGX_PROCESS_SINGLE)
+        && ngx_worker < app->shm_ctx->nreaders)
+    {
+        ngx_memory_barrier();
+        app->shm_ctx->readers[ngx_worker] = 0;
+    }
+}
+
+void
+ngx_strategy_slot_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i;
+    ngx_strategy_slot_app_t        *slot_app;
+    ngx_strategy_frame_app_t       *frame_app;
+    ngx_proc_strategy_main_conf_t  *smcf;
+
+    smcf = ngx_proc_get_main_conf(cycle->conf_ctx, ngx_proc_strategy_module);
+    if (smcf == NULL) {
+        return;
+    }
+
+    frame_app = smcf->frame_apps.elts;
+    for (i = 0; i < smcf->frame_apps.nelts; i++) {
+        if (frame_app[i].app_init != ngx_strategy_slot_init) {
+            continue;
+        }
+
+        slot_app = frame_app[i].ctx.data;
+        ngx_strategy_slot_leave(slot_app);
+    }
+}
+
 /* Shared memory needs to allocate 2 pools of the same size */
 #define NGX_STRATEGY_SHM_POOL_NUM           2
 /* The value of M divided by N is rounded up，must M >= 1 and N > 0 */
@@ -124,6 +124,16 @@ typedef struct {
 typedef struct {
     ngx_int_t                   current;
     ngx_strategy_slot_ctx_t     slots[2];
+
+    /*
+     * Epoch based reclamation: a worker announces the epoch it entered at,
+     * and the builder rebuilds a slot only after every worker that could
+     * still see it has left.
+     */
+    ngx_atomic_t                epoch;          /* bumped on every switch */
+    ngx_atomic_uint_t           retired[2];     /* epoch the slot stopped being current at */
+    ngx_uint_t                  nreaders;
+    ngx_atomic_t               *readers;        /* per worker, 0 when not reading */
 } ngx_strategy_slot_shm_ctx_t;
 
 typedef struct {
@@ -145,12 +155,24 @@ typedef struct {
     
     /* Internal structure, cannot modify */
     ngx_strategy_slot_shm_ctx_t  *shm_ctx;
+    ngx_uint_t                    deferred;
 } ngx_strategy_slot_app_t;
 
 ngx_strategy_slot_app_t* ngx_strategy_slot_app_register(ngx_conf_t *cf, ngx_strategy_slot_app_t * app);
 
 void * ngx_strategy_get_current_slot(ngx_strategy_slot_app_t *app);
 
+/*
+ * Same as ngx_strategy_get_current_slot, but the slot is not rebuilt until
+ * ngx_strategy_slot_leave is called. Every enter must be paired with a leave,
+ * even when NULL is returned, and must not be nested or span events.
+ */
+void * ngx_strategy_slot_enter(ngx_strategy_slot_app_t *app);
+void ngx_strategy_slot_leave(ngx_strategy_slot_app_t *app);
+
+/* Called when a worker starts, drops what a crashed predecessor announced */
+void ngx_strategy_slot_init_process(ngx_cycle_t *cycle);
+
 /* According to app_pool_size, calculate the size of the nginx slab_pool that needs to be created */
 ngx_int_t ngx_shm_cal_slab_pool_size(ngx_int_t app_pool_size);
 
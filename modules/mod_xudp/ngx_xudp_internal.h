@@ -61,4 +61,10 @@ extern struct kern_xquic ngx_xudp_xquic_kern_cid_route_info;
 
 #endif
 
+#if (NGX_KCP)
+
+#include <kcp_xdp.h>
+
+#endif
+
 #endif
\ No newline at end of file
@@ -79,6 +79,21 @@ static char *ngx_xudp_core_module_init_conf(ngx_cycle_t *cycle, void *conf);
  * */
 static ngx_int_t ngx_xudp_create_listening_sockets(ngx_cycle_t *cycle);
 
+#if (NGX_KCP)
+
+/**
+ * get xudp binding address from stream kcp listening
+ * */
+static ngx_int_t ngx_xudp_get_address_from_kcp_listening(ngx_cycle_t *cycle,
+    ngx_xudp_conf_t *xcf);
+
+/**
+ * fill kcp maps of the dispatcher, conv will be routed to worker
+ * */
+static ngx_int_t ngx_xudp_kcp_route_init(ngx_cycle_t *cycle);
+
+#endif
+
 /**
  * according to xudp listening ports, create radix tree
  * */
@@ -316,6 +331,7 @@ ngx_xudp_get_address_from_http_core_module(ngx_xudp_conf_t *xcf, ngx_http_core_m
             if (r != NGX_OK) {
                 return r;
             }
+            xcf->xquic = 1;
             continue;
         }
         addr = (ngx_http_conf_addr_t*) port[i].addrs.elts;
@@ -329,6 +345,7 @@ ngx_xudp_get_address_from_http_core_module(ngx_xudp_conf_t *xcf, ngx_http_core_m
             if (r != NGX_OK) {
                 return r;
             }
+            xcf->xquic = 1;
         }
     }
 
@@ -401,6 +418,13 @@ ngx_xudp_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     /* for xudp_dump, default to 2MB */
     ngx_xudp_conf.dump_prepare_size = 2 * 1024 * 1024;
 
+#if (NGX_KCP)
+    /* get xudp binding address from stream configure */
+    if (ngx_xudp_get_address_from_kcp_listening(cycle, xcf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
     if (xcf->dispatcher_path.data) {
         c_str = ngx_pcalloc(cycle->pool, xcf->dispatcher_path.len + 1);
         if (!c_str) {
@@ -413,6 +437,11 @@ ngx_xudp_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     }else {
 #if (T_NGX_XQUIC)
         return "xquic over xudp required xquic dispatcher";
+#endif
+#if (NGX_KCP)
+        if (xcf->kcp) {
+            return "kcp over xudp required xudp dispatcher";
+        }
 #endif
     }
 
@@ -506,10 +535,16 @@ ngx_xudp_core_module_init_module(ngx_cycle_t *cycle)
                     "|xudp|nginx|update map[%s] xquic failed [xudp_error:%d]", XUDP_XQUIC_MAP_NAME, ret);
                 goto failed;
             }
-        }else {
+        }else if (xcf->xquic) {
             ngx_log_error(NGX_LOG_ERR, cycle->log, 0, "|xudp|nginx|xudp required xquic enable cid route, degrade to system");
             goto failed;
         }
+#endif
+#if (NGX_KCP)
+        /* route kcp conv to worker */
+        if (xcf->kcp && ngx_xudp_kcp_route_init(cycle) != NGX_OK) {
+            goto failed;
+        }
 #endif
     }
 
@@ -904,6 +939,11 @@ ngx_xudp_create_listening_sockets(ngx_cycle_t *cycle)
     ngx_xudp_channel_t  *xudp_ch;
     ngx_pid_t            pid;
     xudp_group          *group;
+#if (NGX_KCP)
+    int                  ret;
+    u32                  slot, value;
+    ngx_xudp_conf_t     *xcf;
+#endif
 
     xsk_addr = ngx_pcalloc(cycle->pool, sizeof(*xsk_addr));
     if (!xsk_addr) {
@@ -959,6 +999,23 @@ ngx_xudp_create_listening_sockets(ngx_cycle_t *cycle)
     // set group key
     xudp_dict_set_group_key(group, pid);
     cycle->xudp_ctx->group = group;
+
+#if (NGX_KCP)
+    xcf = (ngx_xudp_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_xudp_core_module);
+
+    /* publish the group key, kcp conv of this slot will come here */
+    if (xcf->kcp) {
+        slot  = ngx_worker;
+        value = pid;
+        ret = xudp_bpf_map_update(ngx_xudp_engine, XUDP_KCP_WORKERS_MAP_NAME, &slot, &value);
+        if (ret != 0) {
+            ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                "|xudp|nginx|update map[%s] kcp worker %ui failed, pass to system [xudp_error:%d]",
+                XUDP_KCP_WORKERS_MAP_NAME, ngx_worker, ret);
+        }
+    }
+#endif
+
     return NGX_OK;
     failed:
     if (group != NULL) {
@@ -1012,8 +1069,14 @@ static void
 ngx_xudp_stop(ngx_cycle_t *cycle)
 {
     int key = 0;
+#if (NGX_KCP)
+    struct kern_kcp  kcp = {0};
+#endif
     ngx_xudp_xquic_kern_cid_route_info.capture = 0 ;
     xudp_bpf_map_update(ngx_xudp_engine, XUDP_XQUIC_MAP_NAME, &key , &ngx_xudp_xquic_kern_cid_route_info);
+#if (NGX_KCP)
+    xudp_bpf_map_update(ngx_xudp_engine, XUDP_KCP_MAP_NAME, &key , &kcp);
+#endif
     return;
 }
 
@@ -1045,6 +1108,111 @@ ngx_xudp_free(ngx_cycle_t *cycle)
     }
 }
 
+#if (NGX_KCP)
+
+static ngx_int_t
+ngx_xudp_get_address_from_kcp_listening(ngx_cycle_t *cycle, ngx_xudp_conf_t *xcf)
+{
+    size_t               i;
+    ngx_listening_t     *ls;
+#if (T_DYRELOAD)
+    ngx_uint_t           j;
+    ngx_listening_t    **lsp;
+#endif
+
+    /* for each listening socket */
+#if (T_DYRELOAD)
+    i = 0;
+    lsp = cycle->listening.elts;
+    for (j = 0; j < cycle->listening.nelts; j++) {
+        ls = lsp[j];
+#else
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+#endif
+
+        if (!ls[i].xudp || !ls[i].kcp) {
+            continue;
+        }
+
+        if (ngx_xudp_add_address(xcf, ls[i].sockaddr) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        xcf->kcp = 1;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_xudp_kcp_route_init(ngx_cycle_t *cycle)
+{
+    int                  key, ret;
+    u8                   on;
+    u16                  port;
+    size_t               i;
+    ngx_listening_t     *ls;
+    ngx_core_conf_t     *ccf;
+    struct kern_kcp      value = {0};
+#if (T_DYRELOAD)
+    ngx_uint_t           j;
+    ngx_listening_t    **lsp;
+#endif
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->worker_processes > XUDP_KCP_MAX_WORKERS) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+            "|xudp|nginx|kcp over xudp supports at most %d workers", XUDP_KCP_MAX_WORKERS);
+        return NGX_ERROR;
+    }
+
+    /* for each listening socket */
+#if (T_DYRELOAD)
+    i = 0;
+    lsp = cycle->listening.elts;
+    for (j = 0; j < cycle->listening.nelts; j++) {
+        ls = lsp[j];
+#else
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+#endif
+
+        if (!ls[i].xudp || !ls[i].kcp) {
+            continue;
+        }
+
+        on   = 1;
+        port = htons(ngx_inet_get_port(ls[i].sockaddr));
+
+        ret = xudp_bpf_map_update(ngx_xudp_engine, XUDP_KCP_PORTS_MAP_NAME, &port, &on);
+        if (ret != 0) {
+            ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+                "|xudp|nginx|update map[%s] kcp port %V failed [xudp_error:%d]",
+                XUDP_KCP_PORTS_MAP_NAME, &ls[i].addr_text, ret);
+            return NGX_ERROR;
+        }
+    }
+
+    key = XUDP_KCP_MAP_DEFAULT_KEY;
+
+    /* workers fill map_kcp_workers themself, until then traffic passes to system */
+    value.capture = 1;
+    value.workers = ccf->worker_processes;
+
+    ret = xudp_bpf_map_update(ngx_xudp_engine, XUDP_KCP_MAP_NAME, &key, &value);
+    if (ret != 0) {
+        ngx_log_error(NGX_LOG_ERR, cycle->log, 0,
+            "|xudp|nginx|update map[%s] kcp failed [xudp_error:%d]", XUDP_KCP_MAP_NAME, ret);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
 static ngx_listening_t *
 ngx_xudp_find_listening(ngx_listening_t *xudp_ls, const struct sockaddr *sa)
 {
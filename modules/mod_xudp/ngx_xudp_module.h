@@ -33,6 +33,10 @@ struct ngx_xudp_conf_s
     ngx_msec_t       retries_interval;
     /* max count for retry xudp load */
     ngx_uint_t       max_retries;
+    /* has xudp addresses from http listeners */
+    ngx_flag_t       xquic;
+    /* has xudp addresses from stream kcp listeners */
+    ngx_flag_t       kcp;
 };
 
 #endif //_NGX_XUDP_MODULE_H_INCLUDED_
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include "kern_core.c"
 #include "xquic_xdp.h"
+#include "kcp_xdp.h"
 
 bpf_map map_xquic = {
     .type = BPF_MAP_TYPE_ARRAY,
@@ -13,6 +14,29 @@ bpf_map map_xquic = {
     .max_entries = 1,
 };
 
+bpf_map map_kcp = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(int),
+    .value_size = sizeof(struct kern_kcp),
+    .max_entries = 1,
+};
+
+bpf_map map_kcp_ports = {
+    .type = BPF_MAP_TYPE_HASH,
+    .key_size = sizeof(u16),
+    .value_size = sizeof(u8),
+    .max_entries = XUDP_KCP_MAX_PORTS,
+};
+
+bpf_map map_kcp_workers = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(u32),
+    .value_size = sizeof(u32),
+    .max_entries = XUDP_KCP_MAX_WORKERS,
+};
+
+#define KCP_NOT_CAPTURED    (-1)
+
 #define XQUIC_WORKER_PID(key)	((key) & 0x3fffff)
 
 /**
@@ -94,6 +118,58 @@ violence:
     return 0;
 }
 
+/**
+ * kcp segment starts with the little endian conv,
+ * all the segments of a conv go to the same worker
+ */
+static int
+kcp_dispatch(struct xudp_ctx *ctx)
+{
+    struct kern_kcp *kcp;
+
+    int r, kcp_key;
+    u16 port;
+    u32 conv, idx, *pid;
+    u8 *p;
+
+    kcp_key = XUDP_KCP_MAP_DEFAULT_KEY;
+
+    kcp = bpf_map_lookup_elem(&map_kcp, (const void *) &kcp_key);
+
+    if (!kcp || kcp->capture == 0 || kcp->workers == 0) {
+        return KCP_NOT_CAPTURED;
+    }
+
+    port = ctx->hdrs.udp->dest;
+
+    if (!bpf_map_lookup_elem(&map_kcp_ports, (const void *) &port)) {
+        return KCP_NOT_CAPTURED;
+    }
+
+    /* get UDP payload */
+    p = (u8*) (ctx->hdrs.udp + 1);
+    if (!access_ok(ctx, (u32*) p)) {
+        goto fail;
+    }
+
+    conv = p[0] | (p[1] << 8) | (p[2] << 16) | ((u32) p[3] << 24);
+
+    idx = conv % kcp->workers;
+
+    pid = bpf_map_lookup_elem(&map_kcp_workers, (const void *) &idx);
+    if (!pid || *pid == 0) {
+        goto fail;
+    }
+
+    r = xskmap_dict_go(ctx, *pid);
+    if (r >= 0) {
+        return r;
+    }
+
+fail:
+    return XDP_PASS;
+}
+
 static int
 xskmap_dispatch(struct xudp_ctx *ctx)
 {
@@ -104,6 +180,11 @@ xskmap_dispatch(struct xudp_ctx *ctx)
     u8 *dcid, err;
     u8 *p;
 
+    r = kcp_dispatch(ctx);
+    if (r != KCP_NOT_CAPTURED) {
+        return r;
+    }
+
     xquic_key = XUDP_XQUIC_MAP_DEFAULT_KEY;
 
     xquic = bpf_map_lookup_elem(&map_xquic, (const void *) &xquic_key);
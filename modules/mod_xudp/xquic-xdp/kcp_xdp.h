@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2020-2023 Alibaba Group Holding Limited
+ */
+
+#ifndef  __KCP_XDP_H__
+#define __KCP_XDP_H__
+
+struct kern_kcp {
+    /* capturing kcp traffic in xudp */
+    /* system will control traffic for capture=0 */
+    u8  capture;
+    /* just padding */
+    u8  padding;
+    /* number of workers, conv is routed to worker (conv % workers) */
+    u16 workers;
+};
+
+#define XUDP_KCP_MAP_DEFAULT_KEY    (0)
+
+#define XUDP_KCP_MAP_NAME           "map_kcp"
+
+/* udp ports (network order) of kcp listeners */
+#define XUDP_KCP_PORTS_MAP_NAME     "map_kcp_ports"
+#define XUDP_KCP_MAX_PORTS          64
+
+/* worker slot to pid, pid is the key of the worker's xsk group */
+#define XUDP_KCP_WORKERS_MAP_NAME   "map_kcp_workers"
+#define XUDP_KCP_MAX_WORKERS        1024
+
+#endif
@@ -457,6 +457,9 @@ ngx_http_set_host_header(ngx_http_request_t *r, ngx_http_lua_header_val_t *hv,
     var->valid = 0;
     var->not_found = 0;
 
+    /* complex values cached with the old $host */
+    r->complex_values = NULL;
+
     return ngx_http_set_builtin_header(r, hv, value);
 }
 
@@ -6,6 +6,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_http_sysguard_module.h>
 
 
 #define NGX_HTTP_SYSGUARD_MODE_OR  0
@@ -235,15 +236,34 @@ ngx_http_sysguard_update_cpuusage(ngx_http_request_t *r, time_t exptime)
 }
 
 
+static void
+ngx_http_sysguard_sample_cpuinfo(ngx_http_request_t *r, time_t exptime)
+{
+    ngx_int_t      rc;
+    ngx_str_t      cpunumber;
+    ngx_cpuinfo_t  cpuinfo;
+
+    if (ngx_http_sysguard_cached_cpuinfo_exptime >= ngx_time()) {
+        return;
+    }
+
+    ngx_str_set(&cpunumber, "cpu");
+
+    rc = ngx_getcpuinfo(&cpunumber, &cpuinfo, r->connection->log);
+    if (rc == NGX_ERROR) {
+        return;
+    }
+
+    ngx_http_sysguard_cached_pre_cputime = ngx_http_sysguard_cached_cur_cputime;
+    ngx_http_sysguard_cached_cur_cputime = cpuinfo;
+    ngx_http_sysguard_cached_cpuinfo_exptime = ngx_time() + exptime;
+}
+
+
 void
 ngx_http_sysguard_update_cpuinfo(ngx_http_request_t *r)
 {
-    ngx_int_t                       rc;
-    ngx_cpuinfo_t                   cpuinfo;
     ngx_http_sysguard_conf_t       *glcf;
-    ngx_str_t                       cpunumber;
-
-    ngx_str_set(&cpunumber, "cpu");
 
     glcf = ngx_http_get_module_loc_conf(r, ngx_http_sysguard_module);
 
@@ -255,19 +275,24 @@ ngx_http_sysguard_update_cpuinfo(ngx_http_request_t *r)
         return;
     }
 
-    if (ngx_http_sysguard_cached_cpuinfo_exptime < ngx_time()) {
-        rc = ngx_getcpuinfo(&cpunumber, &cpuinfo, r->connection->log);
-        if (rc == NGX_ERROR) {
-            ngx_memzero(&cpuinfo, sizeof(ngx_cpuinfo_t));
-            return;
-        }
+    ngx_http_sysguard_sample_cpuinfo(r, glcf->cpu_interval);
+}
+
+
+ngx_int_t
+ngx_http_sysguard_cpu_usage(ngx_http_request_t *r)
+{
+    ngx_http_sysguard_conf_t  *glcf;
+
+    glcf = ngx_http_get_module_loc_conf(r, ngx_http_sysguard_module);
+
+    ngx_http_sysguard_sample_cpuinfo(r, glcf->cpu_interval);
 
-        ngx_http_sysguard_cached_pre_cputime = ngx_http_sysguard_cached_cur_cputime;
-        ngx_http_sysguard_cached_cur_cputime = cpuinfo;
-        ngx_http_sysguard_cached_cpuinfo_exptime = ngx_time() + glcf->cpu_interval;
+    if (ngx_http_sysguard_cached_cpuusage_exptime < ngx_time()) {
+        ngx_http_sysguard_update_cpuusage(r, glcf->interval);
     }
 
-    return;
+    return ngx_http_sysguard_cached_cpuusage;
 }
 
 
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2010-2017 Alibaba Group Holding Limited
+ */
+
+
+#ifndef _NGX_HTTP_SYSGUARD_MODULE_H_INCLUDED_
+#define _NGX_HTTP_SYSGUARD_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * returns the cpu usage sampled every sysguard_cpu period in the
+ * request location, in hundredths of a percent (10000 is 100%)
+ */
+ngx_int_t ngx_http_sysguard_cpu_usage(ngx_http_request_t *r);
+void ngx_http_sysguard_update_cpuinfo(ngx_http_request_t *r);
+
+
+extern ngx_module_t  ngx_http_sysguard_module;
+
+
+#endif /* _NGX_HTTP_SYSGUARD_MODULE_H_INCLUDED_ */
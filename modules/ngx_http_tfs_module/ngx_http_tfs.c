@@ -14,6 +14,7 @@
 #include <ngx_http_tfs_name_server_message.h>
 #include <ngx_http_tfs_data_server_message.h>
 #include <ngx_http_tfs_remote_block_cache.h>
+#include <ngx_http_tfs_hedge.h>
 
 
 #define ngx_http_tfs_clear_content_len()\
@@ -658,6 +659,8 @@ ngx_http_tfs_send(ngx_http_request_t *r, ngx_http_tfs_t *t)
 
     ngx_add_timer(c->read, t->main_conf->tfs_read_timeout);
 
+    ngx_http_tfs_hedge_arm(t);
+
     if (c->read->ready) {
         ngx_http_tfs_read_handler(r, t);
         return;
@@ -1727,6 +1730,8 @@ ngx_http_tfs_finalize_request(ngx_http_request_t *r, ngx_http_tfs_t *t,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "finalize http tfs request: %i", rc);
 
+    ngx_http_tfs_hedge_done(t, 0);
+
     if (t->parent
         && t->r_ctx.action.code == NGX_HTTP_TFS_ACTION_READ_FILE
         && t->parent->sp_curr != t->sp_curr)
@@ -1846,6 +1851,11 @@ ngx_http_tfs_read_handler(ngx_http_request_t *r, ngx_http_tfs_t *t)
 
     c->log->action = "reading response header from tfs";
 
+    /* a hedge in flight loses to an answer, or takes over the read */
+    if (ngx_http_tfs_hedge_primary(t) == NGX_DONE) {
+        return;
+    }
+
     if (c->read->timedout) {
         ngx_log_error(NGX_LOG_ERR, c->log, 0,
                       "read from (%V: %s) timeout", tp->peer.name,
@@ -162,6 +162,10 @@ struct  ngx_http_tfs_main_conf_s {
 
     ngx_http_connection_pool_t    *conn_pool;
 
+    ngx_flag_t                     hedge_read;
+    ngx_msec_t                     hedge_min_delay;
+    ngx_uint_t                     hedge_percent;
+
     uint32_t                       cluster_id;
 
     ngx_array_t                    upstreams;
@@ -217,6 +221,9 @@ struct ngx_http_tfs_s {
     ngx_http_tfs_peer_connection_t *tfs_peer_servers;
     uint8_t                       tfs_peer_count;
 
+    /* hedged data server read, allocated on first use */
+    ngx_http_tfs_hedge_t          *hedge;
+
     ngx_http_tfs_loc_conf_t       *loc_conf;
     ngx_http_tfs_srv_conf_t       *srv_conf;
     ngx_http_tfs_main_conf_t      *main_conf;
@@ -20,6 +20,12 @@
 
 #define NGX_HTTP_TFS_BLOCK_CACHE_STAT_COUNT  (3000 * 60 * 60)
 
+/* retries of the lock-free read path before falling back to the mutex */
+#define NGX_HTTP_TFS_BLOCK_CACHE_READ_RETRY  4
+
+/* ds addrs of a node are limited by its u_char len */
+#define NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS  (255 / sizeof(uint64_t))
+
 #define NGX_HTTP_TFS_NO_BLOCK_CACHE      0x0
 #define NGX_HTTP_TFS_LOCAL_BLOCK_CACHE   0x1
 #define NGX_HTTP_TFS_REMOTE_BLOCK_CACHE  0x2
@@ -48,14 +54,17 @@ typedef struct {
     ngx_rbtree_node_t                    sentinel;
     ngx_queue_t                          queue;
     uint64_t                             discard_item_count;
-    uint64_t                             hit_count;
-    uint64_t                             miss_count;
+    ngx_atomic_t                         hit_count;
+    ngx_atomic_t                         miss_count;
+    /* odd while rbtree is being changed, readers retry on change */
+    ngx_atomic_t                         seq;
 } ngx_http_tfs_block_cache_shctx_t;
 
 
 typedef struct {
     ngx_http_tfs_block_cache_shctx_t    *sh;
     ngx_slab_pool_t                     *shpool;
+    ngx_flag_t                           prefetch;
 } ngx_http_tfs_local_block_cache_ctx_t;
 
 
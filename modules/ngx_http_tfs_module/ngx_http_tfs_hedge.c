@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2010-2015 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_http_tfs.h>
+#include <ngx_http_tfs_hedge.h>
+#include <ngx_http_tfs_data_server_message.h>
+
+
+#define NGX_HTTP_TFS_HEDGE_BUCKETS           16
+#define NGX_HTTP_TFS_HEDGE_MIN_SAMPLES       32
+#define NGX_HTTP_TFS_HEDGE_MAX_SAMPLES       2048
+
+/* a hedge costs 100 tokens, every armed read earns hedge_percent */
+#define NGX_HTTP_TFS_HEDGE_COST              100
+#define NGX_HTTP_TFS_HEDGE_BURST             (10 * NGX_HTTP_TFS_HEDGE_COST)
+
+
+static ngx_msec_t ngx_http_tfs_hedge_delay(ngx_http_tfs_main_conf_t *tmcf);
+static void ngx_http_tfs_hedge_sample(ngx_msec_t ms);
+static void ngx_http_tfs_hedge_timeout_handler(ngx_event_t *ev);
+static void ngx_http_tfs_hedge_handler(ngx_event_t *ev);
+static void ngx_http_tfs_hedge_send(ngx_http_tfs_t *t);
+static void ngx_http_tfs_hedge_promote(ngx_http_tfs_t *t,
+    ngx_uint_t answered);
+static void ngx_http_tfs_hedge_close(ngx_http_tfs_t *t, ngx_uint_t restore);
+static void ngx_http_tfs_hedge_cleanup(void *data);
+
+
+/*
+ * per worker latency histogram of data server reads, bucket b holds
+ * latencies in [2^(b-1), 2^b) ms, bucket 0 holds sub-millisecond ones
+ */
+static ngx_uint_t  ngx_http_tfs_hedge_buckets[NGX_HTTP_TFS_HEDGE_BUCKETS];
+static ngx_uint_t  ngx_http_tfs_hedge_samples;
+static ngx_uint_t  ngx_http_tfs_hedge_tokens;
+
+
+void
+ngx_http_tfs_hedge_arm(ngx_http_tfs_t *t)
+{
+    ngx_msec_t                    delay;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_tfs_hedge_t         *hedge;
+    ngx_http_tfs_main_conf_t     *tmcf;
+    ngx_http_tfs_segment_data_t  *segment_data;
+
+    tmcf = t->main_conf;
+
+    if (!tmcf->hedge_read
+        || t->r_ctx.action.code != NGX_HTTP_TFS_ACTION_READ_FILE
+        || t->state != NGX_HTTP_TFS_STATE_READ_READ_DATA
+        || t->tfs_peer != &t->tfs_peer_servers[NGX_HTTP_TFS_DATA_SERVER])
+    {
+        return;
+    }
+
+    hedge = t->hedge;
+
+    if (hedge == NULL) {
+        hedge = ngx_pcalloc(t->pool, sizeof(ngx_http_tfs_hedge_t));
+        if (hedge == NULL) {
+            return;
+        }
+
+        cln = ngx_pool_cleanup_add(t->pool, 0);
+        if (cln == NULL) {
+            return;
+        }
+
+        cln->handler = ngx_http_tfs_hedge_cleanup;
+        cln->data = t;
+
+        hedge->timer.handler = ngx_http_tfs_hedge_timeout_handler;
+        hedge->timer.data = t;
+
+        t->hedge = hedge;
+    }
+
+    hedge->timer.log = t->log;
+    hedge->start = ngx_current_msec;
+    hedge->armed = 1;
+
+    ngx_http_tfs_hedge_tokens = ngx_min(ngx_http_tfs_hedge_tokens
+                                        + tmcf->hedge_percent,
+                                        NGX_HTTP_TFS_HEDGE_BURST);
+
+    segment_data = &t->file.segment_data[t->file.segment_index];
+
+    if (segment_data->block_info.ds_count < 2
+        || segment_data->ds_retry >= segment_data->block_info.ds_count)
+    {
+        return;
+    }
+
+    delay = ngx_http_tfs_hedge_delay(tmcf);
+    if (delay == 0 || delay >= tmcf->tfs_read_timeout) {
+        return;
+    }
+
+    ngx_add_timer(&hedge->timer, delay);
+}
+
+
+void
+ngx_http_tfs_hedge_done(ngx_http_tfs_t *t, ngx_uint_t sample)
+{
+    ngx_http_tfs_hedge_t  *hedge;
+
+    hedge = t->hedge;
+
+    if (hedge == NULL || !hedge->armed) {
+        return;
+    }
+
+    hedge->armed = 0;
+
+    if (hedge->timer.timer_set) {
+        ngx_del_timer(&hedge->timer);
+    }
+
+    if (sample) {
+        ngx_http_tfs_hedge_sample(ngx_current_msec - hedge->start);
+    }
+
+    /* the primary answered first, the replica cursor goes back */
+    ngx_http_tfs_hedge_close(t, 1);
+}
+
+
+/*
+ * called on a read event of the primary data server: an answer cancels
+ * the hedge, while a timeout or a failure hands the read over to a hedge
+ * already sent, and NGX_DONE is returned
+ */
+
+ngx_int_t
+ngx_http_tfs_hedge_primary(ngx_http_tfs_t *t)
+{
+    u_char                 ch;
+    ssize_t                n;
+    ngx_err_t              err;
+    ngx_connection_t      *c;
+    ngx_http_tfs_hedge_t  *hedge;
+
+    hedge = t->hedge;
+
+    if (hedge == NULL || !hedge->armed) {
+        return NGX_OK;
+    }
+
+    c = t->tfs_peer->peer.connection;
+
+    if (hedge->peer.peer.connection == NULL || !hedge->sent) {
+        ngx_http_tfs_hedge_done(t, !c->read->timedout);
+        return NGX_OK;
+    }
+
+    if (c->read->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "read from (%s) timeout", t->tfs_peer->peer_addr_text);
+
+        ngx_http_tfs_hedge_promote(t, 0);
+        return NGX_DONE;
+    }
+
+    n = recv(c->fd, &ch, 1, MSG_PEEK);
+
+    if (n == 1) {
+        ngx_http_tfs_hedge_done(t, 1);
+        return NGX_OK;
+    }
+
+    err = ngx_socket_errno;
+
+    if (n == -1 && err == NGX_EAGAIN) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, c->log, n == 0 ? 0 : err,
+                  "read from (%s) failed", t->tfs_peer->peer_addr_text);
+
+    ngx_http_tfs_hedge_promote(t, 0);
+
+    return NGX_DONE;
+}
+
+
+static ngx_msec_t
+ngx_http_tfs_hedge_delay(ngx_http_tfs_main_conf_t *tmcf)
+{
+    ngx_uint_t  b, sum, target, lower, upper;
+    ngx_msec_t  delay;
+
+    if (ngx_http_tfs_hedge_samples < NGX_HTTP_TFS_HEDGE_MIN_SAMPLES) {
+        return 0;
+    }
+
+    target = (ngx_http_tfs_hedge_samples * 95 + 99) / 100;
+    sum = 0;
+
+    for (b = 0; b < NGX_HTTP_TFS_HEDGE_BUCKETS - 1; b++) {
+        if (sum + ngx_http_tfs_hedge_buckets[b] >= target) {
+            break;
+        }
+
+        sum += ngx_http_tfs_hedge_buckets[b];
+    }
+
+    /* interpolate p95 inside its bucket */
+
+    lower = b ? (ngx_uint_t) 1 << (b - 1) : 0;
+    upper = (ngx_uint_t) 1 << b;
+
+    delay = lower;
+
+    if (ngx_http_tfs_hedge_buckets[b]) {
+        delay += (upper - lower) * (target - sum)
+                 / ngx_http_tfs_hedge_buckets[b];
+    }
+
+    return ngx_max(delay, tmcf->hedge_min_delay);
+}
+
+
+static void
+ngx_http_tfs_hedge_sample(ngx_msec_t ms)
+{
+    ngx_uint_t  b;
+
+    for (b = 0; ms && b < NGX_HTTP_TFS_HEDGE_BUCKETS - 1; b++) {
+        ms >>= 1;
+    }
+
+    ngx_http_tfs_hedge_buckets[b]++;
+
+    if (++ngx_http_tfs_hedge_samples < NGX_HTTP_TFS_HEDGE_MAX_SAMPLES) {
+        return;
+    }
+
+    /* decay, so the threshold follows the current latency */
+
+    ngx_http_tfs_hedge_samples = 0;
+
+    for (b = 0; b < NGX_HTTP_TFS_HEDGE_BUCKETS; b++) {
+        ngx_http_tfs_hedge_buckets[b] >>= 1;
+        ngx_http_tfs_hedge_samples += ngx_http_tfs_hedge_buckets[b];
+    }
+}
+
+
+static void
+ngx_http_tfs_hedge_timeout_handler(ngx_event_t *ev)
+{
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_chain_t                  *cl, **ll;
+    ngx_http_tfs_t               *t;
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_tfs_inet_t          *addr;
+    ngx_http_tfs_hedge_t         *hedge;
+    ngx_peer_connection_t        *p;
+    ngx_http_tfs_segment_data_t  *segment_data;
+
+    t = ev->data;
+    r = t->data;
+    hedge = t->hedge;
+
+    if (!hedge->armed || hedge->peer.peer.connection) {
+        return;
+    }
+
+    if (ngx_http_tfs_hedge_tokens < NGX_HTTP_TFS_HEDGE_COST) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, t->log, 0,
+                       "http tfs hedge skipped, budget exhausted");
+        return;
+    }
+
+    segment_data = &t->file.segment_data[t->file.segment_index];
+
+    hedge->ds_index = segment_data->ds_index;
+    hedge->ds_retry = segment_data->ds_retry;
+
+    addr = ngx_http_tfs_select_data_server(t, segment_data);
+    if (addr == NULL) {
+        goto restore;
+    }
+
+    /* the primary request has been sent, resend a copy of its bytes */
+
+    hedge->request = NULL;
+    ll = &hedge->request;
+
+    for (cl = t->request_bufs; cl; cl = cl->next) {
+        b = ngx_create_temp_buf(t->pool, cl->buf->last - cl->buf->start);
+        if (b == NULL) {
+            goto restore;
+        }
+
+        b->last = ngx_cpymem(b->pos, cl->buf->start,
+                             cl->buf->last - cl->buf->start);
+
+        *ll = ngx_alloc_chain_link(t->pool);
+        if (*ll == NULL) {
+            goto restore;
+        }
+
+        (*ll)->buf = b;
+        ll = &(*ll)->next;
+    }
+
+    *ll = NULL;
+
+    hedge->peer = *t->tfs_peer;
+    hedge->peer.peer.connection = NULL;
+    hedge->peer.peer.cached = 0;
+
+    if (ngx_http_tfs_peer_set_addr(t->pool, &hedge->peer, addr) != NGX_OK) {
+        goto restore;
+    }
+
+    p = &hedge->peer.peer;
+
+    rc = ngx_event_connect_peer(p);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_INFO, t->log, 0,
+                      "hedge connect to (%V: %s) failed", p->name,
+                      hedge->peer.peer_addr_text);
+#if (NGX_DEBUG)
+        ((ngx_http_connection_pool_t *) p->data)->count++;
+#endif
+        p->connection = NULL;
+        goto restore;
+    }
+
+    ngx_http_tfs_hedge_tokens -= NGX_HTTP_TFS_HEDGE_COST;
+
+    c = p->connection;
+    c->data = t;
+
+    c->read->handler = ngx_http_tfs_hedge_handler;
+    c->write->handler = ngx_http_tfs_hedge_handler;
+
+    if (c->pool == NULL) {
+        c->pool = ngx_create_pool(128, r->connection->log);
+        if (c->pool == NULL) {
+            ngx_http_tfs_hedge_close(t, 1);
+            return;
+        }
+    }
+
+    c->log = r->connection->log;
+    c->pool->log = c->log;
+    c->read->log = c->log;
+    c->write->log = c->log;
+
+    hedge->sent = 0;
+
+    ngx_log_error(NGX_LOG_INFO, t->log, 0,
+                  "hedge read of block %uD to %s after %M ms",
+                  segment_data->segment_info.block_id,
+                  hedge->peer.peer_addr_text,
+                  ngx_current_msec - hedge->start);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, t->main_conf->tfs_connect_timeout);
+        return;
+    }
+
+    ngx_http_tfs_hedge_send(t);
+
+    return;
+
+restore:
+
+    segment_data->ds_index = hedge->ds_index;
+    segment_data->ds_retry = hedge->ds_retry;
+}
+
+
+static void
+ngx_http_tfs_hedge_handler(ngx_event_t *ev)
+{
+    u_char                 ch;
+    ssize_t                n;
+    ngx_err_t              err;
+    ngx_http_tfs_t        *t;
+    ngx_connection_t      *c;
+    ngx_http_tfs_hedge_t  *hedge;
+
+    c = ev->data;
+    t = c->data;
+    hedge = t->hedge;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "hedge read from (%s) timed out",
+                      hedge->peer.peer_addr_text);
+        ngx_http_tfs_hedge_close(t, 0);
+        return;
+    }
+
+    if (ev->write) {
+        if (!hedge->sent) {
+            ngx_http_tfs_hedge_send(t);
+        }
+
+        return;
+    }
+
+    if (!hedge->sent) {
+        return;
+    }
+
+    /* peek, a closed or broken replica must not take over the read */
+
+    n = recv(c->fd, &ch, 1, MSG_PEEK);
+
+    if (n == 1) {
+        ngx_http_tfs_hedge_promote(t, 1);
+        return;
+    }
+
+    err = ngx_socket_errno;
+
+    if (n == -1 && err == NGX_EAGAIN) {
+        ev->ready = 0;
+
+        if (ngx_handle_read_event(ev, 0) != NGX_OK) {
+            ngx_http_tfs_hedge_close(t, 0);
+        }
+
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, c->log, n == 0 ? 0 : err,
+                  "hedge read from (%s) failed", hedge->peer.peer_addr_text);
+
+    ngx_http_tfs_hedge_close(t, 0);
+}
+
+
+static void
+ngx_http_tfs_hedge_send(ngx_http_tfs_t *t)
+{
+    ngx_chain_t           *cl;
+    ngx_connection_t      *c;
+    ngx_http_tfs_hedge_t  *hedge;
+
+    hedge = t->hedge;
+    c = hedge->peer.peer.connection;
+
+    if (ngx_http_tfs_test_connect(c) != NGX_OK) {
+        ngx_http_tfs_hedge_close(t, 0);
+        return;
+    }
+
+    c->log->action = "sending hedged request to tfs";
+
+    cl = c->send_chain(c, hedge->request, 0);
+
+    if (cl == NGX_CHAIN_ERROR) {
+        ngx_http_tfs_hedge_close(t, 0);
+        return;
+    }
+
+    hedge->request = cl;
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    if (cl) {
+        ngx_add_timer(c->write, t->main_conf->tfs_send_timeout);
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            ngx_http_tfs_hedge_close(t, 0);
+        }
+
+        return;
+    }
+
+    hedge->sent = 1;
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        ngx_http_tfs_hedge_close(t, 0);
+        return;
+    }
+
+    ngx_add_timer(c->read, t->main_conf->tfs_read_timeout);
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_http_tfs_hedge_close(t, 0);
+        return;
+    }
+
+    if (c->read->ready) {
+        ngx_http_tfs_hedge_handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_tfs_hedge_promote(ngx_http_tfs_t *t, ngx_uint_t answered)
+{
+    ngx_connection_t                *c, *old;
+    ngx_http_tfs_hedge_t            *hedge;
+    ngx_http_tfs_peer_connection_t  *tp;
+
+    hedge = t->hedge;
+    tp = t->tfs_peer;
+
+    c = hedge->peer.peer.connection;
+    old = tp->peer.connection;
+
+    if (answered) {
+        ngx_log_error(NGX_LOG_INFO, t->log, 0,
+                      "hedge read from (%s) answered before (%s)",
+                      hedge->peer.peer_addr_text, tp->peer_addr_text);
+
+        /* the primary is at least this slow */
+        ngx_http_tfs_hedge_sample(ngx_current_msec - hedge->start);
+
+    } else {
+        ngx_log_error(NGX_LOG_INFO, t->log, 0,
+                      "hedge read from (%s) takes over from (%s)",
+                      hedge->peer.peer_addr_text, tp->peer_addr_text);
+    }
+
+    hedge->armed = 0;
+
+    c->read->handler = old->read->handler;
+    c->write->handler = old->write->handler;
+
+    /* a hedge which has not answered yet keeps its read timeout */
+
+    if (answered && c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+#if (NGX_DEBUG)
+    ((ngx_http_connection_pool_t *) tp->peer.data)->count++;
+#endif
+
+    if (old->pool) {
+        ngx_destroy_pool(old->pool);
+    }
+
+    ngx_close_connection(old);
+
+    /* the replica becomes the data server of this read */
+
+    tp->peer = hedge->peer.peer;
+    ngx_memcpy(tp->peer_addr_text, hedge->peer.peer_addr_text,
+               sizeof(tp->peer_addr_text));
+
+    hedge->peer.peer.connection = NULL;
+
+    t->writer.connection = c;
+
+    if (answered) {
+        c->read->handler(c->read);
+    }
+}
+
+
+static void
+ngx_http_tfs_hedge_close(ngx_http_tfs_t *t, ngx_uint_t restore)
+{
+    ngx_connection_t             *c;
+    ngx_http_tfs_hedge_t         *hedge;
+    ngx_http_tfs_segment_data_t  *segment_data;
+
+    hedge = t->hedge;
+    c = hedge->peer.peer.connection;
+
+    if (c == NULL) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, t->log, 0,
+                   "close http tfs hedge connection: %d", c->fd);
+
+#if (NGX_DEBUG)
+    ((ngx_http_connection_pool_t *) hedge->peer.peer.data)->count++;
+#endif
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+    ngx_close_connection(c);
+
+    hedge->peer.peer.connection = NULL;
+
+    if (restore) {
+        segment_data = &t->file.segment_data[t->file.segment_index];
+        segment_data->ds_index = hedge->ds_index;
+        segment_data->ds_retry = hedge->ds_retry;
+    }
+}
+
+
+static void
+ngx_http_tfs_hedge_cleanup(void *data)
+{
+    ngx_http_tfs_t  *t = data;
+
+    if (t->hedge == NULL) {
+        return;
+    }
+
+    if (t->hedge->timer.timer_set) {
+        ngx_del_timer(&t->hedge->timer);
+    }
+
+    ngx_http_tfs_hedge_close(t, 0);
+}
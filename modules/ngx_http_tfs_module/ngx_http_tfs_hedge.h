@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010-2015 Alibaba Group Holding Limited
+ */
+
+
+#ifndef _NGX_HTTP_TFS_HEDGE_H_INCLUDED_
+#define _NGX_HTTP_TFS_HEDGE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_http_tfs.h>
+
+
+#define NGX_HTTP_TFS_HEDGE_MIN_DELAY         10
+#define NGX_HTTP_TFS_HEDGE_PERCENT           5
+
+
+struct ngx_http_tfs_hedge_s {
+    ngx_event_t                      timer;
+    ngx_http_tfs_peer_connection_t   peer;
+    ngx_chain_t                     *request;
+    ngx_msec_t                       start;
+
+    /* replica cursor before the hedge, restored when the primary wins */
+    ngx_uint_t                       ds_index;
+    ngx_uint_t                       ds_retry;
+
+    unsigned                         armed:1;
+    unsigned                         sent:1;
+};
+
+
+void ngx_http_tfs_hedge_arm(ngx_http_tfs_t *t);
+void ngx_http_tfs_hedge_done(ngx_http_tfs_t *t, ngx_uint_t sample);
+ngx_int_t ngx_http_tfs_hedge_primary(ngx_http_tfs_t *t);
+
+
+#endif  /* _NGX_HTTP_TFS_HEDGE_H_INCLUDED_ */
@@ -10,6 +10,34 @@
 static void ngx_http_tfs_local_block_cache_rbtree_insert_value(
     ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
     ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_tfs_local_block_cache_read(
+    ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key, ngx_uint_t hash, uint64_t *ds_addrs,
+    uint32_t *ds_count, ngx_http_tfs_block_cache_node_t **bcnp,
+    ngx_atomic_uint_t *seqp);
+static ngx_int_t ngx_http_tfs_local_block_cache_get(
+    ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key, uint64_t *ds_addrs,
+    uint32_t *ds_count, ngx_http_tfs_block_cache_node_t **bcnp,
+    ngx_atomic_uint_t *seqp);
+static void ngx_http_tfs_local_block_cache_touch(
+    ngx_http_tfs_local_block_cache_ctx_t *ctx, ngx_log_t *log,
+    ngx_http_tfs_block_cache_node_t **bcns, ngx_atomic_uint_t *seqs,
+    ngx_uint_t n);
+
+
+#define ngx_http_tfs_local_block_cache_write_begin(sh)                       \
+    (sh)->seq++;                                                              \
+    ngx_memory_barrier()
+
+#define ngx_http_tfs_local_block_cache_write_end(sh)                         \
+    ngx_memory_barrier();                                                     \
+    (sh)->seq++
+
+#define ngx_http_tfs_local_block_cache_in_zone(shpool, p, size)              \
+    ((u_char *) (p) >= (shpool)->start                                        \
+     && (u_char *) (p) + (size) <= (shpool)->end                              \
+     && ((uintptr_t) (p) & (NGX_ALIGNMENT - 1)) == 0)
 
 
 ngx_int_t
@@ -45,6 +73,7 @@ ngx_http_tfs_local_block_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ctx->sh->discard_item_count = NGX_HTTP_TFS_BLOCK_CACHE_DISCARD_ITEM_COUNT;
     ctx->sh->hit_count = 0;
     ctx->sh->miss_count = 0;
+    ctx->sh->seq = 0;
 
     ctx->shpool->data = ctx->sh;
 
@@ -106,31 +135,50 @@ ngx_http_tfs_local_block_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
 }
 
 
-ngx_int_t
-ngx_http_tfs_local_block_cache_lookup(ngx_http_tfs_local_block_cache_ctx_t *ctx,
-    ngx_pool_t *pool, ngx_log_t *log, ngx_http_tfs_block_cache_key_t* key,
-    ngx_http_tfs_block_cache_value_t *value)
+/*
+ * Lock-free lookup: the rbtree is walked without the zone mutex and the
+ * result is only trusted if ctx->sh->seq did not move meanwhile.  Nodes
+ * freed by a concurrent writer stay inside the slab pool, so every pointer
+ * is range checked and the walk is bounded, the seq check then throws the
+ * garbage away.
+ */
+
+static ngx_int_t
+ngx_http_tfs_local_block_cache_read(ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key, ngx_uint_t hash, uint64_t *ds_addrs,
+    uint32_t *ds_count, ngx_http_tfs_block_cache_node_t **bcnp,
+    ngx_atomic_uint_t *seqp)
 {
-    double                            hit_ratio;
     ngx_int_t                         rc;
-    ngx_uint_t                        hash;
+    ngx_uint_t                        depth, count;
     ngx_slab_pool_t                  *shpool;
+    ngx_atomic_uint_t                 seq;
     ngx_rbtree_node_t                *node, *sentinel;
     ngx_http_tfs_block_cache_node_t  *bcn;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
-                   "lookup local block cache, ns addr: %uL, block id: %uD",
-                   key->ns_addr, key->block_id);
-
     shpool = ctx->shpool;
-    ngx_shmtx_lock(&shpool->mutex);
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    seq = ctx->sh->seq;
+    if (seq & 1) {
+        return NGX_AGAIN;
+    }
 
-    hash = ngx_murmur_hash2((u_char*)key, NGX_HTTP_TFS_BLOCK_CACHE_KEY_SIZE);
+    ngx_memory_barrier();
 
-    while (node != sentinel) {
+    node = ctx->sh->rbtree.root;
+    sentinel = &ctx->sh->sentinel;
+    rc = NGX_DECLINED;
+
+    /* a red-black tree in the zone is never deeper than this */
+    for (depth = 0; node != sentinel; depth++) {
+
+        if (depth == 8 * sizeof(ngx_uint_t) * 2
+            || !ngx_http_tfs_local_block_cache_in_zone(shpool, node,
+                   offsetof(ngx_rbtree_node_t, color)
+                   + offsetof(ngx_http_tfs_block_cache_node_t, data)))
+        {
+            return NGX_AGAIN;
+        }
 
         if (hash < node->key) {
             node = node->left;
@@ -146,35 +194,147 @@ ngx_http_tfs_local_block_cache_lookup(ngx_http_tfs_local_block_cache_ctx_t *ctx,
         bcn = (ngx_http_tfs_block_cache_node_t *) &node->color;
         rc = ngx_http_tfs_block_cache_cmp(key, &bcn->key);
         if (rc == 0) {
-            value->ds_count = bcn->count;
-            value->ds_addrs = ngx_pcalloc(pool,
-                                          value->ds_count * sizeof(uint64_t));
-            if (value->ds_addrs == NULL) {
-                ngx_shmtx_unlock(&shpool->mutex);
-                return NGX_ERROR;
-            }
-            ngx_memcpy(value->ds_addrs, bcn->data,
-                       value->ds_count * sizeof(uint64_t));
-            ngx_queue_remove(&bcn->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &bcn->queue);
-            ctx->sh->hit_count++;
-            if (ctx->sh->hit_count >= NGX_HTTP_TFS_BLOCK_CACHE_STAT_COUNT) {
-                hit_ratio = 100 * (double)((double)ctx->sh->hit_count
-                                           / (double)(ctx->sh->hit_count
-                                                      + ctx->sh->miss_count));
-                ngx_log_error(NGX_LOG_INFO, log, 0,
-                              "local block cache hit_ratio: %.2f%%",
-                              hit_ratio);
-                ctx->sh->hit_count = 0;
-                ctx->sh->miss_count = 0;
+            count = bcn->count;
+            if (count == 0
+                || count > NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS
+                || (u_char *) bcn->data + count * sizeof(uint64_t)
+                   > shpool->end)
+            {
+                return NGX_AGAIN;
             }
-            ngx_shmtx_unlock(&shpool->mutex);
-            return NGX_OK;
+
+            ngx_memcpy(ds_addrs, bcn->data, count * sizeof(uint64_t));
+            *ds_count = count;
+            *bcnp = bcn;
+            break;
         }
+
         node = (rc < 0) ? node->left : node->right;
+        rc = NGX_DECLINED;
     }
-    ctx->sh->miss_count++;
-    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_memory_barrier();
+
+    if (ctx->sh->seq != seq) {
+        return NGX_AGAIN;
+    }
+
+    *seqp = seq;
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_tfs_local_block_cache_get(ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key, uint64_t *ds_addrs,
+    uint32_t *ds_count, ngx_http_tfs_block_cache_node_t **bcnp,
+    ngx_atomic_uint_t *seqp)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  i, hash;
+
+    hash = ngx_murmur_hash2((u_char*)key, NGX_HTTP_TFS_BLOCK_CACHE_KEY_SIZE);
+
+    for (i = 0; i < NGX_HTTP_TFS_BLOCK_CACHE_READ_RETRY; i++) {
+        rc = ngx_http_tfs_local_block_cache_read(ctx, key, hash, ds_addrs,
+                                                 ds_count, bcnp, seqp);
+        if (rc != NGX_AGAIN) {
+            return rc;
+        }
+    }
+
+    /* writers keep winning, wait for them once */
+
+    ngx_shmtx_lock(&ctx->shpool->mutex);
+
+    rc = ngx_http_tfs_local_block_cache_read(ctx, key, hash, ds_addrs,
+                                             ds_count, bcnp, seqp);
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+
+    return (rc == NGX_OK) ? NGX_OK : NGX_DECLINED;
+}
+
+
+/*
+ * LRU order and hit ratio are best effort: they are updated only if
+ * the mutex is free, so a hit never waits for an insert.
+ */
+
+static void
+ngx_http_tfs_local_block_cache_touch(ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_log_t *log, ngx_http_tfs_block_cache_node_t **bcns,
+    ngx_atomic_uint_t *seqs, ngx_uint_t n)
+{
+    double      hit_ratio;
+    ngx_uint_t  i;
+
+    if (!ngx_shmtx_trylock(&ctx->shpool->mutex)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        /* node is still linked if the tree did not change since the read */
+        if (ctx->sh->seq != seqs[i]) {
+            continue;
+        }
+
+        ngx_queue_remove(&bcns[i]->queue);
+        ngx_queue_insert_head(&ctx->sh->queue, &bcns[i]->queue);
+    }
+
+    if (ctx->sh->hit_count >= NGX_HTTP_TFS_BLOCK_CACHE_STAT_COUNT) {
+        hit_ratio = 100 * (double)((double)ctx->sh->hit_count
+                                   / (double)(ctx->sh->hit_count
+                                              + ctx->sh->miss_count));
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "local block cache hit_ratio: %.2f%%",
+                      hit_ratio);
+        ctx->sh->hit_count = 0;
+        ctx->sh->miss_count = 0;
+    }
+
+    ngx_shmtx_unlock(&ctx->shpool->mutex);
+}
+
+
+ngx_int_t
+ngx_http_tfs_local_block_cache_lookup(ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_pool_t *pool, ngx_log_t *log, ngx_http_tfs_block_cache_key_t* key,
+    ngx_http_tfs_block_cache_value_t *value)
+{
+    uint32_t                          ds_count;
+    uint64_t                          ds_addrs[NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS];
+    ngx_int_t                         rc;
+    ngx_atomic_uint_t                 seq;
+    ngx_http_tfs_block_cache_node_t  *bcn;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "lookup local block cache, ns addr: %uL, block id: %uD",
+                   key->ns_addr, key->block_id);
+
+    rc = ngx_http_tfs_local_block_cache_get(ctx, key, ds_addrs, &ds_count,
+                                            &bcn, &seq);
+
+    if (rc == NGX_OK) {
+        value->ds_count = ds_count;
+        value->ds_addrs = ngx_pcalloc(pool,
+                                      value->ds_count * sizeof(uint64_t));
+        if (value->ds_addrs == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_memcpy(value->ds_addrs, ds_addrs,
+                   value->ds_count * sizeof(uint64_t));
+
+        (void) ngx_atomic_fetch_add(&ctx->sh->hit_count, 1);
+
+        ngx_http_tfs_local_block_cache_touch(ctx, log, &bcn, &seq, 1);
+
+        return NGX_OK;
+    }
+
+    (void) ngx_atomic_fetch_add(&ctx->sh->miss_count, 1);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
                    "lookup local block cache, "
@@ -185,6 +345,21 @@ ngx_http_tfs_local_block_cache_lookup(ngx_http_tfs_local_block_cache_ctx_t *ctx,
 }
 
 
+ngx_int_t
+ngx_http_tfs_local_block_cache_exist(ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key)
+{
+    uint32_t                          ds_count;
+    uint64_t                          ds_addrs[NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS];
+    ngx_atomic_uint_t                 seq;
+    ngx_http_tfs_block_cache_node_t  *bcn;
+
+    return ngx_http_tfs_local_block_cache_get(ctx, key, ds_addrs, &ds_count,
+                                              &bcn, &seq)
+           == NGX_OK;
+}
+
+
 ngx_int_t
 ngx_http_tfs_local_block_cache_insert(ngx_http_tfs_local_block_cache_ctx_t *ctx,
     ngx_log_t *log, ngx_http_tfs_block_cache_key_t *key,
@@ -199,10 +374,18 @@ ngx_http_tfs_local_block_cache_insert(ngx_http_tfs_local_block_cache_ctx_t *ctx,
                    "insert local block cache, ns addr: %uL, block id: %uD",
                    key->ns_addr, key->block_id);
 
+    if (value->ds_count == 0
+        || value->ds_count > NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS)
+    {
+        return NGX_DECLINED;
+    }
+
     shpool = ctx->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
+    ngx_http_tfs_local_block_cache_write_begin(ctx->sh);
+
     n = offsetof(ngx_rbtree_node_t, color)
         + offsetof(ngx_http_tfs_block_cache_node_t, data)
         + value->ds_count * sizeof(uint64_t);
@@ -212,6 +395,7 @@ ngx_http_tfs_local_block_cache_insert(ngx_http_tfs_local_block_cache_ctx_t *ctx,
         ngx_http_tfs_local_block_cache_discard(ctx);
         node = ngx_slab_alloc_locked(shpool, n);
         if (node == NULL) {
+            ngx_http_tfs_local_block_cache_write_end(ctx->sh);
             ngx_shmtx_unlock(&shpool->mutex);
             return NGX_ERROR;
         }
@@ -229,6 +413,8 @@ ngx_http_tfs_local_block_cache_insert(ngx_http_tfs_local_block_cache_ctx_t *ctx,
     ngx_rbtree_insert(&(ctx->sh->rbtree), node);
     ngx_queue_insert_head(&ctx->sh->queue, &bcn->queue);
 
+    ngx_http_tfs_local_block_cache_write_end(ctx->sh);
+
     ngx_shmtx_unlock(&shpool->mutex);
 
     return NGX_OK;
@@ -274,9 +460,11 @@ ngx_http_tfs_local_block_cache_remove(ngx_http_tfs_local_block_cache_ctx_t *ctx,
             bcn = (ngx_http_tfs_block_cache_node_t *) &node->color;
             rc = ngx_http_tfs_block_cache_cmp(key, &bcn->key);
             if (rc == 0) {
+                ngx_http_tfs_local_block_cache_write_begin(ctx->sh);
                 ngx_rbtree_delete(&ctx->sh->rbtree, node);
-                ngx_slab_free_locked(ctx->shpool, node);
                 ngx_queue_remove(&bcn->queue);
+                ngx_slab_free_locked(ctx->shpool, node);
+                ngx_http_tfs_local_block_cache_write_end(ctx->sh);
                 ngx_shmtx_unlock(&shpool->mutex);
                 return;
             }
@@ -339,14 +527,14 @@ ngx_http_tfs_local_block_cache_batch_lookup(
     ngx_http_tfs_local_block_cache_ctx_t *ctx,
     ngx_pool_t *pool, ngx_log_t *log, ngx_array_t *keys, ngx_array_t *kvs)
 {
-    double                           hit_ratio;
-    ngx_int_t                        rc;
-    ngx_uint_t                       i, hash, hit_count;
-    ngx_slab_pool_t                  *shpool;
-    ngx_rbtree_node_t                *node, *sentinel;
+    uint32_t                          ds_count;
+    uint64_t                          ds_addrs[NGX_HTTP_TFS_BLOCK_CACHE_MAX_DS];
+    ngx_int_t                         rc;
+    ngx_uint_t                        i, n;
+    ngx_atomic_uint_t                 seq, seqs[NGX_HTTP_TFS_MAX_BATCH_COUNT];
     ngx_http_tfs_block_cache_kv_t    *kv;
     ngx_http_tfs_block_cache_key_t   *key;
-    ngx_http_tfs_block_cache_node_t  *bcn;
+    ngx_http_tfs_block_cache_node_t  *bcn, *bcns[NGX_HTTP_TFS_MAX_BATCH_COUNT];
     ngx_http_tfs_block_cache_value_t *value;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
@@ -354,90 +542,58 @@ ngx_http_tfs_local_block_cache_batch_lookup(
                    keys->nelts);
 
     key = keys->elts;
-    shpool = ctx->shpool;
-    rc = NGX_ERROR;
-    ngx_shmtx_lock(&shpool->mutex);
-
-    sentinel = ctx->sh->rbtree.sentinel;
-    hit_count = 0;
+    n = 0;
 
     for (i = 0; i < keys->nelts; i++, key++) {
-        node = ctx->sh->rbtree.root;
-        hash = ngx_murmur_hash2((u_char*)key,
-                                NGX_HTTP_TFS_BLOCK_CACHE_KEY_SIZE);
-
-        while (node != sentinel) {
-
-            if (hash < node->key) {
-                node = node->left;
-                continue;
-            }
+        rc = ngx_http_tfs_local_block_cache_get(ctx, key, ds_addrs, &ds_count,
+                                                &bcn, &seq);
+        if (rc != NGX_OK) {
+            (void) ngx_atomic_fetch_add(&ctx->sh->miss_count, 1);
+            continue;
+        }
 
-            if (hash > node->key) {
-                node = node->right;
-                continue;
-            }
+        value = ngx_pcalloc(pool, sizeof(ngx_http_tfs_block_cache_value_t));
+        if (value == NULL) {
+            return NGX_ERROR;
+        }
 
-            /* hash == node->key */
-            bcn = (ngx_http_tfs_block_cache_node_t *) &node->color;
-            rc = ngx_http_tfs_block_cache_cmp(key, &bcn->key);
-            if (rc == 0) {
-                value = ngx_pcalloc(pool,
-                                    sizeof(ngx_http_tfs_block_cache_value_t));
-                if (value == NULL) {
-                    ngx_shmtx_unlock(&shpool->mutex);
-                    return NGX_ERROR;
-                }
-
-                value->ds_count = bcn->count;
-                value->ds_addrs = ngx_pcalloc(pool,
-                                            value->ds_count * sizeof(uint64_t));
-                if (value->ds_addrs == NULL) {
-                    ngx_shmtx_unlock(&shpool->mutex);
-                    return NGX_ERROR;
-                }
-                ngx_memcpy(value->ds_addrs, bcn->data,
-                           value->ds_count * sizeof(uint64_t));
-
-                kv = (ngx_http_tfs_block_cache_kv_t *)ngx_array_push(kvs);
-                kv->key = key;
-                kv->value = value;
+        value->ds_count = ds_count;
+        value->ds_addrs = ngx_pcalloc(pool,
+                                      value->ds_count * sizeof(uint64_t));
+        if (value->ds_addrs == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_memcpy(value->ds_addrs, ds_addrs,
+                   value->ds_count * sizeof(uint64_t));
 
-                ngx_queue_remove(&bcn->queue);
-                ngx_queue_insert_head(&ctx->sh->queue, &bcn->queue);
-                hit_count++;
-                break;
-            }
-            node = (rc < 0) ? node->left : node->right;
+        kv = (ngx_http_tfs_block_cache_kv_t *)ngx_array_push(kvs);
+        if (kv == NULL) {
+            return NGX_ERROR;
         }
+        kv->key = key;
+        kv->value = value;
 
-        if (node == sentinel) {
-            ctx->sh->miss_count++;
+        if (n < NGX_HTTP_TFS_MAX_BATCH_COUNT) {
+            bcns[n] = bcn;
+            seqs[n] = seq;
+            n++;
         }
     }
 
-    ctx->sh->hit_count += hit_count;
-    if (ctx->sh->hit_count >= NGX_HTTP_TFS_BLOCK_CACHE_STAT_COUNT) {
-        hit_ratio = 100 * (double)((double)ctx->sh->hit_count
-                                   / (double)(ctx->sh->hit_count
-                                              + ctx->sh->miss_count));
-        ngx_log_error(NGX_LOG_INFO, log, 0,
-                      "local block cache hit_ratio: %.2f%%",
-                      hit_ratio);
-        ctx->sh->hit_count = 0;
-        ctx->sh->miss_count = 0;
-    }
+    if (kvs->nelts > 0) {
+        (void) ngx_atomic_fetch_add(&ctx->sh->hit_count, kvs->nelts);
 
-    ngx_shmtx_unlock(&shpool->mutex);
+        ngx_http_tfs_local_block_cache_touch(ctx, log, bcns, seqs, n);
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                    "batch lookup local block cache, hit_count: %ui",
                    kvs->nelts);
 
     /* not all hit */
-    if (hit_count < keys->nelts) {
-        rc = NGX_DECLINED;
+    if (kvs->nelts < keys->nelts) {
+        return NGX_DECLINED;
     }
 
-    return rc;
+    return NGX_OK;
 }
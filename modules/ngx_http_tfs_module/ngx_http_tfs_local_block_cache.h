@@ -32,6 +32,10 @@ ngx_int_t ngx_http_tfs_local_block_cache_lookup(
     ngx_http_tfs_block_cache_key_t *key,
     ngx_http_tfs_block_cache_value_t *value);
 
+ngx_int_t ngx_http_tfs_local_block_cache_exist(
+    ngx_http_tfs_local_block_cache_ctx_t *ctx,
+    ngx_http_tfs_block_cache_key_t *key);
+
 ngx_int_t ngx_http_tfs_local_block_cache_insert(
     ngx_http_tfs_local_block_cache_ctx_t *ctx,
     ngx_log_t *log, ngx_http_tfs_block_cache_key_t *key,
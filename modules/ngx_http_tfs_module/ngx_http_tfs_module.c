@@ -11,6 +11,7 @@
 #include <ngx_http_tfs.h>
 #include <ngx_http_tfs_timers.h>
 #include <ngx_http_tfs_local_block_cache.h>
+#include <ngx_http_tfs_hedge.h>
 
 
 #define NGX_HTTP_TFS_BLOCK_CACHE_ZONE_NAME "tfs_module_block_cache_zone"
@@ -57,6 +58,8 @@ static char *ngx_http_tfs_rcs_heartbeat(ngx_conf_t *cf,
 static char *ngx_http_tfs_rcs_zone(ngx_conf_t *cf, ngx_http_tfs_upstream_t *tu);
 static char *ngx_http_tfs_block_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_tfs_hedge_read(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static char *ngx_http_tfs_upstream_parse(ngx_conf_t *cf, ngx_command_t *dummy,
     void *conf);
@@ -166,6 +169,13 @@ static ngx_command_t  ngx_http_tfs_commands[] = {
       offsetof(ngx_http_tfs_main_conf_t, enable_remote_block_cache),
       NULL },
 
+    { ngx_string("tfs_hedge_read"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_tfs_hedge_read,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -728,6 +738,10 @@ ngx_http_tfs_create_main_conf(ngx_conf_t *cf)
 
     conf->enable_remote_block_cache = NGX_CONF_UNSET;
 
+    conf->hedge_read = NGX_CONF_UNSET;
+    conf->hedge_min_delay = NGX_CONF_UNSET_MSEC;
+    conf->hedge_percent = NGX_CONF_UNSET_UINT;
+
     if (ngx_array_init(&conf->upstreams, cf->pool, 4,
                        sizeof(ngx_http_tfs_upstream_t *))
         != NGX_OK)
@@ -772,6 +786,18 @@ ngx_http_tfs_init_main_conf(ngx_conf_t *cf, void *conf)
         tmcf->body_buffer_size = NGX_HTTP_TFS_DEFAULT_BODY_BUFFER_SIZE;
     }
 
+    if (tmcf->hedge_read == NGX_CONF_UNSET) {
+        tmcf->hedge_read = 0;
+    }
+
+    if (tmcf->hedge_min_delay == NGX_CONF_UNSET_MSEC) {
+        tmcf->hedge_min_delay = NGX_HTTP_TFS_HEDGE_MIN_DELAY;
+    }
+
+    if (tmcf->hedge_percent == NGX_CONF_UNSET_UINT) {
+        tmcf->hedge_percent = NGX_HTTP_TFS_HEDGE_PERCENT;
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -1004,12 +1030,14 @@ ngx_http_tfs_block_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                                 size;
     ngx_str_t                             *value, s, name;
     ngx_uint_t                             i;
+    ngx_flag_t                             prefetch;
     ngx_shm_zone_t                        *shm_zone;
     ngx_http_tfs_main_conf_t              *tmcf = conf;
     ngx_http_tfs_local_block_cache_ctx_t  *ctx;
 
     value = cf->args->elts;
     size = 0;
+    prefetch = 0;
 
     for (i = 1; i < cf->args->nelts; i++) {
 
@@ -1023,6 +1051,16 @@ ngx_http_tfs_block_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             }
         }
 
+        if (ngx_strcmp(value[i].data, "prefetch=on") == 0) {
+            prefetch = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "prefetch=off") == 0) {
+            prefetch = 0;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -1041,6 +1079,8 @@ ngx_http_tfs_block_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ctx->prefetch = prefetch;
+
     name.data = (u_char *) NGX_HTTP_TFS_BLOCK_CACHE_ZONE_NAME;
     name.len = sizeof(NGX_HTTP_TFS_BLOCK_CACHE_ZONE_NAME) - 1;
 
@@ -1059,6 +1099,73 @@ ngx_http_tfs_block_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_http_tfs_hedge_read(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_str_t                 *value, s;
+    ngx_int_t                  n;
+    ngx_msec_t                 delay;
+    ngx_uint_t                 i;
+    ngx_http_tfs_main_conf_t  *tmcf = conf;
+
+    if (tmcf->hedge_read != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        tmcf->hedge_read = 1;
+
+    } else if (ngx_strcmp(value[1].data, "off") == 0) {
+        tmcf->hedge_read = 0;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be \"on\" or \"off\"",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "min=", 4) == 0) {
+            s.len = value[i].len - 4;
+            s.data = value[i].data + 4;
+
+            delay = ngx_parse_time(&s, 0);
+            if (delay == (ngx_msec_t) NGX_ERROR) {
+                goto invalid;
+            }
+
+            tmcf->hedge_min_delay = delay;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "percent=", 8) == 0) {
+            n = ngx_atoi(value[i].data + 8, value[i].len - 8);
+            if (n <= 0 || n > 100) {
+                goto invalid;
+            }
+
+            tmcf->hedge_percent = n;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+}
+
+
 static void
 ngx_http_tfs_read_body_handler(ngx_http_request_t *r)
 {
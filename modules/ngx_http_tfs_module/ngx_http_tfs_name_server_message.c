@@ -6,12 +6,17 @@
 
 #include <ngx_http_tfs_errno.h>
 #include <ngx_http_tfs_name_server_message.h>
+#include <ngx_http_tfs_local_block_cache.h>
 
 
 static ngx_chain_t *ngx_http_tfs_create_block_info_message(ngx_http_tfs_t *t,
     ngx_http_tfs_segment_data_t *segment_data);
 static ngx_chain_t *ngx_http_tfs_create_batch_block_info_message(
     ngx_http_tfs_t *t);
+static ngx_uint_t ngx_http_tfs_get_prefetch_block_ids(ngx_http_tfs_t *t,
+    uint32_t block_count, uint32_t *block_ids);
+static ngx_int_t ngx_http_tfs_is_prefetch_block(ngx_http_tfs_t *t,
+    uint32_t block_count, uint32_t block_id);
 static ngx_chain_t *ngx_http_tfs_create_ctl_message(ngx_http_tfs_t *t,
     uint8_t cmd);
 
@@ -503,7 +508,8 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
 {
     size_t                                       size;
     uint32_t                                     block_count, real_block_count;
-    ngx_uint_t                                   i, j;
+    uint32_t                   prefetch_ids[NGX_HTTP_TFS_MAX_BATCH_COUNT];
+    ngx_uint_t                                   i, j, prefetch_count;
     ngx_buf_t                                   *b;
     ngx_chain_t                                 *cl;
     ngx_http_tfs_segment_data_t                 *segment_data;
@@ -515,6 +521,7 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
     }
 
     real_block_count = block_count;
+    prefetch_count = 0;
     if (t->file.open_mode & NGX_HTTP_TFS_OPEN_MODE_READ) {
         segment_data = &t->file.segment_data[t->file.segment_index];
         for (i = 0; i < block_count; i++, segment_data++) {
@@ -522,10 +529,13 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
                 real_block_count--;
             }
         }
+
+        prefetch_count = ngx_http_tfs_get_prefetch_block_ids(t, block_count,
+                                                             prefetch_ids);
     }
 
     size = sizeof(ngx_http_tfs_ns_batch_block_info_request_t)
-            + real_block_count * sizeof(uint32_t);
+            + (real_block_count + prefetch_count) * sizeof(uint32_t);
 
     b = ngx_create_temp_buf(t->pool, size);
     if (b == NULL) {
@@ -540,7 +550,7 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
     req->header.version = NGX_HTTP_TFS_PACKET_VERSION;
     req->header.id = ngx_http_tfs_generate_packet_id();
     req->mode = t->file.open_mode;
-    req->block_count = real_block_count;
+    req->block_count = real_block_count + prefetch_count;
     segment_data = &t->file.segment_data[t->file.segment_index];
     for (i = 0, j = 0; i < block_count; i++, segment_data++) {
         if (t->file.open_mode & NGX_HTTP_TFS_OPEN_MODE_READ) {
@@ -552,6 +562,17 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
             req->block_ids[i] = 0;
         }
     }
+
+    /* block infos of the next batch ride along, they only fill block cache */
+    for (i = 0; i < prefetch_count; i++) {
+        req->block_ids[j++] = prefetch_ids[i];
+    }
+
+    if (prefetch_count > 0) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, t->log, 0,
+                       "prefetch block info of next batch, block count: %ui",
+                       prefetch_count);
+    }
     req->header.crc = ngx_http_tfs_crc(NGX_HTTP_TFS_PACKET_FLAG,
                                        (const char *) (&req->header + 1),
                                        req->header.len);
@@ -570,6 +591,97 @@ ngx_http_tfs_create_batch_block_info_message(ngx_http_tfs_t *t)
 }
 
 
+static ngx_uint_t
+ngx_http_tfs_get_prefetch_block_ids(ngx_http_tfs_t *t, uint32_t block_count,
+    uint32_t *block_ids)
+{
+    uint32_t                               block_id, end;
+    ngx_uint_t                             i, j, n;
+    ngx_http_tfs_segment_data_t           *segment_data;
+    ngx_http_tfs_block_cache_key_t         key;
+    ngx_http_tfs_local_block_cache_ctx_t  *ctx;
+
+    ctx = t->block_cache_ctx.local_ctx;
+
+    if (t->r_ctx.action.code != NGX_HTTP_TFS_ACTION_READ_FILE
+        || !(t->block_cache_ctx.use_cache & NGX_HTTP_TFS_LOCAL_BLOCK_CACHE)
+        || ctx == NULL
+        || !ctx->prefetch)
+    {
+        return 0;
+    }
+
+    segment_data = &t->file.segment_data[t->file.segment_index];
+
+    end = t->file.segment_count - t->file.segment_index;
+    if (end > block_count + NGX_HTTP_TFS_MAX_BATCH_COUNT) {
+        end = block_count + NGX_HTTP_TFS_MAX_BATCH_COUNT;
+    }
+
+    key.ns_addr = *((uint64_t *) (&t->name_server_addr));
+    n = 0;
+
+    for (i = block_count; i < end; i++) {
+        block_id = segment_data[i].segment_info.block_id;
+
+        /* same block may hold several segments */
+        for (j = 0; j < block_count; j++) {
+            if (segment_data[j].segment_info.block_id == block_id) {
+                break;
+            }
+        }
+
+        if (j < block_count) {
+            continue;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (block_ids[j] == block_id) {
+                break;
+            }
+        }
+
+        if (j < n) {
+            continue;
+        }
+
+        key.block_id = block_id;
+        if (ngx_http_tfs_local_block_cache_exist(ctx, &key)) {
+            continue;
+        }
+
+        block_ids[n++] = block_id;
+    }
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_http_tfs_is_prefetch_block(ngx_http_tfs_t *t, uint32_t block_count,
+    uint32_t block_id)
+{
+    uint32_t                      end;
+    ngx_uint_t                    i;
+    ngx_http_tfs_segment_data_t  *segment_data;
+
+    segment_data = &t->file.segment_data[t->file.segment_index];
+
+    end = t->file.segment_count - t->file.segment_index;
+    if (end > block_count + NGX_HTTP_TFS_MAX_BATCH_COUNT) {
+        end = block_count + NGX_HTTP_TFS_MAX_BATCH_COUNT;
+    }
+
+    for (i = block_count; i < end; i++) {
+        if (segment_data[i].segment_info.block_id == block_id) {
+            return NGX_HTTP_TFS_YES;
+        }
+    }
+
+    return NGX_HTTP_TFS_NO;
+}
+
+
 static ngx_chain_t *
 ngx_http_tfs_create_ctl_message(ngx_http_tfs_t *t, uint8_t cmd)
 {
@@ -718,9 +830,10 @@ ngx_http_tfs_parse_batch_block_info_message(ngx_http_tfs_t *t,
     uint32_t                                      block_count, complete_count,
                                                   ds_count, block_id;
     ngx_str_t                                     err_msg;
-    ngx_uint_t                                    i, j, k;
+    ngx_uint_t                                    i, j, k, prefetch,
+                                                  prefetch_count;
     ngx_http_tfs_header_t                        *header;
-    ngx_http_tfs_block_info_t                    *block_info;
+    ngx_http_tfs_block_info_t                    *block_info, prefetch_info;
     ngx_http_tfs_peer_connection_t               *tp;
     ngx_http_tfs_block_cache_key_t                key;
     ngx_http_tfs_block_cache_value_t              value;
@@ -745,10 +858,11 @@ ngx_http_tfs_parse_batch_block_info_message(ngx_http_tfs_t *t,
     if (block_count > NGX_HTTP_TFS_MAX_BATCH_COUNT) {
         block_count = NGX_HTTP_TFS_MAX_BATCH_COUNT;
     }
-    t->file.curr_batch_count = resp->block_count;
+    prefetch_count = 0;
 
     for (i = 0; i < resp->block_count; i++) {
         j = i;
+        prefetch = 0;
         /* block id */
         block_id = *(uint32_t *) p;
         p += sizeof(uint32_t);
@@ -760,12 +874,25 @@ ngx_http_tfs_parse_batch_block_info_message(ngx_http_tfs_t *t,
                 }
             }
             if (j == block_count) {
-                return NGX_HTTP_TFS_AGAIN;
+                if (!ngx_http_tfs_is_prefetch_block(t, block_count,
+                                                    block_id))
+                {
+                    return NGX_HTTP_TFS_AGAIN;
+                }
+
+                prefetch = 1;
+                prefetch_count++;
             }
         }
-        segment_data[j].segment_info.block_id = block_id;
 
-        block_info = &segment_data[j].block_info;
+        if (prefetch) {
+            ngx_memzero(&prefetch_info, sizeof(ngx_http_tfs_block_info_t));
+            block_info = &prefetch_info;
+
+        } else {
+            segment_data[j].segment_info.block_id = block_id;
+            block_info = &segment_data[j].block_info;
+        }
 
         /* ds count */
         ds_count = *(uint32_t *) p;
@@ -830,9 +957,13 @@ ngx_http_tfs_parse_batch_block_info_message(ngx_http_tfs_t *t,
         }
 
         /* reset segment status */
-        segment_data[j].ds_retry = 0;
+        if (!prefetch) {
+            segment_data[j].ds_retry = 0;
+        }
     }
 
+    t->file.curr_batch_count = resp->block_count - prefetch_count;
+
     /* check if all semgents complete */
     if (t->file.open_mode & NGX_HTTP_TFS_OPEN_MODE_READ) {
         complete_count = 0;
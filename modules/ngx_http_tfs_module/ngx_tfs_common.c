@@ -779,6 +779,7 @@ ngx_http_tfs_alloc_st(ngx_http_tfs_t *t)
     }
     ngx_memcpy(st, t, sizeof(ngx_http_tfs_t));
     st->parent = t;
+    st->hedge = NULL;
 
     /* each st should have independent send/recv buf/peer/out_bufs,
      * and we only care about data server and name server(retry need)
@@ -128,6 +128,7 @@ typedef struct ngx_http_tfs_inet_s ngx_http_tfs_inet_t;
 typedef struct ngx_http_tfs_meta_hh_s  ngx_http_tfs_meta_hh_t;
 
 typedef struct ngx_http_tfs_segment_data_s ngx_http_tfs_segment_data_t;
+typedef struct ngx_http_tfs_hedge_s ngx_http_tfs_hedge_t;
 
 typedef struct ngx_http_tfs_timers_lock_s ngx_http_tfs_timers_lock_t;
 typedef struct ngx_http_tfs_timers_data_s ngx_http_tfs_timers_data_t;
@@ -81,6 +81,10 @@ typedef struct {
 } ngx_http_upstream_check_ctx_t;
 
 
+/* latency histogram buckets: [0], [1], [2, 4), [4, 8) ... milliseconds */
+#define NGX_HTTP_CHECK_OUTLIER_BUCKETS       20
+
+
 typedef struct {
     ngx_shmtx_t                              mutex;
     ngx_shmtx_sh_t                           lock;
@@ -105,6 +109,18 @@ typedef struct {
 
     ngx_atomic_t                             down;
 
+    /* passive outlier detection, updated by the workers' live traffic */
+    ngx_atomic_t                             outlier_requests;
+    ngx_atomic_t                             outlier_fails;
+    ngx_atomic_t                             outlier_consecutive;
+    ngx_atomic_t                             outlier_latency[
+                                             NGX_HTTP_CHECK_OUTLIER_BUCKETS];
+
+    ngx_atomic_t                             outlier_checked;
+    ngx_atomic_t                             ejected;
+    ngx_uint_t                               ejections;
+    ngx_msec_t                               ejected_until;
+
     u_char                                   padding[64];
 } ngx_http_upstream_check_peer_shm_t;
 
@@ -241,6 +257,29 @@ typedef struct {
 } ngx_http_upstream_check_main_conf_t;
 
 
+typedef struct {
+    ngx_msec_t                               interval;
+    ngx_uint_t                               consecutive;
+    ngx_uint_t                               error_rate;
+    ngx_uint_t                               latency_factor;
+    ngx_uint_t                               percentile;
+    ngx_uint_t                               min_requests;
+    ngx_uint_t                               max_percent;
+    ngx_msec_t                               ejection_time;
+    ngx_msec_t                               max_ejection_time;
+
+    ngx_event_t                              event;
+} ngx_http_upstream_check_outlier_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_check_peer_t          *peer;
+    ngx_uint_t                               requests;
+    ngx_uint_t                               fails;
+    ngx_msec_t                               latency;
+} ngx_http_upstream_check_outlier_stat_t;
+
+
 struct ngx_http_upstream_check_srv_conf_s {
     ngx_uint_t                               port;
     ngx_uint_t                               fall_count;
@@ -261,6 +300,8 @@ struct ngx_http_upstream_check_srv_conf_s {
 
     ngx_uint_t                               default_down;
     ngx_uint_t                               unique;
+
+    ngx_http_upstream_check_outlier_conf_t  *outlier;
 };
 
 
@@ -443,6 +484,22 @@ static void ngx_http_upstream_check_clean_event(
 static void ngx_http_upstream_check_timeout_handler(ngx_event_t *event);
 static void ngx_http_upstream_check_finish_handler(ngx_event_t *event);
 
+static ngx_http_upstream_check_peer_t *ngx_http_upstream_check_find_peer(
+    ngx_uint_t index);
+static ngx_uint_t ngx_http_upstream_check_outlier_ejected(
+    ngx_http_upstream_check_peer_shm_t *peer_shm);
+static void ngx_http_upstream_check_outlier_eject(
+    ngx_http_upstream_check_peer_t *peer, char *reason);
+static void ngx_http_upstream_check_outlier_set(
+    ngx_http_upstream_check_peer_t *peer, char *reason);
+static ngx_msec_t ngx_http_upstream_check_outlier_percentile(
+    ngx_uint_t *latency, ngx_uint_t percentile);
+static void ngx_http_upstream_check_add_outlier_timer(
+    ngx_http_upstream_check_srv_conf_t *ucscf, ngx_log_t *log);
+static ngx_int_t ngx_http_upstream_check_outlier_cmp(const void *one,
+    const void *two);
+static void ngx_http_upstream_check_outlier_handler(ngx_event_t *event);
+
 static ngx_int_t ngx_http_upstream_check_need_exit();
 static void ngx_http_upstream_check_clear_all_events();
 static void ngx_http_upstream_check_clear_peer(
@@ -475,6 +532,8 @@ static ngx_check_conf_t *ngx_http_get_check_type_conf(ngx_str_t *str);
 
 static char *ngx_http_upstream_check(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_check_outlier(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static char *ngx_http_upstream_check_keepalive_requests(ngx_conf_t *cf,
     ngx_command_t *cmd, void *conf);
 static char *ngx_http_upstream_check_http_send(ngx_conf_t *cf,
@@ -552,6 +611,13 @@ static ngx_command_t  ngx_http_upstream_check_commands[] = {
       0,
       NULL },
 
+    { ngx_string("check_outlier"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check_outlier,
+      0,
+      0,
+      NULL },
+
     { ngx_string("check_keepalive_requests"),
       NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
       ngx_http_upstream_check_keepalive_requests,
@@ -947,6 +1013,8 @@ ngx_http_upstream_check_add_dynamic_peer(ngx_pool_t *pool,
     ngx_http_upstream_check_add_timer(peer, ucscf->check_type_conf,
                                       0, pool->log);
 
+    ngx_http_upstream_check_add_outlier_timer(ucscf, ngx_cycle->log);
+
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pool->log, 0,
                    "http upstream check add peer: %p, index: %ui, shm->ref: %i",
                    peer, peer->index, peer->shm->ref);
@@ -1097,6 +1165,7 @@ ngx_http_upstream_check_delete_dynamic_peer(ngx_str_t *name,
     ngx_uint_t                            i;
     ngx_http_upstream_check_peer_t       *peer, *chosen;
     ngx_http_upstream_check_peers_t      *peers;
+    ngx_http_upstream_check_srv_conf_t   *ucscf;
 
     chosen = NULL;
     peers = check_peers_ctx;
@@ -1157,7 +1226,23 @@ ngx_http_upstream_check_delete_dynamic_peer(ngx_str_t *name,
     }
     ngx_shmtx_unlock(&chosen->shm->mutex);
 
+    ucscf = chosen->conf;
+
     ngx_http_upstream_check_clear_peer(chosen);
+
+    if (ucscf->outlier == NULL || !ucscf->outlier->event.timer_set) {
+        return;
+    }
+
+    /* the upstream configuration goes away with its last peer */
+
+    for (i = 0; i < peers->peers.nelts; i++) {
+        if (!peer[i].delete && peer[i].conf == ucscf) {
+            return;
+        }
+    }
+
+    ngx_del_timer(&ucscf->outlier->event);
 }
 
 
@@ -1326,7 +1411,8 @@ ngx_http_upstream_check_peer_down(ngx_uint_t index)
 
     peer_shm = check_peers_ctx->peers_shm->peers;
 
-    return (peer_shm[index].down);
+    return (peer_shm[index].down
+            || ngx_http_upstream_check_outlier_ejected(&peer_shm[index]));
 }
 
 
@@ -1397,6 +1483,437 @@ ngx_http_upstream_check_free_peer(ngx_uint_t index)
 }
 
 
+void
+ngx_http_upstream_check_report_peer(ngx_uint_t index, ngx_uint_t failed,
+    ngx_msec_t time)
+{
+    ngx_uint_t                               b, n;
+    ngx_http_upstream_check_peer_t          *peer;
+    ngx_http_upstream_check_peer_shm_t      *peer_shm;
+    ngx_http_upstream_check_outlier_conf_t  *ocf;
+
+    if (upstream_check_index_invalid(check_peers_ctx, index)) {
+        return;
+    }
+
+    peer = ngx_http_upstream_check_find_peer(index);
+    if (peer == NULL || peer->shm == NULL || peer->conf->outlier == NULL) {
+        return;
+    }
+
+    ocf = peer->conf->outlier;
+    peer_shm = peer->shm;
+
+    for (b = 0, n = time; n && b < NGX_HTTP_CHECK_OUTLIER_BUCKETS - 1; b++) {
+        n >>= 1;
+    }
+
+    (void) ngx_atomic_fetch_add(&peer_shm->outlier_requests, 1);
+    (void) ngx_atomic_fetch_add(&peer_shm->outlier_latency[b], 1);
+
+    if (!failed) {
+        if (peer_shm->outlier_consecutive) {
+            peer_shm->outlier_consecutive = 0;
+        }
+
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&peer_shm->outlier_fails, 1);
+
+    n = ngx_atomic_fetch_add(&peer_shm->outlier_consecutive, 1) + 1;
+
+    /*
+     * every failure past the threshold tries again, as max_ejection_percent
+     * may have refused to eject the peer the first time
+     */
+
+    if (ocf->consecutive && n >= ocf->consecutive
+        && !ngx_http_upstream_check_outlier_ejected(peer_shm))
+    {
+        ngx_http_upstream_check_outlier_eject(peer, "consecutive failures");
+    }
+}
+
+
+static ngx_http_upstream_check_peer_t *
+ngx_http_upstream_check_find_peer(ngx_uint_t index)
+{
+    ngx_uint_t                       i;
+    ngx_http_upstream_check_peer_t  *peer;
+
+    peer = check_peers_ctx->peers.elts;
+
+    /* dynamic peers may be placed in a slot other than their shm index */
+
+    if (index < check_peers_ctx->peers.nelts
+        && !peer[index].delete && peer[index].index == index)
+    {
+        return &peer[index];
+    }
+
+    for (i = 0; i < check_peers_ctx->peers.nelts; i++) {
+        if (!peer[i].delete && peer[i].index == index) {
+            return &peer[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_check_outlier_ejected(
+    ngx_http_upstream_check_peer_shm_t *peer_shm)
+{
+    return peer_shm->ejected
+           && (ngx_msec_int_t) (peer_shm->ejected_until - ngx_current_msec) > 0;
+}
+
+
+static void
+ngx_http_upstream_check_outlier_eject(ngx_http_upstream_check_peer_t *peer,
+    char *reason)
+{
+    ngx_uint_t                               i, n, ejected;
+    ngx_http_upstream_check_peer_t          *p;
+    ngx_http_upstream_check_outlier_conf_t  *ocf;
+
+    ocf = peer->conf->outlier;
+
+    n = 0;
+    ejected = 0;
+
+    p = check_peers_ctx->peers.elts;
+
+    for (i = 0; i < check_peers_ctx->peers.nelts; i++) {
+        if (p[i].delete || p[i].conf != peer->conf || p[i].shm == NULL) {
+            continue;
+        }
+
+        n++;
+
+        if (ngx_http_upstream_check_outlier_ejected(p[i].shm)) {
+            ejected++;
+        }
+    }
+
+    if (ejected >= ngx_max(n * ocf->max_percent / 100, 1)) {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "outlier peer: %V is not ejected (%s), "
+                      "%ui of %ui peers are ejected already",
+                      &peer->peer_addr->name, reason, ejected, n);
+        return;
+    }
+
+    ngx_http_upstream_check_outlier_set(peer, reason);
+}
+
+
+static void
+ngx_http_upstream_check_outlier_set(ngx_http_upstream_check_peer_t *peer,
+    char *reason)
+{
+    ngx_msec_t                               time;
+    ngx_http_upstream_check_outlier_conf_t  *ocf;
+
+    ocf = peer->conf->outlier;
+
+    ngx_shmtx_lock(&peer->shm->mutex);
+
+    if (peer->shm->delete == PEER_DELETED
+        || ngx_http_upstream_check_outlier_ejected(peer->shm))
+    {
+        ngx_shmtx_unlock(&peer->shm->mutex);
+        return;
+    }
+
+    /* exponential back-off: each ejection in a row doubles the time */
+
+    time = ocf->ejection_time << ngx_min(peer->shm->ejections, 16);
+    time = ngx_min(time, ocf->max_ejection_time);
+
+    peer->shm->ejections++;
+    peer->shm->ejected_until = ngx_current_msec + time;
+    peer->shm->ejected = 1;
+
+    ngx_shmtx_unlock(&peer->shm->mutex);
+
+    ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                  "eject outlier peer: %V (%s) for %M ms",
+                  &peer->peer_addr->name, reason, time);
+}
+
+
+static ngx_msec_t
+ngx_http_upstream_check_outlier_percentile(ngx_uint_t *latency,
+    ngx_uint_t percentile)
+{
+    ngx_uint_t  b, total, target, sum, low;
+
+    total = 0;
+
+    for (b = 0; b < NGX_HTTP_CHECK_OUTLIER_BUCKETS; b++) {
+        total += latency[b];
+    }
+
+    target = (total * percentile + 99) / 100;
+    if (target == 0) {
+        return 0;
+    }
+
+    sum = 0;
+
+    for (b = 0; b < NGX_HTTP_CHECK_OUTLIER_BUCKETS; b++) {
+
+        if (sum + latency[b] < target) {
+            sum += latency[b];
+            continue;
+        }
+
+        if (b == 0) {
+            return 0;
+        }
+
+        /* interpolate inside the bucket [2^(b-1), 2^b) */
+
+        low = (ngx_uint_t) 1 << (b - 1);
+
+        return low + low * (target - sum) / latency[b];
+    }
+
+    return (ngx_msec_t) 1 << (NGX_HTTP_CHECK_OUTLIER_BUCKETS - 1);
+}
+
+
+static void
+ngx_http_upstream_check_add_outlier_timer(
+    ngx_http_upstream_check_srv_conf_t *ucscf, ngx_log_t *log)
+{
+    ngx_event_t  *ev;
+
+    if (ucscf->outlier == NULL) {
+        return;
+    }
+
+    ev = &ucscf->outlier->event;
+
+    if (ev->timer_set) {
+        return;
+    }
+
+    ev->handler = ngx_http_upstream_check_outlier_handler;
+    ev->data = ucscf;
+    ev->log = log;
+    ev->cancelable = 1;
+
+    ngx_add_timer(ev, ucscf->outlier->interval);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_outlier_cmp(const void *one, const void *two)
+{
+    ngx_msec_t  a = *(ngx_msec_t *) one;
+    ngx_msec_t  b = *(ngx_msec_t *) two;
+
+    return (a > b) - (a < b);
+}
+
+
+static void
+ngx_http_upstream_check_outlier_handler(ngx_event_t *event)
+{
+    char                                    *reason;
+    ngx_msec_t                               last, median, *lat;
+    ngx_uint_t                               i, j, n, m, v, cap, ejected;
+    ngx_uint_t                               requests, fails, orate, prate;
+    ngx_uint_t                               latency[
+                                             NGX_HTTP_CHECK_OUTLIER_BUCKETS];
+    ngx_http_upstream_check_peer_t          *peer, *leader;
+    ngx_http_upstream_check_peer_shm_t      *psh;
+    ngx_http_upstream_check_srv_conf_t      *ucscf;
+    ngx_http_upstream_check_outlier_conf_t  *ocf;
+    ngx_http_upstream_check_outlier_stat_t  *stat;
+
+    if (ngx_http_upstream_check_need_exit()) {
+        return;
+    }
+
+    ucscf = event->data;
+    ocf = ucscf->outlier;
+
+    ngx_add_timer(event, ocf->interval);
+
+    if (check_peers_ctx == NULL || check_peers_ctx->peers_shm == NULL) {
+        return;
+    }
+
+    peer = check_peers_ctx->peers.elts;
+
+    n = 0;
+    leader = NULL;
+
+    for (i = 0; i < check_peers_ctx->peers.nelts; i++) {
+        if (peer[i].delete || peer[i].conf != ucscf || peer[i].shm == NULL) {
+            continue;
+        }
+
+        if (leader == NULL) {
+            leader = &peer[i];
+        }
+
+        n++;
+    }
+
+    if (leader == NULL) {
+        return;
+    }
+
+    /* only one worker evaluates the group per interval */
+
+    last = leader->shm->outlier_checked;
+
+    if ((ngx_msec_int_t) (ngx_current_msec - last) < (ngx_msec_int_t) ocf->interval
+        || !ngx_atomic_cmp_set(&leader->shm->outlier_checked, last,
+                               ngx_current_msec))
+    {
+        return;
+    }
+
+    stat = ngx_alloc(n * (sizeof(ngx_http_upstream_check_outlier_stat_t)
+                          + sizeof(ngx_msec_t)), event->log);
+    if (stat == NULL) {
+        return;
+    }
+
+    lat = (ngx_msec_t *) &stat[n];
+
+    m = 0;
+    ejected = 0;
+    requests = 0;
+    fails = 0;
+
+    for (i = 0, j = 0; i < check_peers_ctx->peers.nelts && j < n; i++) {
+        if (peer[i].delete || peer[i].conf != ucscf || peer[i].shm == NULL) {
+            continue;
+        }
+
+        psh = peer[i].shm;
+
+        stat[j].peer = &peer[i];
+
+        /* take the window and leave concurrent updates for the next one */
+
+        v = psh->outlier_requests;
+        (void) ngx_atomic_fetch_add(&psh->outlier_requests,
+                                    - (ngx_atomic_int_t) v);
+        stat[j].requests = v;
+
+        v = psh->outlier_fails;
+        (void) ngx_atomic_fetch_add(&psh->outlier_fails,
+                                    - (ngx_atomic_int_t) v);
+        stat[j].fails = v;
+
+        for (v = 0; v < NGX_HTTP_CHECK_OUTLIER_BUCKETS; v++) {
+            latency[v] = psh->outlier_latency[v];
+            (void) ngx_atomic_fetch_add(&psh->outlier_latency[v],
+                                        - (ngx_atomic_int_t) latency[v]);
+        }
+
+        stat[j].latency = ngx_http_upstream_check_outlier_percentile(
+                                                  latency, ocf->percentile);
+
+        requests += stat[j].requests;
+        fails += stat[j].fails;
+
+        if (psh->ejected && !ngx_http_upstream_check_outlier_ejected(psh)) {
+
+            ngx_shmtx_lock(&psh->mutex);
+            psh->ejected = 0;
+            psh->outlier_consecutive = 0;
+            ngx_shmtx_unlock(&psh->mutex);
+
+            ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                          "readmit outlier peer: %V",
+                          &peer[i].peer_addr->name);
+        }
+
+        if (psh->ejected) {
+            ejected++;
+
+        } else if (stat[j].requests >= ocf->min_requests && !psh->down) {
+            lat[m++] = stat[j].latency;
+        }
+
+        j++;
+    }
+
+    n = j;
+    median = 0;
+
+    if (m > 1) {
+        ngx_sort(lat, m, sizeof(ngx_msec_t),
+                 ngx_http_upstream_check_outlier_cmp);
+        median = ngx_max(lat[(m - 1) / 2], 1);
+    }
+
+    cap = ngx_max(n * ocf->max_percent / 100, 1);
+
+    for (j = 0; j < n; j++) {
+        psh = stat[j].peer->shm;
+
+        if (psh->ejected) {
+            continue;
+        }
+
+        reason = NULL;
+
+        if (!psh->down && stat[j].requests >= ocf->min_requests) {
+
+            prate = stat[j].fails * 100 / stat[j].requests;
+
+            orate = (requests > stat[j].requests)
+                    ? (fails - stat[j].fails) * 100
+                      / (requests - stat[j].requests)
+                    : 0;
+
+            if (ocf->error_rate && prate >= orate + ocf->error_rate) {
+                reason = "error rate";
+
+            } else if (ocf->latency_factor && median
+                       && stat[j].latency * 100 > median * ocf->latency_factor)
+            {
+                reason = "latency";
+            }
+        }
+
+        if (reason) {
+            if (ejected < cap) {
+                ngx_http_upstream_check_outlier_set(stat[j].peer, reason);
+                ejected++;
+            }
+
+            continue;
+        }
+
+        /* a healthy interval takes one step back from the back-off */
+
+        if (psh->ejections) {
+            ngx_shmtx_lock(&psh->mutex);
+
+            if (psh->ejections && !psh->ejected) {
+                psh->ejections--;
+            }
+
+            ngx_shmtx_unlock(&psh->mutex);
+        }
+    }
+
+    ngx_free(stat);
+}
+
+
 static ngx_int_t
 ngx_http_upstream_check_add_timers(ngx_cycle_t *cycle)
 {
@@ -1444,6 +1961,7 @@ ngx_http_upstream_check_add_timers(ngx_cycle_t *cycle)
 
         ngx_http_upstream_check_add_timer(&peer[i], ucscf->check_type_conf, t, cycle->log);
 
+        ngx_http_upstream_check_add_outlier_timer(ucscf, cycle->log);
     }
 
     return NGX_OK;
@@ -3388,6 +3906,7 @@ ngx_http_upstream_check_status_html_format(ngx_buf_t *b,
             "    <th>Status</th>\n"
             "    <th>Rise counts</th>\n"
             "    <th>Fall counts</th>\n"
+            "    <th>Ejections</th>\n"
             "    <th>Check type</th>\n"
             "    <th>Check port</th>\n"
             "  </tr>\n",
@@ -3420,6 +3939,7 @@ ngx_http_upstream_check_status_html_format(ngx_buf_t *b,
                 "    <td>%s</td>\n"
                 "    <td>%ui</td>\n"
                 "    <td>%ui</td>\n"
+                "    <td>%ui%s</td>\n"
                 "    <td>%V</td>\n"
                 "    <td>%ui</td>\n"
                 "  </tr>\n",
@@ -3430,6 +3950,9 @@ ngx_http_upstream_check_status_html_format(ngx_buf_t *b,
                 peer[i].shm->down ? "down" : "up",
                 peer[i].shm->rise_count,
                 peer[i].shm->fall_count,
+                peer[i].shm->ejections,
+                ngx_http_upstream_check_outlier_ejected(peer[i].shm)
+                    ? " (ejected)" : "",
                 &peer[i].conf->check_type_conf->name,
                 peer[i].conf->port);
     }
@@ -3563,6 +4086,8 @@ ngx_http_upstream_check_status_json_format(ngx_buf_t *b,
                 "\"status\": \"%s\", "
                 "\"rise\": %ui, "
                 "\"fall\": %ui, "
+                "\"ejected\": %s, "
+                "\"ejections\": %ui, "
                 "\"type\": \"%V\", "
                 "\"port\": %ui}"
                 "%s\n",
@@ -3572,6 +4097,9 @@ ngx_http_upstream_check_status_json_format(ngx_buf_t *b,
                 peer[i].shm->down ? "down" : "up",
                 peer[i].shm->rise_count,
                 peer[i].shm->fall_count,
+                ngx_http_upstream_check_outlier_ejected(peer[i].shm)
+                    ? "true" : "false",
+                peer[i].shm->ejections,
                 &peer[i].conf->check_type_conf->name,
                 peer[i].conf->port,
                 (last == count) ? "" : ",");
@@ -3743,6 +4271,39 @@ ngx_http_upstream_check_status_prometheus_format(ngx_buf_t *b,
                 peer[i].conf->port,
                 peer[i].shm->down ? 0 : 1);
     }
+
+    b->last = ngx_snprintf(b->last, b->end - b->last,
+            "# HELP nginx_upstream_server_ejected Nginx 1 for ejected by outlier detection / 0 otherwise\n"
+            "# TYPE nginx_upstream_server_ejected gauge\n");
+
+    for (i = 0; i < peers->peers.nelts; i++) {
+
+        if (peer[i].delete) {
+            continue;
+        }
+
+        if (flag & NGX_CHECK_STATUS_DOWN) {
+
+            if (!peer[i].shm->down) {
+                continue;
+            }
+
+        } else if (flag & NGX_CHECK_STATUS_UP) {
+
+            if (peer[i].shm->down) {
+                continue;
+            }
+        }
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "nginx_upstream_server_ejected{index=\"%ui\",upstream=\"%V\",name=\"%V\",type=\"%V\",port=\"%ui\"} %ui\n",
+                i,
+                peer[i].upstream_name,
+                &peer[i].peer_addr->name,
+                &peer[i].conf->check_type_conf->name,
+                peer[i].conf->port,
+                ngx_http_upstream_check_outlier_ejected(peer[i].shm));
+    }
 }
 
 
@@ -3949,6 +4510,194 @@ invalid_check_parameter:
 }
 
 
+static char *
+ngx_http_upstream_check_outlier(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                               *value, s;
+    ngx_int_t                                n;
+    ngx_uint_t                               i;
+    ngx_http_upstream_check_srv_conf_t      *ucscf;
+    ngx_http_upstream_check_outlier_conf_t  *ocf;
+
+    ucscf = ngx_http_conf_get_module_srv_conf(cf,
+                                              ngx_http_upstream_check_module);
+    if (ucscf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ucscf->outlier) {
+        return "is duplicate";
+    }
+
+    ocf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_outlier_conf_t));
+    if (ocf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    /* default values */
+    ocf->interval = 10000;
+    ocf->consecutive = 5;
+    ocf->error_rate = 0;
+    ocf->latency_factor = 0;
+    ocf->percentile = 90;
+    ocf->min_requests = 10;
+    ocf->max_percent = 50;
+    ocf->ejection_time = 30000;
+    ocf->max_ejection_time = 300000;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->interval = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "consecutive=", 12) == 0) {
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->consecutive = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "error_rate=", 11) == 0) {
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n > 100) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->error_rate = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "latency_factor=", 15) == 0) {
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            /* stored multiplied by 100, "1.5" is 150 */
+
+            n = ngx_atofp(s.data, s.len, 2);
+            if (n == NGX_ERROR || (n != 0 && n <= 100)) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->latency_factor = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "percentile=", 11) == 0) {
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0 || n > 100) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->percentile = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min_requests=", 13) == 0) {
+            s.len = value[i].len - 13;
+            s.data = value[i].data + 13;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->min_requests = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_ejection_percent=", 21) == 0) {
+            s.len = value[i].len - 21;
+            s.data = value[i].data + 21;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0 || n > 100) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->max_percent = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ejection_time=", 14) == 0) {
+            s.len = value[i].len - 14;
+            s.data = value[i].data + 14;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->ejection_time = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_ejection_time=", 18) == 0) {
+            s.len = value[i].len - 18;
+            s.data = value[i].data + 18;
+
+            n = ngx_atoi(s.data, s.len);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid_outlier_parameter;
+            }
+
+            ocf->max_ejection_time = n;
+
+            continue;
+        }
+
+        goto invalid_outlier_parameter;
+    }
+
+    if (ocf->max_ejection_time < ocf->ejection_time) {
+        ocf->max_ejection_time = ocf->ejection_time;
+    }
+
+    ucscf->outlier = ocf;
+
+    return NGX_CONF_OK;
+
+invalid_outlier_parameter:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
 static char *
 ngx_http_upstream_check_keepalive_requests(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf)
@@ -4429,6 +5178,13 @@ ngx_http_upstream_check_init_srv_conf(ngx_conf_t *cf, void *conf)
         ucscf->check_type_conf = NULL;
     }
 
+    if (ucscf->outlier && ucscf->check_interval == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"check_outlier\" requires \"check\" "
+                           "in upstream \"%V\"", &us->host);
+        return NGX_CONF_ERROR;
+    }
+
     check = ucscf->check_type_conf;
 
     if (check) {
@@ -4498,8 +5254,17 @@ ngx_http_upstream_check_init_shm(ngx_conf_t *cf, void *conf)
     ngx_http_upstream_check_get_shm_name(shm_name, cf->pool,
                                 ngx_http_upstream_check_shm_generation);
 
-    /* The default check shared memory size is 1M */
-    shm_size = 1 * 1024 * 1024;
+    /*
+     * The default check shared memory size is 1M, or large enough
+     * for the peers, the reserved dynamic peers and their addresses.
+     */
+    shm_size = (ucmcf->peers->peers.nelts + MAX_DYNAMIC_PEER)
+               * (sizeof(ngx_http_upstream_check_peer_shm_t)
+                  + sizeof(struct sockaddr_in6));
+    shm_size = ngx_align(shm_size + shm_size / 8, ngx_pagesize)
+               + 8 * ngx_pagesize;
+
+    shm_size = shm_size < 1 * 1024 * 1024 ? 1 * 1024 * 1024 : shm_size;
 
     shm_size = shm_size < ucmcf->check_shm_size ?
                           ucmcf->check_shm_size : shm_size;
@@ -4770,6 +5535,10 @@ ngx_http_upstream_check_init_shm_peer(ngx_http_upstream_check_peer_shm_t *psh,
 
         psh->down         = opsh->down;
 
+        psh->ejected       = opsh->ejected;
+        psh->ejections     = opsh->ejections;
+        psh->ejected_until = opsh->ejected_until;
+
     } else{
         psh->access_time  = 0;
         psh->access_count = 0;
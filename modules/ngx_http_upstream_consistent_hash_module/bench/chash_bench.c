@@ -0,0 +1,417 @@
+
+/*
+ * Copyright (C) 2010-2015 Alibaba Group Holding Limited
+ */
+
+
+/*
+ * Compares the virtual node ring of the consistent hash module with the
+ * maglev lookup table: lookup cost, memory and the share of keys that move
+ * when one server goes down.  The code mirrors the module, so it is kept
+ * standalone and builds without the nginx tree:
+ *
+ *     cc -O2 -o chash_bench chash_bench.c
+ *     ./chash_bench [servers] [lookups]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+#define VIRTUAL_NODE_NUMBER  160
+#define MAGLEV_TABLE_SIZE    65537
+#define MAGLEV_EMPTY         0xffffffff
+
+
+typedef struct {
+    uint32_t    hash;
+    uint32_t    server;
+} ring_node_t;
+
+
+typedef struct {
+    uint32_t    offset;
+    uint32_t    skip;
+    uint32_t    next;
+} maglev_perm_t;
+
+
+static uint32_t
+murmur_hash2(const unsigned char *data, size_t len)
+{
+    uint32_t  h, k;
+
+    h = 0 ^ len;
+
+    while (len >= 4) {
+        k  = data[0];
+        k |= data[1] << 8;
+        k |= data[2] << 16;
+        k |= (uint32_t) data[3] << 24;
+
+        k *= 0x5bd1e995;
+        k ^= k >> 24;
+        k *= 0x5bd1e995;
+
+        h *= 0x5bd1e995;
+        h ^= k;
+
+        data += 4;
+        len -= 4;
+    }
+
+    switch (len) {
+    case 3:
+        h ^= data[2] << 16;
+        /* fall through */
+    case 2:
+        h ^= data[1] << 8;
+        /* fall through */
+    case 1:
+        h ^= data[0];
+        h *= 0x5bd1e995;
+    }
+
+    h ^= h >> 13;
+    h *= 0x5bd1e995;
+    h ^= h >> 15;
+
+    return h;
+}
+
+
+static uint32_t
+crc32_short(const unsigned char *p, size_t len)
+{
+    int       i;
+    uint32_t  crc;
+
+    crc = 0xffffffff;
+
+    while (len--) {
+        crc ^= *p++;
+
+        for (i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return crc ^ 0xffffffff;
+}
+
+
+static int
+ring_cmp(const void *one, const void *two)
+{
+    const ring_node_t  *a = one, *b = two;
+
+    return (a->hash > b->hash) - (a->hash < b->hash);
+}
+
+
+static ring_node_t *
+ring_build(uint32_t n, uint32_t *number)
+{
+    uint32_t      i, j, id, k;
+    ring_node_t  *ring;
+
+    *number = n * VIRTUAL_NODE_NUMBER;
+
+    /* 1-based as in the module */
+
+    ring = calloc(*number + 1, sizeof(ring_node_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    k = 0;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < VIRTUAL_NODE_NUMBER; j++) {
+            id = (i + 1) * 256 * 16 + j;
+            ring[++k].hash = murmur_hash2((unsigned char *) &id, 4);
+            ring[k].server = i;
+        }
+    }
+
+    qsort(ring + 1, *number, sizeof(ring_node_t), ring_cmp);
+
+    return ring;
+}
+
+
+static uint32_t
+ring_lookup(ring_node_t *ring, uint32_t n, const char *down, uint32_t hash)
+{
+    uint32_t  low, high, mid, i;
+
+    low = 1;
+    high = n;
+
+    while (low < high) {
+        mid = (low + high) >> 1;
+
+        if (ring[mid].hash == hash) {
+            low = mid;
+            break;
+
+        } else if (ring[mid].hash < hash) {
+            low = mid + 1;
+
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == n && ring[low].hash < hash) {
+        low = 1;
+    }
+
+    /* the module skips down servers with a segment tree, a walk will do */
+
+    for (i = 0; i < n && down[ring[low].server]; i++) {
+        low = low == n ? 1 : low + 1;
+    }
+
+    return ring[low].server;
+}
+
+
+static void
+maglev_populate(uint32_t *table, uint32_t size, maglev_perm_t *perm,
+    uint32_t n, const char *down)
+{
+    uint32_t  i, slot, filled, live;
+
+    memset(table, 0xff, size * sizeof(uint32_t));
+
+    live = 0;
+
+    for (i = 0; i < n; i++) {
+        perm[i].next = perm[i].offset;
+        live += !down[i];
+    }
+
+    if (live == 0) {
+        return;
+    }
+
+    filled = 0;
+
+    for ( ;; ) {
+        for (i = 0; i < n; i++) {
+
+            if (down[i]) {
+                continue;
+            }
+
+            do {
+                slot = perm[i].next;
+                perm[i].next = (perm[i].next + perm[i].skip) % size;
+            } while (table[slot] != MAGLEV_EMPTY);
+
+            table[slot] = i;
+
+            if (++filled == size) {
+                return;
+            }
+        }
+    }
+}
+
+
+static void
+maglev_update(uint32_t *table, uint32_t *lookup, uint32_t size,
+    const char *down)
+{
+    uint32_t  i, owner;
+
+    for (i = size; i > 0 && down[table[i - 1]]; i--) { /* void */ }
+
+    if (i == 0) {
+        memset(lookup, 0xff, size * sizeof(uint32_t));
+        return;
+    }
+
+    owner = table[i - 1];
+
+    for (i = 0; i < size; i++) {
+
+        if (!down[table[i]]) {
+            owner = table[i];
+        }
+
+        lookup[i] = owner;
+    }
+}
+
+
+static int
+is_prime(uint32_t n)
+{
+    uint32_t  i;
+
+    for (i = 2; i * i <= n; i++) {
+        if (n % i == 0) {
+            return 0;
+        }
+    }
+
+    return n >= 2;
+}
+
+
+static double
+elapsed(struct timespec *start)
+{
+    struct timespec  now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1e9
+           + (now.tv_nsec - start->tv_nsec);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    char             *down;
+    uint32_t          n, lookups, number, size, i, id, sum;
+    uint32_t         *keys, *table, *lookup, *before;
+    uint32_t          moved_ring, moved_maglev;
+    ring_node_t      *ring;
+    maglev_perm_t    *perm;
+    struct timespec   start;
+
+    n = argc > 1 ? (uint32_t) atoi(argv[1]) : 2000;
+    lookups = argc > 2 ? (uint32_t) atoi(argv[2]) : 10000000;
+
+    if (n == 0 || lookups == 0) {
+        fprintf(stderr, "usage: %s [servers] [lookups]\n", argv[0]);
+        return 1;
+    }
+
+    size = n * 100 > MAGLEV_TABLE_SIZE ? n * 100 : MAGLEV_TABLE_SIZE;
+
+    while (!is_prime(size)) {
+        size++;
+    }
+
+    down = calloc(n, 1);
+    perm = calloc(n, sizeof(maglev_perm_t));
+    table = malloc(size * sizeof(uint32_t));
+    lookup = malloc(size * sizeof(uint32_t));
+    keys = malloc(lookups * sizeof(uint32_t));
+    before = malloc(lookups * sizeof(uint32_t));
+
+    if (down == NULL || perm == NULL || table == NULL || lookup == NULL
+        || keys == NULL || before == NULL)
+    {
+        return 1;
+    }
+
+    srandom(1);
+
+    for (i = 0; i < lookups; i++) {
+        id = (uint32_t) random();
+        keys[i] = murmur_hash2((unsigned char *) &id, 4);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ring = ring_build(n, &number);
+    if (ring == NULL) {
+        return 1;
+    }
+
+    printf("servers %u, lookups %u\n\n", n, lookups);
+    printf("ring:   %u nodes, %zu KB, built in %.2f ms\n",
+           number, (number + 1) * sizeof(ring_node_t) / 1024,
+           elapsed(&start) / 1e6);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < n; i++) {
+        id = i + 1;
+        perm[i].offset = murmur_hash2((unsigned char *) &id, 4) % size;
+        perm[i].skip = crc32_short((unsigned char *) &id, 4) % (size - 1) + 1;
+    }
+
+    maglev_populate(table, size, perm, n, down);
+    maglev_update(table, lookup, size, down);
+
+    printf("maglev: %u slots, %zu KB, built in %.2f ms\n\n",
+           size, size * sizeof(uint32_t) / 1024, elapsed(&start) / 1e6);
+
+    sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < lookups; i++) {
+        sum += ring_lookup(ring, number, down, keys[i]);
+    }
+
+    printf("ring lookup:   %6.1f ns\n", elapsed(&start) / lookups);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < lookups; i++) {
+        sum += lookup[keys[i] % size];
+    }
+
+    printf("maglev lookup: %6.1f ns\n\n", elapsed(&start) / lookups);
+
+    /* one server goes down: count keys that change their server */
+
+    for (i = 0; i < lookups; i++) {
+        before[i] = ring_lookup(ring, number, down, keys[i]);
+    }
+
+    down[0] = 1;
+    moved_ring = 0;
+
+    for (i = 0; i < lookups; i++) {
+        moved_ring += ring_lookup(ring, number, down, keys[i]) != before[i];
+    }
+
+    down[0] = 0;
+
+    for (i = 0; i < lookups; i++) {
+        before[i] = lookup[keys[i] % size];
+    }
+
+    down[0] = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    maglev_update(table, lookup, size, down);
+    printf("maglev update after a server is down: %.3f ms\n",
+           elapsed(&start) / 1e6);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    maglev_populate(table, size, perm, n, down);
+    printf("maglev full repopulation instead:     %.3f ms\n",
+           elapsed(&start) / 1e6);
+
+    down[0] = 0;
+    maglev_populate(table, size, perm, n, down);
+    down[0] = 1;
+    maglev_update(table, lookup, size, down);
+
+    moved_maglev = 0;
+
+    for (i = 0; i < lookups; i++) {
+        moved_maglev += lookup[keys[i] % size] != before[i];
+    }
+
+    printf("keys moved, ideal %.3f%%: ring %.3f%%, maglev %.3f%%\n",
+           100.0 / n, 100.0 * moved_ring / lookups,
+           100.0 * moved_maglev / lookups);
+
+    /* keep the lookups from being optimized away */
+
+    return sum == 0xffffffff;
+}
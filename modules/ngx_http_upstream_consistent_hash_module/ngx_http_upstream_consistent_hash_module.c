@@ -13,6 +13,8 @@
 #define NGX_CHASH_EQUAL                     0
 #define NGX_CHASH_LESS                      -1
 #define NGX_CHASH_VIRTUAL_NODE_NUMBER       160
+#define NGX_CHASH_MAGLEV_TABLE_SIZE         65537
+#define NGX_CHASH_MAGLEV_EMPTY              0xffffffff
 
 #if (NGX_HTTP_UPSTREAM_CHECK)
 #include "ngx_http_upstream_check_module.h"
@@ -32,8 +34,20 @@ typedef struct {
     ngx_http_upstream_rr_peer_t            *peer;
 } ngx_http_upstream_chash_server_t;
 
+typedef struct {
+    uint32_t                                offset;
+    uint32_t                                skip;
+    uint32_t                                next;
+    ngx_uint_t                              credit;
+} ngx_http_upstream_chash_maglev_t;
+
 typedef struct {
     ngx_uint_t                              number;
+    ngx_flag_t                              maglev;
+    ngx_uint_t                              table_size;
+    uint32_t                               *table;
+    uint32_t                               *lookup;
+    ngx_http_upstream_chash_maglev_t       *permutation;
     ngx_queue_t                             down_servers;
     ngx_array_t                            *values;
     ngx_array_t                            *lengths;
@@ -52,12 +66,18 @@ typedef struct {
 
     ngx_http_upstream_chash_server_t       *server;
     ngx_http_upstream_chash_srv_conf_t     *ucscf;
+    ngx_msec_t                              start_time;
 } ngx_http_upstream_chash_peer_data_t;
 
 
 static void *ngx_http_upstream_chash_create_srv_conf(ngx_conf_t *cf);
 static ngx_int_t ngx_http_upstream_init_chash(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_init_chash_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_uint_t ngx_http_upstream_chash_server_id(
+    ngx_http_upstream_rr_peer_t *peer, ngx_log_t *log);
 static ngx_int_t ngx_http_upstream_chash_cmp(const void *one, const void *two);
 static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us);
@@ -72,6 +92,13 @@ static uint32_t ngx_http_upstream_chash_get_server_index(
 static void ngx_http_upstream_chash_delete_node(
     ngx_http_upstream_chash_srv_conf_t *ucscf,
     ngx_http_upstream_chash_server_t *server);
+static ngx_int_t ngx_http_upstream_get_chash_maglev_peer(
+    ngx_peer_connection_t *pc, ngx_http_upstream_chash_peer_data_t *uchpd);
+static void ngx_http_upstream_chash_maglev_populate(
+    ngx_http_upstream_chash_srv_conf_t *ucscf);
+static void ngx_http_upstream_chash_maglev_update(
+    ngx_http_upstream_chash_srv_conf_t *ucscf);
+static ngx_uint_t ngx_http_upstream_chash_is_prime(ngx_uint_t n);
 
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_chash_set_peer_session(
@@ -84,7 +111,7 @@ static void ngx_http_upstream_chash_save_peer_session(ngx_peer_connection_t *pc,
 static ngx_command_t ngx_http_upstream_chash_commands[] = {
 
     { ngx_string("consistent_hash"),
-      NGX_HTTP_UPS_CONF | NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF | NGX_CONF_TAKE123,
       ngx_http_upstream_chash,
       0,
       0,
@@ -144,9 +171,8 @@ ngx_http_upstream_chash_create_srv_conf(ngx_conf_t *cf)
 static ngx_int_t
 ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-    u_char                               hash_buf[256];
     ngx_int_t                            j, weight;
-    ngx_uint_t                           sid, id, hash_len;
+    ngx_uint_t                           sid, id;
     ngx_uint_t                           i, n, *number, rnindex;
     ngx_http_upstream_rr_peer_t         *peer;
     ngx_http_upstream_rr_peers_t        *peers;
@@ -170,6 +196,10 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
         return NGX_ERROR;
     }
 
+    if (ucscf->maglev) {
+        return ngx_http_upstream_init_chash_maglev(cf, ucscf, peers);
+    }
+
     n = peers->number;
     ucscf->number = 0;
     ucscf->real_node = ngx_pcalloc(cf->pool, n *
@@ -208,16 +238,7 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     for (i = 0; i < n; i++) {
 
         peer = &peers->peer[i];
-        sid = (ngx_uint_t) ngx_atoi(peer->id.data, peer->id.len);
-
-        if (sid == (ngx_uint_t) NGX_ERROR || sid > 65535) {
-
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, cf->log, 0, "server id %d", sid);
-
-            ngx_snprintf(hash_buf, 256, "%V%Z", &peer->name);
-            hash_len = ngx_strlen(hash_buf);
-            sid = ngx_murmur_hash2(hash_buf, hash_len);
-        }
+        sid = ngx_http_upstream_chash_server_id(peer, cf->log);
 
         weight = peer->weight * NGX_CHASH_VIRTUAL_NODE_NUMBER;
 
@@ -272,6 +293,123 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_init_chash_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_chash_srv_conf_t *ucscf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    uint32_t                           id;
+    ngx_uint_t                         i, n, size;
+    ngx_http_upstream_chash_server_t  *server;
+    ngx_http_upstream_chash_maglev_t  *perm;
+
+    n = peers->number;
+    size = ucscf->table_size;
+
+    if (size == 0) {
+
+        /* about a hundred slots per server keeps the shares within 1% */
+
+        size = ngx_max(NGX_CHASH_MAGLEV_TABLE_SIZE, n * 100);
+
+        while (!ngx_http_upstream_chash_is_prime(size)) {
+            size++;
+        }
+
+    } else if (size < n) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "consistent hash table_size %ui is less than "
+                      "the number of servers %ui", size, n);
+        return NGX_ERROR;
+    }
+
+    ucscf->table_size = size;
+    ucscf->number = n;
+
+    ucscf->servers = ngx_pcalloc(cf->pool,
+                                 n * sizeof(ngx_http_upstream_chash_server_t));
+    if (ucscf->servers == NULL) {
+        return NGX_ERROR;
+    }
+
+    ucscf->d_servers = ngx_pcalloc(cf->pool, n *
+                                sizeof(ngx_http_upstream_chash_down_server_t));
+    if (ucscf->d_servers == NULL) {
+        return NGX_ERROR;
+    }
+
+    ucscf->permutation = ngx_pcalloc(cf->pool,
+                                 n * sizeof(ngx_http_upstream_chash_maglev_t));
+    if (ucscf->permutation == NULL) {
+        return NGX_ERROR;
+    }
+
+    ucscf->table = ngx_palloc(cf->pool, size * sizeof(uint32_t));
+    if (ucscf->table == NULL) {
+        return NGX_ERROR;
+    }
+
+    ucscf->lookup = ngx_palloc(cf->pool, size * sizeof(uint32_t));
+    if (ucscf->lookup == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        server = &ucscf->servers[i];
+        server->peer = &peers->peer[i];
+        server->index = i;
+        server->rnindex = i;
+        server->down = server->peer->down ? 1 : 0;
+
+        ucscf->d_servers[i].id = i;
+
+        /*
+         * the preference list of a server only depends on its id, so the
+         * table changes little when other servers come and go
+         */
+
+        id = (uint32_t) ngx_http_upstream_chash_server_id(server->peer,
+                                                          cf->log);
+        server->hash = ngx_murmur_hash2((u_char *) &id, sizeof(uint32_t));
+
+        perm = &ucscf->permutation[i];
+        perm->offset = server->hash % size;
+        perm->skip = ngx_crc32_short((u_char *) &id, sizeof(uint32_t))
+                     % (size - 1) + 1;
+    }
+
+    ngx_http_upstream_chash_maglev_populate(ucscf);
+
+    ngx_memcpy(ucscf->lookup, ucscf->table, size * sizeof(uint32_t));
+
+    ngx_queue_init(&ucscf->down_servers);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_chash_server_id(ngx_http_upstream_rr_peer_t *peer,
+    ngx_log_t *log)
+{
+    u_char      hash_buf[256];
+    ngx_uint_t  sid, hash_len;
+
+    sid = (ngx_uint_t) ngx_atoi(peer->id.data, peer->id.len);
+
+    if (sid == (ngx_uint_t) NGX_ERROR || sid > 65535) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "server id %d", sid);
+
+        ngx_snprintf(hash_buf, 256, "%V%Z", &peer->name);
+        hash_len = ngx_strlen(hash_buf);
+        sid = ngx_murmur_hash2(hash_buf, hash_len);
+    }
+
+    return sid;
+}
+
+
 static ngx_int_t
 ngx_http_upstream_chash_cmp(const void *one, const void *two)
 {
@@ -318,6 +456,7 @@ ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
     }
 
     uchpd->hash = ngx_murmur_hash2(hash_value.data, hash_value.len);
+    uchpd->start_time = ngx_current_msec;
 
     r->upstream->peer.get = ngx_http_upstream_get_chash_peer;
     r->upstream->peer.free = ngx_http_upstream_free_chash_peer;
@@ -349,6 +488,10 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ucscf = uchpd->ucscf;
 
+    if (ucscf->maglev) {
+        return ngx_http_upstream_get_chash_maglev_peer(pc, uchpd);
+    }
+
     if (!ngx_queue_empty(&ucscf->down_servers)) {
         q = ngx_queue_head(&ucscf->down_servers);
         while(q != ngx_queue_sentinel(&ucscf->down_servers)) {
@@ -500,6 +643,235 @@ ngx_http_upstream_chash_delete_node(ngx_http_upstream_chash_srv_conf_t *ucscf,
 }
 
 
+static ngx_int_t
+ngx_http_upstream_get_chash_maglev_peer(ngx_peer_connection_t *pc,
+    ngx_http_upstream_chash_peer_data_t *uchpd)
+{
+    time_t                                  now;
+    uint32_t                                slot;
+    ngx_uint_t                              rebuild;
+    ngx_queue_t                            *q, *temp;
+    ngx_http_upstream_rr_peer_t            *peer;
+    ngx_http_upstream_chash_server_t       *server;
+    ngx_http_upstream_chash_srv_conf_t     *ucscf;
+    ngx_http_upstream_chash_down_server_t  *down_server;
+
+    ucscf = uchpd->ucscf;
+    rebuild = 0;
+    now = ngx_time();
+
+    q = ngx_queue_head(&ucscf->down_servers);
+
+    while (q != ngx_queue_sentinel(&ucscf->down_servers)) {
+        temp = ngx_queue_next(q);
+        down_server = ngx_queue_data(q, ngx_http_upstream_chash_down_server_t,
+                                     queue);
+
+        if (now >= down_server->timeout) {
+            server = &ucscf->servers[down_server->id];
+            peer = server->peer;
+#if (NGX_HTTP_UPSTREAM_CHECK)
+            if (!ngx_http_upstream_check_peer_down(peer->check_index)) {
+#endif
+                peer->fails = 0;
+                peer->down = 0;
+                server->down = 0;
+
+                ngx_queue_remove(&down_server->queue);
+                rebuild = 1;
+#if (NGX_HTTP_UPSTREAM_CHECK)
+            }
+#endif
+        }
+
+        q = temp;
+    }
+
+    if (rebuild) {
+        ngx_http_upstream_chash_maglev_update(ucscf);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    for ( ;; ) {
+
+        slot = ucscf->lookup[uchpd->hash % ucscf->table_size];
+
+        if (slot == NGX_CHASH_MAGLEV_EMPTY) {
+            ngx_log_error(NGX_LOG_ERR, pc->log, 0, "all servers are down");
+            return NGX_BUSY;
+        }
+
+        server = &ucscf->servers[slot];
+        peer = server->peer;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "consistent hash maglev [peer name]:%V %ud",
+                       &peer->name, uchpd->hash);
+
+        if (
+#if (NGX_HTTP_UPSTREAM_CHECK)
+            !ngx_http_upstream_check_peer_down(peer->check_index) &&
+#endif
+            peer->fails <= peer->max_fails
+            && !peer->down)
+        {
+            break;
+        }
+
+        server->down = 1;
+        ucscf->d_servers[server->index].timeout = now + peer->fail_timeout;
+        ngx_queue_insert_head(&ucscf->down_servers,
+                              &ucscf->d_servers[server->index].queue);
+
+        ngx_http_upstream_chash_maglev_update(ucscf);
+    }
+
+    uchpd->server = server;
+
+    pc->name = &peer->name;
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_chash_maglev_populate(
+    ngx_http_upstream_chash_srv_conf_t *ucscf)
+{
+    uint32_t                           *table, slot;
+    ngx_uint_t                          i, n, size, filled, max_weight;
+    ngx_http_upstream_chash_server_t   *server;
+    ngx_http_upstream_chash_maglev_t   *perm;
+
+    n = ucscf->number;
+    size = ucscf->table_size;
+    table = ucscf->table;
+
+    ngx_memset(table, 0xff, size * sizeof(uint32_t));
+
+    max_weight = 0;
+
+    for (i = 0; i < n; i++) {
+        server = &ucscf->servers[i];
+        perm = &ucscf->permutation[i];
+
+        perm->next = perm->offset;
+        perm->credit = 0;
+
+        if (!server->down && (ngx_uint_t) server->peer->weight > max_weight) {
+            max_weight = server->peer->weight;
+        }
+    }
+
+    if (max_weight == 0) {
+        return;
+    }
+
+    /*
+     * every live server in turn claims the next free slot of its own
+     * permutation; a server of weight w takes w turns per max_weight
+     */
+
+    filled = 0;
+
+    for ( ;; ) {
+
+        for (i = 0; i < n; i++) {
+            server = &ucscf->servers[i];
+
+            if (server->down) {
+                continue;
+            }
+
+            perm = &ucscf->permutation[i];
+
+            perm->credit += server->peer->weight;
+            if (perm->credit < max_weight) {
+                continue;
+            }
+
+            perm->credit -= max_weight;
+
+            do {
+                slot = perm->next;
+                perm->next = (perm->next + perm->skip) % size;
+            } while (table[slot] != NGX_CHASH_MAGLEV_EMPTY);
+
+            table[slot] = i;
+
+            if (++filled == size) {
+                return;
+            }
+        }
+    }
+}
+
+
+static void
+ngx_http_upstream_chash_maglev_update(ngx_http_upstream_chash_srv_conf_t *ucscf)
+{
+    uint32_t    *table, *lookup, owner;
+    ngx_uint_t   i, size;
+
+    /*
+     * the populated table is left as is: a slot of a down server is lent
+     * to the owner of the nearest live slot before it, so only the keys of
+     * down servers move and they come back once their server is up again
+     */
+
+    size = ucscf->table_size;
+    table = ucscf->table;
+    lookup = ucscf->lookup;
+
+    for (i = size; i > 0; i--) {
+        if (table[i - 1] != NGX_CHASH_MAGLEV_EMPTY
+            && !ucscf->servers[table[i - 1]].down)
+        {
+            break;
+        }
+    }
+
+    if (i == 0) {
+        ngx_memset(lookup, 0xff, size * sizeof(uint32_t));
+        return;
+    }
+
+    owner = table[i - 1];
+
+    for (i = 0; i < size; i++) {
+
+        if (!ucscf->servers[table[i]].down) {
+            owner = table[i];
+        }
+
+        lookup[i] = owner;
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_chash_is_prime(ngx_uint_t n)
+{
+    ngx_uint_t  i;
+
+    if (n < 2) {
+        return 0;
+    }
+
+    for (i = 2; i * i <= n; i++) {
+        if (n % i == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 static uint32_t
 ngx_http_upstream_chash_get_server_index(
     ngx_http_upstream_chash_server_t *servers, uint32_t n, uint32_t hash)
@@ -545,13 +917,23 @@ ngx_http_upstream_free_chash_peer(ngx_peer_connection_t *pc, void *data,
     if (state & NGX_PEER_FAILED) {
         uchpd->server->peer->fails++;
     }
+
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    ngx_http_upstream_check_report_peer(uchpd->server->peer->check_index,
+                                        state & NGX_PEER_FAILED,
+                                        ngx_current_msec - uchpd->start_time);
+#endif
+
+    uchpd->start_time = ngx_current_msec;
 }
 
 
 static char *
 ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_int_t                            size;
     ngx_str_t                           *value;
+    ngx_uint_t                           i;
     ngx_http_script_compile_t            sc;
     ngx_http_upstream_srv_conf_t        *uscf;
     ngx_http_upstream_chash_srv_conf_t  *ucscf;
@@ -585,6 +967,40 @@ ngx_http_upstream_chash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "maglev") == 0) {
+            ucscf->maglev = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "table_size=", 11) == 0) {
+            size = ngx_atoi(value[i].data + 11, value[i].len - 11);
+
+            if (size == NGX_ERROR
+                || !ngx_http_upstream_chash_is_prime((ngx_uint_t) size))
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "table_size must be a prime number in "
+                                   "\"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ucscf->table_size = (ngx_uint_t) size;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ucscf->table_size && !ucscf->maglev) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"table_size\" requires \"maglev\"");
+        return NGX_CONF_ERROR;
+    }
+
     uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
     uscf->flags = NGX_HTTP_UPSTREAM_CREATE
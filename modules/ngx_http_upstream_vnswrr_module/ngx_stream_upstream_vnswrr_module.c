@@ -0,0 +1,622 @@
+
+/*
+ *  Copyright (C) 2010-2019 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_uint_t                              rindex;
+    ngx_stream_upstream_rr_peer_t          *vpeer;
+} ngx_stream_upstream_rr_vpeers_t;
+
+
+typedef struct ngx_stream_upstream_vnswrr_srv_conf_s
+    ngx_stream_upstream_vnswrr_srv_conf_t;
+
+
+struct ngx_stream_upstream_vnswrr_srv_conf_s {
+    ngx_uint_t                              vnumber;
+    ngx_uint_t                              last_number;
+    ngx_uint_t                              max_init;
+    ngx_uint_t                              gcd;
+    ngx_uint_t                              number;
+    ngx_int_t                              *current_weight;
+    ngx_stream_upstream_rr_peer_t         **rpeers;
+    ngx_stream_upstream_rr_peers_t         *peers;
+    ngx_stream_upstream_rr_vpeers_t        *vpeers;
+    ngx_stream_upstream_vnswrr_srv_conf_t  *next;
+};
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_stream_upstream_rr_peer_data_t      rrp;
+
+    ngx_stream_upstream_vnswrr_srv_conf_t  *uvnscf;
+} ngx_stream_upstream_vnswrr_peer_data_t;
+
+
+static char *ngx_stream_upstream_vnswrr(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void *ngx_stream_upstream_vnswrr_create_srv_conf(ngx_conf_t *cf);
+static ngx_int_t ngx_stream_upstream_init_vnswrr(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_vnswrr_init_conf(ngx_conf_t *cf,
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf,
+    ngx_stream_upstream_rr_peers_t *peers, ngx_uint_t gcd,
+    ngx_uint_t max_init);
+static ngx_int_t ngx_stream_upstream_init_vnswrr_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us);
+static ngx_int_t ngx_stream_upstream_get_vnswrr_peer(ngx_peer_connection_t *pc,
+    void *data);
+static ngx_stream_upstream_rr_peer_t *ngx_stream_upstream_get_vnswrr(
+    ngx_stream_upstream_vnswrr_peer_data_t *vnsp);
+static void ngx_stream_upstream_vnswrr_bind_peers(
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf,
+    ngx_stream_upstream_rr_peers_t *peers);
+static void ngx_stream_upstream_init_virtual_peers(
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf, ngx_uint_t e);
+static ngx_uint_t ngx_stream_upstream_vnswrr_gcd(ngx_uint_t a, ngx_uint_t b);
+
+
+static ngx_command_t  ngx_stream_upstream_vnswrr_commands[] = {
+
+    { ngx_string("vnswrr"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_stream_upstream_vnswrr,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_vnswrr_module_ctx = {
+    NULL,                                   /* preconfiguration */
+    NULL,                                   /* postconfiguration */
+
+    NULL,                                   /* create main configuration */
+    NULL,                                   /* init main configuration */
+
+    ngx_stream_upstream_vnswrr_create_srv_conf,
+                                            /* create server configuration */
+    NULL                                    /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_vnswrr_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_vnswrr_module_ctx,  /* module context */
+    ngx_stream_upstream_vnswrr_commands,     /* module directives */
+    NGX_STREAM_MODULE,                       /* module type */
+    NULL,                                    /* init master */
+    NULL,                                    /* init module */
+    NULL,                                    /* init process */
+    NULL,                                    /* init thread */
+    NULL,                                    /* exit thread */
+    NULL,                                    /* exit process */
+    NULL,                                    /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void *
+ngx_stream_upstream_vnswrr_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_vnswrr_srv_conf_t  *uvnscf;
+
+    uvnscf = ngx_pcalloc(cf->pool,
+                         sizeof(ngx_stream_upstream_vnswrr_srv_conf_t));
+    if (uvnscf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     uvnscf->vnumber = 0;
+     *     uvnscf->peers = NULL;
+     *     uvnscf->vpeers = NULL;
+     *     uvnscf->next = NULL;
+     */
+
+    uvnscf->last_number = NGX_CONF_UNSET_UINT;
+
+    return uvnscf;
+}
+
+
+static char *
+ngx_stream_upstream_vnswrr(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_int_t                               max_init;
+    ngx_str_t                              *value;
+    ngx_stream_upstream_srv_conf_t         *uscf;
+    ngx_stream_upstream_vnswrr_srv_conf_t  *uvnscf;
+
+    uscf = ngx_stream_conf_get_module_srv_conf(cf, ngx_stream_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_stream_upstream_init_vnswrr;
+
+    uscf->flags = NGX_STREAM_UPSTREAM_CREATE
+                  |NGX_STREAM_UPSTREAM_WEIGHT
+                  |NGX_STREAM_UPSTREAM_MAX_CONNS
+                  |NGX_STREAM_UPSTREAM_MAX_FAILS
+                  |NGX_STREAM_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_STREAM_UPSTREAM_DOWN
+                  |NGX_STREAM_UPSTREAM_BACKUP;
+
+    uvnscf = ngx_stream_conf_upstream_srv_conf(uscf,
+                                            ngx_stream_upstream_vnswrr_module);
+
+    value = cf->args->elts;
+
+    max_init = 0;
+
+    if (cf->args->nelts > 1) {
+
+        if (ngx_strncmp(value[1].data, "max_init=", 9) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        max_init = ngx_atoi(&value[1].data[9], value[1].len - 9);
+
+        if (max_init == NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    uvnscf->max_init = max_init;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_init_vnswrr(ngx_conf_t *cf,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    ngx_uint_t                              i, g, bg, max_init;
+    ngx_stream_upstream_server_t           *server;
+    ngx_stream_upstream_rr_peers_t         *peers;
+    ngx_stream_upstream_vnswrr_srv_conf_t  *uvnscf, *ubvnscf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, cf->log, 0, "init vnswrr");
+
+    if (ngx_stream_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    g = 0;
+    bg = 0;
+
+    if (us->servers) {
+        server = us->servers->elts;
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            if (server[i].backup) {
+                bg = ngx_stream_upstream_vnswrr_gcd(bg, server[i].weight);
+
+            } else {
+                g = ngx_stream_upstream_vnswrr_gcd(g, server[i].weight);
+            }
+        }
+    }
+
+    uvnscf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_vnswrr_module);
+
+    peers = us->peer.data;
+    max_init = uvnscf->max_init;
+
+    if (ngx_stream_upstream_vnswrr_init_conf(cf, uvnscf, peers, g, max_init)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_stream_upstream_init_vnswrr_peer;
+
+    if (peers->next == NULL) {
+        return NGX_OK;
+    }
+
+    /* backup peers */
+
+    ubvnscf = ngx_pcalloc(cf->pool,
+                          sizeof(ngx_stream_upstream_vnswrr_srv_conf_t));
+    if (ubvnscf == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_stream_upstream_vnswrr_init_conf(cf, ubvnscf, peers->next, bg,
+                                             max_init)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    uvnscf->next = ubvnscf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_vnswrr_init_conf(ngx_conf_t *cf,
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf,
+    ngx_stream_upstream_rr_peers_t *peers, ngx_uint_t gcd,
+    ngx_uint_t max_init)
+{
+    uvnscf->vnumber = 0;
+    uvnscf->last_number = NGX_CONF_UNSET_UINT;
+    uvnscf->number = peers->number;
+    uvnscf->gcd = gcd ? gcd : 1;
+    uvnscf->peers = NULL;
+    uvnscf->next = NULL;
+
+    if (!max_init) {
+        uvnscf->max_init = peers->number;
+
+    } else if (max_init > peers->total_weight) {
+        uvnscf->max_init = peers->total_weight;
+
+    } else {
+        uvnscf->max_init = max_init;
+    }
+
+    /*
+     * the peers may still be moved to a shared memory zone, so only the
+     * room is allocated here and the peers are bound in the workers
+     */
+
+    uvnscf->rpeers = ngx_pcalloc(cf->pool, peers->number
+                                 * sizeof(ngx_stream_upstream_rr_peer_t *));
+    if (uvnscf->rpeers == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (!peers->weighted) {
+        return NGX_OK;
+    }
+
+    uvnscf->current_weight = ngx_pcalloc(cf->pool,
+                                         peers->number * sizeof(ngx_int_t));
+    if (uvnscf->current_weight == NULL) {
+        return NGX_ERROR;
+    }
+
+    uvnscf->vpeers = ngx_pcalloc(cf->pool,
+                                 sizeof(ngx_stream_upstream_rr_vpeers_t)
+                                 * (peers->total_weight / uvnscf->gcd));
+    if (uvnscf->vpeers == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_init_vnswrr_peer(ngx_stream_session_t *s,
+    ngx_stream_upstream_srv_conf_t *us)
+{
+    ngx_stream_upstream_vnswrr_srv_conf_t   *uvnscf;
+    ngx_stream_upstream_vnswrr_peer_data_t  *vnsp;
+
+    uvnscf = ngx_stream_conf_upstream_srv_conf(us,
+                                            ngx_stream_upstream_vnswrr_module);
+
+    vnsp = ngx_palloc(s->connection->pool,
+                      sizeof(ngx_stream_upstream_vnswrr_peer_data_t));
+    if (vnsp == NULL) {
+        return NGX_ERROR;
+    }
+
+    vnsp->uvnscf = uvnscf;
+    s->upstream->peer.data = &vnsp->rrp;
+
+    if (ngx_stream_upstream_init_round_robin_peer(s, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    s->upstream->peer.get = ngx_stream_upstream_get_vnswrr_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_get_vnswrr_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_stream_upstream_vnswrr_peer_data_t  *vnsp = data;
+
+    ngx_int_t                            rc;
+    ngx_uint_t                           i, n;
+    ngx_stream_upstream_rr_peer_t       *peer;
+    ngx_stream_upstream_rr_peers_t      *peers;
+    ngx_stream_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "get vnswrr peer, try: %ui", pc->tries);
+
+    if (vnsp->rrp.peers->single) {
+        return ngx_stream_upstream_get_round_robin_peer(pc, &vnsp->rrp);
+    }
+
+    pc->connection = NULL;
+
+    rrp = &vnsp->rrp;
+    peers = rrp->peers;
+
+    /*
+     * the virtual peers are private to the worker, so the shared peers
+     * are only read here and each peer is locked to account connections
+     */
+
+    ngx_stream_upstream_rr_peers_rlock(peers);
+
+    peer = ngx_stream_upstream_get_vnswrr(vnsp);
+
+    if (peer == NULL) {
+        goto failed;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "get vnswrr peer, current: %p %ui",
+                   peer, vnsp->uvnscf->last_number);
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+#if (NGX_STREAM_UPSTREAM_TYPE)
+    if (peer->type) pc->type = peer->type;
+#endif
+#if (NGX_KCP && NGX_STREAM_UPSTREAM_TYPE)
+    if (peer->kcp != -1)
+    {
+        pc->kcp      = peer->kcp;
+        pc->conv     = peer->conv;
+        pc->kcp_mode = peer->kcp_mode;
+    }
+#endif
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, pc->log, 0, "backup servers");
+
+        rrp->peers = peers->next;
+
+        vnsp->uvnscf = vnsp->uvnscf->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        for (i = 0; i < n; i++) {
+            rrp->tried[i] = 0;
+        }
+
+        ngx_stream_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_stream_upstream_get_vnswrr_peer(pc, vnsp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_stream_upstream_rr_peers_rlock(peers);
+    }
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static ngx_stream_upstream_rr_peer_t *
+ngx_stream_upstream_get_vnswrr(ngx_stream_upstream_vnswrr_peer_data_t *vnsp)
+{
+    time_t                                  now;
+    uintptr_t                               m;
+    ngx_uint_t                              i, n, r, total, flag;
+    ngx_stream_upstream_rr_peer_t          *peer;
+    ngx_stream_upstream_rr_peers_t         *peers;
+    ngx_stream_upstream_rr_peer_data_t     *rrp;
+    ngx_stream_upstream_vnswrr_srv_conf_t  *uvnscf;
+
+    now = ngx_time();
+
+    rrp = &vnsp->rrp;
+    peers = rrp->peers;
+    uvnscf = vnsp->uvnscf;
+
+    if (uvnscf->peers != peers) {
+        ngx_stream_upstream_vnswrr_bind_peers(uvnscf, peers);
+    }
+
+    total = peers->weighted ? peers->total_weight / uvnscf->gcd
+                            : uvnscf->number;
+
+    if (uvnscf->last_number == NGX_CONF_UNSET_UINT) {
+
+        if (peers->weighted) {
+            ngx_stream_upstream_init_virtual_peers(uvnscf,
+                                          ngx_min(uvnscf->max_init, total));
+            n = uvnscf->vnumber;
+
+        } else {
+            n = total;
+        }
+
+        uvnscf->last_number = ngx_random() % n;
+    }
+
+    for (i = (uvnscf->last_number + 1) % total, flag = 1;
+         flag || i != (uvnscf->last_number + 1) % total;
+         i = (i + 1) % total)
+    {
+        flag = 0;
+
+        if (peers->weighted) {
+
+            /* batch initialization of the virtual peers at runtime */
+
+            if (i == uvnscf->vnumber) {
+                n = ngx_min(uvnscf->vnumber + uvnscf->max_init, total);
+                ngx_stream_upstream_init_virtual_peers(uvnscf, n);
+            }
+
+            peer = uvnscf->vpeers[i].vpeer;
+            r = uvnscf->vpeers[i].rindex;
+
+        } else {
+            peer = uvnscf->rpeers[i];
+            r = i;
+        }
+
+        n = r / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << r % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        ngx_stream_upstream_rr_peer_lock(peers, peer);
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            ngx_stream_upstream_rr_peer_unlock(peers, peer);
+            continue;
+        }
+
+        peer->conns++;
+
+        if (now - peer->checked > peer->fail_timeout) {
+            peer->checked = now;
+        }
+
+        ngx_stream_upstream_rr_peer_unlock(peers, peer);
+
+        uvnscf->last_number = i;
+        rrp->current = peer;
+        rrp->tried[n] |= m;
+
+        return peer;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_stream_upstream_vnswrr_bind_peers(
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf,
+    ngx_stream_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                      i;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    for (peer = peers->peer, i = 0;
+         peer && i < uvnscf->number;
+         peer = peer->next, i++)
+    {
+        uvnscf->rpeers[i] = peer;
+
+        if (uvnscf->current_weight) {
+            uvnscf->current_weight[i] = 0;
+        }
+    }
+
+    uvnscf->peers = peers;
+    uvnscf->vnumber = 0;
+    uvnscf->last_number = NGX_CONF_UNSET_UINT;
+}
+
+
+static void
+ngx_stream_upstream_init_virtual_peers(
+    ngx_stream_upstream_vnswrr_srv_conf_t *uvnscf, ngx_uint_t e)
+{
+    ngx_int_t                       total, *cw;
+    ngx_uint_t                      i, v, best;
+    ngx_stream_upstream_rr_peer_t  *peer;
+
+    /*
+     * smooth weighted round robin over the weights of the configuration,
+     * kept in the worker: the effective weights of the shared peers are
+     * left to the other balancers
+     */
+
+    cw = uvnscf->current_weight;
+
+    for (v = uvnscf->vnumber; v < e; v++) {
+        best = 0;
+        total = 0;
+
+        for (i = 0; i < uvnscf->number; i++) {
+            peer = uvnscf->rpeers[i];
+
+            cw[i] += peer->weight;
+            total += peer->weight;
+
+            if (cw[i] > cw[best]) {
+                best = i;
+            }
+        }
+
+        cw[best] -= total;
+
+        uvnscf->vpeers[v].vpeer = uvnscf->rpeers[best];
+        uvnscf->vpeers[v].rindex = best;
+    }
+
+    uvnscf->vnumber = e;
+}
+
+
+static ngx_uint_t
+ngx_stream_upstream_vnswrr_gcd(ngx_uint_t a, ngx_uint_t b)
+{
+    ngx_uint_t  r;
+
+    while (b) {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2010-2015 Alibaba Group Holding Limited
+ */
+
+
+/*
+ * Memory and lookup cost of the user_agent keyword trie: the former
+ * layout, a 256 pointer array in every inner node (kept here as it was),
+ * against the compiled trie of src/core/ngx_trie.c.  The keywords are
+ * inserted and the user agents queried the way ngx_http_user_agent_module
+ * does, in reverse, with some keywords greedy; both tries must return the
+ * same keyword and position for every user agent.  It links the objects
+ * of a configured and built tree, from the top directory:
+ *
+ *     cc -O2 -o ua_trie_bench \
+ *         modules/ngx_http_user_agent_module/bench/ua_trie_bench.c \
+ *         -I objs -I src/core -I src/event -I src/os/unix -I src/proc \
+ *         objs/src/core/ngx_trie.o objs/src/core/ngx_palloc.o \
+ *         objs/src/os/unix/ngx_alloc.o
+ *     ./ua_trie_bench [keywords] [user agents file] [rounds]
+ *
+ * The user agents file has one user agent per line, for example taken
+ * from an access log; without it a small built-in sample is used.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#include <time.h>
+
+
+#define OLD_TRIE_KIND  256
+#define MAX_UA         100000
+
+
+typedef struct old_node_s  old_node_t;
+
+struct old_node_s {
+    void          *value;
+    old_node_t    *search_clue;
+    old_node_t   **next;
+
+    unsigned       key:31;
+    unsigned       greedy:1;
+};
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+static size_t          old_bytes;
+static ngx_log_t       log;
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static const char  *keywords[] = {
+    "Chrome", "Firefox", "Safari", "Opera", "OPR", "Edge", "Edg", "MSIE",
+    "Trident", "Mobile", "Android", "iPhone", "iPad", "Windows NT",
+    "Mac OS X", "Linux", "UCBrowser", "UCWEB", "MQQBrowser", "QQBrowser",
+    "MicroMessenger", "AlipayClient", "Weibo", "baiduboxapp", "SogouMobile",
+    "Quark", "HuaweiBrowser", "MiuiBrowser", "VivoBrowser", "HeyTapBrowser",
+    "SamsungBrowser", "YaBrowser", "Vivaldi", "Brave", "DuckDuckGo",
+    "Googlebot", "bingbot", "Baiduspider", "YandexBot", "Sogou web spider",
+    "360Spider", "Bytespider", "PetalBot", "AhrefsBot", "SemrushBot",
+    "curl", "Wget", "python-requests", "Go-http-client", "okhttp",
+    "Java", "Apache-HttpClient", "PostmanRuntime", "axios", "Dalvik",
+    "CFNetwork", "Darwin", "TaoBrowser", "LBBROWSER", "Maxthon",
+    NULL
+};
+
+
+static const char  *sample[] = {
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 "
+        "(KHTML, like Gecko) Version/17.0 Safari/605.1.15",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/119.0",
+    "Mozilla/5.0 (iPhone; CPU iPhone OS 17_0 like Mac OS X) "
+        "AppleWebKit/605.1.15 (KHTML, like Gecko) Mobile/15E148 "
+        "MicroMessenger/8.0.42(0x18002a2c) NetType/WIFI Language/zh_CN",
+    "Mozilla/5.0 (Linux; Android 13; SM-S9080 Build/TP1A.220624.014; wv) "
+        "AppleWebKit/537.36 (KHTML, like Gecko) Version/4.0 "
+        "Chrome/107.0.5304.141 Mobile Safari/537.36 AlipayClient/10.5.30",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36 Edg/118.0.2088.69",
+    "Mozilla/5.0 (compatible; MSIE 9.0; Windows NT 6.1; Trident/5.0)",
+    "Mozilla/5.0 (compatible; Googlebot/2.1; "
+        "+http://www.google.com/bot.html)",
+    "Mozilla/5.0 (compatible; Baiduspider/2.0; "
+        "+http://www.baidu.com/search/spider.html)",
+    "Mozilla/5.0 (Linux; U; Android 12; zh-CN; V2145A Build/SP1A.210812.003) "
+        "AppleWebKit/537.36 (KHTML, like Gecko) Version/4.0 "
+        "Chrome/100.0.4896.58 UCBrowser/15.5.8.1258 Mobile Safari/537.36",
+    "curl/8.4.0",
+    "okhttp/4.11.0",
+    "Go-http-client/1.1",
+    "python-requests/2.31.0",
+    "Dalvik/2.1.0 (Linux; U; Android 11; M2012K11AC Build/RKQ1.200826.002)",
+    "MyApp/3.2.1 CFNetwork/1474 Darwin/23.0.0",
+    NULL
+};
+
+
+static old_node_t *
+old_node_create(ngx_pool_t *pool)
+{
+    old_bytes += sizeof(old_node_t);
+
+    return ngx_pcalloc(pool, sizeof(old_node_t));
+}
+
+
+static old_node_t *
+old_insert(ngx_pool_t *pool, old_node_t *root, ngx_str_t *str,
+    ngx_uint_t mode)
+{
+    size_t       i;
+    ngx_int_t    pos, step, index;
+    old_node_t  *p;
+
+    i = 0;
+
+    if (mode & NGX_TRIE_REVERSE) {
+        pos = str->len;
+        step = -1;
+    } else {
+        pos = -1;
+        step = 1;
+    }
+
+    p = root;
+
+    while (i < str->len) {
+        pos = pos + step;
+        index = str->data[pos];
+
+        if (p->next == NULL) {
+            p->next = ngx_pcalloc(pool, OLD_TRIE_KIND * sizeof(old_node_t *));
+            if (p->next == NULL) {
+                return NULL;
+            }
+
+            old_bytes += OLD_TRIE_KIND * sizeof(old_node_t *);
+        }
+
+        if (p->next[index] == NULL) {
+            p->next[index] = old_node_create(pool);
+            if (p->next[index] == NULL) {
+                return NULL;
+            }
+        }
+
+        p = p->next[index];
+        i++;
+    }
+
+    p->key = str->len;
+    if (mode & NGX_TRIE_CONTINUE) {
+        p->greedy = 1;
+    }
+
+    return p;
+}
+
+
+/* with an unbounded queue, the former one wrapped at 300 nodes */
+
+static ngx_int_t
+old_build_clue(old_node_t *root, ngx_uint_t count)
+{
+    ngx_int_t     i;
+    ngx_uint_t    head, tail;
+    old_node_t  **q, *p, *t;
+
+    q = malloc(count * sizeof(old_node_t *));
+    if (q == NULL) {
+        return NGX_ERROR;
+    }
+
+    head = tail = 0;
+    q[head++] = root;
+    root->search_clue = NULL;
+
+    while (head != tail) {
+        t = q[tail++];
+
+        if (t->next == NULL) {
+            continue;
+        }
+
+        for (i = 0; i < OLD_TRIE_KIND; i++) {
+            if (t->next[i] == NULL) {
+                continue;
+            }
+
+            q[head++] = t->next[i];
+
+            if (t == root) {
+                t->next[i]->search_clue = root;
+                continue;
+            }
+
+            for (p = t->search_clue; p != NULL; p = p->search_clue) {
+                if (p->next != NULL && p->next[i] != NULL) {
+                    t->next[i]->search_clue = p->next[i];
+                    break;
+                }
+            }
+
+            if (p == NULL) {
+                t->next[i]->search_clue = root;
+            }
+        }
+    }
+
+    free(q);
+
+    return NGX_OK;
+}
+
+
+static void *
+old_query(old_node_t *root, ngx_str_t *str, ngx_int_t *version_pos,
+    ngx_uint_t mode)
+{
+    void        *value;
+    size_t       i;
+    ngx_int_t    step, pos, index;
+    old_node_t  *p;
+
+    value = NULL;
+    p = root;
+    i = 0;
+
+    if (mode & NGX_TRIE_REVERSE) {
+        pos = str->len;
+        step = -1;
+    } else {
+        pos = -1;
+        step = 1;
+    }
+
+    if (p->next == NULL) {
+        return NULL;
+    }
+
+    while (i < str->len) {
+        pos += step;
+        index = str->data[pos];
+
+        /* a clue without children has no next array */
+        while (p->next == NULL || p->next[index] == NULL) {
+            if (p == root) {
+                break;
+            }
+            p = p->search_clue;
+        }
+
+        p = p->next[index];
+        p = p == NULL ? root : p;
+        if (p->key) {
+            value = p->value;
+            *version_pos = pos + p->key;
+            if (!p->greedy) {
+                return value;
+            }
+            p = root;
+        }
+
+        i++;
+    }
+
+    return value;
+}
+
+
+static size_t
+new_bytes(ngx_trie_t *trie)
+{
+    size_t             size;
+    ngx_uint_t         n, dense, edges;
+    ngx_trie_node_t   *node;
+    ngx_trie_state_t  *s;
+
+    size = sizeof(ngx_trie_t) + trie->count * sizeof(ngx_trie_state_t);
+    dense = 0;
+    edges = 0;
+
+    for (n = 0; n < trie->count; n++) {
+        s = &trie->states[n];
+        node = s->node;
+
+        size += sizeof(ngx_trie_node_t)
+                + node->size * (sizeof(ngx_trie_node_t *) + 1);
+
+        if (s->dense) {
+            dense++;
+
+        } else {
+            edges += s->nnext;
+        }
+    }
+
+    return size + edges * (1 + sizeof(uint32_t))
+           + dense * 256 * sizeof(uint32_t);
+}
+
+
+static double
+now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    char          line[4096], *kw;
+    FILE         *f;
+    double        t0, t, t_old, t_new;
+    size_t        len;
+    ngx_int_t     pos1, pos2;
+    ngx_str_t    *ua, name;
+    ngx_uint_t    n, nkw, nbuiltin, nua, i, r, rounds, mode, old_count, hits;
+    ngx_pool_t   *pool;
+    ngx_trie_t   *trie;
+    ngx_trie_node_t  *node;
+    old_node_t   *root, *on;
+    void         *v1, *v2;
+    volatile ngx_uint_t  sink;
+
+    ngx_pagesize = getpagesize();
+    nbuiltin = sizeof(keywords) / sizeof(char *) - 1;
+
+    nkw = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 3000;
+    rounds = (argc > 3) ? (ngx_uint_t) atoi(argv[3]) : 20;
+
+    pool = ngx_create_pool(16384, &log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    ua = malloc(MAX_UA * sizeof(ngx_str_t));
+    if (ua == NULL) {
+        return 1;
+    }
+
+    nua = 0;
+
+    if (argc > 2 && argv[2][0] != '\0') {
+        f = fopen(argv[2], "r");
+        if (f == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+
+        while (nua < MAX_UA && fgets(line, sizeof(line), f)) {
+            len = strcspn(line, "\r\n");
+            if (len == 0) {
+                continue;
+            }
+
+            ua[nua].data = ngx_pnalloc(pool, len);
+            ua[nua].len = len;
+            ngx_memcpy(ua[nua].data, line, len);
+            nua++;
+        }
+
+        fclose(f);
+
+    } else {
+        for (nua = 0; sample[nua]; nua++) {
+            ua[nua].data = (u_char *) sample[nua];
+            ua[nua].len = ngx_strlen(sample[nua]);
+        }
+    }
+
+    trie = ngx_trie_create(pool);
+    root = old_node_create(pool);
+    if (trie == NULL || root == NULL) {
+        return 1;
+    }
+
+    old_count = 1;
+
+    /*
+     * the common keywords, then made up product tokens with versions,
+     * as long rule sets collect them
+     */
+
+    for (n = 0; n < nkw; n++) {
+        kw = (char *) ngx_pnalloc(pool, 64);
+        if (kw == NULL) {
+            return 1;
+        }
+
+        if (n < nbuiltin) {
+            snprintf(kw, 64, "%s", keywords[n]);
+
+        } else {
+            snprintf(kw, 64, "%s%c%x", keywords[n % nbuiltin], "/-_ "[n % 4],
+                     (unsigned) (n * 2654435761u) >> 16);
+        }
+
+        name.data = (u_char *) kw;
+        name.len = ngx_strlen(kw);
+
+        mode = NGX_TRIE_REVERSE;
+
+        /* Safari, Mobile, Chrome and the like are greedy */
+        if (n < 10) {
+            mode |= NGX_TRIE_CONTINUE;
+        }
+
+        on = old_insert(pool, root, &name, mode);
+        node = trie->insert(trie, &name, mode);
+        if (on == NULL || node == NULL) {
+            return 1;
+        }
+
+        on->value = (void *) (n + 1);
+        node->value = (void *) (n + 1);
+    }
+
+    old_count = old_bytes / sizeof(old_node_t);
+
+    if (old_build_clue(root, trie->count + old_count) != NGX_OK
+        || trie->build_clue(trie) != NGX_OK)
+    {
+        return 1;
+    }
+
+    hits = 0;
+
+    for (i = 0; i < nua; i++) {
+        pos1 = -1;
+        pos2 = -1;
+
+        v1 = old_query(root, &ua[i], &pos1, NGX_TRIE_REVERSE);
+        v2 = trie->query(trie, &ua[i], &pos2, NGX_TRIE_REVERSE);
+
+        if (v1 != v2 || (v1 && pos1 != pos2)) {
+            printf("mismatch: %.*s\n", (int) ua[i].len, ua[i].data);
+            return 1;
+        }
+
+        hits += (v1 != NULL);
+    }
+
+    /* the best of the rounds, interleaved to share any noise */
+
+    sink = 0;
+    t_old = 1e18;
+    t_new = 1e18;
+
+    for (r = 0; r < rounds; r++) {
+        t0 = now();
+
+        for (i = 0; i < nua; i++) {
+            sink += (uintptr_t) old_query(root, &ua[i], &pos1,
+                                          NGX_TRIE_REVERSE);
+        }
+
+        t = (now() - t0) / nua;
+        t_old = ngx_min(t_old, t);
+
+        t0 = now();
+
+        for (i = 0; i < nua; i++) {
+            sink += (uintptr_t) trie->query(trie, &ua[i], &pos1,
+                                            NGX_TRIE_REVERSE);
+        }
+
+        t = (now() - t0) / nua;
+        t_new = ngx_min(t_new, t);
+    }
+
+    printf("%d keywords, %d nodes, %d user agents, %d matched\n",
+           (int) nkw, (int) trie->count, (int) nua, (int) hits);
+    printf("256 pointer nodes %10.1f KB %8.1f ns/query\n",
+           old_bytes / 1024.0, t_old);
+    printf("compiled trie     %10.1f KB %8.1f ns/query\n",
+           new_bytes(trie) / 1024.0, t_new);
+
+    return 0;
+}
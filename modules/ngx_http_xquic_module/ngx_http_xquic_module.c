@@ -4,6 +4,7 @@
 
 #include <ngx_http_xquic_module.h>
 #include <ngx_xquic.h>
+#include <ngx_xquic_recv.h>
 
 
 #define NGX_XQUIC_DEFAULT_DOMAIN_SOCKET_PATH "/dev/shm/tengine/xquic"
@@ -68,6 +69,10 @@ ngx_http_xquic_main_conf_t *ngx_http_xquic_main_conf = NULL;
 static ngx_conf_post_t  ngx_http_xquic_streams_index_mask_post =
     { ngx_http_xquic_streams_index_mask };
 
+static ngx_conf_num_bounds_t  ngx_http_xquic_recv_batch_bounds = {
+    ngx_conf_check_num_bounds, 1, NGX_XQUIC_MAX_RECV_MSG_ONCE
+};
+
 
 
 static ngx_command_t  ngx_http_xquic_commands[] = {
@@ -149,6 +154,20 @@ static ngx_command_t  ngx_http_xquic_commands[] = {
       offsetof(ngx_http_xquic_main_conf_t, socket_rcvbuf),
       NULL },
 
+    { ngx_string("xquic_socket_gro"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_xquic_main_conf_t, socket_gro),
+      NULL },
+
+    { ngx_string("xquic_recv_batch"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_xquic_main_conf_t, recv_batch),
+      &ngx_http_xquic_recv_batch_bounds },
+
     { ngx_string("xquic_congestion_control"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -521,6 +540,8 @@ ngx_http_xquic_create_main_conf(ngx_conf_t *cf)
 
     qmcf->socket_rcvbuf = NGX_CONF_UNSET;
     qmcf->socket_sndbuf = NGX_CONF_UNSET;
+    qmcf->socket_gro = NGX_CONF_UNSET;
+    qmcf->recv_batch = NGX_CONF_UNSET;
 
     qmcf->streams_index_mask = NGX_CONF_UNSET_UINT;
 
@@ -575,6 +596,27 @@ ngx_http_xquic_init_main_conf(ngx_conf_t *cf, void *conf)
         qmcf->socket_sndbuf = 1*1024*1024;
     }
 
+    if (qmcf->socket_gro == NGX_CONF_UNSET) {
+        qmcf->socket_gro = 0;
+    }
+
+#if !defined(T_NGX_XQUIC_SUPPORT_UDP_GRO)
+    if (qmcf->socket_gro) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "|xquic|xquic_socket_gro is not supported "
+                           "on this platform, ignored|");
+        qmcf->socket_gro = 0;
+    }
+#endif
+
+    if (qmcf->recv_batch == NGX_CONF_UNSET) {
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
+        qmcf->recv_batch = 32;
+#else
+        qmcf->recv_batch = 1;
+#endif
+    }
+
     if (qmcf->conn_max_streams_can_create == NGX_CONF_UNSET_UINT) {
         qmcf->conn_max_streams_can_create = 4096;
     }
@@ -805,6 +847,7 @@ ngx_http_xquic_status_handler(ngx_http_request_t *r)
     ngx_buf_t         *b;
     ngx_chain_t        out;
     ngx_atomic_int_t   cps, active, rq, limit_conns, limit_reqs;
+    ngx_atomic_int_t   batches, full_batches, datagrams, packets;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -831,7 +874,9 @@ ngx_http_xquic_status_handler(ngx_http_request_t *r)
     }
 
     size = sizeof("xquic: accepts active requests limit_conns limit_requests\n") - 1
-           + 8 + 5 * NGX_ATOMIC_T_LEN;
+           + 8 + 5 * NGX_ATOMIC_T_LEN
+           + sizeof("recv: batches full_batches datagrams packets\n") - 1
+           + 6 + 4 * NGX_ATOMIC_T_LEN;
 
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
@@ -847,11 +892,21 @@ ngx_http_xquic_status_handler(ngx_http_request_t *r)
     limit_conns = *ngx_stat_quic_conns_refused;
     limit_reqs = *ngx_stat_quic_queries_refused;
 
+    batches = *ngx_stat_quic_recv_batches;
+    full_batches = *ngx_stat_quic_recv_full_batches;
+    datagrams = *ngx_stat_quic_recv_datagrams;
+    packets = *ngx_stat_quic_recv_packets;
+
     b->last = ngx_cpymem(b->last, "xquic: accepts active requests limit_conns limit_requests\n",
                          sizeof("xquic: accepts active requests limit_conns limit_requests\n") - 1);
 
     b->last = ngx_sprintf(b->last, " %uA %uA %uA %uA %uA \n", cps, active, rq, limit_conns, limit_reqs);
 
+    b->last = ngx_cpymem(b->last, "recv: batches full_batches datagrams packets\n",
+                         sizeof("recv: batches full_batches datagrams packets\n") - 1);
+
+    b->last = ngx_sprintf(b->last, " %uA %uA %uA %uA \n", batches, full_batches, datagrams, packets);
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
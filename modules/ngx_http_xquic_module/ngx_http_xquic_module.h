@@ -41,6 +41,10 @@ typedef struct {
 
     ngx_int_t                   socket_rcvbuf;
     ngx_int_t                   socket_sndbuf;
+    ngx_flag_t                  socket_gro;
+
+    /* max datagrams read by one recvmmsg() call */
+    ngx_int_t                   recv_batch;
 
     ngx_uint_t                  conn_max_streams_can_create;
 
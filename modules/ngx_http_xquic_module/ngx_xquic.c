@@ -425,6 +425,19 @@ ngx_xquic_process_init(ngx_cycle_t *cycle)
                         "|xquic|ngx_xquic_process_init|qmcf equals NULL|");
             return NGX_ERROR;  
         }
+
+#if defined(T_NGX_XQUIC_SUPPORT_UDP_GRO)
+        /* reset as well, the socket may be inherited from a GRO config */
+        int gro = qmcf->socket_gro ? 1 : 0;
+        if (setsockopt(c->fd, SOL_UDP, UDP_GRO,
+                       (const void *) &gro, sizeof(int))
+            == -1 && gro)
+        {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, ngx_socket_errno,
+                          "|xquic| setsockopt(UDP_GRO) %V failed, ignored|",
+                          &ls[i].addr_text);
+        }
+#endif
     }
 
     /* socket init end */
@@ -438,6 +451,12 @@ ngx_xquic_process_init(ngx_cycle_t *cycle)
         return NGX_ERROR;
     }
 
+    if (with_xquic && ngx_xquic_recv_init(cycle) != NGX_OK) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                    "|xquic|ngx_xquic_process_init|recv_init fail|");
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -454,6 +473,7 @@ ngx_xquic_process_exit(ngx_cycle_t *cycle)
         qmcf->xquic_engine = NULL;
 
         ngx_xquic_intercom_exit();
+        ngx_xquic_recv_exit();
     }
 }
 
@@ -11,6 +11,26 @@
 #include <xquic/xqc_errno.h>
 
 
+#define NGX_XQUIC_RECV_CMSG_SIZE                                              \
+    (CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int)))
+
+
+static void ngx_xquic_recv_parse_cmsg(ngx_xquic_recv_packet_t *packet,
+    struct msghdr *msg, size_t *gso_size);
+static void ngx_xquic_recv_dispatch(ngx_connection_t *c,
+    ngx_xquic_recv_packet_t *packet);
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
+static ngx_int_t ngx_xquic_recv_mmsg(ngx_connection_t *c, ngx_log_t *log,
+    ngx_http_xquic_main_conf_t *qmcf);
+#endif
+
+
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
+/* per worker buffers for GRO coalesced datagrams, NULL if GRO is off */
+static u_char  *ngx_xquic_gro_buf;
+#endif
+
+
 ngx_inline void
 ngx_xquic_packet_get_cid_raw(xqc_engine_t *engine, unsigned char *payload, size_t sz, 
     xqc_cid_t *dcid, xqc_cid_t *scid)
@@ -32,6 +52,141 @@ ngx_xquic_packet_get_cid(ngx_xquic_recv_packet_t *packet,
     return ngx_xquic_packet_get_cid_raw(engine, (unsigned char *)packet->buf, packet->len, &packet->xquic.dcid, &packet->xquic.scid);
 }
 
+
+ngx_int_t
+ngx_xquic_recv_init(ngx_cycle_t *cycle)
+{
+#if defined(T_NGX_XQUIC_SUPPORT_UDP_GRO)
+    ngx_http_xquic_main_conf_t  *qmcf;
+
+    qmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_xquic_module);
+
+    if (!qmcf->socket_gro || ngx_xquic_gro_buf != NULL) {
+        return NGX_OK;
+    }
+
+    ngx_xquic_gro_buf = ngx_alloc(qmcf->recv_batch * NGX_XQUIC_GRO_BUF_SIZE,
+                                  cycle->log);
+    if (ngx_xquic_gro_buf == NULL) {
+        return NGX_ERROR;
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
+void
+ngx_xquic_recv_exit(void)
+{
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
+    if (ngx_xquic_gro_buf) {
+        ngx_free(ngx_xquic_gro_buf);
+        ngx_xquic_gro_buf = NULL;
+    }
+#endif
+}
+
+
+static void
+ngx_xquic_recv_parse_cmsg(ngx_xquic_recv_packet_t *packet, struct msghdr *msg,
+    size_t *gso_size)
+{
+#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+
+    struct cmsghdr   *cmsg;
+    struct sockaddr  *sockaddr = &packet->local_sockaddr;
+    socklen_t        *socklen  = &packet->local_socklen;
+
+    if (msg->msg_control == NULL) {
+        return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(msg);
+            cmsg != NULL;
+            cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+
+#if (NGX_HAVE_IP_RECVDSTADDR)
+
+        if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_RECVDSTADDR
+                && packet->local_sockaddr.sa_family == AF_INET)
+        {
+            struct in_addr      *addr;
+            struct sockaddr_in  *sin;
+
+            addr = (struct in_addr *) CMSG_DATA(cmsg);
+            sin = (struct sockaddr_in *) sockaddr;
+            sin->sin_family = AF_INET;
+            sin->sin_addr = *addr;
+            *socklen = sizeof(struct sockaddr_in);
+
+            continue;
+        }
+
+#elif (NGX_HAVE_IP_PKTINFO)
+
+        if (cmsg->cmsg_level == IPPROTO_IP
+                && cmsg->cmsg_type == IP_PKTINFO
+                && packet->local_sockaddr.sa_family == AF_INET)
+        {
+            struct in_pktinfo   *pkt;
+            struct sockaddr_in  *sin;
+
+            pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+            sin = (struct sockaddr_in *) sockaddr;
+            sin->sin_family = AF_INET;
+            sin->sin_addr = pkt->ipi_addr;
+            *socklen = sizeof(struct sockaddr_in);
+
+            continue;
+        }
+
+#endif
+
+#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+
+        if (cmsg->cmsg_level == IPPROTO_IPV6
+                && cmsg->cmsg_type == IPV6_PKTINFO
+                && packet->local_sockaddr.sa_family == AF_INET6)
+        {
+            struct in6_pktinfo   *pkt6;
+            struct sockaddr_in6  *sin6;
+
+            pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+            sin6 = (struct sockaddr_in6 *) sockaddr;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_addr = pkt6->ipi6_addr;
+            *socklen = sizeof(struct sockaddr_in6);
+
+            continue;
+        }
+
+#endif
+
+#if defined(T_NGX_XQUIC_SUPPORT_UDP_GRO)
+
+        if (cmsg->cmsg_level == SOL_UDP
+                && cmsg->cmsg_type == UDP_GRO
+                && gso_size != NULL)
+        {
+            int  segment;
+
+            ngx_memcpy(&segment, CMSG_DATA(cmsg), sizeof(int));
+            *gso_size = segment;
+
+            continue;
+        }
+
+#endif
+
+    }
+
+#endif
+}
+
+
 ngx_int_t
 ngx_xquic_recv(ngx_connection_t *c, char *buf, size_t size)
 {
@@ -111,6 +266,9 @@ ngx_xquic_recv_packet(ngx_connection_t *c,
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
 
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+
 #if (NGX_HAVE_IP_RECVDSTADDR || NGX_HAVE_IP_PKTINFO)
     if (packet->local_sockaddr.sa_family == AF_INET) {
         msg.msg_control = &msg_control;
@@ -157,109 +315,197 @@ ngx_xquic_recv_packet(ngx_connection_t *c,
     packet->len = n;
     packet->socklen = msg.msg_namelen;
 
-#if (NGX_HAVE_MSGHDR_MSG_CONTROL)
+    ngx_xquic_recv_parse_cmsg(packet, &msg, NULL);
 
+#if (NGX_DEBUG)
     {
-        struct cmsghdr   *cmsg;
-        struct sockaddr  *sockaddr = &packet->local_sockaddr;
-        socklen_t        *socklen  = &packet->local_socklen;
+        ngx_str_t caddr, saddr;
+        u_char    ctext[NGX_SOCKADDR_STRLEN];
+        u_char    stext[NGX_SOCKADDR_STRLEN];
 
-        for (cmsg = CMSG_FIRSTHDR(&msg);
-                cmsg != NULL;
-                cmsg = CMSG_NXTHDR(&msg, cmsg))
-        {
+        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+            caddr.data = ctext;
+            caddr.len = ngx_sock_ntop(&packet->sockaddr, packet->socklen, ctext,
+                    NGX_SOCKADDR_STRLEN, 1);
+            saddr.data = stext;
+            saddr.len = ngx_sock_ntop(&packet->local_sockaddr, packet->local_socklen, stext,
+                    NGX_SOCKADDR_STRLEN, 1);
 
-#if (NGX_HAVE_IP_RECVDSTADDR)
+            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                    "ngx_xquic_recv_packet: %V->%V fd:%d n:%z",
+                    &caddr, &saddr, c->fd, n);
+        }
 
-            if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_RECVDSTADDR
-                    && packet->local_sockaddr.sa_family == AF_INET)
-            {
-                struct in_addr      *addr;
-                struct sockaddr_in  *sin;
+    }
+#endif
 
-                addr = (struct in_addr *) CMSG_DATA(cmsg);
-                sin = (struct sockaddr_in *) sockaddr;
-                sin->sin_family = AF_INET;
-                sin->sin_addr = *addr;
-                *socklen = sizeof(struct sockaddr_in);
+    /* get dcid here */
+    ngx_xquic_packet_get_cid(packet, engine);
 
-                break;
-            }
+    return NGX_OK;
+}
 
-#elif (NGX_HAVE_IP_PKTINFO)
 
-            if (cmsg->cmsg_level == IPPROTO_IP
-                    && cmsg->cmsg_type == IP_PKTINFO
-                    && packet->local_sockaddr.sa_family == AF_INET)
-            {
-                struct in_pktinfo   *pkt;
-                struct sockaddr_in  *sin;
 
-                pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-                sin = (struct sockaddr_in *) sockaddr;
-                sin->sin_family = AF_INET;
-                sin->sin_addr = pkt->ipi_addr;
-                *socklen = sizeof(struct sockaddr_in);
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
 
-                break;
-            }
+static ngx_int_t
+ngx_xquic_recv_mmsg(ngx_connection_t *c, ngx_log_t *log,
+    ngx_http_xquic_main_conf_t *qmcf)
+{
+    int                               n;
+    u_char                           *p, *last;
+    size_t                            size, gso_size;
+    ngx_err_t                         err;
+    ngx_uint_t                        i, vlen, npackets;
+    ngx_listening_t                  *ls;
+    struct iovec                      iov[NGX_XQUIC_MAX_RECV_MSG_ONCE];
+    struct mmsghdr                    msgs[NGX_XQUIC_MAX_RECV_MSG_ONCE];
+    ngx_xquic_recv_packet_t          *packet;
+    static ngx_xquic_recv_packet_t    packets[NGX_XQUIC_MAX_RECV_MSG_ONCE];
+    static u_char                     msg_control[NGX_XQUIC_MAX_RECV_MSG_ONCE]
+                                                 [NGX_XQUIC_RECV_CMSG_SIZE];
 
-#endif
+    ls = c->listening;
+    vlen = qmcf->recv_batch;
 
-#if (NGX_HAVE_INET6 && NGX_HAVE_IPV6_RECVPKTINFO)
+    ngx_memzero(msgs, vlen * sizeof(struct mmsghdr));
 
-            if (cmsg->cmsg_level == IPPROTO_IPV6
-                    && cmsg->cmsg_type == IPV6_PKTINFO
-                    && packet->local_sockaddr.sa_family == AF_INET6)
-            {
-                struct in6_pktinfo   *pkt6;
-                struct sockaddr_in6  *sin6;
+    for (i = 0; i < vlen; i++) {
+        packet = &packets[i];
 
-                pkt6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-                sin6 = (struct sockaddr_in6 *) sockaddr;
-                sin6->sin6_family = AF_INET6;
-                sin6->sin6_addr = pkt6->ipi6_addr;
-                *socklen = sizeof(struct sockaddr_in6);
+        packet->local_socklen = ls->socklen;
+        ngx_memcpy(&packet->local_sockaddr, ls->sockaddr, ls->socklen);
 
-                break;
-            }
+        if (ngx_xquic_gro_buf) {
+            iov[i].iov_base = ngx_xquic_gro_buf + i * NGX_XQUIC_GRO_BUF_SIZE;
+            iov[i].iov_len = NGX_XQUIC_GRO_BUF_SIZE;
 
-#endif
+        } else {
+            iov[i].iov_base = packet->buf;
+            iov[i].iov_len = sizeof(packet->buf);
+        }
 
+        msgs[i].msg_hdr.msg_name = &packet->sockaddr;
+        msgs[i].msg_hdr.msg_namelen = NGX_SOCKADDRLEN;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = msg_control[i];
+        msgs[i].msg_hdr.msg_controllen = NGX_XQUIC_RECV_CMSG_SIZE;
+    }
+
+    do {
+        n = recvmmsg(c->fd, msgs, vlen, 0, NULL);
+
+        if (n > 0) {
+            break;
+        }
+
+        if (n == 0) {
+            return NGX_AGAIN;
         }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EAGAIN || err == NGX_EINTR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "ngx_quic_recv_mmsg: recvmmsg() not ready");
+            n = NGX_AGAIN;
+        } else if (err == NGX_ECONNREFUSED) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "ngx_quic_recv_mmsg: recvmmsg() get icmp");
+            n = NGX_DONE;
+        } else {
+            n = ngx_connection_error(c, err, "quic recvmmsg() failed");
+            break;
+        }
+    } while (err == NGX_EINTR);
+
+    if (n < 0) {
+        return n;
     }
 
-#endif
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ngx_xquic_recv_mmsg: fd:%d %d of %ui datagrams",
+                   c->fd, n, vlen);
 
-#if (NGX_DEBUG)
-    {
-        ngx_str_t caddr, saddr;
-        u_char    ctext[NGX_SOCKADDR_STRLEN];
-        u_char    stext[NGX_SOCKADDR_STRLEN];
+    npackets = 0;
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            caddr.data = ctext;
-            caddr.len = ngx_sock_ntop(&packet->sockaddr, packet->socklen, ctext,
-                    NGX_SOCKADDR_STRLEN, 1);
-            saddr.data = stext;
-            saddr.len = ngx_sock_ntop(&packet->local_sockaddr, packet->local_socklen, stext,
-                    NGX_SOCKADDR_STRLEN, 1);
+    for (i = 0; i < (ngx_uint_t) n; i++) {
+        packet = &packets[i];
+        packet->socklen = msgs[i].msg_hdr.msg_namelen;
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                    "ngx_xquic_recv_packet: %V->%V fd:%d n:%z",
-                    &caddr, &saddr, c->fd, n);
+        size = msgs[i].msg_len;
+        gso_size = 0;
+
+        ngx_xquic_recv_parse_cmsg(packet, &msgs[i].msg_hdr, &gso_size);
+
+        if (iov[i].iov_base == (void *) packet->buf) {
+            packet->len = size;
+            ngx_xquic_packet_get_cid(packet, qmcf->xquic_engine);
+
+            ngx_xquic_recv_dispatch(c, packet);
+            npackets++;
+
+            continue;
+        }
+
+        /*
+         * a GRO coalesced datagram is a run of gso_size segments,
+         * only the last one may be shorter
+         */
+
+        if (gso_size == 0) {
+            gso_size = size;
         }
 
+        p = iov[i].iov_base;
+        last = p + size;
+
+        for ( /* void */ ; p < last; p += gso_size) {
+            packet->len = ngx_min(gso_size, (size_t) (last - p));
+
+            if (packet->len > sizeof(packet->buf)) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                               "ngx_xquic_recv_mmsg: drop %uz bytes segment",
+                               packet->len);
+                continue;
+            }
+
+            ngx_memcpy(packet->buf, p, packet->len);
+            ngx_xquic_packet_get_cid(packet, qmcf->xquic_engine);
+
+            ngx_xquic_recv_dispatch(c, packet);
+            npackets++;
+        }
     }
-#endif
 
-    /* get dcid here */
-    ngx_xquic_packet_get_cid(packet, engine);
+    (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_batches, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_datagrams, n);
+    (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_packets, npackets);
 
-    return NGX_OK;
+    if ((ngx_uint_t) n == vlen) {
+        (void) ngx_atomic_fetch_add(ngx_stat_quic_recv_full_batches, 1);
+    }
+
+    return n;
 }
 
+#endif
+
+
+static void
+ngx_xquic_recv_dispatch(ngx_connection_t *c, ngx_xquic_recv_packet_t *packet)
+{
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+#endif
+
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
+
+    ngx_xquic_dispatcher_process_packet(c, packet);
+}
 
 
 void
@@ -290,6 +536,27 @@ ngx_xquic_event_recv(ngx_event_t *ev)
                    "ngx_xquic_event_recv on %V, ready: %d",
                    &ls->addr_text, ev->available);
 
+#if defined(T_NGX_XQUIC_SUPPORT_RECVMMSG)
+
+    if (qmcf->recv_batch > 1 || ngx_xquic_gro_buf) {
+
+        /* keep reading while the previous batch was full */
+
+        do {
+            rc = ngx_xquic_recv_mmsg(lc, ev->log, qmcf);
+            if (rc <= 0) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, ngx_socket_errno,
+                               "ngx_xquic_recv_mmsg: return rc=%i.", rc);
+                goto finish_recv;
+            }
+
+        } while (ev->available && rc == qmcf->recv_batch);
+
+        goto finish_recv;
+    }
+
+#endif
+
     do {
         packet.local_socklen = ls->socklen;
         ngx_memcpy(&packet.local_sockaddr, ls->sockaddr, ls->socklen);
@@ -301,14 +568,7 @@ ngx_xquic_event_recv(ngx_event_t *ev)
             goto finish_recv;
         }
 
-#if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
-#endif
-
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
-
-        ngx_xquic_dispatcher_process_packet(lc, &packet);
+        ngx_xquic_recv_dispatch(lc, &packet);
 
         if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
             ev->available --;
@@ -316,6 +576,7 @@ ngx_xquic_event_recv(ngx_event_t *ev)
     } while (ev->available);
 
 finish_recv:
+    /* let the engine run once for everything read above */
     xqc_engine_finish_recv(qmcf->xquic_engine);
 }
 
@@ -9,10 +9,32 @@
 #include <ngx_config.h>
 #include <ngx_event.h>
 #include <ngx_http.h>
+#if defined(__linux__)
+#include <linux/version.h>
+#include <netinet/udp.h>
+#endif
 
 #include <xquic/xquic_typedef.h>
 
 
+#if defined(LINUX_VERSION_CODE)
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33)
+        //The recvmmsg() system call was added in Linux 2.6.33.
+        #define T_NGX_XQUIC_SUPPORT_RECVMMSG
+    #endif
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0) && defined(UDP_GRO)
+        //The UDP_GRO socket option was added in Linux 5.0.
+        #define T_NGX_XQUIC_SUPPORT_UDP_GRO
+    #endif
+#endif
+
+/* max datagrams read by one recvmmsg() call */
+#define NGX_XQUIC_MAX_RECV_MSG_ONCE  64
+
+/* a GRO coalesced datagram never exceeds the max UDP payload */
+#define NGX_XQUIC_GRO_BUF_SIZE       65535
+
+
 typedef struct {
     union {
         struct sockaddr   sockaddr;
@@ -37,6 +59,8 @@ typedef struct {
     size_t                len;
 } ngx_xquic_recv_packet_t;
 
+ngx_int_t ngx_xquic_recv_init(ngx_cycle_t *cycle);
+void ngx_xquic_recv_exit(void);
 ngx_int_t ngx_xquic_recv(ngx_connection_t *c, char *buf, size_t size);
 ngx_int_t ngx_xquic_recv_packet(ngx_connection_t *c, ngx_xquic_recv_packet_t *packet, ngx_log_t *log, xqc_engine_t *engine);
 void ngx_xquic_event_recv(ngx_event_t *ev);
@@ -0,0 +1,1232 @@
+/*
+ * Copyright (C) 2010-2019 Alibaba Group Holding Limited
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#if (T_NGX_HTTP_SYSGUARD)
+#include <ngx_http_sysguard_module.h>
+#endif
+
+#include <zstd.h>
+
+
+#define NGX_HTTP_ZSTD_MAX_LEVEL     19
+
+/* the dcz stream header: a skippable frame carrying the dictionary hash */
+#define NGX_HTTP_ZSTD_DCZ_HEADER    "\x5e\x2a\x4d\x18\x20\x00\x00\x00"
+#define NGX_HTTP_ZSTD_DCZ_LEN       (8 + NGX_HTTP_ZSTD_HASH_LEN)
+
+#define NGX_HTTP_ZSTD_HASH_LEN      32
+
+
+typedef struct {
+    ngx_str_t            name;
+    ngx_str_t            data;
+
+    u_char               hash[NGX_HTTP_ZSTD_HASH_LEN];
+
+    /* the Available-Dictionary request header value, ":<base64>:" */
+    ngx_str_t            id;
+
+    ZSTD_CDict          *cdicts[NGX_HTTP_ZSTD_MAX_LEVEL + 1];
+} ngx_http_zstd_dict_t;
+
+
+typedef struct {
+    ngx_flag_t           enable;
+
+    ngx_hash_t           types;
+
+    ngx_bufs_t           bufs;
+
+    ngx_int_t            level;
+    ssize_t              min_length;
+
+    ngx_int_t            adaptive_usage;
+    ngx_int_t            adaptive_level;
+
+    ngx_http_zstd_dict_t  *dict;
+    ZSTD_CDict          *cdict;
+
+    ngx_array_t         *types_keys;
+} ngx_http_zstd_conf_t;
+
+
+typedef struct {
+    ngx_chain_t         *in;
+    ngx_chain_t         *free;
+    ngx_chain_t         *busy;
+    ngx_chain_t         *out;
+    ngx_chain_t        **last_out;
+
+    ngx_buf_t           *in_buf;
+    ngx_buf_t           *out_buf;
+    ngx_int_t            bufs;
+
+    ZSTD_CCtx           *cctx;
+    ZSTD_EndDirective    op;
+
+    u_char              *next_in;
+    size_t               avail_in;
+    u_char              *next_out;
+    size_t               avail_out;
+
+    unsigned             redo:1;
+    unsigned             done:1;
+    unsigned             nomem:1;
+    unsigned             dict:1;
+
+    ngx_http_request_t  *request;
+} ngx_http_zstd_ctx_t;
+
+
+static ngx_int_t ngx_http_zstd_dict_ok(ngx_http_request_t *r,
+    ngx_http_zstd_conf_t *conf);
+static ngx_int_t ngx_http_zstd_filter_start(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_add_data(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_get_buf(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_compress(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_end(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx);
+static ngx_int_t ngx_http_zstd_filter_level(ngx_http_request_t *r,
+    ngx_http_zstd_conf_t *conf);
+static void ngx_http_zstd_filter_cleanup(void *data);
+
+static ngx_int_t ngx_http_zstd_filter_init(ngx_conf_t *cf);
+static void *ngx_http_zstd_create_conf(ngx_conf_t *cf);
+static char *ngx_http_zstd_merge_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_zstd_adaptive_level(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_zstd_dictionary(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void ngx_http_zstd_dict_cleanup(void *data);
+
+
+static ngx_conf_num_bounds_t  ngx_http_zstd_comp_level_bounds = {
+    ngx_conf_check_num_bounds, 1, NGX_HTTP_ZSTD_MAX_LEVEL
+};
+
+
+static ngx_command_t  ngx_http_zstd_filter_commands[] = {
+
+    { ngx_string("zstd"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, enable),
+      NULL },
+
+    { ngx_string("zstd_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, bufs),
+      NULL },
+
+    { ngx_string("zstd_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, types_keys),
+      &ngx_http_html_default_types[0] },
+
+    { ngx_string("zstd_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, level),
+      &ngx_http_zstd_comp_level_bounds },
+
+    { ngx_string("zstd_min_length"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_zstd_conf_t, min_length),
+      NULL },
+
+    { ngx_string("zstd_adaptive_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_zstd_adaptive_level,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("zstd_dictionary"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_zstd_dictionary,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_zstd_filter_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_zstd_filter_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_zstd_create_conf,             /* create location configuration */
+    ngx_http_zstd_merge_conf               /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_zstd_filter_module = {
+    NGX_MODULE_V1,
+    &ngx_http_zstd_filter_module_ctx,      /* module context */
+    ngx_http_zstd_filter_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_http_zstd_coding = ngx_string("zstd");
+static ngx_str_t  ngx_http_zstd_dict_coding = ngx_string("dcz");
+static ngx_str_t  ngx_http_zstd_available_dict =
+    ngx_string("Available-Dictionary");
+
+static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
+
+
+static ngx_int_t
+ngx_http_zstd_header_filter(ngx_http_request_t *r)
+{
+    ngx_uint_t             dict;
+    ngx_table_elt_t       *h;
+    ngx_http_zstd_ctx_t   *ctx;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (!conf->enable
+        || (r->headers_out.status != NGX_HTTP_OK
+            && r->headers_out.status != NGX_HTTP_FORBIDDEN
+            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len)
+        || (r->headers_out.content_length_n != -1
+            && r->headers_out.content_length_n < conf->min_length)
+        || ngx_http_test_content_type(r, &conf->types) == NULL
+        || r->header_only)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    r->gzip_vary = 1;
+
+#if (NGX_HTTP_DEGRADATION)
+    {
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->gzip_disable_degradation && ngx_http_degraded(r)) {
+        return ngx_http_next_header_filter(r);
+    }
+    }
+#endif
+
+    if (conf->cdict) {
+
+        /* the response also varies on the dictionary the client has */
+
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        ngx_str_set(&h->key, "Vary");
+        h->value = ngx_http_zstd_available_dict;
+    }
+
+    dict = (ngx_http_zstd_dict_ok(r, conf) == NGX_OK);
+
+    if (!dict && ngx_http_coding_ok(r, &ngx_http_zstd_coding) != NGX_OK) {
+        return ngx_http_next_header_filter(r);
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_zstd_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_set_ctx(r, ctx, ngx_http_zstd_filter_module);
+
+    ctx->request = r;
+    ctx->dict = dict;
+
+    h = ngx_list_push(&r->headers_out.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->hash = 1;
+    ngx_str_set(&h->key, "Content-Encoding");
+    h->value = dict ? ngx_http_zstd_dict_coding : ngx_http_zstd_coding;
+    r->headers_out.content_encoding = h;
+
+    r->main_filter_need_in_memory = 1;
+
+    ngx_http_clear_content_length(r);
+    ngx_http_clear_accept_ranges(r);
+    ngx_http_weak_etag(r);
+
+    return ngx_http_next_header_filter(r);
+}
+
+
+static ngx_int_t
+ngx_http_zstd_dict_ok(ngx_http_request_t *r, ngx_http_zstd_conf_t *conf)
+{
+    ngx_str_t         value;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    if (conf->cdict == NULL) {
+        return NGX_DECLINED;
+    }
+
+    part = &r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                return NGX_DECLINED;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].key.len == ngx_http_zstd_available_dict.len
+            && ngx_strncasecmp(header[i].key.data,
+                               ngx_http_zstd_available_dict.data,
+                               ngx_http_zstd_available_dict.len)
+               == 0)
+        {
+            break;
+        }
+    }
+
+    value = header[i].value;
+
+    while (value.len && value.data[value.len - 1] == ' ') {
+        value.len--;
+    }
+
+    if (value.len != conf->dict->id.len
+        || ngx_strncmp(value.data, conf->dict->id.data, value.len) != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return ngx_http_coding_ok(r, &ngx_http_zstd_dict_coding);
+}
+
+
+static ngx_int_t
+ngx_http_zstd_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_int_t             rc;
+    ngx_uint_t            flush;
+    ngx_chain_t          *cl;
+    ngx_http_zstd_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_zstd_filter_module);
+
+    if (ctx == NULL || ctx->done || r->header_only) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http zstd filter");
+
+    if (ctx->cctx == NULL) {
+        if (ngx_http_zstd_filter_start(r, ctx) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    if (in) {
+        if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+            goto failed;
+        }
+
+        r->connection->buffered |= NGX_HTTP_GZIP_BUFFERED;
+    }
+
+    if (ctx->nomem) {
+
+        /* flush busy buffers */
+
+        if (ngx_http_next_body_filter(r, NULL) == NGX_ERROR) {
+            goto failed;
+        }
+
+        cl = NULL;
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &cl,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->nomem = 0;
+        flush = 0;
+
+    } else {
+        flush = ctx->busy ? 1 : 0;
+    }
+
+    for ( ;; ) {
+
+        /* cycle while we can write to a client */
+
+        for ( ;; ) {
+
+            /* cycle while there is data to feed the cctx and ... */
+
+            rc = ngx_http_zstd_filter_add_data(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_AGAIN) {
+                continue;
+            }
+
+
+            /* ... there are buffers to write the cctx output */
+
+            rc = ngx_http_zstd_filter_get_buf(r, ctx);
+
+            if (rc == NGX_DECLINED) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+
+            rc = ngx_http_zstd_filter_compress(r, ctx);
+
+            if (rc == NGX_OK) {
+                break;
+            }
+
+            if (rc == NGX_ERROR) {
+                goto failed;
+            }
+
+            /* rc == NGX_AGAIN */
+        }
+
+        if (ctx->out == NULL && !flush) {
+            return ctx->busy ? NGX_AGAIN : NGX_OK;
+        }
+
+        rc = ngx_http_next_body_filter(r, ctx->out);
+
+        if (rc == NGX_ERROR) {
+            goto failed;
+        }
+
+        ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                (ngx_buf_tag_t) &ngx_http_zstd_filter_module);
+        ctx->last_out = &ctx->out;
+
+        ctx->nomem = 0;
+        flush = 0;
+
+        if (ctx->done) {
+            return rc;
+        }
+    }
+
+    /* unreachable */
+
+failed:
+
+    ctx->done = 1;
+
+    ngx_http_zstd_filter_cleanup(ctx);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_start(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t                 rc;
+    ngx_buf_t             *b;
+    ngx_int_t              level;
+    ngx_chain_t           *cl;
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->cctx = ZSTD_createCCtx();
+    if (ctx->cctx == NULL) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_createCCtx() failed");
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_zstd_filter_cleanup;
+    cln->data = ctx;
+
+    ctx->last_out = &ctx->out;
+    ctx->op = ZSTD_e_continue;
+
+    if (ctx->dict) {
+
+        /* the dictionary compression level is fixed by its cdict */
+
+        rc = ZSTD_CCtx_refCDict(ctx->cctx, conf->cdict);
+        if (ZSTD_isError(rc)) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "ZSTD_CCtx_refCDict() failed: %s",
+                          ZSTD_getErrorName(rc));
+            return NGX_ERROR;
+        }
+
+        b = ngx_create_temp_buf(r->pool, NGX_HTTP_ZSTD_DCZ_LEN);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, NGX_HTTP_ZSTD_DCZ_HEADER, 8);
+        b->last = ngx_cpymem(b->last, conf->dict->hash,
+                             NGX_HTTP_ZSTD_HASH_LEN);
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+    } else {
+        level = ngx_http_zstd_filter_level(r, conf);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "zstd level:%i", level);
+
+        rc = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel,
+                                    (int) level);
+        if (ZSTD_isError(rc)) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "ZSTD_CCtx_setParameter() failed: %s",
+                          ZSTD_getErrorName(rc));
+            return NGX_ERROR;
+        }
+    }
+
+    /*
+     * a known length shrinks the window and the tables to the response,
+     * much like the gzip filter does with its window bits
+     */
+
+    if (r->headers_out.content_length_n > 0) {
+        rc = ZSTD_CCtx_setPledgedSrcSize(ctx->cctx,
+                                  (unsigned long long)
+                                  r->headers_out.content_length_n);
+        if (ZSTD_isError(rc)) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "ZSTD_CCtx_setPledgedSrcSize() failed: %s",
+                          ZSTD_getErrorName(rc));
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_add_data(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_chain_t  *cl;
+
+    if (ctx->avail_in || ctx->op != ZSTD_e_continue || ctx->redo) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in: %p", ctx->in);
+
+    if (ctx->in == NULL) {
+        return NGX_DECLINED;
+    }
+
+    cl = ctx->in;
+    ctx->in_buf = cl->buf;
+    ctx->in = cl->next;
+
+    ngx_free_chain(r->pool, cl);
+
+    ctx->next_in = ctx->in_buf->pos;
+    ctx->avail_in = ctx->in_buf->last - ctx->in_buf->pos;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd in_buf:%p ni:%p ai:%uz",
+                   ctx->in_buf, ctx->next_in, ctx->avail_in);
+
+    if (ctx->in_buf->last_buf) {
+        ctx->op = ZSTD_e_end;
+
+    } else if (ctx->in_buf->flush) {
+        ctx->op = ZSTD_e_flush;
+
+    } else if (ctx->avail_in == 0) {
+        /* ctx->op == ZSTD_e_continue */
+        return NGX_AGAIN;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_get_buf(ngx_http_request_t *r,
+    ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_chain_t             *cl;
+    ngx_http_zstd_conf_t  *conf;
+
+    if (ctx->avail_out) {
+        return NGX_OK;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_zstd_filter_module);
+
+    if (ctx->free) {
+
+        cl = ctx->free;
+        ctx->out_buf = cl->buf;
+        ctx->free = cl->next;
+
+        ngx_free_chain(r->pool, cl);
+
+    } else if (ctx->bufs < conf->bufs.num) {
+
+        ctx->out_buf = ngx_create_temp_buf(r->pool, conf->bufs.size);
+        if (ctx->out_buf == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx->out_buf->tag = (ngx_buf_tag_t) &ngx_http_zstd_filter_module;
+        ctx->out_buf->recycled = 1;
+        ctx->bufs++;
+
+    } else {
+        ctx->nomem = 1;
+        return NGX_DECLINED;
+    }
+
+    ctx->next_out = ctx->out_buf->pos;
+    ctx->avail_out = conf->bufs.size;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_compress(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    size_t           rc;
+    ngx_buf_t       *b;
+    ngx_uint_t       finished;
+    ngx_chain_t     *cl;
+    ZSTD_inBuffer    input;
+    ZSTD_outBuffer   output;
+
+    ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "zstd compress in: ni:%p no:%p ai:%uz ao:%uz op:%d redo:%d",
+                 ctx->next_in, ctx->next_out, ctx->avail_in, ctx->avail_out,
+                 ctx->op, ctx->redo);
+
+    input.src = ctx->next_in;
+    input.size = ctx->avail_in;
+    input.pos = 0;
+
+    output.dst = ctx->next_out;
+    output.size = ctx->avail_out;
+    output.pos = 0;
+
+    rc = ZSTD_compressStream2(ctx->cctx, &output, &input, ctx->op);
+
+    if (ZSTD_isError(rc)) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "ZSTD_compressStream2() failed: %d, %s",
+                      ctx->op, ZSTD_getErrorName(rc));
+        return NGX_ERROR;
+    }
+
+    ctx->avail_in -= input.pos;
+    ctx->next_out += output.pos;
+    ctx->avail_out -= output.pos;
+
+    /* rc is the amount of data zstd still has to flush */
+
+    finished = (ctx->op == ZSTD_e_end && rc == 0);
+
+    ngx_log_debug5(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "zstd compress out: ni:%p no:%p ai:%uz ao:%uz rc:%uz",
+                   ctx->next_in, ctx->next_out, ctx->avail_in, ctx->avail_out,
+                   rc);
+
+    if (ctx->next_in) {
+        ctx->next_in += input.pos;
+        ctx->in_buf->pos = ctx->next_in;
+
+        if (ctx->avail_in == 0) {
+            ctx->next_in = NULL;
+        }
+    }
+
+    ctx->out_buf->last = ctx->next_out;
+
+    if (ctx->avail_out == 0 && !finished) {
+
+        /* zstd wants to output some more data */
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ctx->out_buf;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    if (ctx->op != ZSTD_e_continue && rc != 0) {
+
+        /* a flush or the frame end is not complete yet */
+
+        ctx->redo = 1;
+
+        return NGX_AGAIN;
+    }
+
+    ctx->redo = 0;
+
+    if (ctx->op == ZSTD_e_flush) {
+
+        ctx->op = ZSTD_e_continue;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ctx->out_buf;
+
+        if (ngx_buf_size(b) == 0) {
+
+            b = ngx_calloc_buf(ctx->request->pool);
+            if (b == NULL) {
+                return NGX_ERROR;
+            }
+
+        } else {
+            ctx->avail_out = 0;
+        }
+
+        b->flush = 1;
+
+        cl->buf = b;
+        cl->next = NULL;
+        *ctx->last_out = cl;
+        ctx->last_out = &cl->next;
+
+        r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+        return NGX_OK;
+    }
+
+    if (finished) {
+        return ngx_http_zstd_filter_end(r, ctx);
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_end(ngx_http_request_t *r, ngx_http_zstd_ctx_t *ctx)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    ZSTD_freeCCtx(ctx->cctx);
+    ctx->cctx = NULL;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_ERROR;
+    }
+
+    b = ctx->out_buf;
+
+    if (ngx_buf_size(b) == 0) {
+        b->temporary = 0;
+    }
+
+    b->last_buf = 1;
+
+    cl->buf = b;
+    cl->next = NULL;
+    *ctx->last_out = cl;
+    ctx->last_out = &cl->next;
+
+    ctx->avail_in = 0;
+    ctx->avail_out = 0;
+
+    ctx->done = 1;
+
+    r->connection->buffered &= ~NGX_HTTP_GZIP_BUFFERED;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_level(ngx_http_request_t *r, ngx_http_zstd_conf_t *conf)
+{
+#if (T_NGX_HTTP_SYSGUARD)
+    ngx_int_t  usage;
+
+    if (conf->adaptive_usage == NGX_CONF_UNSET) {
+        return conf->level;
+    }
+
+    /*
+     * the level goes down linearly from zstd_comp_level at the
+     * configured cpu usage to the adaptive level at 100% usage
+     */
+
+    usage = ngx_http_sysguard_cpu_usage(r);
+
+    if (usage > conf->adaptive_usage) {
+        return conf->level - (conf->level - conf->adaptive_level)
+                             * (ngx_min(usage, 10000) - conf->adaptive_usage)
+                             / (10000 - conf->adaptive_usage);
+    }
+#endif
+
+    return conf->level;
+}
+
+
+static void
+ngx_http_zstd_filter_cleanup(void *data)
+{
+    ngx_http_zstd_ctx_t  *ctx = data;
+
+    if (ctx->cctx) {
+        ZSTD_freeCCtx(ctx->cctx);
+        ctx->cctx = NULL;
+    }
+}
+
+
+static void *
+ngx_http_zstd_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_zstd_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_zstd_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->bufs.num = 0;
+     *     conf->types = { NULL };
+     *     conf->types_keys = NULL;
+     *     conf->cdict = NULL;
+     */
+
+    conf->enable = NGX_CONF_UNSET;
+
+    conf->level = NGX_CONF_UNSET;
+    conf->min_length = NGX_CONF_UNSET;
+
+    conf->adaptive_usage = NGX_CONF_UNSET;
+    conf->adaptive_level = NGX_CONF_UNSET;
+
+    conf->dict = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_zstd_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_zstd_conf_t *prev = parent;
+    ngx_http_zstd_conf_t *conf = child;
+
+    ngx_http_zstd_dict_t  *dict;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+
+    ngx_conf_merge_bufs_value(conf->bufs, prev->bufs,
+                              (128 * 1024) / ngx_pagesize, ngx_pagesize);
+
+    ngx_conf_merge_value(conf->level, prev->level, ZSTD_CLEVEL_DEFAULT);
+    ngx_conf_merge_value(conf->min_length, prev->min_length, 20);
+
+    if (conf->adaptive_usage == NGX_CONF_UNSET
+        && conf->adaptive_level == NGX_CONF_UNSET)
+    {
+        conf->adaptive_usage = prev->adaptive_usage;
+        conf->adaptive_level = prev->adaptive_level;
+    }
+
+    if (conf->adaptive_level > conf->level) {
+        conf->adaptive_level = conf->level;
+    }
+
+    ngx_conf_merge_ptr_value(conf->dict, prev->dict, NULL);
+
+    if (conf->dict) {
+
+        /* digested dictionaries are shared by all locations using a level */
+
+        dict = conf->dict;
+
+        if (dict->cdicts[conf->level] == NULL) {
+            dict->cdicts[conf->level] = ZSTD_createCDict(dict->data.data,
+                                                         dict->data.len,
+                                                         (int) conf->level);
+            if (dict->cdicts[conf->level] == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ZSTD_createCDict(\"%V\") failed",
+                                   &dict->name);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        conf->cdict = dict->cdicts[conf->level];
+    }
+
+    if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                             &prev->types_keys, &prev->types,
+                             ngx_http_html_default_types)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_zstd_filter_init(ngx_conf_t *cf)
+{
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_zstd_header_filter;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_zstd_body_filter;
+
+    return NGX_OK;
+}
+
+
+static char *
+ngx_http_zstd_adaptive_level(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_zstd_conf_t  *zcf = conf;
+
+    ngx_str_t   *value;
+    ngx_uint_t   i;
+#if (T_NGX_HTTP_SYSGUARD)
+    ngx_int_t    n;
+#endif
+
+    if (zcf->adaptive_usage != NGX_CONF_UNSET
+        || zcf->adaptive_level != NGX_CONF_UNSET)
+    {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            i = 2;
+            goto invalid;
+        }
+
+        /* keeps the level set, so that "off" is not overridden by merge */
+
+        zcf->adaptive_level = 1;
+
+        return NGX_CONF_OK;
+    }
+
+#if !(T_NGX_HTTP_SYSGUARD)
+
+    return "requires ngx_http_sysguard_module";
+
+#else
+
+    zcf->adaptive_level = 1;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "usage=", 6) == 0) {
+
+            n = ngx_atofp(value[i].data + 6, value[i].len - 6, 2);
+            if (n == NGX_ERROR || n > 10000) {
+                goto invalid;
+            }
+
+            zcf->adaptive_usage = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "level=", 6) == 0) {
+
+            n = ngx_atoi(value[i].data + 6, value[i].len - 6);
+            if (n == NGX_ERROR || n < 1 || n > NGX_HTTP_ZSTD_MAX_LEVEL) {
+                goto invalid;
+            }
+
+            zcf->adaptive_level = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (zcf->adaptive_usage == NGX_CONF_UNSET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"usage\" parameter is required");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+
+#endif
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_zstd_dictionary(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_OPENSSL)
+
+    ngx_http_zstd_conf_t  *zcf = conf;
+
+    u_char                *p;
+    size_t                 size;
+    ssize_t                n;
+    ngx_str_t             *value, hash, id;
+    ngx_file_t             file;
+    ngx_file_info_t        fi;
+    ngx_pool_cleanup_t    *cln;
+    ngx_http_zstd_dict_t  *dict;
+
+    if (zcf->dict != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        zcf->dict = NULL;
+        return NGX_CONF_OK;
+    }
+
+    dict = ngx_pcalloc(cf->pool, sizeof(ngx_http_zstd_dict_t));
+    if (dict == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_zstd_dict_cleanup;
+    cln->data = dict;
+
+    dict->name = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &dict->name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = dict->name;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", &file.name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", &file.name);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "dictionary \"%V\" is empty", &file.name);
+        goto failed;
+    }
+
+    dict->data.data = ngx_pnalloc(cf->pool, size);
+    if (dict->data.data == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, dict->data.data, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_read_file_n " \"%V\" failed", &file.name);
+        goto failed;
+    }
+
+    if ((size_t) n != size) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
+                           ngx_read_file_n " \"%V\" returned only "
+                           "%z bytes instead of %uz", &file.name, n, size);
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    dict->data.len = size;
+
+    /* the dictionary is identified by its sha-256 hash, RFC 9842 */
+
+    if (EVP_Digest(dict->data.data, size, dict->hash, NULL, EVP_sha256(), NULL)
+        == 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, cf->log, 0, "EVP_Digest() failed");
+        return NGX_CONF_ERROR;
+    }
+
+    hash.data = dict->hash;
+    hash.len = NGX_HTTP_ZSTD_HASH_LEN;
+
+    p = ngx_pnalloc(cf->pool, ngx_base64_encoded_length(hash.len) + 2);
+    if (p == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    id.data = p + 1;
+    ngx_encode_base64(&id, &hash);
+
+    p[0] = ':';
+    p[id.len + 1] = ':';
+
+    dict->id.data = p;
+    dict->id.len = id.len + 2;
+
+    zcf->dict = dict;
+
+    return NGX_CONF_OK;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file.name);
+    }
+
+    return NGX_CONF_ERROR;
+
+#else
+
+    return "requires OpenSSL for dictionary hashes";
+
+#endif
+}
+
+
+static void
+ngx_http_zstd_dict_cleanup(void *data)
+{
+    ngx_http_zstd_dict_t  *dict = data;
+
+    ngx_uint_t  i;
+
+    for (i = 0; i <= NGX_HTTP_ZSTD_MAX_LEVEL; i++) {
+        if (dict->cdicts[i]) {
+            ZSTD_freeCDict(dict->cdicts[i]);
+        }
+    }
+}
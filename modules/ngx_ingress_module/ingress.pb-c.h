@@ -28,6 +28,7 @@ typedef struct _Ingress__Upstream Ingress__Upstream;
 typedef struct _Ingress__Metadata Ingress__Metadata;
 typedef struct _Ingress__VirtualService Ingress__VirtualService;
 typedef struct _Ingress__Config Ingress__Config;
+typedef struct _Ingress__ConfigDelta Ingress__ConfigDelta;
 
 
 /* --- enums --- */
@@ -263,6 +264,34 @@ struct  _Ingress__Config
     , 0,NULL, 0,NULL }
 
 
+struct  _Ingress__ConfigDelta
+{
+  ProtobufCMessage base;
+  /*
+   * version the delta applies on
+   */
+  protobuf_c_boolean has_base_version;
+  uint64_t base_version;
+  /*
+   * host routers added or replaced
+   */
+  size_t n_routers;
+  Ingress__Router **routers;
+  /*
+   * services added or replaced
+   */
+  size_t n_services;
+  Ingress__VirtualService **services;
+  size_t n_removed_hosts;
+  char **removed_hosts;
+  size_t n_removed_services;
+  char **removed_services;
+};
+#define INGRESS__CONFIG_DELTA__INIT \
+ { PROTOBUF_C_MESSAGE_INIT (&ingress__config_delta__descriptor) \
+    , 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL }
+
+
 /* Ingress__TagItem methods */
 void   ingress__tag_item__init
                      (Ingress__TagItem         *message);
@@ -510,6 +539,25 @@ Ingress__Config *
 void   ingress__config__free_unpacked
                      (Ingress__Config *message,
                       ProtobufCAllocator *allocator);
+/* Ingress__ConfigDelta methods */
+void   ingress__config_delta__init
+                     (Ingress__ConfigDelta         *message);
+size_t ingress__config_delta__get_packed_size
+                     (const Ingress__ConfigDelta   *message);
+size_t ingress__config_delta__pack
+                     (const Ingress__ConfigDelta   *message,
+                      uint8_t             *out);
+size_t ingress__config_delta__pack_to_buffer
+                     (const Ingress__ConfigDelta   *message,
+                      ProtobufCBuffer     *buffer);
+Ingress__ConfigDelta *
+       ingress__config_delta__unpack
+                     (ProtobufCAllocator  *allocator,
+                      size_t               len,
+                      const uint8_t       *data);
+void   ingress__config_delta__free_unpacked
+                     (Ingress__ConfigDelta *message,
+                      ProtobufCAllocator *allocator);
 /* --- per-message closures --- */
 
 typedef void (*Ingress__TagItem_Closure)
@@ -551,6 +599,9 @@ typedef void (*Ingress__VirtualService_Closure)
 typedef void (*Ingress__Config_Closure)
                  (const Ingress__Config *message,
                   void *closure_data);
+typedef void (*Ingress__ConfigDelta_Closure)
+                 (const Ingress__ConfigDelta *message,
+                  void *closure_data);
 
 /* --- services --- */
 
@@ -572,6 +623,7 @@ extern const ProtobufCMessageDescriptor ingress__upstream__descriptor;
 extern const ProtobufCMessageDescriptor ingress__metadata__descriptor;
 extern const ProtobufCMessageDescriptor ingress__virtual_service__descriptor;
 extern const ProtobufCMessageDescriptor ingress__config__descriptor;
+extern const ProtobufCMessageDescriptor ingress__config_delta__descriptor;
 
 PROTOBUF_C__END_DECLS
 
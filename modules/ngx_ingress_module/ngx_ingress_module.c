@@ -274,6 +274,11 @@ ngx_ingress_check_upstream_enable(ngx_ingress_service_t *service)
 {
     ngx_int_t   enable = 0;
 
+    if (service == NULL) {
+        /* removed by a delta */
+        return enable;
+    }
+
     if (service->upstreams == NULL || service->upstreams->nelts == 0) {
         /* No upstream is processed according to no rules */
         return enable;
@@ -369,9 +374,67 @@ ngx_ingress_get_req_tag_value(ngx_http_request_t *r, Ingress__LocationType locat
     return NGX_OK;
 }
 
+typedef struct {
+    ngx_http_request_t         *r;
+    ngx_shm_array_t            *keys;       /* host tag_keys */
+    ngx_str_t                  *values;     /* indexed like keys, NULL until resolved */
+} ngx_ingress_tag_ctx_t;
+
+/* resolve every header referenced by the host tags in one pass */
+static ngx_int_t
+ngx_ingress_resolve_tag_values(ngx_ingress_tag_ctx_t *ctx)
+{
+    ngx_uint_t                      i, k, left;
+    ngx_str_t                      *keys;
+    ngx_list_part_t                *part;
+    ngx_table_elt_t                *header;
+
+    ctx->values = ngx_pcalloc(ctx->r->pool, ctx->keys->nelts * sizeof(ngx_str_t));
+    if (ctx->values == NULL) {
+        return NGX_ERROR;
+    }
+
+    keys = ctx->keys->elts;
+    left = ctx->keys->nelts;
+
+    part = &ctx->r->headers_in.headers.part;
+    header = part->elts;
+
+    for (i = 0; left; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        for (k = 0; k < ctx->keys->nelts; k++) {
+            /* the first header with a name wins, as in ngx_http_header_in() */
+            if (ctx->values[k].data == NULL
+                && keys[k].len == header[i].key.len
+                && ngx_strncasecmp(header[i].key.data, keys[k].data, keys[k].len) == 0)
+            {
+                ctx->values[k] = header[i].value;
+                left--;
+                break;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
 static ngx_ingress_service_t *
 ngx_ingress_get_tag_match_service(ngx_ingress_gateway_t *gateway,
-ngx_http_request_t *r, ngx_shm_array_t *tags)
+ngx_ingress_tag_ctx_t *ctx, ngx_shm_array_t *tags)
 {
     ngx_uint_t                      i, j, k;
     ngx_ingress_service_t          *service = NULL;
@@ -393,7 +456,21 @@ ngx_http_request_t *r, ngx_shm_array_t *tags)
             /* Traversing each tag item, each item must match before returning */
             for (k = 0; k < tag_rule[j].items->nelts; k++) {
 
-                ret = ngx_ingress_get_req_tag_value(r, tag_item[k].location, &tag_item[k].key, &value);
+                if (tag_item[k].location == INGRESS__LOCATION_TYPE__LocHttpHeader) {
+
+                    if (ctx->values == NULL
+                        && ngx_ingress_resolve_tag_values(ctx) != NGX_OK)
+                    {
+                        return NULL;
+                    }
+
+                    value = ctx->values[tag_item[k].key_index];
+                    ret = NGX_OK;
+
+                } else {
+                    ret = ngx_ingress_get_req_tag_value(ctx->r, tag_item[k].location, &tag_item[k].key, &value);
+                }
+
                 /* The request does not carry the target parameter */
                 if (ret != NGX_OK) {
                     break;
@@ -408,29 +485,84 @@ ngx_http_request_t *r, ngx_shm_array_t *tags)
 
             /* every item matched */
             if (k == tag_rule[j].items->nelts) {
-                if (ngx_ingress_check_upstream_enable(tag_router[i].service)) {
-                    return tag_router[i].service;
+                /* loaded once, a delta may swap it meanwhile */
+                service = tag_router[i].entry->service;
+
+                if (ngx_ingress_check_upstream_enable(service)) {
+                    return service;
                 }
             }
         }
     }
 
-    return service;
+    return NULL;
+}
+
+/* the deepest trie node whose prefix matches uri case-insensitively */
+static ngx_ingress_path_node_t *
+ngx_ingress_match_path_node(ngx_ingress_path_node_t *node, ngx_str_t *uri)
+{
+    u_char                      c, *p, *last;
+    ngx_uint_t                  lo, hi, mid;
+    ngx_ingress_path_node_t    *child, *match;
+
+    match = node->nrouters ? node : NULL;
+
+    p = uri->data;
+    last = uri->data + uri->len;
+
+    while (p < last && node->nchildren) {
+
+        c = ngx_tolower(*p);
+        child = NULL;
+
+        lo = 0;
+        hi = node->nchildren;
+
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+
+            if (node->children[mid].label.data[0] == c) {
+                child = &node->children[mid];
+                break;
+            }
+
+            if (node->children[mid].label.data[0] < c) {
+                lo = mid + 1;
+
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (child == NULL
+            || (size_t) (last - p) < child->label.len
+            || ngx_strncasecmp(p, child->label.data, child->label.len) != 0)
+        {
+            break;
+        }
+
+        p += child->label.len;
+        node = child;
+
+        if (node->nrouters) {
+            match = node;
+        }
+    }
+
+    return match;
 }
 
 static ngx_ingress_service_t *
-ngx_ingress_match_service(ngx_ingress_gateway_t *gateway, ngx_http_request_t* r)
+ngx_ingress_match_service(ngx_ingress_gateway_t *gateway, ngx_ingress_t *current,
+    ngx_http_request_t* r)
 {
     ngx_uint_t i;
-    ngx_ingress_t *current;
     ngx_ingress_service_t *service = NULL;
     ngx_ingress_host_router_t host_key;
     ngx_ingress_host_router_t *host_router;
-
-    current = ngx_strategy_get_current_slot(gateway->ingress_app);
-    if (current == NULL) {
-        return NULL;
-    }
+    ngx_ingress_path_node_t *node;
+    ngx_ingress_tag_ctx_t ctx;
 
     /* request no host */
     if (r->headers_in.server.len == 0) {
@@ -457,32 +589,43 @@ ngx_ingress_match_service(ngx_ingress_gateway_t *gateway, ngx_http_request_t* r)
         return NULL;
     }
 
-    /* match path */
-    ngx_ingress_path_router_t *path_router = host_router->paths->elts;
-    for (i = 0; i < host_router->paths->nelts; i++) {
-        if (ngx_comm_prefix_casecmp(&r->uri, &path_router[i].prefix) == 0) {
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                          "|ingress|match prefix prefix|%V|%V|",
-                          &host_key.host,
-                          &r->uri);
-            
+    ctx.r = r;
+    ctx.keys = host_router->tag_keys;
+    ctx.values = NULL;
+
+    /* match path: longest prefix first, falling back to shorter ones */
+    for (node = ngx_ingress_match_path_node(host_router->trie, &r->uri);
+         node;
+         node = node->fallback)
+    {
+        ngx_ingress_path_router_t *path_router = node->routers;
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|match prefix prefix|%V|%V|",
+                      &host_key.host,
+                      &r->uri);
+
+        for (i = 0; i < node->nrouters; i++) {
+
             /* if path route has tag router, match first */
             if (path_router[i].tags) {
-                service = ngx_ingress_get_tag_match_service(gateway, r, path_router[i].tags);
+                service = ngx_ingress_get_tag_match_service(gateway, &ctx, path_router[i].tags);
                 if (service) {
                     return service;
                 }
             }
 
-            if (ngx_ingress_check_upstream_enable(path_router[i].service)) {
-                return path_router[i].service;
+            service = path_router[i].entry->service;
+
+            if (ngx_ingress_check_upstream_enable(service)) {
+                return service;
             }
         }
     }
 
     /* if host route has tag router, match first */
     if (host_router->tags) {
-        service = ngx_ingress_get_tag_match_service(gateway, r, host_router->tags);
+        service = ngx_ingress_get_tag_match_service(gateway, &ctx, host_router->tags);
         if (service) {
             return service;
         }
@@ -491,9 +634,86 @@ ngx_ingress_match_service(ngx_ingress_gateway_t *gateway, ngx_http_request_t* r)
     ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
                   "|ingress|match host|%V|%V|", &host_key.host, &r->uri);
     
-    return host_router->service;
+    return host_router->entry->service;
 }
 
+/*
+ * Each strategy slot applies a delta to its own tables. The slot that was
+ * current before the last switch is one version behind, so it applies the
+ * same delta on its next turn; if a newer delta has already arrived by then,
+ * the previous one is replayed first. A slot that cannot follow the chain
+ * is left alone and the producer has to publish a full config.
+ */
+static ngx_int_t
+ngx_ingress_update_delta(ngx_ingress_gateway_t *gateway,
+    ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress)
+{
+    size_t                  used;
+    ngx_int_t               rc;
+    Ingress__ConfigDelta   *pbdelta = shm_pb_config->pbdelta;
+
+    if (!pbdelta->has_base_version || pbdelta->base_version == 0) {
+        ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                 "|ingress|delta without base version|%V|", &gateway->name);
+        return NGX_ERROR;
+    }
+
+    /* retired objects are only reclaimed by a full config */
+    used = ngx_shm_pool_size(ingress->pool) - ngx_shm_pool_free_size(ingress->pool);
+
+    if (ingress->retired > used / 2) {
+        ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                 "|ingress|retired %uz of %uz pool bytes, need full config|%V|",
+                 ingress->retired, used, &gateway->name);
+        return NGX_ERROR;
+    }
+
+    if (ingress->version == pbdelta->base_version) {
+        rc = ngx_ingress_update_shm_by_delta(gateway, pbdelta, ingress);
+
+    } else if (gateway->last_delta != NULL
+               && gateway->last_delta->base_version == ingress->version
+               && gateway->last_delta_version == pbdelta->base_version)
+    {
+        rc = ngx_ingress_update_shm_by_delta(gateway, gateway->last_delta, ingress);
+        if (rc == NGX_OK) {
+            ingress->version = gateway->last_delta_version;
+            rc = ngx_ingress_update_shm_by_delta(gateway, pbdelta, ingress);
+        }
+
+    } else {
+        ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                 "|ingress|delta base mismatch, need full config|%V|%uL|%uL|",
+                 &gateway->name, ingress->version, pbdelta->base_version);
+        return NGX_ERROR;
+    }
+
+    if (rc != NGX_OK) {
+        /* nothing of a failed delta is published, the slot keeps its version */
+        ngx_log_error(NGX_LOG_EMERG, ngx_cycle->log, 0,
+                 "|ingress|apply delta failed|%V|%uL|", &gateway->name, shm_pb_config->version);
+        return NGX_ERROR;
+    }
+
+    ingress->version = shm_pb_config->version;
+
+    if (gateway->last_delta_version != shm_pb_config->version) {
+        if (gateway->last_delta != NULL) {
+            ingress__config_delta__free_unpacked(gateway->last_delta, NULL);
+        }
+
+        gateway->last_delta = pbdelta;
+        gateway->last_delta_version = shm_pb_config->version;
+        shm_pb_config->pbdelta = NULL;
+    }
+
+    ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                  "|ingress|update ingress delta succ|%uL|%*s|retired %uz|",
+                  ingress->version, NGX_COMM_MD5_HEX_LEN,
+                  shm_pb_config->md5_digit, ingress->retired);
+
+    return NGX_OK;
+}
 
 ngx_int_t
 ngx_ingress_update(ngx_cycle_t *cycle,
@@ -523,6 +743,24 @@ ngx_ingress_update(ngx_cycle_t *cycle,
         return NGX_ERROR;
     }
 
+    if (shm_pb_config.type == NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA) {
+        rc = ngx_ingress_update_delta(gateway, &shm_pb_config, ingress);
+
+        ngx_ingress_shared_memory_free_pb(&shm_pb_config);
+
+        ngx_ingress_shared_memory_write_status(gateway->shared,
+            rc == NGX_OK ? NGX_INGRESS_SHARED_MEMORY_TYPE_SUCCESS : NGX_INGRESS_SHARED_MEMORY_TYPE_ERR);
+
+        return rc;
+    }
+
+    /* a full config starts a new delta chain */
+    if (gateway->last_delta != NULL) {
+        ingress__config_delta__free_unpacked(gateway->last_delta, NULL);
+        gateway->last_delta = NULL;
+        gateway->last_delta_version = 0;
+    }
+
     if (ingress->version != 0 && shm_pb_config.pbconfig->n_services == 0) {
         /* empty config protection */
         ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
@@ -531,6 +769,7 @@ ngx_ingress_update(ngx_cycle_t *cycle,
     }
 
     ngx_shm_pool_reset(ingress->pool);
+    ingress->retired = 0;
 
     rc = ngx_ingress_update_shm_by_pb(gateway, &shm_pb_config, ingress);
     if (rc != NGX_OK) {
@@ -903,21 +1142,17 @@ ngx_ingress_gateway_shm_config(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
+/* everything needed from the slot is copied into the request */
 static ngx_int_t
-ngx_ingress_init_ctx(ngx_ingress_ctx_t *ctx, ngx_http_request_t *r)
+ngx_ingress_init_ctx_from_slot(ngx_ingress_ctx_t *ctx, ngx_http_request_t *r,
+    ngx_ingress_gateway_t *gateway, ngx_ingress_t *current)
 {
-    ngx_ingress_loc_conf_t              *ilcf = NULL;
     ngx_ingress_upstream_t              *ups;
     ngx_int_t                            ups_index;
     ngx_int_t                            rc;
     ngx_uint_t                           i;
 
-    ilcf = ngx_http_get_module_loc_conf(r, ngx_ingress_module);
-    if (ilcf->gateway == NULL) {
-        return NGX_DECLINED;
-    }
-
-    ngx_ingress_service_t *service = ngx_ingress_match_service(ilcf->gateway, r);
+    ngx_ingress_service_t *service = ngx_ingress_match_service(gateway, current, r);
     if (service == NULL) {
         ngx_log_error(NGX_LOG_DEBUG, r->connection->log, 0,
                     "|ingress|route service not found|");
@@ -1003,6 +1238,32 @@ ngx_ingress_init_ctx(ngx_ingress_ctx_t *ctx, ngx_http_request_t *r)
     return NGX_OK;
 }
 
+static ngx_int_t
+ngx_ingress_init_ctx(ngx_ingress_ctx_t *ctx, ngx_http_request_t *r)
+{
+    ngx_int_t                            rc;
+    ngx_ingress_t                       *current;
+    ngx_ingress_loc_conf_t              *ilcf = NULL;
+
+    ilcf = ngx_http_get_module_loc_conf(r, ngx_ingress_module);
+    if (ilcf->gateway == NULL) {
+        return NGX_DECLINED;
+    }
+
+    /* the strategy process does not rebuild the slot until we leave */
+    current = ngx_strategy_slot_enter(ilcf->gateway->ingress_app);
+    if (current == NULL) {
+        rc = NGX_DECLINED;
+
+    } else {
+        rc = ngx_ingress_init_ctx_from_slot(ctx, r, ilcf->gateway, current);
+    }
+
+    ngx_strategy_slot_leave(ilcf->gateway->ingress_app);
+
+    return rc;
+}
+
 static ngx_ingress_ctx_t *
 ngx_ingress_get_ctx(ngx_ingress_main_conf_t *imcf,
                     ngx_http_request_t *r)
@@ -42,13 +42,26 @@ typedef struct {
     ngx_int_t                   force_https;
 
     ngx_shm_array_t            *metadata;       /* ngx_ingress_metadata_t */
+
+    size_t                      size;           /* pool bytes, retired when replaced */
 } ngx_ingress_service_t;
 
+/*
+ * Routers refer to a service through its entry in the service map, so that
+ * a delta publishes a rebuilt service by swapping a single pointer.
+ */
+typedef struct {
+    ngx_str_t                   name;
+    ngx_ingress_service_t      *volatile service;   /* NULL once removed */
+    ngx_ingress_service_t      *pending;        /* built by the delta being applied */
+} ngx_ingress_service_entry_t;
+
 typedef struct {
     Ingress__LocationType       location;       /* match field location */
     ngx_str_t                   key;            /* match field name */
     ngx_str_t                   value;          /* match field value */
     Ingress__MatchType          match_type;     /* match field type */
+    ngx_uint_t                  key_index;      /* index in host tag_keys, LocHttpHeader only */
 } ngx_ingress_tag_item_t;
 
 typedef struct {
@@ -57,20 +70,36 @@ typedef struct {
 
 typedef struct {
     ngx_shm_array_t         *rules;             /* ngx_ingress_tag_rule_t */
-    ngx_ingress_service_t   *service;
+    ngx_ingress_service_entry_t *entry;
 } ngx_ingress_tag_router_t;
 
 typedef struct {
     ngx_str_t                prefix;
     ngx_shm_array_t         *tags;              /* ngx_ingress_tag_router_t: The number of elements is 0 and assigned to NULL */
-    ngx_ingress_service_t   *service;
+    ngx_ingress_service_entry_t *entry;
 } ngx_ingress_path_router_t;
 
+typedef struct ngx_ingress_path_node_s  ngx_ingress_path_node_t;
+
+/* radix trie node compiled from the lowercased path prefixes of a host */
+struct ngx_ingress_path_node_s {
+    ngx_str_t                   label;          /* edge label, points into a router prefix */
+    ngx_ingress_path_router_t  *routers;        /* routers whose prefix ends here, NULL if none */
+    ngx_uint_t                  nrouters;
+    ngx_ingress_path_node_t    *fallback;       /* nearest ancestor with routers */
+    ngx_ingress_path_node_t    *children;       /* sorted by the first byte of label */
+    ngx_uint_t                  nchildren;
+};
+
 typedef struct {
     ngx_str_t                   host;
     ngx_shm_array_t            *paths;          /* ngx_ingress_path_router_t */
+    ngx_ingress_path_node_t    *trie;           /* compiled from paths */
     ngx_shm_array_t            *tags;           /* ngx_ingress_tag_router_t: The number of elements is 0 and assigned to NULL */
-    ngx_ingress_service_t      *service;
+    ngx_shm_array_t            *tag_keys;       /* ngx_str_t: lowercased header names referenced by tags, NULL if none */
+    ngx_ingress_service_entry_t *entry;
+
+    size_t                      size;           /* pool bytes, retired when replaced */
 } ngx_ingress_host_router_t;
 
 
@@ -78,9 +107,10 @@ typedef struct {
     ngx_shm_hash_t      *host_map;                  /* ngx_ingress_host_router_t */
     ngx_shm_hash_t      *wildcard_host_map;         /* ngx_ingress_host_router_t */
 
-    ngx_shm_hash_t      *service_map;               /* ngx_ingress_service_t */
+    ngx_shm_hash_t      *service_map;               /* ngx_ingress_service_entry_t */
 
     uint64_t            version;
+    size_t              retired;                    /* pool bytes replaced by deltas */
 
     ngx_shm_pool_t      *pool;
 } ngx_ingress_t;
@@ -100,6 +130,10 @@ typedef struct {
 
     ngx_ingress_shared_memory_t     *shared;
     ngx_strategy_slot_app_t         *ingress_app;
+
+    /* strategy process only: the last delta, replayed on a lagging slot */
+    Ingress__ConfigDelta            *last_delta;
+    uint64_t                         last_delta_version;
 } ngx_ingress_gateway_t;
 
 
@@ -115,6 +149,7 @@ typedef struct {
 
 
 ngx_int_t ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress);
+ngx_int_t ngx_ingress_update_shm_by_delta(ngx_ingress_gateway_t *gateway, Ingress__ConfigDelta *pbdelta, ngx_ingress_t *ingress);
 
 
 #endif // NGX_INGRESS_MODULE_H
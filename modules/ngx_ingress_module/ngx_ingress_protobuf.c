@@ -143,6 +143,7 @@ ngx_ingress_shared_memory_read_pb_locked(
     left = shared->shm_size;
 
     shm_pb_config->pbconfig = NULL;
+    shm_pb_config->pbdelta = NULL;
 
     /* read Status */
     rc = ngx_serialize_read_uint32(&pos, &left, &status);
@@ -173,7 +174,9 @@ ngx_ingress_shared_memory_read_pb_locked(
     }
     shm_pb_config->type = type;
 
-    if (shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_SERVICE) {
+    if (shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_SERVICE
+        && shm_pb_config->type != NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA)
+    {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                       "|ingress|unknown config type|%d|", shm_pb_config->type);
         return NGX_ERROR;
@@ -212,6 +215,19 @@ ngx_ingress_shared_memory_read_pb_locked(
     }
 
     /* parse PB */
+    if (shm_pb_config->type == NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA) {
+        Ingress__ConfigDelta * pbdelta = ingress__config_delta__unpack(NULL, src.len, src.data);
+        if (pbdelta == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|shared parse pb delta failed|");
+            return NGX_ERROR;
+        }
+
+        shm_pb_config->pbdelta = pbdelta;
+
+        return NGX_OK;
+    }
+
     Ingress__Config * pbconfig = ingress__config__unpack(NULL, src.len, src.data);
     if (pbconfig == NULL) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
@@ -256,6 +272,10 @@ ngx_ingress_shared_memory_free_pb(ngx_ingress_shared_memory_config_t *shm_pb_con
     if (shm_pb_config->pbconfig != NULL) {
         ingress__config__free_unpacked(shm_pb_config->pbconfig, NULL);
     }
+
+    if (shm_pb_config->pbdelta != NULL) {
+        ingress__config_delta__free_unpacked(shm_pb_config->pbdelta, NULL);
+    }
 }
 
 static int
@@ -278,8 +298,8 @@ ngx_ingress_host_hash(const void * p) {
 
 static int
 ngx_ingress_service_compare(const void * p1, const void* p2) {
-    ngx_ingress_service_t * v1 = (ngx_ingress_service_t*)p1;
-    ngx_ingress_service_t * v2 = (ngx_ingress_service_t*)p2;
+    ngx_ingress_service_entry_t * v1 = (ngx_ingress_service_entry_t*)p1;
+    ngx_ingress_service_entry_t * v2 = (ngx_ingress_service_entry_t*)p2;
 
     return ngx_comm_strcmp(&v1->name, &v2->name);
 }
@@ -287,18 +307,28 @@ ngx_ingress_service_compare(const void * p1, const void* p2) {
 static ngx_uint_t
 ngx_ingress_service_hash(const void * p) {
     ngx_uint_t hash;
-    ngx_ingress_service_t * v1 = (ngx_ingress_service_t*)p;
+    ngx_ingress_service_entry_t * v1 = (ngx_ingress_service_entry_t*)p;
 
     hash = ngx_hash_key(v1->name.data, v1->name.len);
 
     return hash;
 }
 
-static ngx_ingress_service_t *
+static ngx_ingress_service_entry_t *
+ngx_ingress_get_service_entry(ngx_ingress_t *ingress, char *service_name)
+{
+    ngx_ingress_service_entry_t     service_key;
+
+    service_key.name.data = (u_char *) service_name;
+    service_key.name.len = ngx_strlen(service_name);
+
+    return ngx_shm_hash_get(ingress->service_map, &service_key);
+}
+
+static ngx_ingress_service_entry_t *
 ngx_ingress_get_service(ngx_ingress_t *ingress, char* service_name)
 {
-    ngx_ingress_service_t service_key;
-    ngx_ingress_service_t *service;
+    ngx_ingress_service_entry_t *entry;
 
     if (service_name == NULL) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
@@ -306,16 +336,16 @@ ngx_ingress_get_service(ngx_ingress_t *ingress, char* service_name)
         return NULL;
     }
 
-    service_key.name.len = ngx_strlen(service_name);
-    service_key.name.data = (u_char*)service_name;
-    service = (ngx_ingress_service_t *)ngx_shm_hash_get(ingress->service_map, &service_key);
-    if (service == NULL) {
+    entry = ngx_ingress_get_service_entry(ingress, service_name);
+
+    /* a service built by the delta being applied can already be referred to */
+    if (entry == NULL || (entry->service == NULL && entry->pending == NULL)) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                      "|ingress|service not found|%V|", &service_key.name);
+                      "|ingress|service not found|%s|", service_name);
         return NULL;
     }
 
-    return service;
+    return entry;
 }
 
 int
@@ -482,6 +512,34 @@ ngx_ingress_update_shm_service(ngx_ingress_t *ingress,
     return NGX_OK;
 }
 
+static ngx_ingress_service_t *
+ngx_ingress_build_shm_service(ngx_ingress_gateway_t *gateway, ngx_ingress_t *ingress,
+    Ingress__VirtualService *pbservice)
+{
+    ngx_int_t                       rc;
+    ngx_int_t                       free_size;
+
+    free_size = ngx_shm_pool_free_size(ingress->pool);
+
+    ngx_ingress_service_t *shm_service = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_service_t));
+    if (shm_service == NULL) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|alloc service failed|gateway=%V|", &gateway->name);
+        return NULL;
+    }
+
+    rc = ngx_ingress_update_shm_service(ingress, shm_service, pbservice);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|update service failed|gateway=%V|", &gateway->name);
+        return NULL;
+    }
+
+    shm_service->size = free_size - ngx_shm_pool_free_size(ingress->pool);
+
+    return shm_service;
+}
+
 static int
 ngx_path_prefix_compare(const void *c1, const void *c2)
 {
@@ -498,10 +556,188 @@ ngx_path_prefix_compare(const void *c1, const void *c2)
     return ngx_comm_str_compare(&router1->prefix, &router2->prefix);
 }
 
+static int
+ngx_path_prefix_lex_compare(const void *c1, const void *c2)
+{
+    ngx_int_t                   rc;
+    ngx_ingress_path_router_t  *router1 = *(ngx_ingress_path_router_t **) c1;
+    ngx_ingress_path_router_t  *router2 = *(ngx_ingress_path_router_t **) c2;
+
+    rc = ngx_memcmp(router1->prefix.data, router2->prefix.data,
+                    ngx_min(router1->prefix.len, router2->prefix.len));
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (router1->prefix.len != router2->prefix.len) {
+        return router1->prefix.len < router2->prefix.len ? -1 : 1;
+    }
+
+    /* equal prefixes keep their order in the paths array */
+    return router1 < router2 ? -1 : (router1 > router2);
+}
+
+/*
+ * Build the subtree of node from lexicographically sorted routers, all of
+ * which share their first depth bytes. Edge labels point into the router
+ * prefixes, so only the nodes themselves are allocated.
+ */
+static ngx_int_t
+ngx_ingress_build_path_node(ngx_ingress_t *ingress, ngx_ingress_path_node_t *node,
+    ngx_ingress_path_router_t **routers, ngx_uint_t n, size_t depth,
+    ngx_ingress_path_node_t *fallback)
+{
+    size_t                       lcp;
+    ngx_uint_t                   i, s, e, nchildren;
+    ngx_ingress_path_node_t     *child;
+    ngx_ingress_path_router_t   *first, *last;
+
+    node->fallback = fallback;
+
+    /* prefixes ending at this node sort before the longer ones */
+    for (i = 0; i < n && routers[i]->prefix.len == depth; i++) { /* void */ }
+
+    if (i) {
+        node->routers = routers[0];
+        node->nrouters = i;
+        fallback = node;
+    }
+
+    nchildren = 0;
+    for (s = i; s < n; s = e) {
+        for (e = s + 1;
+             e < n && routers[e]->prefix.data[depth] == routers[s]->prefix.data[depth];
+             e++) { /* void */ }
+        nchildren++;
+    }
+
+    if (nchildren == 0) {
+        return NGX_OK;
+    }
+
+    node->children = ngx_shm_pool_calloc(ingress->pool,
+                                         nchildren * sizeof(ngx_ingress_path_node_t));
+    if (node->children == NULL) {
+        return NGX_ERROR;
+    }
+
+    node->nchildren = nchildren;
+    child = node->children;
+
+    for (s = i; s < n; s = e) {
+        for (e = s + 1;
+             e < n && routers[e]->prefix.data[depth] == routers[s]->prefix.data[depth];
+             e++) { /* void */ }
+
+        /* in sorted order the first and last share the group's common prefix */
+        first = routers[s];
+        last = routers[e - 1];
+
+        for (lcp = depth + 1;
+             lcp < first->prefix.len && first->prefix.data[lcp] == last->prefix.data[lcp];
+             lcp++) { /* void */ }
+
+        child->label.data = first->prefix.data + depth;
+        child->label.len = lcp - depth;
+
+        if (ngx_ingress_build_path_node(ingress, child, &routers[s], e - s, lcp, fallback)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        child++;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_ingress_build_path_trie(ngx_ingress_t *ingress, ngx_ingress_host_router_t *shm_host)
+{
+    ngx_int_t                    rc;
+    ngx_uint_t                   i, n;
+    ngx_ingress_path_router_t   *paths, **routers;
+
+    shm_host->trie = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_path_node_t));
+    if (shm_host->trie == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = shm_host->paths->nelts;
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    routers = ngx_alloc(n * sizeof(ngx_ingress_path_router_t *), ngx_cycle->log);
+    if (routers == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * Routers with the same prefix are adjacent in the paths array, which
+     * is ordered longest prefix first, so a node refers to them as a slice.
+     */
+    paths = shm_host->paths->elts;
+    for (i = 0; i < n; i++) {
+        routers[i] = &paths[i];
+    }
+
+    ngx_qsort(routers, n, sizeof(ngx_ingress_path_router_t *), ngx_path_prefix_lex_compare);
+
+    rc = ngx_ingress_build_path_node(ingress, shm_host->trie, routers, n, 0, NULL);
+
+    ngx_free(routers);
+
+    return rc;
+}
+
+static ngx_int_t
+ngx_ingress_tag_key_index(ngx_ingress_t *ingress, ngx_shm_array_t **pkeys,
+    ngx_str_t *key, ngx_uint_t *index)
+{
+    ngx_uint_t           i;
+    ngx_str_t           *keys, *shm_key;
+
+    if (*pkeys == NULL) {
+        *pkeys = ngx_shm_array_create(ingress->pool, 4, sizeof(ngx_str_t));
+        if (*pkeys == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    keys = (*pkeys)->elts;
+    for (i = 0; i < (*pkeys)->nelts; i++) {
+        if (keys[i].len == key->len
+            && ngx_strncasecmp(keys[i].data, key->data, key->len) == 0)
+        {
+            *index = i;
+            return NGX_OK;
+        }
+    }
+
+    shm_key = ngx_shm_array_push(*pkeys);
+    if (shm_key == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_key->data = ngx_shm_pool_calloc(ingress->pool, key->len);
+    if (shm_key->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    shm_key->len = key->len;
+    ngx_strlow(shm_key->data, key->data, key->len);
+
+    *index = i;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 ngx_ingress_update_shm_tag_routers(ngx_ingress_t *ingress,
     size_t n_tags, Ingress__TagRouter **pb_tag_routers,
-    ngx_shm_array_t **pptags)
+    ngx_shm_array_t **pptags, ngx_shm_array_t **pkeys)
 {
     size_t                  i, j, k;
     ngx_shm_array_t        *ptags = NULL;
@@ -651,6 +887,17 @@ ngx_ingress_update_shm_tag_routers(ngx_ingress_t *ingress,
                         ngx_memcpy(shm_item->key.data, pb_items[k]->key, key_len);
                         ngx_memcpy(shm_item->value.data, pb_items[k]->value, value_len);
 
+                        /* header values are resolved once per request by key index */
+                        if (shm_item->location == INGRESS__LOCATION_TYPE__LocHttpHeader
+                            && ngx_ingress_tag_key_index(ingress, pkeys, &shm_item->key,
+                                                         &shm_item->key_index)
+                               != NGX_OK)
+                        {
+                            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                                            "|ingress|tag key alloc failed|");
+                            return NGX_ERROR;
+                        }
+
                     } else {
                         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                                 "|ingress|miss loc type or match type|");
@@ -660,8 +907,8 @@ ngx_ingress_update_shm_tag_routers(ngx_ingress_t *ingress,
             }
 
             /* matched service */
-            shm_tag->service = ngx_ingress_get_service(ingress, pb_tag_routers[i]->service_name);
-            if (shm_tag->service == NULL) {
+            shm_tag->entry = ngx_ingress_get_service(ingress, pb_tag_routers[i]->service_name);
+            if (shm_tag->entry == NULL) {
                 ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                                 "|ingress|service not exist|");
                 return NGX_ERROR;
@@ -740,17 +987,18 @@ ngx_ingress_update_shm_host(ngx_ingress_t *ingress,
         shm_path->prefix.len = len;
         ngx_strlow(shm_path->prefix.data, (u_char*)pbpath[i]->prefix, len);
 
-        shm_path->service = ngx_ingress_get_service(ingress, pbpath[i]->service_name);
-        if (shm_path->service == NULL) {
+        shm_path->entry = ngx_ingress_get_service(ingress, pbpath[i]->service_name);
+        if (shm_path->entry == NULL) {
             ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                             "|ingress|service not exist|host=%V|prefix=%V|", &shm_host->host, &shm_path->prefix);
             return NGX_ERROR;
         }
         ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                      "|ingress|prefix service|host=%V|prefix=%V|%p|", &shm_host->host, &shm_path->prefix, shm_path->service);
+                      "|ingress|prefix service|host=%V|prefix=%V|%p|", &shm_host->host, &shm_path->prefix, shm_path->entry);
 
         /* Subdivided PATH granularity, different tags match routes */
-        rc = ngx_ingress_update_shm_tag_routers(ingress, pbpath[i]->n_tags, pbpath[i]->tags, &shm_path->tags);
+        rc = ngx_ingress_update_shm_tag_routers(ingress, pbpath[i]->n_tags, pbpath[i]->tags,
+                                                &shm_path->tags, &shm_host->tag_keys);
         if (rc != NGX_OK) {
             ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                         "|ingress|update path tag routes failed|%V|%V|", &shm_host->host, &shm_path->prefix);
@@ -760,8 +1008,16 @@ ngx_ingress_update_shm_host(ngx_ingress_t *ingress,
 
     ngx_shm_sort_array(shm_host->paths, ngx_path_prefix_compare);
 
+    rc = ngx_ingress_build_path_trie(ingress, shm_host);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                    "|ingress|build path trie failed|%V|", &shm_host->host);
+        return NGX_ERROR;
+    }
+
     /* Under the host granularity, different tags match routes */
-    rc = ngx_ingress_update_shm_tag_routers(ingress, pbrouter->n_tags, pbrouter->tags, &shm_host->tags);
+    rc = ngx_ingress_update_shm_tag_routers(ingress, pbrouter->n_tags, pbrouter->tags,
+                                            &shm_host->tags, &shm_host->tag_keys);
     if (rc != NGX_OK) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                     "|ingress|update path tag routes failed|%V|", &shm_host->host);
@@ -775,8 +1031,8 @@ ngx_ingress_update_shm_host(ngx_ingress_t *ingress,
         return NGX_ERROR;
     }
 
-    shm_host->service = ngx_ingress_get_service(ingress, pbrouter->service_name);
-    if (shm_host->service == NULL) {
+    shm_host->entry = ngx_ingress_get_service(ingress, pbrouter->service_name);
+    if (shm_host->entry == NULL) {
         ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                         "|ingress|service not exist|host=%V|", &shm_host->host);
         
@@ -786,6 +1042,47 @@ ngx_ingress_update_shm_host(ngx_ingress_t *ingress,
     return NGX_OK;
 }
 
+static ngx_ingress_host_router_t *
+ngx_ingress_build_shm_host(ngx_ingress_gateway_t *gateway, ngx_ingress_t *ingress,
+    Ingress__HostRouter *pb_host_router, ngx_shm_hash_t **phost_map)
+{
+    ngx_int_t                       rc;
+    ngx_int_t                       free_size;
+    ngx_str_t                       wildcard_prefix = ngx_string("*.");
+    ngx_str_t                       remove_prefix = ngx_null_string;
+
+    free_size = ngx_shm_pool_free_size(ingress->pool);
+
+    ngx_ingress_host_router_t *shm_host = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_host_router_t));
+    if (shm_host == NULL) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|host router alloc failed|gateway=%V|", &gateway->name);
+        return NULL;
+    }
+
+    *phost_map = ingress->host_map;
+    if (pb_host_router->host != NULL
+        && ngx_strncmp(pb_host_router->host, wildcard_prefix.data, wildcard_prefix.len) == 0)
+    {
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|match wildcard|host=%s|", pb_host_router->host);
+
+        *phost_map = ingress->wildcard_host_map;
+        remove_prefix = wildcard_prefix;
+    }
+
+    rc = ngx_ingress_update_shm_host(ingress, shm_host, pb_host_router, &remove_prefix);
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "|ingress|update host router failed|gateway=%V|", &gateway->name);
+        return NULL;
+    }
+
+    shm_host->size = free_size - ngx_shm_pool_free_size(ingress->pool);
+
+    return shm_host;
+}
+
 ngx_int_t
 ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_memory_config_t *shm_pb_config, ngx_ingress_t *ingress)
 {
@@ -802,21 +1099,21 @@ ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_
     Ingress__VirtualService **pbservice = shm_pb_config->pbconfig->services;
     /* service */
     for (i = 0; i < shm_pb_config->pbconfig->n_services; i++) {
-        ngx_ingress_service_t *shm_service = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_service_t));
+        ngx_ingress_service_t *shm_service = ngx_ingress_build_shm_service(gateway, ingress, pbservice[i]);
         if (shm_service == NULL) {
-            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                          "|ingress|alloc service failed|gateway=%V|", &gateway->name);
             return NGX_ERROR;
         }
 
-        rc = ngx_ingress_update_shm_service(ingress, shm_service, pbservice[i]);
-        if (rc != NGX_OK) {
+        ngx_ingress_service_entry_t *entry = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_service_entry_t));
+        if (entry == NULL) {
             ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                          "|ingress|update service failed|gateway=%V|", &gateway->name);
+                          "|ingress|alloc service entry failed|gateway=%V|", &gateway->name);
             return NGX_ERROR;
         }
+        entry->name = shm_service->name;
+        entry->service = shm_service;
 
-        rc = ngx_shm_hash_add(ingress->service_map, shm_service);
+        rc = ngx_shm_hash_add(ingress->service_map, entry);
         if (rc != NGX_OK) {
             ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
                           "|ingress|service ngx_shm_hash_add failed|service=%V|", &shm_service->name);
@@ -842,47 +1139,232 @@ ngx_ingress_update_shm_by_pb(ngx_ingress_gateway_t *gateway, ngx_ingress_shared_
 
     for (i = 0; i < shm_pb_config->pbconfig->n_routers; i++) {
         if (pbrouter[i]->host_router != NULL) {
-            Ingress__HostRouter *pb_host_router = pbrouter[i]->host_router;
-
-            ngx_str_t wildcard_prefix = ngx_string("*.");
-            ngx_str_t remove_prefix = ngx_null_string;
+            ngx_shm_hash_t *host_map;
+            ngx_ingress_host_router_t *shm_host;
 
-            ngx_ingress_host_router_t *shm_host = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_host_router_t));
+            shm_host = ngx_ingress_build_shm_host(gateway, ingress, pbrouter[i]->host_router, &host_map);
             if (shm_host == NULL) {
+                return NGX_ERROR;
+            }
+
+            rc = ngx_shm_hash_add(host_map, shm_host);
+            if (rc != NGX_OK) {
                 ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|host router alloc failed|gateway=%V|", &gateway->name);
+                              "|ingress|host ngx_shm_hash_add failed|host=%V", &shm_host->host);
                 return NGX_ERROR;
             }
 
-            ngx_shm_hash_t *host_map = ingress->host_map;
-            if (pb_host_router->host != NULL
-                && ngx_strncmp(pb_host_router->host, wildcard_prefix.data, wildcard_prefix.len) == 0)
-            {
-                ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                              "|ingress|match wildcard|host=%s|", pb_host_router->host);
+            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                          "|ingress|host add succ|host=%V", &shm_host->host);
+        }
+    }
 
-                host_map = ingress->wildcard_host_map;
-                remove_prefix = wildcard_prefix;
-            }
+    return NGX_OK;
+}
 
-            rc = ngx_ingress_update_shm_host(ingress, shm_host, pb_host_router, &remove_prefix);
-            if (rc != NGX_OK) {
+typedef struct {
+    ngx_ingress_host_router_t      *host;
+    ngx_shm_hash_t                 *host_map;
+    ngx_shm_hash_node_t            *node;           /* used if the host is new */
+} ngx_ingress_delta_host_t;
+
+ngx_int_t
+ngx_ingress_update_shm_by_delta(ngx_ingress_gateway_t *gateway, Ingress__ConfigDelta *pbdelta, ngx_ingress_t *ingress)
+{
+    size_t                          i, nhosts;
+    size_t                          retired;
+    ngx_int_t                       rc;
+    ngx_int_t                       free_size;
+    ngx_ingress_delta_host_t       *hosts;
+    ngx_ingress_service_t          *shm_service;
+    ngx_ingress_service_entry_t    *entry;
+    ngx_ingress_host_router_t      *old_host;
+    ngx_ingress_host_router_t       host_key;
+    ngx_str_t                       wildcard_prefix = ngx_string("*.");
+
+    /*
+     * Only the hosts and services named by the delta are touched. Readers of
+     * the slot take no lock, so everything the delta names is built first,
+     * unreachable from the maps, and then published by single pointer
+     * stores. The pool cannot free: replaced objects are retired and only
+     * reclaimed by the next full config.
+     */
+
+    free_size = ngx_shm_pool_free_size(ingress->pool);
+    retired = ingress->retired;
+
+    nhosts = 0;
+    hosts = NULL;
+
+    if (pbdelta->n_routers) {
+        hosts = ngx_alloc(pbdelta->n_routers * sizeof(ngx_ingress_delta_host_t), ngx_cycle->log);
+        if (hosts == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    Ingress__VirtualService **pbservice = pbdelta->services;
+    for (i = 0; i < pbdelta->n_services; i++) {
+        if (pbservice[i]->service_name == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|pb service name is null|gateway=%V|", &gateway->name);
+            goto failed;
+        }
+
+        shm_service = ngx_ingress_build_shm_service(gateway, ingress, pbservice[i]);
+        if (shm_service == NULL) {
+            goto failed;
+        }
+
+        entry = ngx_ingress_get_service_entry(ingress, pbservice[i]->service_name);
+        if (entry == NULL) {
+            /* no router refers to a new entry until the delta is published */
+            entry = ngx_shm_pool_calloc(ingress->pool, sizeof(ngx_ingress_service_entry_t));
+            if (entry == NULL) {
                 ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|update host router failed|gateway=%V|", &gateway->name);
-                return NGX_ERROR;
+                              "|ingress|alloc service entry failed|gateway=%V|", &gateway->name);
+                goto failed;
             }
+            entry->name = shm_service->name;
 
-            rc = ngx_shm_hash_add(host_map, shm_host);
+            rc = ngx_shm_hash_add(ingress->service_map, entry);
             if (rc != NGX_OK) {
                 ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
-                              "|ingress|host ngx_shm_hash_add failed|host=%V", &shm_host->host);
-                return NGX_ERROR;
+                              "|ingress|service ngx_shm_hash_add failed|service=%V|", &shm_service->name);
+                goto failed;
             }
+        }
 
-            ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
-                          "|ingress|host add succ|host=%V", &shm_host->host);
+        if (entry->pending != NULL) {
+            /* named twice by the delta, the last one wins */
+            ingress->retired += entry->pending->size;
+        }
+
+        entry->pending = shm_service;
+    }
+
+    Ingress__Router **pbrouter = pbdelta->routers;
+    for (i = 0; i < pbdelta->n_routers; i++) {
+        if (pbrouter[i]->host_router == NULL) {
+            continue;
+        }
+
+        hosts[nhosts].host = ngx_ingress_build_shm_host(gateway, ingress, pbrouter[i]->host_router,
+                                                        &hosts[nhosts].host_map);
+        if (hosts[nhosts].host == NULL) {
+            goto failed;
+        }
+
+        hosts[nhosts].node = ngx_shm_hash_alloc_node(hosts[nhosts].host_map);
+        if (hosts[nhosts].node == NULL) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "|ingress|alloc host node failed|host=%V", &hosts[nhosts].host->host);
+            goto failed;
+        }
+
+        nhosts++;
+    }
+
+    /* the delta is complete, nothing below can fail */
+
+    ngx_memory_barrier();
+
+    for (i = 0; i < pbdelta->n_services; i++) {
+        entry = ngx_ingress_get_service_entry(ingress, pbservice[i]->service_name);
+        if (entry->pending == NULL) {
+            continue;
+        }
+
+        if (entry->service != NULL) {
+            ingress->retired += entry->service->size;
         }
+
+        entry->service = entry->pending;
+        entry->pending = NULL;
+    }
+
+    for (i = 0; i < pbdelta->n_removed_hosts; i++) {
+        ngx_shm_hash_t *host_map = ingress->host_map;
+
+        host_key.host.data = (u_char *) pbdelta->removed_hosts[i];
+        host_key.host.len = ngx_strlen(pbdelta->removed_hosts[i]);
+
+        if (host_key.host.len >= wildcard_prefix.len
+            && ngx_strncmp(host_key.host.data, wildcard_prefix.data, wildcard_prefix.len) == 0)
+        {
+            host_map = ingress->wildcard_host_map;
+            host_key.host.data += wildcard_prefix.len;
+            host_key.host.len -= wildcard_prefix.len;
+        }
+
+        old_host = ngx_shm_hash_get(host_map, &host_key);
+        if (old_host == NULL) {
+            continue;
+        }
+
+        ngx_shm_hash_del(host_map, old_host);
+        ingress->retired += old_host->size;
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|host del succ|host=%s", pbdelta->removed_hosts[i]);
+    }
+
+    for (i = 0; i < nhosts; i++) {
+        old_host = ngx_shm_hash_replace(hosts[i].host_map, hosts[i].host);
+        if (old_host == NULL) {
+            ngx_shm_hash_add_node(hosts[i].host_map, hosts[i].node, hosts[i].host);
+
+        } else {
+            ingress->retired += old_host->size;
+        }
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|host add succ|host=%V", &hosts[i].host->host);
+    }
+
+    /*
+     * A removed service keeps its entry, so the routers still referring to
+     * it fall through as if it were disabled, until it is added again.
+     */
+    for (i = 0; i < pbdelta->n_removed_services; i++) {
+        entry = ngx_ingress_get_service_entry(ingress, pbdelta->removed_services[i]);
+        if (entry == NULL || entry->service == NULL) {
+            continue;
+        }
+
+        ingress->retired += entry->service->size;
+        entry->service = NULL;
+
+        ngx_log_error(NGX_LOG_DEBUG, ngx_cycle->log, 0,
+                      "|ingress|service del succ|service=%V", &entry->name);
+    }
+
+    if (hosts != NULL) {
+        ngx_free(hosts);
     }
 
     return NGX_OK;
+
+failed:
+
+    /* nothing was published, what was built is garbage until a full config */
+
+    for (i = 0; i < pbdelta->n_services; i++) {
+        if (pbservice[i]->service_name == NULL) {
+            continue;
+        }
+
+        entry = ngx_ingress_get_service_entry(ingress, pbservice[i]->service_name);
+        if (entry != NULL) {
+            entry->pending = NULL;
+        }
+    }
+
+    ingress->retired = retired + (free_size - ngx_shm_pool_free_size(ingress->pool));
+
+    if (hosts != NULL) {
+        ngx_free(hosts);
+    }
+
+    return NGX_ERROR;
 }
@@ -16,6 +16,7 @@
 typedef enum {
     NGX_INGRESS_SHARED_MEMORY_TYPE_EMPTY        = 0,
     NGX_INGRESS_SHARED_MEMORY_TYPE_SERVICE      = 1,
+    NGX_INGRESS_SHARED_MEMORY_TYPE_DELTA        = 2,
 } ngx_ingress_shared_memory_type_e;
 
 typedef enum {
@@ -27,7 +28,8 @@ typedef struct {
     ngx_ingress_shared_memory_type_e     type;
     uint64_t                             version;
     u_char                               md5_digit[NGX_COMM_MD5_HEX_LEN];
-    Ingress__Config                     *pbconfig;
+    Ingress__Config                     *pbconfig;     /* TYPE_SERVICE */
+    Ingress__ConfigDelta                *pbdelta;      /* TYPE_DELTA */
 } ngx_ingress_shared_memory_config_t;
 
 typedef struct {
@@ -247,6 +247,7 @@ ngx_http_multi_upstream_process_non_buffered_request(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_multi_upstream_write_handler(ngx_connection_t *pc)
 {
+    ngx_int_t                rc;
     ngx_http_request_t      *fake_r, *real_r;
     ngx_http_upstream_t     *fake_u, *real_u;
     ngx_multi_connection_t  *multi_c;
@@ -257,6 +258,24 @@ ngx_http_multi_upstream_write_handler(ngx_connection_t *pc)
 
     multi_c = ngx_get_multi_connection(pc);
 
+    //write out the requests batched on the connection first, unless
+    //they wait for the end of the tick or the delay
+    if (multi_c->batch.event.posted || multi_c->batch.event.timer_set) {
+        rc = NGX_OK;
+
+    } else {
+        rc = ngx_multi_batch_flush(multi_c);
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_http_multi_upstream_next(pc, NGX_HTTP_UPSTREAM_FT_ERROR);
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
     ngx_queue_init(&tmp_queue);
 
     while (!ngx_queue_empty(&multi_c->waiting_list)) {
@@ -407,7 +426,9 @@ ngx_http_multi_upstream_read_handler(ngx_connection_t *pc)
                     , b->last - b->pos, b->start, b->end, b->pos, b->last);
 
             if (rc == NGX_AGAIN) {
-                if (b->last == b->end && b->pos == b->last) {
+                //all parsed, leave the whole buffer to the next read so
+                //that one read brings in as many frames as it holds
+                if (b->pos == b->last) {
                     b->pos = b->start;
                     b->last = b->start;
                 }
@@ -7,9 +7,16 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#include <ngx_event.h>
 
 #include "ngx_multi_upstream_module.h"
 
+#define NGX_MULTI_INFLIGHT_INIT_SIZE    64
+
+static ngx_int_t ngx_multi_inflight_grow(ngx_multi_connection_t *multi_c);
+static void ngx_multi_free_leak(ngx_multi_connection_t *multi_c);
+static void ngx_multi_batch_handler(ngx_event_t *ev);
+
 ngx_multi_connection_t* 
 ngx_get_multi_connection(ngx_connection_t *c)
 {
@@ -70,6 +77,23 @@ ngx_multi_cleanup(void *data)
         //free multi_r and pool
         ngx_destroy_pool(multi_r->pool);
     }
+
+    if (multi_c->batch.event.posted) {
+        ngx_delete_posted_event(&multi_c->batch.event);
+    }
+
+    if (multi_c->batch.event.timer_set) {
+        ngx_del_timer(&multi_c->batch.event);
+    }
+
+    ngx_log_error(NGX_LOG_INFO, multi_c->connection->log, 0,
+                  "multi: cleanup connection, in-flight %ui, max in-flight %ui",
+                  multi_c->inflight.nelts, multi_c->inflight.max);
+
+    if (multi_c->inflight.elts) {
+        ngx_free(multi_c->inflight.elts);
+        multi_c->inflight.elts = NULL;
+    }
 }
 
 ngx_multi_connection_t*
@@ -91,6 +115,10 @@ ngx_create_multi_connection(ngx_connection_t *c)
     
     multi_c->connection = c;
 
+    multi_c->batch.event.handler = ngx_multi_batch_handler;
+    multi_c->batch.event.data = multi_c;
+    multi_c->batch.event.log = c->log;
+
     cln = ngx_pool_cleanup_add(c->pool, 0);
     if (cln == NULL) {
         return NULL;
@@ -128,23 +156,342 @@ ngx_create_multi_request(ngx_connection_t *c, void *data)
 void
 ngx_multi_clean_leak(ngx_connection_t *c)
 {
-    ngx_queue_t             *q;
     ngx_multi_connection_t  *multi_c;
-    ngx_multi_request_t     *multi_r;
 
     multi_c = ngx_get_multi_connection(c);
 
+    //buffers of the leaked requests may still wait in a batch,
+    //ngx_multi_batch_flush() frees them once the batch is written
+    if (multi_c && multi_c->batch.writer && multi_c->batch.writer->out) {
+        return;
+    }
+
     if (multi_c) {
-        while (!ngx_queue_empty(&multi_c->leak_list)) {
-            q = ngx_queue_head(&multi_c->leak_list);
+        ngx_multi_free_leak(multi_c);
+    }
+}
+
+static void
+ngx_multi_free_leak(ngx_multi_connection_t *multi_c)
+{
+    ngx_queue_t             *q;
+    ngx_multi_request_t     *multi_r;
+
+    while (!ngx_queue_empty(&multi_c->leak_list)) {
+        q = ngx_queue_head(&multi_c->leak_list);
+
+        ngx_queue_remove(q);
+
+        multi_r = ngx_queue_data(q, ngx_multi_request_t, backend_queue);
+
+        //free hsf_r and pool
+        ngx_destroy_pool(multi_r->pool);
+    }
+}
+
+
+ngx_int_t
+ngx_multi_request_insert(ngx_multi_connection_t *multi_c,
+    ngx_multi_request_t *multi_r)
+{
+    ngx_uint_t               i, mask;
+    ngx_multi_inflight_t    *t;
 
-            ngx_queue_remove(q);
+    t = &multi_c->inflight;
 
-            multi_r = ngx_queue_data(q, ngx_multi_request_t, backend_queue);
+    //keep load factor under 1/2
+    if (2 * (t->nelts + 1) > t->size) {
+        if (ngx_multi_inflight_grow(multi_c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    mask = t->size - 1;
 
-            //free hsf_r and pool
-            ngx_destroy_pool(multi_r->pool);
+    for (i = multi_r->id & mask; t->elts[i]; i = (i + 1) & mask) {
+        if (t->elts[i]->id == multi_r->id) {
+            ngx_log_error(NGX_LOG_ERR, multi_c->connection->log, 0,
+                          "multi: duplicate in-flight id %ui", multi_r->id);
+            return NGX_ERROR;
         }
     }
+
+    t->elts[i] = multi_r;
+    t->nelts++;
+
+    if (t->nelts > t->max) {
+        t->max = t->nelts;
+    }
+
+    multi_r->indexed = 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, multi_c->connection->log, 0,
+                   "multi: in-flight insert %ui, depth %ui, max %ui",
+                   multi_r->id, t->nelts, t->max);
+
+    return NGX_OK;
+}
+
+ngx_multi_request_t*
+ngx_multi_request_lookup(ngx_multi_connection_t *multi_c, ngx_uint_t id)
+{
+    ngx_uint_t               i, mask;
+    ngx_multi_inflight_t    *t;
+
+    t = &multi_c->inflight;
+
+    if (t->nelts == 0) {
+        return NULL;
+    }
+
+    mask = t->size - 1;
+
+    for (i = id & mask; t->elts[i]; i = (i + 1) & mask) {
+        if (t->elts[i]->id == id) {
+            return t->elts[i];
+        }
+    }
+
+    return NULL;
 }
 
+void
+ngx_multi_request_remove(ngx_multi_connection_t *multi_c,
+    ngx_multi_request_t *multi_r)
+{
+    ngx_uint_t               i, j, k, mask;
+    ngx_multi_inflight_t    *t;
+
+    if (!multi_r->indexed) {
+        return;
+    }
+
+    multi_r->indexed = 0;
+
+    t = &multi_c->inflight;
+    mask = t->size - 1;
+
+    for (i = multi_r->id & mask; t->elts[i] != multi_r; i = (i + 1) & mask) {
+        if (t->elts[i] == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, multi_c->connection->log, 0,
+                          "multi: in-flight id %ui not found", multi_r->id);
+            return;
+        }
+    }
+
+    t->nelts--;
+
+    //shift back the following entries of the cluster, no tombstones
+    for (j = (i + 1) & mask; t->elts[j]; j = (j + 1) & mask) {
+        k = t->elts[j]->id & mask;
+
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            t->elts[i] = t->elts[j];
+            i = j;
+        }
+    }
+
+    t->elts[i] = NULL;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, multi_c->connection->log, 0,
+                   "multi: in-flight remove %ui, depth %ui",
+                   multi_r->id, t->nelts);
+}
+
+static ngx_int_t
+ngx_multi_inflight_grow(ngx_multi_connection_t *multi_c)
+{
+    ngx_uint_t               i, n, size, mask;
+    ngx_multi_request_t    **elts, *multi_r;
+    ngx_multi_inflight_t    *t;
+
+    t = &multi_c->inflight;
+
+    size = t->size ? 2 * t->size : NGX_MULTI_INFLIGHT_INIT_SIZE;
+    mask = size - 1;
+
+    //the table lives as long as the connection, so not from its pool
+    elts = ngx_calloc(size * sizeof(ngx_multi_request_t *),
+                      multi_c->connection->log);
+    if (elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < t->size; n++) {
+        multi_r = t->elts[n];
+
+        if (multi_r == NULL) {
+            continue;
+        }
+
+        for (i = multi_r->id & mask; elts[i]; i = (i + 1) & mask) {
+            /* void */
+        }
+
+        elts[i] = multi_r;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, multi_c->connection->log, 0,
+                   "multi: in-flight table grow %ui -> %ui", t->size, size);
+
+    if (t->elts) {
+        ngx_free(t->elts);
+    }
+
+    t->elts = elts;
+    t->size = size;
+
+    return NGX_OK;
+}
+
+
+//the connection is shared by all locations proxying to the upstream, the
+//first batched request sets its limits for the life of the connection
+void
+ngx_multi_batch_init(ngx_multi_connection_t *multi_c,
+    ngx_chain_writer_ctx_t *writer, size_t size, ngx_msec_t delay,
+    ngx_msec_t timeout)
+{
+    ngx_multi_batch_t       *batch;
+
+    batch = &multi_c->batch;
+
+    batch->writer = writer;
+    batch->max_size = size;
+    batch->delay = delay;
+    batch->timeout = timeout;
+}
+
+//queue a request on the connection, written out once per event loop tick
+ngx_int_t
+ngx_multi_batch_write(ngx_multi_connection_t *multi_c, ngx_chain_t *in)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               blocked;
+    ngx_chain_t             *cl;
+    ngx_multi_batch_t       *batch;
+    ngx_chain_writer_ctx_t  *writer;
+
+    batch = &multi_c->batch;
+    writer = batch->writer;
+
+    //a blocked connection flushes on its write event
+    blocked = (writer->out != NULL && !batch->event.posted
+               && !batch->event.timer_set);
+
+    for ( /* void */ ; in; in = in->next) {
+
+        if (ngx_buf_size(in->buf) == 0 && !ngx_buf_special(in->buf)) {
+            continue;
+        }
+
+        cl = ngx_alloc_chain_link(writer->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = in->buf;
+        cl->next = NULL;
+
+        *writer->last = cl;
+        writer->last = &cl->next;
+
+        batch->size += ngx_buf_size(in->buf);
+    }
+
+    batch->frames++;
+
+    if (batch->size >= batch->max_size) {
+        rc = ngx_multi_batch_flush(multi_c);
+
+        //the rest is sent by the write handler of the connection
+        return rc == NGX_ERROR ? NGX_ERROR : NGX_OK;
+    }
+
+    if (!blocked && !batch->event.posted && !batch->event.timer_set) {
+        if (batch->delay) {
+            ngx_add_timer(&batch->event, batch->delay);
+
+        } else {
+            ngx_post_event(&batch->event, &ngx_posted_events);
+        }
+    }
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_multi_batch_flush(ngx_multi_connection_t *multi_c)
+{
+    ngx_int_t                rc;
+    ngx_connection_t        *c;
+    ngx_multi_batch_t       *batch;
+
+    batch = &multi_c->batch;
+    c = multi_c->connection;
+
+    if (batch->writer == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (batch->writer->out == NULL) {
+        //written by a direct send, leaked requests may wait for it
+        ngx_multi_free_leak(multi_c);
+        return NGX_DECLINED;
+    }
+
+    if (batch->event.posted) {
+        ngx_delete_posted_event(&batch->event);
+    }
+
+    if (batch->event.timer_set) {
+        ngx_del_timer(&batch->event);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "multi: batch flush %ui requests, %uz bytes",
+                   batch->frames, batch->size);
+
+    batch->size = 0;
+    batch->frames = 0;
+
+    rc = ngx_chain_writer(batch->writer, NULL);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_AGAIN) {
+        if (!c->write->timer_set) {
+            ngx_add_timer(c->write, batch->timeout);
+        }
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    //nothing of the leaked requests is referenced by the connection anymore
+    ngx_multi_free_leak(multi_c);
+
+    return NGX_OK;
+}
+
+static void
+ngx_multi_batch_handler(ngx_event_t *ev)
+{
+    ngx_connection_t        *c;
+    ngx_multi_connection_t  *multi_c;
+
+    multi_c = ev->data;
+    c = multi_c->connection;
+
+    //the write handler flushes and owns the errors of the connection
+    c->write->handler(c->write);
+}
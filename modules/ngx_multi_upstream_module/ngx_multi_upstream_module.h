@@ -18,6 +18,27 @@
 typedef ngx_int_t (*ngx_multi_upstream_handler_pt)(ngx_connection_t *pc);
 typedef ngx_int_t (*ngx_multi_upstream_free_pt)(ngx_connection_t *pc, void *data);
 
+typedef struct ngx_multi_request_s  ngx_multi_request_t;
+
+//in-flight requests indexed by id, open addressing with linear probing
+typedef struct {
+    ngx_multi_request_t **elts;
+    ngx_uint_t           size;          //power of 2
+    ngx_uint_t           nelts;         //in-flight depth
+    ngx_uint_t           max;           //peak in-flight depth
+} ngx_multi_inflight_t;
+
+//requests queued on a multi connection and written out together
+typedef struct {
+    ngx_chain_writer_ctx_t *writer;
+    ngx_event_t          event;         //flush at the end of tick or delay
+    size_t               size;          //bytes queued since last flush
+    ngx_uint_t           frames;        //requests queued since last flush
+    size_t               max_size;      //flush at once beyond
+    ngx_msec_t           delay;
+    ngx_msec_t           timeout;       //send timeout when blocked
+} ngx_multi_batch_t;
+
 typedef struct {
     ngx_connection_t    *connection;
 
@@ -26,6 +47,9 @@ typedef struct {
     ngx_queue_t          leak_list;     //backend request list sending but front close
     ngx_queue_t          waiting_list;  //waiting backend send block
 
+    ngx_multi_inflight_t inflight;      //send list indexed by id
+    ngx_multi_batch_t    batch;         //coalesced writes
+
     void                *data_c;
 
     ngx_flag_t           connected:1;
@@ -38,7 +62,7 @@ typedef struct {
     void                *data;
 } ngx_multi_data_t;
 
-typedef struct {
+struct ngx_multi_request_s {
     ngx_queue_t          backend_queue;
     ngx_queue_t          front_queue;
 
@@ -51,7 +75,9 @@ typedef struct {
     ngx_chain_t         *out;
 
     void                *ctx;
-} ngx_multi_request_t;
+
+    unsigned             indexed:1;
+};
 
 typedef enum {
     NGX_FRONT_OK = 0,
@@ -70,4 +96,18 @@ ngx_multi_request_t* ngx_create_multi_request(ngx_connection_t *c, void *data);
 
 void ngx_multi_clean_leak(ngx_connection_t *c);
 
+ngx_int_t ngx_multi_request_insert(ngx_multi_connection_t *multi_c,
+    ngx_multi_request_t *multi_r);
+ngx_multi_request_t* ngx_multi_request_lookup(ngx_multi_connection_t *multi_c,
+    ngx_uint_t id);
+void ngx_multi_request_remove(ngx_multi_connection_t *multi_c,
+    ngx_multi_request_t *multi_r);
+
+void ngx_multi_batch_init(ngx_multi_connection_t *multi_c,
+    ngx_chain_writer_ctx_t *writer, size_t size, ngx_msec_t delay,
+    ngx_msec_t timeout);
+ngx_int_t ngx_multi_batch_write(ngx_multi_connection_t *multi_c,
+    ngx_chain_t *in);
+ngx_int_t ngx_multi_batch_flush(ngx_multi_connection_t *multi_c);
+
 #endif /* _NGX_MULTI_UPSTREAM_MODULE_H_ */
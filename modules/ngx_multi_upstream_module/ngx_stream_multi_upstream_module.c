@@ -521,6 +521,7 @@ ngx_stream_multi_upstream_free_peer(ngx_peer_connection_t *pc, void *data,
 
             //clean send_list on backend connection
             ngx_queue_remove(&multi_r->backend_queue);
+            ngx_multi_request_remove(multi_c, multi_r);
 
             len = 0;
             for (cl = multi_r->out; cl; cl = cl->next) {
@@ -9,6 +9,9 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -31,6 +34,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
     "    mov    %%ebx, %%esi;  "
 
+    "    xor    %%ecx, %%ecx;  "
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
     "    mov    %%ebx, 4(%1);  "
@@ -55,7 +59,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -67,6 +71,17 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    __asm__ ( ".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
 /* auto detect the L2 cache line size of modern and widespread CPUs */
 
 void
@@ -125,6 +140,22 @@ ngx_cpuinfo(void)
     } else if (ngx_strcmp(vendor, "AuthenticAMD") == 0) {
         ngx_cacheline_size = 64;
     }
+
+    /* SSE4.1 and SSE4.2 */
+
+    if ((cpu[3] & 0x180000) == 0x180000) {
+        ngx_cpu_features |= NGX_CPU_SSE42;
+    }
+
+    /* AVX2 needs the OS to save the ymm state, OSXSAVE and XCR0 bits 1-2 */
+
+    if (vbuf[0] >= 7 && (cpu[3] & 0x8000000) && (ngx_xgetbv() & 6) == 6) {
+        ngx_cpuid(7, cpu);
+
+        if (cpu[1] & 0x20) {
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+    }
 }
 
 #else
@@ -8,16 +8,26 @@
 #include <ngx_core.h>
 
 
-#define NGX_TRIE_MAX_QUEUE_SIZE     300
 #define NGX_TRIE_KIND               256
 
+/* states with more edges get a 256 entry table */
+#define NGX_TRIE_SPARSE             4
+
+
+static ngx_trie_node_t *ngx_trie_child(ngx_trie_node_t *node, u_char ch);
+static ngx_trie_node_t *ngx_trie_add_child(ngx_trie_t *trie,
+    ngx_trie_node_t *node, u_char ch);
+static ngx_int_t ngx_trie_compile(ngx_trie_t *trie, ngx_trie_node_t **q);
+static ngx_inline uint32_t ngx_trie_next(ngx_trie_t *trie,
+    ngx_trie_state_t *states, uint32_t cur, u_char ch);
+
 
 ngx_trie_t *
 ngx_trie_create(ngx_pool_t *pool)
 {
     ngx_trie_t *trie;
 
-    trie = ngx_palloc(pool, sizeof(ngx_trie_t));
+    trie = ngx_pcalloc(pool, sizeof(ngx_trie_t));
     if (trie == NULL) {
         return NULL;
     }
@@ -31,6 +41,7 @@ ngx_trie_create(ngx_pool_t *pool)
     trie->insert = ngx_trie_insert;
     trie->query = ngx_trie_query;
     trie->build_clue = ngx_trie_build_clue;
+    trie->count = 1;
 
     return trie;
 }
@@ -54,10 +65,9 @@ ngx_trie_node_t *
 ngx_trie_insert(ngx_trie_t *trie, ngx_str_t *str, ngx_uint_t mode)
 {
     size_t           i;
-    ngx_int_t        pos, step, index;
-    ngx_trie_node_t *p, *root;
+    ngx_int_t        pos, step;
+    ngx_trie_node_t *p, *next;
 
-    root = trie->root;
     i = 0;
 
     if (mode & NGX_TRIE_REVERSE) {
@@ -68,33 +78,21 @@ ngx_trie_insert(ngx_trie_t *trie, ngx_str_t *str, ngx_uint_t mode)
         step = 1;
     }
 
-    p = root;
+    p = trie->root;
 
     while (i < str->len) {
         pos = pos + step;
-        index = str->data[pos];
 
-        if (index < 0 || index >= NGX_TRIE_KIND) {
-            continue;
-        }
+        next = ngx_trie_child(p, str->data[pos]);
 
-        if (p->next == NULL) {
-            p->next = ngx_pcalloc(trie->pool,
-                                  NGX_TRIE_KIND * sizeof(ngx_trie_node_t *));
-
-            if (p->next == NULL) {
+        if (next == NULL) {
+            next = ngx_trie_add_child(trie, p, str->data[pos]);
+            if (next == NULL) {
                 return NULL;
             }
         }
 
-        if (p->next[index] == NULL) {
-            p->next[index] = ngx_trie_node_create(trie->pool);
-            if (p->next[index] == NULL) {
-                return NULL;
-            }
-        }
-
-        p = p->next[index];
+        p = next;
         i++;
     }
 
@@ -103,81 +101,283 @@ ngx_trie_insert(ngx_trie_t *trie, ngx_str_t *str, ngx_uint_t mode)
         p->greedy = 1;
     }
 
+    /* the compiled trie is stale until the next build_clue() */
+    trie->states = NULL;
+
     return p;
 }
 
 
+static ngx_trie_node_t *
+ngx_trie_child(ngx_trie_node_t *node, u_char ch)
+{
+    ngx_uint_t  lo, hi, mid;
+
+    lo = 0;
+    hi = node->nnext;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (node->label[mid] == ch) {
+            return node->next[mid];
+        }
+
+        if (node->label[mid] < ch) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_trie_node_t *
+ngx_trie_add_child(ngx_trie_t *trie, ngx_trie_node_t *node, u_char ch)
+{
+    u_char            *label;
+    ngx_uint_t         i, size;
+    ngx_trie_node_t   *child, **next;
+
+    child = ngx_trie_node_create(trie->pool);
+    if (child == NULL) {
+        return NULL;
+    }
+
+    if (node->nnext == node->size) {
+        size = node->size ? node->size * 2 : 1;
+
+        next = ngx_palloc(trie->pool, size * sizeof(ngx_trie_node_t *));
+        if (next == NULL) {
+            return NULL;
+        }
+
+        label = ngx_pnalloc(trie->pool, size);
+        if (label == NULL) {
+            return NULL;
+        }
+
+        if (node->nnext) {
+            ngx_memcpy(next, node->next,
+                       node->nnext * sizeof(ngx_trie_node_t *));
+            ngx_memcpy(label, node->label, node->nnext);
+        }
+
+        node->next = next;
+        node->label = label;
+        node->size = size;
+    }
+
+    for (i = node->nnext; i > 0 && node->label[i - 1] > ch; i--) {
+        node->next[i] = node->next[i - 1];
+        node->label[i] = node->label[i - 1];
+    }
+
+    node->next[i] = child;
+    node->label[i] = ch;
+    node->nnext++;
+
+    trie->count++;
+
+    return child;
+}
+
+
 ngx_int_t
 ngx_trie_build_clue(ngx_trie_t *trie)
 {
-    ngx_int_t        i, head, tail;
-    ngx_trie_node_t *q[NGX_TRIE_MAX_QUEUE_SIZE], *p, *t, *root;
+    ngx_int_t         rc;
+    ngx_uint_t        i, head, tail;
+    ngx_trie_node_t **q, *p, *t, *next, *root;
+
+    q = ngx_alloc(trie->count * sizeof(ngx_trie_node_t *), trie->pool->log);
+    if (q == NULL) {
+        return NGX_ERROR;
+    }
 
     head = tail = 0;
     root = trie->root;
+    root->index = head;
     q[head++] = root;
     root->search_clue = NULL;
 
     while (head != tail) {
         t = q[tail++];
-        tail %= NGX_TRIE_MAX_QUEUE_SIZE;
-
-        if (t->next == NULL) {
-            continue;
-        }
 
-        p = NULL;
+        for (i = 0; i < t->nnext; i++) {
+            next = t->next[i];
 
-        for (i = 0; i< NGX_TRIE_KIND; i++) {
-            if (t->next[i] == NULL) {
-                continue;
-            }
+            next->index = head;
+            q[head++] = next;
 
             if (t == root) {
-                t->next[i]->search_clue = root;
-
-                q[head++] = t->next[i];
-                head %= NGX_TRIE_MAX_QUEUE_SIZE;
-
+                next->search_clue = root;
                 continue;
             }
 
-            p = t->search_clue;
-
-            while (p != NULL) {
-                if (p->next !=NULL && p->next[i] != NULL) {
-                    t->next[i]->search_clue = p->next[i];
+            for (p = t->search_clue; p != NULL; p = p->search_clue) {
+                next->search_clue = ngx_trie_child(p, t->label[i]);
+                if (next->search_clue != NULL) {
                     break;
                 }
-                p = p->search_clue;
             }
 
             if (p == NULL) {
-                t->next[i]->search_clue = root;
+                next->search_clue = root;
+            }
+        }
+    }
+
+    rc = ngx_trie_compile(trie, q);
+
+    ngx_free(q);
+
+    return rc;
+}
+
+
+/* q holds the nodes in breadth first order */
+
+static ngx_int_t
+ngx_trie_compile(ngx_trie_t *trie, ngx_trie_node_t **q)
+{
+    ngx_uint_t         n, i, edges, dense;
+    uint32_t          *table;
+    ngx_trie_node_t   *node;
+    ngx_trie_state_t  *states, *s;
+
+    edges = 0;
+    dense = 0;
+
+    for (n = 0; n < trie->count; n++) {
+        if (n == 0 || q[n]->nnext > NGX_TRIE_SPARSE) {
+            dense++;
+
+        } else {
+            edges += q[n]->nnext;
+        }
+    }
+
+    states = ngx_palloc(trie->pool, trie->count * sizeof(ngx_trie_state_t));
+    if (states == NULL) {
+        return NGX_ERROR;
+    }
+
+    trie->labels = ngx_pnalloc(trie->pool, edges + 1);
+    trie->targets = ngx_palloc(trie->pool, (edges + 1) * sizeof(uint32_t));
+    trie->dense = ngx_pcalloc(trie->pool,
+                              dense * NGX_TRIE_KIND * sizeof(uint32_t));
+
+    if (trie->labels == NULL || trie->targets == NULL || trie->dense == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    edges = 0;
+    dense = 0;
+
+    for (n = 0; n < trie->count; n++) {
+        node = q[n];
+        s = &states[n];
+
+        s->clue = node->search_clue ? node->search_clue->index : 0;
+        s->key = node->key;
+        s->greedy = node->greedy;
+        s->nnext = node->nnext;
+        s->node = node;
+
+        if (n == 0 || node->nnext > NGX_TRIE_SPARSE) {
+            s->dense = 1;
+            s->next = dense * NGX_TRIE_KIND;
+
+            table = &trie->dense[s->next];
+
+            for (i = 0; i < node->nnext; i++) {
+                table[node->label[i]] = node->next[i]->index;
             }
 
-            q[head++] = t->next[i];
-            head %= NGX_TRIE_MAX_QUEUE_SIZE;
+            /*
+             * the missing edges are resolved through the search clues
+             * here, so that queries never fall back from a wide state;
+             * the clue of a state precedes it in breadth first order
+             */
+
+            if (n != 0) {
+                for (i = 0; i < NGX_TRIE_KIND; i++) {
+                    if (table[i] == 0) {
+                        table[i] = ngx_trie_next(trie, states, s->clue, i);
+                    }
+                }
+            }
+
+            dense++;
+            continue;
+        }
+
+        s->dense = 0;
+        s->next = edges;
+
+        for (i = 0; i < node->nnext; i++) {
+            trie->labels[edges] = node->label[i];
+            trie->targets[edges] = node->next[i]->index;
+            edges++;
         }
     }
 
+    trie->states = states;
+
     return NGX_OK;
 }
 
 
+static ngx_inline uint32_t
+ngx_trie_next(ngx_trie_t *trie, ngx_trie_state_t *states, uint32_t cur,
+    u_char ch)
+{
+    u_char            *label;
+    ngx_uint_t         i;
+    ngx_trie_state_t  *s;
+
+    for ( ;; ) {
+        s = &states[cur];
+
+        if (s->dense) {
+            return trie->dense[s->next + ch];
+        }
+
+        label = &trie->labels[s->next];
+
+        for (i = 0; i < s->nnext && label[i] <= ch; i++) {
+            if (label[i] == ch) {
+                return trie->targets[s->next + i];
+            }
+        }
+
+        cur = s->clue;
+    }
+}
+
+
 void *
 ngx_trie_query(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *version_pos,
     ngx_uint_t mode)
 {
-    void            *value;
-    size_t           i;
-    ngx_int_t        step, pos, index;
-    ngx_trie_node_t *p, *root;
+    void              *value;
+    u_char            *data;
+    size_t             i, len;
+    uint32_t           cur, *root;
+    ngx_int_t          step, pos;
+    ngx_trie_state_t  *states, *s;
 
     value = NULL;
-    root = trie->root;
-    p = root;
-    i = 0;
+    states = trie->states;
+
+    if (states == NULL || states[0].nnext == 0) {
+        return NULL;
+    }
 
     if (mode & NGX_TRIE_REVERSE) {
         pos = str->len;
@@ -187,36 +387,36 @@ ngx_trie_query(ngx_trie_t *trie, ngx_str_t *str, ngx_int_t *version_pos,
         step = 1;
     }
 
-    if (p->next == NULL) {
-        return NULL;
-    }
+    /* the root table comes first */
+    root = trie->dense;
+    data = str->data;
+    len = str->len;
+    cur = 0;
 
-    while (i < str->len) {
+    for (i = 0; i < len; i++) {
         pos += step;
-        index = str->data[pos];
-        if (index < 0 || index >= NGX_TRIE_KIND) {
-            index = 0;
-        }
 
-        while (p->next[index] == NULL) {
-            if (p == root) {
-                break;
+        if (cur == 0) {
+            cur = root[data[pos]];
+
+            if (cur == 0) {
+                continue;
             }
-            p = p->search_clue;
+
+        } else {
+            cur = ngx_trie_next(trie, states, cur, data[pos]);
         }
 
-        p = p->next[index];
-        p = p == NULL ? root : p;
-        if (p->key) {
-            value = p->value;
-            *version_pos = pos + p->key;
-            if (!p->greedy) {
+        s = &states[cur];
+
+        if (s->key) {
+            value = s->node->value;
+            *version_pos = pos + s->key;
+            if (!s->greedy) {
                 return value;
             }
-            p = root;
+            cur = 0;
         }
-
-        i++;
     }
 
     return value;
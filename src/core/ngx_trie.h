@@ -29,19 +29,54 @@ typedef void *(*ngx_trie_query_pt)(ngx_trie_t *trie,
 struct ngx_trie_node_s {
     void                           *value;
     ngx_trie_node_t                *search_clue;
+
+    /* children sorted by label, the arrays grow in powers of two */
     ngx_trie_node_t               **next;
+    u_char                         *label;
+    uint16_t                        nnext;
+    uint16_t                        size;
+
+    uint32_t                        index;
 
     unsigned                        key:31;
     unsigned                        greedy:1;
 };
 
 
+/*
+ * the trie compiled by build_clue() for queries: states in breadth first
+ * order, the edges of a state are either "nnext" sorted labels with their
+ * targets or, for the root and wide states, a 256 entry table that already
+ * follows the search clues; 0 is the root
+ */
+
+typedef struct {
+    uint32_t                        next;
+    uint32_t                        clue;
+
+    unsigned                        key:31;
+    unsigned                        greedy:1;
+
+    uint16_t                        nnext;
+    unsigned                        dense:1;
+
+    ngx_trie_node_t                *node;
+} ngx_trie_state_t;
+
+
 struct ngx_trie_s {
     ngx_trie_node_t                *root;
     ngx_pool_t                     *pool;
     ngx_trie_insert_pt              insert;
     ngx_trie_query_pt               query;
     ngx_trie_build_clue_pt          build_clue;
+
+    ngx_uint_t                      count;
+
+    ngx_trie_state_t               *states;
+    u_char                         *labels;
+    uint32_t                       *targets;
+    uint32_t                       *dense;
 };
 
 
@@ -110,6 +110,15 @@ ngx_atomic_t  *ngx_stat_quic_queries_refused = &ngx_stat_quic_queries_refused0;
 ngx_atomic_t   ngx_stat_quic_concurrent_conns0;
 ngx_atomic_t  *ngx_stat_quic_concurrent_conns = &ngx_stat_quic_concurrent_conns0;
 
+ngx_atomic_t   ngx_stat_quic_recv_batches0;
+ngx_atomic_t  *ngx_stat_quic_recv_batches = &ngx_stat_quic_recv_batches0;
+ngx_atomic_t   ngx_stat_quic_recv_full_batches0;
+ngx_atomic_t  *ngx_stat_quic_recv_full_batches = &ngx_stat_quic_recv_full_batches0;
+ngx_atomic_t   ngx_stat_quic_recv_datagrams0;
+ngx_atomic_t  *ngx_stat_quic_recv_datagrams = &ngx_stat_quic_recv_datagrams0;
+ngx_atomic_t   ngx_stat_quic_recv_packets0;
+ngx_atomic_t  *ngx_stat_quic_recv_packets = &ngx_stat_quic_recv_packets0;
+
 #endif
 
 static ngx_command_t  ngx_events_commands[] = {
@@ -607,7 +616,11 @@ ngx_event_module_init(ngx_cycle_t *cycle)
             + cl        /* ngx_stat_quic_qps_nexttime */
             + cl        /* ngx_stat_quic_qps */
             + cl        /* ngx_stat_quic_queries_refused */
-            + cl;       /* ngx_stat_quic_concurrent_conns */
+            + cl        /* ngx_stat_quic_concurrent_conns */
+            + cl        /* ngx_stat_quic_recv_batches */
+            + cl        /* ngx_stat_quic_recv_full_batches */
+            + cl        /* ngx_stat_quic_recv_datagrams */
+            + cl;       /* ngx_stat_quic_recv_packets */
 
 #endif
 
@@ -677,8 +690,12 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_quic_qps = (ngx_atomic_t *) (shared + (n + 7) * cl);
     ngx_stat_quic_queries_refused = (ngx_atomic_t *) (shared + (n + 8) * cl);
     ngx_stat_quic_concurrent_conns = (ngx_atomic_t * ) (shared + (n + 9) * cl);
+    ngx_stat_quic_recv_batches = (ngx_atomic_t *) (shared + (n + 10) * cl);
+    ngx_stat_quic_recv_full_batches = (ngx_atomic_t *) (shared + (n + 11) * cl);
+    ngx_stat_quic_recv_datagrams = (ngx_atomic_t *) (shared + (n + 12) * cl);
+    ngx_stat_quic_recv_packets = (ngx_atomic_t *) (shared + (n + 13) * cl);
 
-    n += 9;
+    n += 13;
 #endif
 
     return NGX_OK;
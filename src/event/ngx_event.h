@@ -40,6 +40,11 @@ extern ngx_atomic_t  *ngx_stat_quic_queries_refused;
 
 extern ngx_atomic_t  *ngx_stat_quic_concurrent_conns;
 
+extern ngx_atomic_t  *ngx_stat_quic_recv_batches;
+extern ngx_atomic_t  *ngx_stat_quic_recv_full_batches;
+extern ngx_atomic_t  *ngx_stat_quic_recv_datagrams;
+extern ngx_atomic_t  *ngx_stat_quic_recv_packets;
+
 #endif
 
 struct ngx_event_s {
@@ -535,6 +540,10 @@ extern ngx_module_t           ngx_event_core_module;
 void ngx_event_accept(ngx_event_t *ev);
 #if !(NGX_WIN32)
 void ngx_event_recvmsg(ngx_event_t *ev);
+#if (T_NGX_UDPV2)
+ngx_udpv2_traffic_filter_retcode ngx_event_udpv2_recvmsg_filter(
+    ngx_listening_t *ls, const ngx_udpv2_packet_t *upkt);
+#endif
 void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 #endif
@@ -22,6 +22,9 @@ struct ngx_udp_connection_s {
 static void ngx_close_accepted_udp_connection(ngx_connection_t *c);
 static ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf,
     size_t size);
+static ngx_int_t ngx_event_udp_process(ngx_connection_t *lc, u_char *buffer,
+    ssize_t n, struct sockaddr *sockaddr, socklen_t socklen,
+    struct sockaddr *local_sockaddr, socklen_t local_socklen);
 static ngx_int_t ngx_insert_udp_connection(ngx_connection_t *c);
 static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
     struct sockaddr *sockaddr, socklen_t socklen,
@@ -32,18 +35,15 @@ void
 ngx_event_recvmsg(ngx_event_t *ev)
 {
     ssize_t            n;
-    ngx_buf_t          buf;
-    ngx_log_t         *log;
     ngx_err_t          err;
     socklen_t          socklen, local_socklen;
-    ngx_event_t       *rev, *wev;
     struct iovec       iov[1];
     struct msghdr      msg;
     ngx_sockaddr_t     sa, lsa;
     struct sockaddr   *sockaddr, *local_sockaddr;
     ngx_listening_t   *ls;
     ngx_event_conf_t  *ecf;
-    ngx_connection_t  *c, *lc;
+    ngx_connection_t  *lc;
     static u_char      buffer[65535];
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
@@ -229,233 +229,295 @@ ngx_event_recvmsg(ngx_event_t *ev)
 
 #endif
 
-        c = ngx_lookup_udp_connection(ls, sockaddr, socklen, local_sockaddr,
-                                      local_socklen);
+        if (ngx_event_udp_process(lc, buffer, n, sockaddr, socklen,
+                                  local_sockaddr, local_socklen)
+            != NGX_OK)
+        {
+            return;
+        }
 
-        if (c) {
+        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+            ev->available -= n;
+        }
+
+    } while (ev->available);
+}
 
+
+static ngx_int_t
+ngx_event_udp_process(ngx_connection_t *lc, u_char *buffer, ssize_t n,
+    struct sockaddr *sockaddr, socklen_t socklen,
+    struct sockaddr *local_sockaddr, socklen_t local_socklen)
+{
+    ngx_buf_t          buf;
+    ngx_log_t         *log;
+    ngx_event_t       *rev, *wev;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *c;
 #if (NGX_DEBUG)
-            if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
-                ngx_log_handler_pt  handler;
+    ngx_event_conf_t  *ecf;
+#endif
 
-                handler = c->log->handler;
-                c->log->handler = NULL;
+    ls = lc->listening;
 
-                ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "recvmsg: fd:%d n:%z", c->fd, n);
+    c = ngx_lookup_udp_connection(ls, sockaddr, socklen, local_sockaddr,
+                                  local_socklen);
 
-                c->log->handler = handler;
-            }
+    if (c) {
+
+#if (NGX_DEBUG)
+        if (c->log->log_level & NGX_LOG_DEBUG_EVENT) {
+            ngx_log_handler_pt  handler;
+
+            handler = c->log->handler;
+            c->log->handler = NULL;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "recvmsg: fd:%d n:%z", c->fd, n);
+
+            c->log->handler = handler;
+        }
 #endif
 
-            ngx_memzero(&buf, sizeof(ngx_buf_t));
+        ngx_memzero(&buf, sizeof(ngx_buf_t));
 
-            buf.pos = buffer;
-            buf.last = buffer + n;
+        buf.pos = buffer;
+        buf.last = buffer + n;
 
-            rev = c->read;
+        rev = c->read;
 
-            c->udp->buffer = &buf;
+        c->udp->buffer = &buf;
 
-            rev->ready = 1;
-            rev->active = 0;
+        rev->ready = 1;
+        rev->active = 0;
 
 #if (NGX_KCP)
-            if (c->kcp)
-            {
-                ngx_event_kcp_handler(rev);
-            }
-            else
-            {
-                rev->handler(rev);
-            }
-#else
+        if (c->kcp)
+        {
+            ngx_event_kcp_handler(rev);
+        }
+        else
+        {
             rev->handler(rev);
+        }
+#else
+        rev->handler(rev);
 #endif
 
-            if (c->udp) {
-                c->udp->buffer = NULL;
-            }
+        if (c->udp) {
+            c->udp->buffer = NULL;
+        }
 
-            rev->ready = 0;
-            rev->active = 1;
+        rev->ready = 0;
+        rev->active = 1;
 
-            goto next;
-        }
+        return NGX_OK;
+    }
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
 #endif
 
-        ngx_accept_disabled = ngx_cycle->connection_n / 8
-                              - ngx_cycle->free_connection_n;
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
 
-        c = ngx_get_connection(lc->fd, ev->log);
-        if (c == NULL) {
-            return;
-        }
+    c = ngx_get_connection(lc->fd, lc->log);
+    if (c == NULL) {
+        return NGX_ERROR;
+    }
 
-        c->shared = 1;
-        c->type = SOCK_DGRAM;
-        c->socklen = socklen;
+    c->shared = 1;
+    c->type = SOCK_DGRAM;
+    c->socklen = socklen;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
 #endif
 
-        c->pool = ngx_create_pool(ls->pool_size, ev->log);
-        if (c->pool == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
-
-        c->sockaddr = ngx_palloc(c->pool, socklen);
-        if (c->sockaddr == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    c->pool = ngx_create_pool(ls->pool_size, lc->log);
+    if (c->pool == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        ngx_memcpy(c->sockaddr, sockaddr, socklen);
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        log = ngx_palloc(c->pool, sizeof(ngx_log_t));
-        if (log == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    ngx_memcpy(c->sockaddr, sockaddr, socklen);
 
-        *log = ls->log;
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        c->recv = ngx_udp_shared_recv;
-        c->send = ngx_udp_send;
-        c->send_chain = ngx_udp_send_chain;
+    *log = ls->log;
 
-        c->log = log;
-        c->pool->log = log;
-        c->listening = ls;
+    c->recv = ngx_udp_shared_recv;
+    c->send = ngx_udp_send;
+    c->send_chain = ngx_udp_send_chain;
 
-        if (local_sockaddr == &lsa.sockaddr) {
-            local_sockaddr = ngx_palloc(c->pool, local_socklen);
-            if (local_sockaddr == NULL) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+    c->log = log;
+    c->pool->log = log;
+    c->listening = ls;
 
-            ngx_memcpy(local_sockaddr, &lsa, local_socklen);
+    if (local_sockaddr != ls->sockaddr) {
+        c->local_sockaddr = ngx_palloc(c->pool, local_socklen);
+        if (c->local_sockaddr == NULL) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
         }
 
+        ngx_memcpy(c->local_sockaddr, local_sockaddr, local_socklen);
+
+    } else {
         c->local_sockaddr = local_sockaddr;
-        c->local_socklen = local_socklen;
+    }
 
-        c->buffer = ngx_create_temp_buf(c->pool, n);
-        if (c->buffer == NULL) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    c->local_socklen = local_socklen;
+
+    c->buffer = ngx_create_temp_buf(c->pool, n);
+    if (c->buffer == NULL) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
 
-        c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
+    c->buffer->last = ngx_cpymem(c->buffer->last, buffer, n);
 
-        rev = c->read;
-        wev = c->write;
+    rev = c->read;
+    wev = c->write;
 
-        rev->active = 1;
-        wev->ready = 1;
+    rev->active = 1;
+    wev->ready = 1;
 
-        rev->log = log;
-        wev->log = log;
+    rev->log = log;
+    wev->log = log;
 
-        /*
-         * TODO: MT: - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         *
-         * TODO: MP: - allocated in a shared memory
-         *           - ngx_atomic_fetch_add()
-         *             or protection by critical section or light mutex
-         */
+    /*
+     * TODO: MT: - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     *
+     * TODO: MP: - allocated in a shared memory
+     *           - ngx_atomic_fetch_add()
+     *             or protection by critical section or light mutex
+     */
 
-        c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
 
-        c->start_time = ngx_current_msec;
+    c->start_time = ngx_current_msec;
 
 #if (NGX_STAT_STUB)
-        (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
 #endif
 
 #if (NGX_KCP)
-        if (ls->kcp)
+    if (ls->kcp)
+    {
+        ngx_uint_t conv = ngx_get_kcp_conv(buffer, n);
+        if (conv == 0)
         {
-            ngx_uint_t conv = ngx_get_kcp_conv(buffer, n);
-            if (conv == 0)
-            {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, 0,
-                               "get kcp conv failed");
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, 0,
+                           "get kcp conv failed");
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
+        }
 
-            c->kcp = ngx_create_kcp(c, conv, ls->kcp_mode);
-            if (c->kcp == NULL)
-            {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+        c->kcp = ngx_create_kcp(c, conv, ls->kcp_mode);
+        if (c->kcp == NULL)
+        {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
         }
+    }
 #endif
 
-        if (ls->addr_ntop) {
-            c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
-            if (c->addr_text.data == NULL) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
+        }
 
-            c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
-                                             c->addr_text.data,
-                                             ls->addr_text_max_len, 0);
-            if (c->addr_text.len == 0) {
-                ngx_close_accepted_udp_connection(c);
-                return;
-            }
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_accepted_udp_connection(c);
+            return NGX_ERROR;
         }
+    }
 
 #if (NGX_DEBUG)
-        {
-        ngx_str_t  addr;
-        u_char     text[NGX_SOCKADDR_STRLEN];
+    {
+    ngx_str_t  addr;
+    u_char     text[NGX_SOCKADDR_STRLEN];
+
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
 
-        ngx_debug_accepted_connection(ecf, c);
+    ngx_debug_accepted_connection(ecf, c);
 
-        if (log->log_level & NGX_LOG_DEBUG_EVENT) {
-            addr.data = text;
-            addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
-                                     NGX_SOCKADDR_STRLEN, 1);
+    if (log->log_level & NGX_LOG_DEBUG_EVENT) {
+        addr.data = text;
+        addr.len = ngx_sock_ntop(c->sockaddr, c->socklen, text,
+                                 NGX_SOCKADDR_STRLEN, 1);
 
-            ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
-                           "*%uA recvmsg: %V fd:%d n:%z",
-                           c->number, &addr, c->fd, n);
-        }
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "*%uA recvmsg: %V fd:%d n:%z",
+                       c->number, &addr, c->fd, n);
+    }
 
-        }
+    }
 #endif
 
-        if (ngx_insert_udp_connection(c) != NGX_OK) {
-            ngx_close_accepted_udp_connection(c);
-            return;
-        }
+    if (ngx_insert_udp_connection(c) != NGX_OK) {
+        ngx_close_accepted_udp_connection(c);
+        return NGX_ERROR;
+    }
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    ls->handler(c);
 
-        log->data = NULL;
-        log->handler = NULL;
+    return NGX_OK;
+}
 
-        ls->handler(c);
 
-    next:
+#if (T_NGX_UDPV2)
 
-        if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
-            ev->available -= n;
-        }
+ngx_udpv2_traffic_filter_retcode
+ngx_event_udpv2_recvmsg_filter(ngx_listening_t *ls,
+    const ngx_udpv2_packet_t *upkt)
+{
+    socklen_t         local_socklen;
+    struct sockaddr  *local_sockaddr;
 
-    } while (ev->available);
+    if (ls->connection == NULL) {
+        return NGX_UDPV2_PASS;
+    }
+
+    local_sockaddr = ls->sockaddr;
+    local_socklen = ls->socklen;
+
+    if (ls->wildcard) {
+        local_sockaddr = (struct sockaddr *) &upkt->pkt_local_sockaddr;
+        local_socklen = upkt->pkt_local_socklen;
+    }
+
+    (void) ngx_event_udp_process(ls->connection, upkt->pkt_payload,
+                                 upkt->pkt_sz,
+                                 (struct sockaddr *) &upkt->pkt_sockaddr,
+                                 upkt->pkt_socklen,
+                                 local_sockaddr, local_socklen);
+
+    return NGX_UDPV2_DONE;
 }
 
+#endif
+
 
 static void
 ngx_close_accepted_udp_connection(ngx_connection_t *c)
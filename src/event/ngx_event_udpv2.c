@@ -35,6 +35,14 @@ ngx_event_udpv2_init_listening(ngx_listening_t *ls) {
     ngx_queue_init(&ls->udpv2_filter);
 
     ls->udpv2_traffic_filter.func = NULL;
+
+#if (NGX_KCP)
+    /* kcp sessions fed by xudp go through the regular udp sessions */
+    if (ls->kcp) {
+        ls->udpv2_traffic_filter.func = ngx_event_udpv2_recvmsg_filter;
+    }
+#endif
+
     ngx_udpv2_add_dispatch_filter(ls, &ls->udpv2_traffic_filter);
 }
 
@@ -0,0 +1,422 @@
+
+/*
+ * Copyright (C) 2010-2019 Alibaba Group Holding Limited
+ */
+
+
+/*
+ * Evaluation cost of ngx_http_complex_value() for complex values shaped
+ * like those of a caching reverse proxy.  As in nginx, each directive
+ * using a value compiles a complex value of its own, and all of them are
+ * evaluated once per request: the two pass evaluation, the one pass
+ * evaluation, and the one pass evaluation with the values cached in the
+ * request, where equal values of different directives share an entry.
+ * Variables are served by a stand-in for the variables module, with the
+ * same caching rules.  Before timing, the results of the three ways are
+ * compared.  It links the objects of a configured and built tree, from
+ * the top directory:
+ *
+ *     cc -O2 -o complex_value_bench src/http/bench/complex_value_bench.c \
+ *         -I objs -I src/core -I src/event -I src/event/modules \
+ *         -I src/os/unix -I src/proc -I src/http -I src/http/modules \
+ *         -I src/http/v2 -I src/stream \
+ *         objs/src/http/ngx_http_script.o objs/src/core/ngx_string.o \
+ *         objs/src/core/ngx_palloc.o objs/src/core/ngx_array.o \
+ *         objs/src/core/ngx_parse.o objs/src/core/ngx_rbtree.o \
+ *         objs/src/core/ngx_crc32.o objs/src/os/unix/ngx_alloc.o
+ *     ./complex_value_bench [requests]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+#include <time.h>
+
+
+#define NVARIABLES  (sizeof(variables) / sizeof(variables[0]) - 1)
+#define NVALUES     16
+
+
+typedef struct {
+    char        *name;
+    char        *value;
+    ngx_uint_t   flags;
+} variable_t;
+
+
+typedef struct {
+    char        *name;
+    char        *value;
+    ngx_uint_t   uses;
+} config_t;
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+ngx_module_t  ngx_http_core_module;
+
+ngx_http_variable_value_t  ngx_http_variable_null_value =
+    ngx_http_variable("");
+ngx_http_variable_value_t  ngx_http_variable_true_value =
+    ngx_http_variable("1");
+
+
+static variable_t  variables[] = {
+    { "scheme", "https", 0 },
+    { "request_method", "GET", 0 },
+    { "host", "api.example.com", 0 },
+    { "request_uri", "/api/v1/tenants/acme/orders/20231015/items"
+                     "?fields=id,name,price&page=2", 0 },
+    { "remote_addr", "203.0.113.195", 0 },
+    { "http_x_request_id", "7b1c2f3e-4d5a-6b7c-8d9e-0f1a2b3c4d5e", 0 },
+    { "cookie_session", "5f2b8c1d9e7a4f3b8c2d1e0f9a8b7c6d", 0 },
+    { "upstream_cache_status", "HIT", NGX_HTTP_VAR_NOCACHEABLE },
+    { "msec", "1697371200.123", NGX_HTTP_VAR_NOCACHEABLE },
+    { NULL, NULL, 0 }
+};
+
+
+static config_t  configs[] = {
+
+    /* proxy_cache_key, hash in the upstream block, a log format field */
+    { "cache key", "$scheme$request_method$host$request_uri", 3 },
+
+    /* proxy_set_header X-Forwarded and a sub_filter replacement */
+    { "forwarded", "for=$remote_addr;proto=$scheme;host=$host", 2 },
+
+    /* limit_req key and a log field */
+    { "session", "$cookie_session:$http_x_request_id", 2 },
+
+    /* add_header values */
+    { "cache status", "$upstream_cache_status", 1 },
+    { "timing", "$host $msec", 1 },
+
+    { NULL, NULL, 0 }
+};
+
+
+void ngx_cdecl
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void ngx_cdecl
+ngx_conf_log_error(ngx_uint_t level, ngx_conf_t *cf, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+ngx_int_t
+ngx_conf_full_name(ngx_cycle_t *cycle, ngx_str_t *name, ngx_uint_t conf_prefix)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_get_full_name(ngx_pool_t *pool, ngx_str_t *prefix, ngx_str_t *name)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    ngx_open_file_info_t *of, ngx_pool_t *pool)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_send_response(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_str_t *ct, ngx_http_complex_value_t *cv)
+{
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_http_set_disable_symlinks(ngx_http_request_t *r,
+    ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_http_update_location_config(ngx_http_request_t *r)
+{
+}
+
+
+ngx_int_t
+ngx_http_get_variable_index(ngx_conf_t *cf, ngx_str_t *name)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; variables[i].name; i++) {
+        if (name->len == ngx_strlen(variables[i].name)
+            && ngx_strncmp(name->data, variables[i].name, name->len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+/* the caching rules of ngx_http_variables.c */
+
+ngx_http_variable_value_t *
+ngx_http_get_indexed_variable(ngx_http_request_t *r, ngx_uint_t index)
+{
+    ngx_http_variable_value_t  *vv;
+
+    vv = &r->variables[index];
+
+    if (vv->not_found || vv->valid) {
+        return vv;
+    }
+
+    vv->data = (u_char *) variables[index].value;
+    vv->len = ngx_strlen(variables[index].value);
+    vv->valid = 1;
+    vv->no_cacheable = 0;
+    vv->not_found = 0;
+
+    if (variables[index].flags & NGX_HTTP_VAR_NOCACHEABLE) {
+        vv->no_cacheable = 1;
+    }
+
+    return vv;
+}
+
+
+ngx_http_variable_value_t *
+ngx_http_get_flushed_variable(ngx_http_request_t *r, ngx_uint_t index)
+{
+    ngx_http_variable_value_t  *vv;
+
+    vv = &r->variables[index];
+
+    if (vv->no_cacheable) {
+        vv->valid = 0;
+        vv->not_found = 0;
+    }
+
+    return ngx_http_get_indexed_variable(r, index);
+}
+
+
+/* one complex value per directive, in configuration order */
+
+static ngx_uint_t  nvalues;
+static ngx_uint_t  owner[NVALUES];
+
+
+static void
+request(ngx_http_request_t *r, ngx_http_complex_value_t *cv, ngx_str_t *out)
+{
+    ngx_uint_t  i;
+
+    ngx_reset_pool(r->pool);
+
+    ngx_memzero(r->variables, NVARIABLES * sizeof(ngx_http_variable_value_t));
+
+    r->complex_values = NULL;
+
+    for (i = 0; i < nvalues; i++) {
+        if (ngx_http_complex_value(r, &cv[i], &out[i]) != NGX_OK) {
+            out[i].len = 0;
+        }
+    }
+}
+
+
+static void
+set_mode(ngx_http_complex_value_t *cv, ngx_http_complex_value_t *compiled,
+    ngx_uint_t mode)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < nvalues; i++) {
+        cv[i] = compiled[i];
+
+        if (mode < 2) {
+            cv[i].id = 0;
+        }
+
+        if (mode < 1) {
+            cv[i].one_pass = 0;
+        }
+    }
+}
+
+
+static double
+run(ngx_http_request_t *r, ngx_http_complex_value_t *cv, ngx_str_t *out,
+    ngx_uint_t requests)
+{
+    ngx_uint_t       i;
+    struct timespec  t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < requests; i++) {
+        request(r, cv, out);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec))
+           / requests;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    double                            ns;
+    ngx_str_t                         value, out[NVALUES], expect[NVALUES];
+    ngx_log_t                         log;
+    ngx_uint_t                        i, n, mode, requests;
+    ngx_conf_t                        cf;
+    ngx_connection_t                  c;
+    ngx_http_variable_t               vars[16];
+    ngx_http_request_t                r;
+    ngx_http_conf_ctx_t               ctx;
+    ngx_http_complex_value_t          compiled[NVALUES], cv[NVALUES];
+    ngx_http_core_main_conf_t         cmcf;
+    ngx_http_compile_complex_value_t  ccv;
+
+    static const char  *names[] = { "two pass", "one pass",
+                                    "one pass, cached" };
+    void               *main_conf[1];
+
+    requests = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 1000000;
+
+    ngx_pagesize = getpagesize();
+
+    ngx_memzero(&log, sizeof(ngx_log_t));
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+    ngx_memzero(&cmcf, sizeof(ngx_http_core_main_conf_t));
+    ngx_memzero(vars, sizeof(vars));
+
+    cf.pool = ngx_create_pool(16384, &log);
+    cf.log = &log;
+
+    for (n = 0; variables[n].name; n++) {
+        vars[n].name.len = ngx_strlen(variables[n].name);
+        vars[n].name.data = (u_char *) variables[n].name;
+        vars[n].flags = variables[n].flags;
+        vars[n].index = n;
+    }
+
+    cmcf.variables.elts = vars;
+    cmcf.variables.nelts = n;
+
+    ngx_rbtree_init(&cmcf.complex_values, &cmcf.complex_values_sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    main_conf[0] = &cmcf;
+
+    ctx.main_conf = main_conf;
+    cf.ctx = &ctx;
+
+    for (i = 0; configs[i].name; i++) {
+        for (n = 0; n < configs[i].uses; n++) {
+
+            if (nvalues == NVALUES) {
+                printf("too many values\n");
+                return 1;
+            }
+
+            /* the text of each directive is parsed on its own */
+
+            value.len = ngx_strlen(configs[i].value);
+            value.data = ngx_pnalloc(cf.pool, value.len);
+            if (value.data == NULL) {
+                return 1;
+            }
+
+            ngx_memcpy(value.data, configs[i].value, value.len);
+
+            ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+            ccv.cf = &cf;
+            ccv.value = &value;
+            ccv.complex_value = &compiled[nvalues];
+
+            if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+                printf("%s: failed to compile\n", configs[i].name);
+                return 1;
+            }
+
+            owner[nvalues++] = i;
+        }
+    }
+
+    c.log = &log;
+
+    r.connection = &c;
+    r.main_conf = main_conf;
+    r.pool = ngx_create_pool(4096, &log);
+    r.variables = ngx_pcalloc(cf.pool,
+                              NVARIABLES * sizeof(ngx_http_variable_value_t));
+
+    if (r.pool == NULL || r.variables == NULL) {
+        return 1;
+    }
+
+    for (mode = 0; mode < 3; mode++) {
+        set_mode(cv, compiled, mode);
+
+        /* the second request also uses the sizing hints of one pass */
+
+        for (n = 0; n < 2; n++) {
+            request(&r, cv, out);
+
+            for (i = 0; i < nvalues; i++) {
+                if (mode == 0 && n == 0) {
+                    expect[i].len = out[i].len;
+                    expect[i].data = ngx_pstrdup(cf.pool, &out[i]);
+                    continue;
+                }
+
+                if (out[i].len != expect[i].len
+                    || ngx_memcmp(out[i].data, expect[i].data, out[i].len)
+                       != 0)
+                {
+                    printf("%s: \"%s\" differs: \"%.*s\"\n", names[mode],
+                           configs[owner[i]].name, (int) out[i].len,
+                           out[i].data);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < nvalues; i++) {
+        printf("%-13s id %-2d \"%.*s\"\n", configs[owner[i]].name,
+               (int) compiled[i].id, (int) expect[i].len, expect[i].data);
+    }
+
+    for (mode = 0; mode < 3; mode++) {
+        set_mode(cv, compiled, mode);
+
+        ns = run(&r, cv, out, requests);
+
+        printf("%-17s %8.1f ns/request\n", names[mode], ns);
+    }
+
+    return 0;
+}
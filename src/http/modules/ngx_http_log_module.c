@@ -33,6 +33,7 @@ struct ngx_http_log_op_s {
 
 typedef struct {
     ngx_str_t                   name;
+    uint32_t                    crc32;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
 } ngx_http_log_fmt_t;
@@ -40,10 +41,53 @@ typedef struct {
 
 typedef struct {
     ngx_array_t                 formats;    /* array of ngx_http_log_fmt_t */
+    ngx_array_t                *rings;      /* array of ngx_http_log_ring_t * */
     ngx_uint_t                  combined_used; /* unsigned  combined_used:1 */
 } ngx_http_log_main_conf_t;
 
 
+/*
+ * an asynchronous log entry: the fields of the format which are not
+ * literal text follow the header, each as a 32-bit length and the data;
+ * variables are stored unescaped
+ */
+
+typedef struct {
+    ngx_atomic_t                commit;
+    uint32_t                    len;
+    uint32_t                    crc32;
+} ngx_http_log_ring_entry_t;
+
+
+typedef struct {
+    ngx_atomic_t                head;
+    ngx_atomic_t                tail;
+    ngx_atomic_t                dropped;
+    u_char                      data[1];
+} ngx_http_log_ring_sh_t;
+
+
+typedef struct {
+    ngx_http_log_ring_sh_t     *sh;
+    ngx_slab_pool_t            *shpool;
+    size_t                      size;
+    ngx_msec_t                  flush;
+
+    ngx_open_file_t            *file;
+    ngx_array_t                *formats;
+
+    /* the logger process state */
+
+    ngx_http_log_fmt_t         *format;
+    ngx_atomic_uint_t           dropped;
+    ngx_uint_t                  lost;
+    ngx_atomic_uint_t           stall;
+    ngx_atomic_uint_t           stall_head;
+    ngx_msec_t                  stall_time;
+    ngx_event_t                 event;
+} ngx_http_log_ring_t;
+
+
 typedef struct {
     u_char                     *start;
     u_char                     *pos;
@@ -52,6 +96,8 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+    ngx_http_log_ring_t        *ring;
 } ngx_http_log_buf_t;
 
 
@@ -95,6 +141,16 @@ typedef struct {
 #define NGX_HTTP_LOG_ESCAPE_NONE     2
 
 
+#define NGX_HTTP_LOG_RING_EMPTY      0
+#define NGX_HTTP_LOG_RING_ENTRY      1
+#define NGX_HTTP_LOG_RING_PADDING    2
+
+/* not less than sizeof(ngx_http_log_ring_entry_t): a padding entry fits */
+#define NGX_HTTP_LOG_RING_ALIGN      16
+#define NGX_HTTP_LOG_RING_NOT_FOUND  0xffffffff
+#define NGX_HTTP_LOG_RING_STALL      10000
+
+
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
     u_char *buf, size_t len);
 static ssize_t ngx_http_log_script_write(ngx_http_request_t *r,
@@ -111,6 +167,17 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+static void ngx_http_log_ring_write(ngx_http_request_t *r, ngx_http_log_t *log,
+    ngx_http_log_ring_t *ring);
+#if (NGX_PROCS)
+static void ngx_http_log_ring_handler(ngx_event_t *ev);
+static void ngx_http_log_ring_drain(ngx_http_log_ring_t *ring, ngx_log_t *log);
+static void ngx_http_log_ring_format(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_entry_t *entry, ngx_log_t *log);
+static ngx_int_t ngx_http_log_ring_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -166,6 +233,12 @@ static char *ngx_http_log_compile_format(ngx_conf_t *cf,
 static char *ngx_http_log_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_log_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_log_init_module(ngx_cycle_t *cycle);
+
+#if (NGX_PROCS)
+static ngx_int_t ngx_proc_http_log_init(ngx_cycle_t *cycle);
+static void ngx_proc_http_log_exit(ngx_cycle_t *cycle);
+#endif
 
 
 static ngx_command_t  ngx_http_log_commands[] = {
@@ -217,6 +290,37 @@ ngx_module_t  ngx_http_log_module = {
     ngx_http_log_commands,                 /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
+    ngx_http_log_init_module,              /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+#if (NGX_PROCS)
+
+static ngx_proc_module_t  ngx_proc_http_log_module_ctx = {
+    ngx_string("http_log"),
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ngx_proc_http_log_init,
+    NULL,
+    ngx_proc_http_log_exit
+};
+
+
+ngx_module_t  ngx_proc_http_log_module = {
+    NGX_MODULE_V1,
+    &ngx_proc_http_log_module_ctx,         /* module context */
+    NULL,                                  /* module directives */
+    NGX_PROC_MODULE,                       /* module type */
+    NULL,                                  /* init master */
     NULL,                                  /* init module */
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
@@ -226,6 +330,8 @@ ngx_module_t  ngx_http_log_module = {
     NGX_MODULE_V1_PADDING
 };
 
+#endif
+
 
 static ngx_str_t  ngx_http_access_log = ngx_string(NGX_HTTP_LOG_PATH);
 
@@ -310,6 +416,13 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         ngx_http_script_flush_no_cacheable_variables(r, log[l].format->flushes);
 
+        buffer = log[l].file ? log[l].file->data : NULL;
+
+        if (buffer && buffer->ring) {
+            ngx_http_log_ring_write(r, &log[l], buffer->ring);
+            continue;
+        }
+
         len = 0;
         op = log[l].format->ops->elts;
         for (i = 0; i < log[l].format->ops->nelts; i++) {
@@ -333,8 +446,6 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
         len += NGX_LINEFEED_SIZE;
 
-        buffer = log[l].file ? log[l].file->data : NULL;
-
         if (buffer) {
 
             if (len > (size_t) (buffer->last - buffer->pos)) {
@@ -1230,6 +1341,480 @@ ngx_http_log_unescaped_variable(ngx_http_request_t *r, u_char *buf,
 }
 
 
+static void
+ngx_http_log_ring_write(ngx_http_request_t *r, ngx_http_log_t *log,
+    ngx_http_log_ring_t *ring)
+{
+    u_char                     *p, *last;
+    size_t                      len;
+    uint32_t                    n;
+    ngx_uint_t                  i;
+    ngx_atomic_uint_t           head, tail, pos, pad;
+    ngx_http_log_op_t          *op;
+    ngx_http_log_ring_sh_t     *sh;
+    ngx_http_log_ring_entry_t  *entry;
+    ngx_http_variable_value_t  *value;
+
+    len = sizeof(ngx_http_log_ring_entry_t);
+
+    op = log->format->ops->elts;
+    for (i = 0; i < log->format->ops->nelts; i++) {
+
+        if (op[i].run == ngx_http_log_copy_short
+            || op[i].run == ngx_http_log_copy_long)
+        {
+            continue;
+        }
+
+        len += sizeof(uint32_t);
+
+        if (op[i].getlen == NULL) {
+            len += op[i].len;
+            continue;
+        }
+
+        value = ngx_http_get_indexed_variable(r, op[i].data);
+
+        if (value && !value->not_found) {
+            len += value->len;
+        }
+    }
+
+    len = ngx_align(len, NGX_HTTP_LOG_RING_ALIGN);
+
+    sh = ring->sh;
+
+    if (len > ring->size / 4) {
+        (void) ngx_atomic_fetch_add(&sh->dropped, 1);
+        return;
+    }
+
+    /* the logger process only moves the tail forward */
+
+    for ( ;; ) {
+        tail = sh->tail;
+        head = sh->head;
+
+        pos = head & (ring->size - 1);
+        pad = (pos + len > ring->size) ? ring->size - pos : 0;
+
+        if (head + pad + len - tail > ring->size) {
+            (void) ngx_atomic_fetch_add(&sh->dropped, 1);
+            return;
+        }
+
+        if (ngx_atomic_cmp_set(&sh->head, head, head + pad + len)) {
+            break;
+        }
+    }
+
+    if (pad) {
+        entry = (ngx_http_log_ring_entry_t *) &sh->data[pos];
+
+        entry->len = (uint32_t) pad;
+        entry->crc32 = 0;
+
+        ngx_memory_barrier();
+
+        entry->commit = NGX_HTTP_LOG_RING_PADDING;
+
+        pos = 0;
+    }
+
+    entry = (ngx_http_log_ring_entry_t *) &sh->data[pos];
+
+    entry->len = (uint32_t) len;
+    entry->crc32 = log->format->crc32;
+
+    p = (u_char *) entry + sizeof(ngx_http_log_ring_entry_t);
+
+    for (i = 0; i < log->format->ops->nelts; i++) {
+
+        if (op[i].run == ngx_http_log_copy_short
+            || op[i].run == ngx_http_log_copy_long)
+        {
+            continue;
+        }
+
+        if (op[i].getlen == NULL) {
+            last = op[i].run(r, p + sizeof(uint32_t), &op[i]);
+            n = (uint32_t) (last - p - sizeof(uint32_t));
+
+        } else {
+            value = ngx_http_get_indexed_variable(r, op[i].data);
+
+            if (value == NULL || value->not_found) {
+                n = NGX_HTTP_LOG_RING_NOT_FOUND;
+                last = p + sizeof(uint32_t);
+
+            } else {
+                n = value->len;
+                last = ngx_cpymem(p + sizeof(uint32_t), value->data,
+                                  value->len);
+            }
+        }
+
+        ngx_memcpy(p, &n, sizeof(uint32_t));
+        p = last;
+    }
+
+    ngx_memory_barrier();
+
+    entry->commit = NGX_HTTP_LOG_RING_ENTRY;
+}
+
+
+#if (NGX_PROCS)
+
+static void
+ngx_http_log_ring_handler(ngx_event_t *ev)
+{
+    ngx_http_log_ring_t  *ring;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "http log ring handler");
+
+    ring = ev->data;
+
+    ngx_http_log_ring_drain(ring, ev->log);
+    ngx_http_log_flush(ring->file, ev->log);
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, ring->flush);
+    }
+}
+
+
+static void
+ngx_http_log_ring_drain(ngx_http_log_ring_t *ring, ngx_log_t *log)
+{
+    size_t                      len;
+    ngx_atomic_uint_t           head, tail, dropped;
+    ngx_http_log_ring_sh_t     *sh;
+    ngx_http_log_ring_entry_t  *entry;
+
+    sh = ring->sh;
+
+    /* a single consumer, even while an old logger process is exiting */
+
+    if (!ngx_shmtx_trylock(&ring->shpool->mutex)) {
+        return;
+    }
+
+    tail = sh->tail;
+
+    for ( ;; ) {
+        head = sh->head;
+
+        if (tail == head) {
+            break;
+        }
+
+        entry = (ngx_http_log_ring_entry_t *)
+                    &sh->data[tail & (ring->size - 1)];
+
+        if (entry->commit == NGX_HTTP_LOG_RING_EMPTY) {
+
+            /*
+             * the entry is still being written; an entry which stays
+             * incomplete belongs to a worker process which has exited
+             * abnormally, and is skipped
+             */
+
+            if (ring->stall != tail) {
+                ring->stall = tail;
+                ring->stall_head = head;
+                ring->stall_time = ngx_current_msec;
+                break;
+            }
+
+            if (ngx_current_msec - ring->stall_time < NGX_HTTP_LOG_RING_STALL) {
+                break;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "incomplete entry skipped in access log ring \"%V\"",
+                          &ring->file->name);
+
+            if (entry->len == 0) {
+
+                /*
+                 * the process exited before it stored the length, so
+                 * the entry is still zeroed up to the next entry reserved
+                 * before the stall, which is complete by now
+                 */
+
+                len = 0;
+
+                do {
+                    len += NGX_HTTP_LOG_RING_ALIGN;
+                    entry = (ngx_http_log_ring_entry_t *)
+                                &sh->data[(tail + len) & (ring->size - 1)];
+
+                } while (tail + len != ring->stall_head
+                         && entry->commit == NGX_HTTP_LOG_RING_EMPTY
+                         && entry->len == 0);
+
+                tail += len;
+
+                ngx_memory_barrier();
+
+                sh->tail = tail;
+
+                continue;
+            }
+
+        } else {
+            ngx_memory_barrier();
+
+            if (entry->commit == NGX_HTTP_LOG_RING_ENTRY) {
+                ngx_http_log_ring_format(ring, entry, log);
+            }
+        }
+
+        len = entry->len;
+
+        ngx_memzero(entry, len);
+
+        tail += len;
+
+        ngx_memory_barrier();
+
+        sh->tail = tail;
+    }
+
+    ngx_shmtx_unlock(&ring->shpool->mutex);
+
+    dropped = sh->dropped;
+
+    if (dropped != ring->dropped) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%uA entries dropped by access log ring \"%V\"",
+                      dropped - ring->dropped, &ring->file->name);
+
+        ring->dropped = dropped;
+    }
+
+    if (ring->lost) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "%ui entries with unknown format "
+                      "in access log ring \"%V\"",
+                      ring->lost, &ring->file->name);
+
+        ring->lost = 0;
+    }
+}
+
+
+static void
+ngx_http_log_ring_format(ngx_http_log_ring_t *ring,
+    ngx_http_log_ring_entry_t *entry, ngx_log_t *log)
+{
+    u_char              *p, *q, *last, *line;
+    size_t               len;
+    uint32_t             n;
+    ngx_uint_t           i;
+    ngx_http_log_op_t   *op;
+    ngx_http_log_buf_t  *buffer, tmp;
+    ngx_http_log_fmt_t  *fmt;
+
+    fmt = ring->format;
+
+    if (fmt == NULL || fmt->crc32 != entry->crc32) {
+
+        fmt = ring->formats->elts;
+        for (i = 0; i < ring->formats->nelts; i++) {
+            if (fmt[i].crc32 == entry->crc32) {
+                break;
+            }
+        }
+
+        if (i == ring->formats->nelts) {
+            ring->lost++;
+            return;
+        }
+
+        fmt = &fmt[i];
+        ring->format = fmt;
+    }
+
+    last = (u_char *) entry + entry->len;
+
+    len = NGX_LINEFEED_SIZE;
+
+    p = (u_char *) entry + sizeof(ngx_http_log_ring_entry_t);
+
+    op = fmt->ops->elts;
+    for (i = 0; i < fmt->ops->nelts; i++) {
+
+        if (op[i].run == ngx_http_log_copy_short
+            || op[i].run == ngx_http_log_copy_long)
+        {
+            len += op[i].len;
+            continue;
+        }
+
+        if ((size_t) (last - p) < sizeof(uint32_t)) {
+            goto invalid;
+        }
+
+        ngx_memcpy(&n, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+
+        if (n == NGX_HTTP_LOG_RING_NOT_FOUND) {
+            if (op[i].run == ngx_http_log_variable) {
+                len++;
+            }
+
+            continue;
+        }
+
+        if ((size_t) (last - p) < n) {
+            goto invalid;
+        }
+
+        if (op[i].run == ngx_http_log_variable) {
+            len += n + 3 * ngx_http_log_escape(NULL, p, n);
+
+        } else if (op[i].run == ngx_http_log_json_variable) {
+            len += n + ngx_escape_json(NULL, p, n);
+
+        } else {
+            len += n;
+        }
+
+        p += n;
+    }
+
+    buffer = ring->file->data;
+
+    if (len > (size_t) (buffer->last - buffer->pos)) {
+        ngx_http_log_flush(ring->file, log);
+    }
+
+    if (len <= (size_t) (buffer->last - buffer->pos)) {
+        line = buffer->pos;
+
+    } else {
+        line = ngx_alloc(len, log);
+        if (line == NULL) {
+            return;
+        }
+    }
+
+    q = line;
+    p = (u_char *) entry + sizeof(ngx_http_log_ring_entry_t);
+
+    for (i = 0; i < fmt->ops->nelts; i++) {
+
+        if (op[i].run == ngx_http_log_copy_short
+            || op[i].run == ngx_http_log_copy_long)
+        {
+            q = op[i].run(NULL, q, &op[i]);
+            continue;
+        }
+
+        ngx_memcpy(&n, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+
+        if (n == NGX_HTTP_LOG_RING_NOT_FOUND) {
+            if (op[i].run == ngx_http_log_variable) {
+                *q++ = '-';
+            }
+
+            continue;
+        }
+
+        if (op[i].run == ngx_http_log_variable) {
+            q = (u_char *) ngx_http_log_escape(q, p, n);
+
+        } else if (op[i].run == ngx_http_log_json_variable) {
+            q = (u_char *) ngx_escape_json(q, p, n);
+
+        } else {
+            q = ngx_cpymem(q, p, n);
+        }
+
+        p += n;
+    }
+
+    ngx_linefeed(q);
+
+    if (line == buffer->pos) {
+        buffer->pos = q;
+        return;
+    }
+
+    /* a line larger than the buffer is written by itself */
+
+    tmp = *buffer;
+    tmp.start = line;
+    tmp.pos = q;
+
+    ring->file->data = &tmp;
+    ngx_http_log_flush(ring->file, log);
+    ring->file->data = buffer;
+
+    ngx_free(line);
+
+    return;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  "invalid entry in access log ring \"%V\"",
+                  &ring->file->name);
+}
+
+
+static ngx_int_t
+ngx_http_log_ring_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_log_ring_t  *oring = data;
+
+    size_t                len;
+    ngx_http_log_ring_t  *ring;
+
+    ring = shm_zone->data;
+
+    if (oring) {
+        ring->sh = oring->sh;
+        ring->shpool = oring->shpool;
+        return NGX_OK;
+    }
+
+    ring->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ring->sh = ring->shpool->data;
+        return NGX_OK;
+    }
+
+    ring->sh = ngx_slab_calloc(ring->shpool,
+                               offsetof(ngx_http_log_ring_sh_t, data)
+                               + ring->size);
+    if (ring->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ring->shpool->data = ring->sh;
+
+    len = sizeof(" in access log ring \"\"") + shm_zone->shm.name.len;
+
+    ring->shpool->log_ctx = ngx_slab_alloc(ring->shpool, len);
+    if (ring->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ring->shpool->log_ctx, " in access log ring \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static void *
 ngx_http_log_create_main_conf(ngx_conf_t *cf)
 {
@@ -1255,6 +1840,8 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
 
     ngx_str_set(&fmt->name, "combined");
 
+    fmt->crc32 = ngx_crc32_short(ngx_http_combined_fmt.data,
+                                 ngx_http_combined_fmt.len);
     fmt->flushes = NULL;
 
     fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
@@ -1347,7 +1934,7 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_loc_conf_t *llcf = conf;
 
-    ssize_t                            size;
+    ssize_t                            size, async;
     ngx_int_t                          gzip;
     ngx_uint_t                         i, n;
     ngx_msec_t                         flush;
@@ -1359,6 +1946,10 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_PROCS)
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_log_ring_t               *ring, **rp;
+#endif
 
     value = cf->args->elts;
 
@@ -1500,6 +2091,7 @@ process_formats:
     size = 0;
     flush = 0;
     gzip = 0;
+    async = 0;
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1566,6 +2158,36 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "async=", 6) == 0) {
+#if (NGX_PROCS)
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            async = ngx_parse_size(&s);
+
+            if (async == NGX_ERROR || async < 64 * 1024) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid async ring size \"%V\"", &s);
+                return NGX_CONF_ERROR;
+            }
+
+            /* the ring size is a power of two */
+
+            for (n = 64 * 1024; n < (ngx_uint_t) async; n <<= 1) {
+                /* void */
+            }
+
+            async = n;
+
+            continue;
+
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "nginx was built without procs support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1594,6 +2216,16 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (async) {
+        if (size == 0) {
+            size = 64 * 1024;
+        }
+
+        if (flush == 0) {
+            flush = 1000;
+        }
+    }
+
     if (flush && size == 0) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no buffer is defined for access_log \"%V\"",
@@ -1620,7 +2252,8 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+                || (buffer->ring ? (ssize_t) buffer->ring->size : 0) != async)
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1645,6 +2278,64 @@ process_formats:
         buffer->pos = buffer->start;
         buffer->last = buffer->start + size;
 
+#if (NGX_PROCS)
+
+        if (async) {
+
+            /* the buffer is used by the logger process */
+
+            ring = ngx_pcalloc(cf->pool, sizeof(ngx_http_log_ring_t));
+            if (ring == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ring->size = async;
+            ring->flush = flush;
+            ring->file = log->file;
+            ring->formats = &lmcf->formats;
+
+            s.len = sizeof("access_log:") - 1 + log->file->name.len;
+            s.data = ngx_pnalloc(cf->pool, s.len);
+            if (s.data == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_sprintf(s.data, "access_log:%V", &log->file->name);
+
+            shm_zone = ngx_shared_memory_add(cf, &s,
+                                             async + async / ngx_pagesize
+                                                     * sizeof(ngx_slab_page_t)
+                                             + 8 * ngx_pagesize,
+                                             &ngx_http_log_module);
+            if (shm_zone == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            shm_zone->init = ngx_http_log_ring_init_zone;
+            shm_zone->data = ring;
+
+            if (lmcf->rings == NULL) {
+                lmcf->rings = ngx_array_create(cf->pool, 1,
+                                               sizeof(ngx_http_log_ring_t *));
+                if (lmcf->rings == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+            }
+
+            rp = ngx_array_push(lmcf->rings);
+            if (rp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            *rp = ring;
+
+            buffer->ring = ring;
+            buffer->flush = flush;
+
+        } else
+
+#endif
+
         if (flush) {
             buffer->event = ngx_pcalloc(cf->pool, sizeof(ngx_event_t));
             if (buffer->event == NULL) {
@@ -1674,6 +2365,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_log_main_conf_t *lmcf = conf;
 
+    uint32_t             crc32;
     ngx_str_t           *value;
     ngx_uint_t           i;
     ngx_http_log_fmt_t  *fmt;
@@ -1699,6 +2391,18 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     fmt->name = value[1];
 
+    /* identifies the format of asynchronous log entries */
+
+    ngx_crc32_init(crc32);
+
+    for (i = 2; i < cf->args->nelts; i++) {
+        ngx_crc32_update(&crc32, value[i].data, value[i].len + 1);
+    }
+
+    ngx_crc32_final(crc32);
+
+    fmt->crc32 = crc32;
+
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
         return NGX_CONF_ERROR;
@@ -2043,3 +2747,100 @@ ngx_http_log_init(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+static ngx_int_t
+ngx_http_log_init_module(ngx_cycle_t *cycle)
+{
+#if (NGX_PROCS)
+    ngx_uint_t                 i;
+    ngx_proc_conf_t          **cpcfp;
+    ngx_proc_main_conf_t      *cmcf;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->rings == NULL) {
+        return NGX_OK;
+    }
+
+    cmcf = ngx_proc_get_main_conf(cycle->conf_ctx, ngx_proc_core_module);
+
+    if (cmcf) {
+        cpcfp = cmcf->processes.elts;
+        for (i = 0; i < cmcf->processes.nelts; i++) {
+            if (cpcfp[i]->name.len == sizeof("http_log") - 1
+                && ngx_strncmp(cpcfp[i]->name.data, "http_log",
+                               sizeof("http_log") - 1) == 0)
+            {
+                return NGX_OK;
+            }
+        }
+    }
+
+    ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                  "async access logs are not written "
+                  "without the \"http_log\" process");
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_PROCS)
+
+static ngx_int_t
+ngx_proc_http_log_init(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_http_log_ring_t      **ring;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->rings == NULL) {
+        return NGX_OK;
+    }
+
+    ring = lmcf->rings->elts;
+    for (i = 0; i < lmcf->rings->nelts; i++) {
+        ring[i]->stall = (ngx_atomic_uint_t) -1;
+        ring[i]->dropped = ring[i]->sh->dropped;
+
+        ring[i]->event.handler = ngx_http_log_ring_handler;
+        ring[i]->event.data = ring[i];
+        ring[i]->event.log = cycle->log;
+        ring[i]->event.cancelable = 1;
+
+        ngx_add_timer(&ring[i]->event, ring[i]->flush);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_proc_http_log_exit(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                 i;
+    ngx_http_log_ring_t      **ring;
+    ngx_http_log_main_conf_t  *lmcf;
+
+    lmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_log_module);
+
+    if (lmcf == NULL || lmcf->rings == NULL) {
+        return;
+    }
+
+    ring = lmcf->rings->elts;
+    for (i = 0; i < lmcf->rings->nelts; i++) {
+        ngx_http_log_ring_drain(ring[i], cycle->log);
+        ngx_http_log_flush(ring[i]->file, cycle->log);
+
+        if (ring[i]->event.timer_set) {
+            ngx_del_timer(&ring[i]->event);
+        }
+    }
+}
+
+#endif
@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
+
 
 typedef struct {
     ngx_http_complex_value_t   match;
@@ -22,12 +26,36 @@ typedef struct {
 } ngx_http_sub_match_t;
 
 
+/*
+ * Aho-Corasick automaton of the static search patterns: "next" holds the
+ * complete transitions, "nclasses" per state, of the byte classes of the
+ * lowercased input; 0 is the root
+ */
+
+typedef struct {
+    ngx_uint_t                 nclasses;
+
+    uint16_t                  *next;
+    uint16_t                  *depth;
+    u_char                    *output;
+
+    u_char                     class[256];
+    uint16_t                   root[256];
+
+    /* bytes that leave the root, for the SSE4.2 prefilter */
+    ngx_uint_t                 nfirst;
+    u_char                     first[16];
+} ngx_http_sub_automaton_t;
+
+
 typedef struct {
     ngx_uint_t                 min_match_len;
     ngx_uint_t                 max_match_len;
 
     u_char                     index[257];
     u_char                     shift[256];
+
+    ngx_http_sub_automaton_t  *automaton;
 } ngx_http_sub_tables_t;
 
 
@@ -72,6 +100,10 @@ typedef struct {
     ngx_int_t                  offset;
     ngx_uint_t                 index;
 
+    /* the automaton has consumed the bytes before "scan" */
+    ngx_int_t                  scan;
+    ngx_uint_t                 state;
+
     ngx_http_sub_tables_t     *tables;
     ngx_array_t               *matches;
 } ngx_http_sub_ctx_t;
@@ -86,6 +118,14 @@ static ngx_int_t ngx_http_sub_parse(ngx_http_request_t *r,
     ngx_http_sub_ctx_t *ctx, ngx_uint_t flush);
 static ngx_int_t ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start,
     ngx_str_t *m);
+static ngx_int_t ngx_http_sub_scan(ngx_http_sub_ctx_t *ctx,
+    ngx_http_sub_tables_t *tables, ngx_int_t end);
+static ngx_inline u_char *ngx_http_sub_first(ngx_http_sub_tables_t *tables,
+    u_char *p, u_char *last);
+#if (NGX_HAVE_X86_SIMD)
+static u_char *ngx_http_sub_first_sse42(ngx_http_sub_automaton_t *ac,
+    u_char *p, u_char *last);
+#endif
 
 static char * ngx_http_sub_filter(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -94,6 +134,8 @@ static char *ngx_http_sub_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
 static void ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
     ngx_http_sub_match_t *match, ngx_uint_t n);
+static ngx_int_t ngx_http_sub_init_automaton(ngx_conf_t *cf,
+    ngx_http_sub_tables_t *tables, ngx_http_sub_match_t *match, ngx_uint_t n);
 static ngx_int_t ngx_http_sub_cmp_matches(const void *one, const void *two);
 static ngx_int_t ngx_http_sub_filter_init(ngx_conf_t *cf);
 
@@ -630,6 +672,27 @@ ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
 
     while (offset < end) {
 
+        if (tables->automaton && offset >= ctx->scan) {
+
+            /*
+             * let the automaton skip to the first start a match may
+             * have, the matches are then looked for as without it
+             */
+
+            start = offset - (ngx_int_t) tables->min_match_len + 1;
+
+            if (ctx->scan < start) {
+                ctx->scan = start;
+                ctx->state = 0;
+            }
+
+            start = ngx_http_sub_scan(ctx, tables, end);
+
+            offset = ngx_max(offset,
+                             start + (ngx_int_t) tables->min_match_len - 1);
+            continue;
+        }
+
         c = offset < 0 ? ctx->looked.data[ctx->looked.len + offset]
                        : ctx->pos[offset];
 
@@ -673,6 +736,9 @@ ngx_http_sub_parse(ngx_http_request_t *r, ngx_http_sub_ctx_t *ctx,
             end = ngx_max(next, 0);
             rc = NGX_OK;
 
+            ctx->scan = next;
+            ctx->state = 0;
+
             goto done;
 
         next:
@@ -711,6 +777,11 @@ again:
     next = start;
     rc = NGX_AGAIN;
 
+    if (ctx->scan < start) {
+        ctx->scan = start;
+        ctx->state = 0;
+    }
+
 done:
 
     /* send [ - looked.len, start ] to client */
@@ -735,11 +806,144 @@ done:
 
     ctx->pos += end;
     ctx->offset -= end;
+    ctx->scan -= end;
 
     return rc;
 }
 
 
+static ngx_int_t
+ngx_http_sub_scan(ngx_http_sub_ctx_t *ctx, ngx_http_sub_tables_t *tables,
+    ngx_int_t end)
+{
+    u_char                    *p, *last;
+    ngx_int_t                  scan;
+    ngx_uint_t                 state;
+    ngx_http_sub_automaton_t  *ac;
+
+    ac = tables->automaton;
+    scan = ctx->scan;
+    state = ctx->state;
+
+    while (scan < 0) {
+        p = &ctx->looked.data[ctx->looked.len + scan];
+        state = ac->next[state * ac->nclasses + ac->class[*p]];
+        scan++;
+
+        if (ac->output[state]) {
+            goto done;
+        }
+    }
+
+    p = ctx->pos + scan;
+    last = ctx->pos + end;
+
+    while (p < last) {
+
+        if (state == 0) {
+            p = ngx_http_sub_first(tables, p, last);
+
+            if (p == last) {
+                break;
+            }
+        }
+
+        state = ac->next[state * ac->nclasses + ac->class[*p++]];
+
+        if (ac->output[state]) {
+            break;
+        }
+    }
+
+    scan = p - ctx->pos;
+
+done:
+
+    ctx->scan = scan;
+    ctx->state = state;
+
+    /*
+     * a match cannot start before the bytes that led to the state,
+     * and the first one ends at the state if it has an output
+     */
+
+    return scan - ac->depth[state];
+}
+
+
+static ngx_inline u_char *
+ngx_http_sub_first(ngx_http_sub_tables_t *tables, u_char *p, u_char *last)
+{
+    ngx_int_t                  min;
+    ngx_uint_t                 shift;
+    ngx_http_sub_automaton_t  *ac;
+
+    ac = tables->automaton;
+
+#if (NGX_HAVE_X86_SIMD)
+
+    if (ac->nfirst && (ngx_cpu_features & NGX_CPU_SSE42)) {
+        p = ngx_http_sub_first_sse42(ac, p, last);
+
+    } else
+
+#endif
+
+    {
+        /* the shift table rules out starts as in ngx_http_sub_parse() */
+
+        min = tables->min_match_len - 1;
+
+        while (last - p > min) {
+            shift = tables->shift[ngx_tolower(p[min])];
+
+            if (shift == 0) {
+                break;
+            }
+
+            p += shift;
+        }
+    }
+
+    while (p < last && ac->root[*p] == 0) {
+        p++;
+    }
+
+    return p;
+}
+
+
+#if (NGX_HAVE_X86_SIMD)
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_sub_first_sse42(ngx_http_sub_automaton_t *ac, u_char *p,
+    u_char *last)
+{
+    int      n;
+    __m128i  set, v;
+
+    set = _mm_loadu_si128((__m128i *) ac->first);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(set, (int) ac->nfirst, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_sub_match(ngx_http_sub_ctx_t *ctx, ngx_int_t start, ngx_str_t *m)
 {
@@ -938,6 +1142,13 @@ ngx_http_sub_merge_conf(ngx_conf_t *cf, void *parent, void *child)
 
         ngx_http_sub_init_tables(conf->tables, conf->matches->elts,
                                  conf->matches->nelts);
+
+        if (ngx_http_sub_init_automaton(cf, conf->tables, conf->matches->elts,
+                                        conf->matches->nelts)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
@@ -961,6 +1172,7 @@ ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
 
     tables->min_match_len = min;
     tables->max_match_len = max;
+    tables->automaton = NULL;
 
     ngx_http_sub_cmp_index = tables->min_match_len - 1;
     ngx_sort(match, n, sizeof(ngx_http_sub_match_t), ngx_http_sub_cmp_matches);
@@ -989,6 +1201,164 @@ ngx_http_sub_init_tables(ngx_http_sub_tables_t *tables,
 }
 
 
+/*
+ * a single pattern is skipped over well enough by the shift table, and the
+ * dynamic ones are not known until the request
+ */
+
+static ngx_int_t
+ngx_http_sub_init_automaton(ngx_conf_t *cf, ngx_http_sub_tables_t *tables,
+    ngx_http_sub_match_t *match, ngx_uint_t n)
+{
+    u_char                    *p, *last;
+    uint16_t                  *next, *fail, *queue;
+    ngx_uint_t                 i, size, states, head, tail, s, t, k, nc;
+    ngx_http_sub_automaton_t  *ac;
+
+    if (n < 2) {
+        return NGX_OK;
+    }
+
+    size = 1;
+
+    for (i = 0; i < n; i++) {
+        size += match[i].match.len;
+    }
+
+    if (size > 0xffff) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "search patterns are too long to be matched "
+                           "by an automaton");
+        return NGX_OK;
+    }
+
+    ac = ngx_pcalloc(cf->pool, sizeof(ngx_http_sub_automaton_t));
+    if (ac == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the bytes of the patterns are the classes, the rest is class 0 */
+
+    nc = 1;
+
+    for (i = 0; i < n; i++) {
+        p = match[i].match.data;
+        last = p + match[i].match.len;
+
+        while (p < last) {
+            if (ac->class[*p] == 0) {
+                ac->class[*p] = (u_char) nc++;
+            }
+
+            p++;
+        }
+    }
+
+    for (k = 0; k < 256; k++) {
+        ac->class[k] = ac->class[ngx_tolower(k)];
+    }
+
+    ac->nclasses = nc;
+
+    ac->next = ngx_pcalloc(cf->pool, size * nc * sizeof(uint16_t));
+    ac->depth = ngx_pcalloc(cf->pool, size * sizeof(uint16_t));
+    ac->output = ngx_pcalloc(cf->pool, size);
+
+    if (ac->next == NULL || ac->depth == NULL || ac->output == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the trie */
+
+    states = 1;
+
+    for (i = 0; i < n; i++) {
+        p = match[i].match.data;
+        last = p + match[i].match.len;
+        s = 0;
+
+        while (p < last) {
+            next = &ac->next[s * nc + ac->class[*p++]];
+
+            if (*next == 0) {
+                *next = (uint16_t) states;
+                ac->depth[states] = ac->depth[s] + 1;
+                states++;
+            }
+
+            s = *next;
+        }
+
+        ac->output[s] = 1;
+    }
+
+    /* failure links in breadth first order complete the transitions */
+
+    fail = ngx_alloc(2 * states * sizeof(uint16_t), cf->log);
+    if (fail == NULL) {
+        return NGX_ERROR;
+    }
+
+    queue = fail + states;
+    head = 0;
+    tail = 0;
+    queue[tail++] = 0;
+    fail[0] = 0;
+
+    while (head != tail) {
+        s = queue[head++];
+        next = &ac->next[s * nc];
+
+        for (k = 1; k < nc; k++) {
+            t = next[k];
+
+            if (t == 0) {
+                next[k] = (s == 0) ? 0 : ac->next[fail[s] * nc + k];
+                continue;
+            }
+
+            fail[t] = (s == 0) ? 0 : ac->next[fail[s] * nc + k];
+            ac->output[t] |= ac->output[fail[t]];
+
+            queue[tail++] = (uint16_t) t;
+        }
+    }
+
+    ngx_free(fail);
+
+    /*
+     * the prefilter needs both cases of the bytes leaving the root and
+     * is only used for up to 16 of them
+     */
+
+    for (k = 0; k < 256; k++) {
+        ac->root[k] = ac->next[ac->class[k]];
+
+        if (ac->root[k] == 0) {
+            continue;
+        }
+
+        if (ac->nfirst < 16) {
+            ac->first[ac->nfirst] = (u_char) k;
+        }
+
+        ac->nfirst++;
+    }
+
+    if (ac->nfirst > 16) {
+        ac->nfirst = 0;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "sub automaton: %ui states, %ui classes, %ui first bytes",
+                   states, nc, ac->nfirst);
+
+    tables->automaton = ac;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_sub_cmp_matches(const void *one, const void *two)
 {
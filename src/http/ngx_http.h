@@ -20,6 +20,7 @@ typedef struct ngx_http_file_cache_s  ngx_http_file_cache_t;
 typedef struct ngx_http_log_ctx_s     ngx_http_log_ctx_t;
 typedef struct ngx_http_chunked_s     ngx_http_chunked_t;
 typedef struct ngx_http_v2_stream_s   ngx_http_v2_stream_t;
+typedef struct ngx_http_complex_value_cache_s  ngx_http_complex_value_cache_t;
 #if (T_NGX_XQUIC)
 typedef struct ngx_http_v3_stream_s  ngx_http_v3_stream_t;
 #endif
@@ -122,6 +122,7 @@ struct ngx_http_cache_s {
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+    unsigned                         in_memory:1;
 };
 
 
@@ -144,6 +145,54 @@ typedef struct {
 } ngx_http_file_cache_header_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_ram_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+    size_t                           size;
+    size_t                           max_size;
+    ngx_uint_t                       width;
+    ngx_uint_t                       samples;
+    u_char                          *sketch;
+} ngx_http_file_cache_ram_sh_t;
+
+
+typedef struct {
+    ngx_http_file_cache_ram_sh_t    *sh;
+    ngx_slab_pool_t                 *shpool;
+    ngx_shm_zone_t                  *shm_zone;
+    size_t                           max_object;
+} ngx_http_file_cache_ram_t;
+
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_str_t                        temp;
+    time_t                           interval;
+    time_t                           next;
+
+    ngx_file_t                       file;
+    time_t                           start;
+    uint64_t                         count;
+    uint32_t                         crc32;
+    ngx_uint_t                       cursor;
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    u_char                          *buf;
+} ngx_http_file_cache_index_t;
+
+
 typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
@@ -175,11 +224,15 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       last;
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
+    ngx_uint_t                       loader_threads;
 
     ngx_uint_t                       manager_files;
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
+    ngx_http_file_cache_index_t     *index;
+    ngx_http_file_cache_ram_t       *ram;
+
     ngx_shm_zone_t                  *shm_zone;
 
     ngx_uint_t                       use_temp_path;
@@ -86,7 +86,9 @@ static char *ngx_http_set_server_tag(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
 #if (NGX_HTTP_GZIP)
-static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae);
+static ngx_int_t ngx_http_gzip_allowed(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_accept_encoding(ngx_str_t *ae,
+    ngx_str_t *coding);
 static ngx_uint_t ngx_http_gzip_quantity(u_char *p, u_char *last);
 static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -2201,11 +2203,9 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_array_t               *cc;
-    ngx_table_elt_t           *e, *d, *ae;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_table_elt_t  *ae;
+
+    static ngx_str_t  gzip = ngx_string("gzip");
 
     r->gzip_tested = 1;
 
@@ -2232,11 +2232,60 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
      */
 
     if (ngx_memcmp(ae->value.data, "gzip,", 5) != 0
-        && ngx_http_gzip_accept_encoding(&ae->value) != NGX_OK)
+        && ngx_http_gzip_accept_encoding(&ae->value, &gzip) != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_gzip_allowed(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * tests a content coding other than gzip, e.g. "br" or "zstd", against
+ * Accept-Encoding, and the response against the same gzip_proxied,
+ * gzip_http_version, gzip_disable, and msie6 rules as gzip
+ */
+
+ngx_int_t
+ngx_http_coding_ok(ngx_http_request_t *r, ngx_str_t *coding)
+{
+    ngx_table_elt_t  *ae;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
+    ae = r->headers_in.accept_encoding;
+    if (ae == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ae->value.len < coding->len
+        || ngx_http_gzip_accept_encoding(&ae->value, coding) != NGX_OK)
     {
         return NGX_DECLINED;
     }
 
+    return ngx_http_gzip_allowed(r);
+}
+
+
+static ngx_int_t
+ngx_http_gzip_allowed(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_array_t               *cc;
+    ngx_table_elt_t           *e, *d;
+    ngx_http_core_loc_conf_t  *clcf;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_in.msie6 && clcf->gzip_disable_msie6) {
@@ -2353,8 +2402,6 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2364,10 +2411,12 @@ ok:
  *     "gzip; q=0.001" ... "gzip; q=1.000"
  * gzip is disabled for the following quantities:
  *     "gzip; q=0" ... "gzip; q=0.000", and for any invalid cases
+ *
+ * other codings are tested the same way
  */
 
 static ngx_int_t
-ngx_http_gzip_accept_encoding(ngx_str_t *ae)
+ngx_http_gzip_accept_encoding(ngx_str_t *ae, ngx_str_t *coding)
 {
     u_char  *p, *start, *last;
 
@@ -2375,7 +2424,7 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
     last = start + ae->len;
 
     for ( ;; ) {
-        p = ngx_strcasestrn(start, "gzip", 4 - 1);
+        p = ngx_strcasestrn(start, (char *) coding->data, coding->len - 1);
         if (p == NULL) {
             return NGX_DECLINED;
         }
@@ -2384,10 +2433,10 @@ ngx_http_gzip_accept_encoding(ngx_str_t *ae)
             break;
         }
 
-        start = p + 4;
+        start = p + coding->len;
     }
 
-    p += 4;
+    p += coding->len;
 
     while (p < last) {
         switch (*p++) {
@@ -3533,6 +3582,9 @@ ngx_http_core_create_main_conf(ngx_conf_t *cf)
     cmcf->variables_hash_max_size = NGX_CONF_UNSET_UINT;
     cmcf->variables_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
+    ngx_rbtree_init(&cmcf->complex_values, &cmcf->complex_values_sentinel,
+                    ngx_str_rbtree_insert_value);
+
     return cmcf;
 }
 
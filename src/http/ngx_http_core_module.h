@@ -183,6 +183,9 @@ typedef struct {
 
     ngx_hash_keys_arrays_t    *variables_keys;
 
+    ngx_rbtree_t               complex_values;    /* ids of cached values */
+    ngx_rbtree_node_t          complex_values_sentinel;
+
     ngx_array_t               *ports;
 
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
@@ -548,6 +551,7 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_coding_ok(ngx_http_request_t *r, ngx_str_t *coding);
 #endif
 
 
@@ -11,6 +11,45 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_FILE_CACHE_INDEX_VERSION  1
+#define NGX_HTTP_FILE_CACHE_INDEX_BATCH    512
+
+#define NGX_HTTP_FILE_CACHE_RAM_ROWS       4
+#define NGX_HTTP_FILE_CACHE_RAM_FREQ       15
+
+
+typedef struct {
+    u_char                           magic[8];
+    uint32_t                         version;
+    uint32_t                         bsize;
+    uint64_t                         time;
+    uint64_t                         count;
+    uint32_t                         crc32;
+    uint32_t                         reserved;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    uint64_t                         fs_size;
+} ngx_http_file_cache_index_entry_t;
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    time_t                           since;
+    ngx_uint_t                       files;
+    ngx_msec_t                       last;
+
+#if (NGX_THREADS)
+    ngx_array_t                     *dirs;
+    ngx_atomic_t                    *next;
+    ngx_atomic_t                    *abort;
+    pthread_t                        tid;
+#endif
+} ngx_http_file_cache_loader_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -49,7 +88,29 @@ static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
     ngx_queue_t *q, u_char *name);
-static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_index_write(
+    ngx_http_file_cache_t *cache);
+static ngx_uint_t ngx_http_file_cache_index_batch(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_t *index);
+static void ngx_http_file_cache_index_abort(ngx_http_file_cache_index_t *index);
+static ngx_int_t ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache,
+    time_t *since);
+static ngx_int_t ngx_http_file_cache_index_read(ngx_http_file_cache_t *cache,
+    ngx_file_t *file, ngx_http_file_cache_index_header_t *h, u_char *buf,
+    ngx_uint_t add);
+static ngx_int_t ngx_http_file_cache_walk(ngx_http_file_cache_loader_t *loader);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_walk_parallel(
+    ngx_http_file_cache_loader_t *loader);
+static void *ngx_http_file_cache_walk_thread(void *data);
+static void ngx_http_file_cache_walk_dirs(ngx_http_file_cache_loader_t *loader);
+static ngx_int_t ngx_http_file_cache_collect_directory(ngx_tree_ctx_t *ctx,
+    ngx_str_t *path);
+#endif
+static void ngx_http_file_cache_init_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_loader_t *loader);
+static void ngx_http_file_cache_loader_sleep(
+    ngx_http_file_cache_loader_t *loader);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx,
@@ -63,6 +124,26 @@ static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_ram_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_ram_get(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_add(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_ram_delete(ngx_http_file_cache_ram_t *ram,
+    u_char *key);
+static ngx_http_file_cache_ram_node_t *
+    ngx_http_file_cache_ram_lookup(ngx_http_file_cache_ram_t *ram, u_char *key);
+static void ngx_http_file_cache_ram_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_uint_t ngx_http_file_cache_ram_frequency(
+    ngx_http_file_cache_ram_sh_t *sh, u_char *key, ngx_uint_t increment);
+static size_t ngx_http_file_cache_ram_size(size_t len);
+static void ngx_http_file_cache_ram_evict(ngx_http_file_cache_ram_t *ram,
+    ngx_http_file_cache_ram_node_t *rn);
+
+
+static u_char  ngx_http_file_cache_index_magic[8] = "NGXCIDX";
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -284,6 +365,8 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
 
     cache = c->file_cache;
 
+    c->in_memory = 0;
+
     if (c->node == NULL) {
         cln = ngx_pool_cleanup_add(r->pool, 0);
         if (cln == NULL) {
@@ -345,6 +428,19 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (cache->ram && c->exists) {
+        rc = ngx_http_file_cache_ram_get(r, c);
+
+        if (rc == NGX_OK) {
+            c->in_memory = 1;
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -384,6 +480,15 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
+    /* read a small response whole, so it can be kept in memory */
+
+    if (cache->ram
+        && c->length <= (off_t) cache->ram->max_object
+        && c->length > (off_t) c->body_start)
+    {
+        c->body_start = (size_t) c->length;
+    }
+
     c->buf = ngx_create_temp_buf(r->pool, c->body_start);
     if (c->buf == NULL) {
         return NGX_ERROR;
@@ -532,11 +637,16 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ssize_t                        n;
     ngx_str_t                     *key;
     ngx_int_t                      rc;
-    ngx_uint_t                     i;
+    ngx_uint_t                     i, admit;
     ngx_http_file_cache_t         *cache;
     ngx_http_file_cache_header_t  *h;
 
-    n = ngx_http_file_cache_aio_read(r, c);
+    if (c->in_memory) {
+        n = (ssize_t) c->length;
+
+    } else {
+        n = ngx_http_file_cache_aio_read(r, c);
+    }
 
     if (n < 0) {
         return n;
@@ -603,6 +713,19 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     c->buf->last += n;
 
+    cache = c->file_cache;
+
+    admit = 0;
+
+    if (cache->ram
+        && !c->in_memory
+        && (off_t) n == c->length
+        && c->length <= (off_t) cache->ram->max_object)
+    {
+        c->in_memory = 1;
+        admit = 1;
+    }
+
     c->valid_sec = h->valid_sec;
     c->updating_sec = h->updating_sec;
     c->error_sec = h->error_sec;
@@ -615,8 +738,6 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     r->cached = 1;
 
-    cache = c->file_cache;
-
     if (cache->sh->cold) {
 
         ngx_shmtx_lock(&cache->shpool->mutex);
@@ -661,6 +782,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         return rc;
     }
 
+    if (admit) {
+        ngx_http_file_cache_ram_add(r, c);
+    }
+
     return NGX_OK;
 }
 
@@ -1426,6 +1551,10 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
+    if (cache->ram) {
+        ngx_http_file_cache_ram_delete(cache->ram, c->key);
+    }
+
     ngx_shmtx_unlock(&cache->shpool->mutex);
 }
 
@@ -1553,6 +1682,10 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    if (c->file_cache->ram) {
+        ngx_http_file_cache_ram_delete(c->file_cache->ram, c->key);
+    }
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1586,9 +1719,11 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (!c->in_memory) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
     rc = ngx_http_send_header(r);
@@ -1597,16 +1732,24 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
-
-    b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    if (c->in_memory) {
+        b->pos = c->buf->start + c->body_start;
+        b->last = c->buf->start + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
 
     out.buf = b;
     out.next = NULL;
@@ -1914,6 +2057,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
     size_t                       len;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
@@ -1928,6 +2072,13 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         p = ngx_hex_dump(p, fcn->key, len);
         *p = '\0';
 
+        if (cache->ram) {
+            ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(key + sizeof(ngx_rbtree_key_t), fcn->key, len);
+
+            ngx_http_file_cache_ram_delete(cache->ram, key);
+        }
+
         fcn->count++;
         fcn->deleting = 1;
         ngx_shmtx_unlock(&cache->shpool->mutex);
@@ -1938,7 +2089,11 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache expire: \"%s\"", name);
 
-        if (ngx_delete_file(name) == NGX_FILE_ERROR) {
+        /* a node restored from an index may outlive its file */
+
+        if (ngx_delete_file(name) == NGX_FILE_ERROR
+            && ngx_errno != NGX_ENOENT)
+        {
             ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
@@ -2034,6 +2189,13 @@ ngx_http_file_cache_manager(void *data)
 
 done:
 
+    if (cache->index
+        && ngx_http_file_cache_index_write(cache) == NGX_AGAIN
+        && next > cache->manager_sleep)
+    {
+        next = cache->manager_sleep;
+    }
+
     elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -2044,259 +2206,1288 @@ done:
 }
 
 
-static void
-ngx_http_file_cache_loader(void *data)
+static ngx_int_t
+ngx_http_file_cache_index_write(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
-
-    ngx_tree_ctx_t  tree;
-
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
-    }
+    size_t                               size;
+    ngx_uint_t                           n;
+    ngx_msec_t                           elapsed;
+    ngx_http_file_cache_index_t         *index;
+    ngx_http_file_cache_index_header_t   h;
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
-        return;
-    }
+    index = cache->index;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    if (index->file.fd == NGX_INVALID_FILE) {
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+        if (index->next == 0) {
+            index->next = ngx_time() + index->interval;
+        }
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+        /* an index of a partially loaded cache would hide files */
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
-        cache->sh->loading = 0;
-        return;
-    }
+        if (ngx_time() < index->next
+            || cache->sh->cold || cache->sh->loading)
+        {
+            return NGX_OK;
+        }
 
-    cache->sh->cold = 0;
-    cache->sh->loading = 0;
+        /* an exiting manager may still be writing its own copy */
 
-    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
-                  "http file cache: %V %.3fM, bsize: %uz",
-                  &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
-                  cache->bsize);
-}
+        ngx_sprintf(index->temp.data, "%V.%P%Z", &index->name, ngx_pid);
 
+        index->file.fd = ngx_open_file(index->temp.data, NGX_FILE_WRONLY,
+                                       NGX_FILE_TRUNCATE,
+                                       NGX_FILE_DEFAULT_ACCESS);
 
-static ngx_int_t
-ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    return NGX_OK;
-}
+        if (index->file.fd == NGX_INVALID_FILE) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                          ngx_open_file_n " \"%s\" failed", index->temp.data);
 
+            index->next = ngx_time() + index->interval;
+            return NGX_OK;
+        }
 
-static ngx_int_t
-ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+        index->file.log = ngx_cycle->log;
+        index->file.offset = sizeof(ngx_http_file_cache_index_header_t);
 
-    cache = ctx->data;
+        index->start = ngx_time();
+        index->count = 0;
+        index->cursor = 0;
 
-    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
-        (void) ngx_http_file_cache_delete_file(ctx, path);
+        ngx_crc32_init(index->crc32);
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
-
-    } else {
-        ngx_time_update();
+    do {
+        n = ngx_http_file_cache_index_batch(cache, index);
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
+        if (n) {
+            size = n * sizeof(ngx_http_file_cache_index_entry_t);
 
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache loader time elapsed: %M", elapsed);
+            if (ngx_write_file(&index->file, index->buf, size,
+                               index->file.offset)
+                != (ssize_t) size)
+            {
+                ngx_http_file_cache_index_abort(index);
+                return NGX_OK;
+            }
 
-        if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+            ngx_crc32_update(&index->crc32, index->buf, size);
+            index->count += n;
         }
-    }
 
-    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
-}
+        if (n < NGX_HTTP_FILE_CACHE_INDEX_BATCH) {
+            break;
+        }
 
+        if (ngx_quit || ngx_terminate) {
+            ngx_http_file_cache_index_abort(index);
+            return NGX_OK;
+        }
 
-static ngx_int_t
-ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
-{
-    if (path->len >= 5
-        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
-    {
-        return NGX_DECLINED;
-    }
+        ngx_time_update();
 
-    return NGX_OK;
-}
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
+    } while (elapsed < cache->manager_threshold);
 
-static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
-{
-    ngx_msleep(cache->loader_sleep);
+    if (n == NGX_HTTP_FILE_CACHE_INDEX_BATCH) {
+        return NGX_AGAIN;
+    }
 
-    ngx_time_update();
+    ngx_crc32_final(index->crc32);
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
-}
+    ngx_memzero(&h, sizeof(ngx_http_file_cache_index_header_t));
 
+    ngx_memcpy(h.magic, ngx_http_file_cache_index_magic, sizeof(h.magic));
+    h.version = NGX_HTTP_FILE_CACHE_INDEX_VERSION;
+    h.bsize = (uint32_t) cache->bsize;
+    h.time = index->start;
+    h.count = index->count;
+    h.crc32 = index->crc32;
 
-static ngx_int_t
-ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
-{
-    u_char                 *p;
-    ngx_int_t               n;
-    ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    if (ngx_write_file(&index->file, (u_char *) &h, sizeof(h), 0)
+        != (ssize_t) sizeof(h))
+    {
+        ngx_http_file_cache_index_abort(index);
+        return NGX_OK;
+    }
 
-    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
-        return NGX_ERROR;
+    if (ngx_close_file(index->file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", index->temp.data);
     }
 
-    /*
-     * Temporary files in cache have a suffix consisting of a dot
-     * followed by 10 digits.
-     */
+    index->file.fd = NGX_INVALID_FILE;
+    index->next = ngx_time() + index->interval;
 
-    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
-        && name->data[name->len - 10 - 1] == '.')
+    if (ngx_rename_file(index->temp.data, index->name.data)
+        == NGX_FILE_ERROR)
     {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      index->temp.data, index->name.data);
         return NGX_OK;
     }
 
-    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
-                      "cache file \"%s\" is too small", name->data);
-        return NGX_ERROR;
-    }
+    ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                  "http file cache index: \"%V\", %uL entries",
+                  &index->name, index->count);
 
-    ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    return NGX_OK;
+}
 
-    c.length = ctx->size;
-    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
 
-    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+static ngx_uint_t
+ngx_http_file_cache_index_batch(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_index_t *index)
+{
+    ngx_int_t                           rc;
+    ngx_uint_t                          n;
+    ngx_rbtree_key_t                    key;
+    ngx_rbtree_node_t                  *node, *sentinel, *next;
+    ngx_http_file_cache_node_t         *fcn;
+    ngx_http_file_cache_index_entry_t  *entry;
 
-    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
-        n = ngx_hextoi(p, 2);
+    n = 0;
+    entry = (ngx_http_file_cache_index_entry_t *) index->buf;
 
-        if (n == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-        p += 2;
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+    next = NULL;
 
-        c.key[i] = (u_char) n;
-    }
+    if (!index->cursor) {
+        if (node != sentinel) {
+            next = ngx_rbtree_min(node, sentinel);
+        }
 
-    return ngx_http_file_cache_add(cache, &c);
-}
+    } else {
 
+        /* the lock is dropped between batches, look up the next key */
 
-static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
-{
-    ngx_http_file_cache_node_t  *fcn;
+        ngx_memcpy(&key, index->key, sizeof(ngx_rbtree_key_t));
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+        while (node != sentinel) {
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+            if (key != node->key) {
+                rc = (key < node->key) ? -1 : 1;
 
-    if (fcn == NULL) {
+            } else {
+                fcn = (ngx_http_file_cache_node_t *) node;
+                rc = ngx_memcmp(&index->key[sizeof(ngx_rbtree_key_t)],
+                                fcn->key,
+                                NGX_HTTP_CACHE_KEY_LEN
+                                - sizeof(ngx_rbtree_key_t));
+            }
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
-                                     sizeof(ngx_http_file_cache_node_t));
-        if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+            if (rc < 0) {
+                next = node;
+                node = node->left;
 
-            if (cache->fail_time != ngx_time()) {
-                cache->fail_time = ngx_time();
-                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
+            } else {
+                node = node->right;
             }
-
-            ngx_shmtx_unlock(&cache->shpool->mutex);
-            return NGX_ERROR;
         }
+    }
 
-        cache->sh->count++;
+    for (node = next; node && n < NGX_HTTP_FILE_CACHE_INDEX_BATCH; /* void */)
+    {
+        fcn = (ngx_http_file_cache_node_t *) node;
 
-        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+        if (fcn->exists && !fcn->deleting) {
+            ngx_memcpy(entry[n].key, &node->key, sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(&entry[n].key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                       NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+            entry[n].fs_size = fcn->fs_size;
+            n++;
+        }
 
-        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+        ngx_memcpy(index->key, &node->key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&index->key[sizeof(ngx_rbtree_key_t)], fcn->key,
                    NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        index->cursor = 1;
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
-
-        fcn->uses = 1;
-        fcn->exists = 1;
-        fcn->fs_size = c->fs_size;
-
-        cache->sh->size += c->fs_size;
-
-    } else {
-        ngx_queue_remove(&fcn->queue);
+        node = ngx_rbtree_next(&cache->sh->rbtree, node);
     }
 
-    fcn->expire = ngx_time() + cache->inactive;
-
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
-
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    return NGX_OK;
+    return n;
 }
 
 
-static ngx_int_t
-ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+static void
+ngx_http_file_cache_index_abort(ngx_http_file_cache_index_t *index)
 {
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
-                   "http file cache delete: \"%s\"", path->data);
+    if (ngx_close_file(index->file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", index->temp.data);
+    }
 
-    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
-        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
-                      ngx_delete_file_n " \"%s\" failed", path->data);
+    if (ngx_delete_file(index->temp.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", index->temp.data);
     }
 
-    return NGX_OK;
+    index->file.fd = NGX_INVALID_FILE;
+    index->next = ngx_time() + index->interval;
 }
 
 
-static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+static ngx_int_t
+ngx_http_file_cache_index_load(ngx_http_file_cache_t *cache, time_t *since)
 {
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    u_char                              *buf;
+    ssize_t                              n;
+    ngx_err_t                            err;
+    ngx_int_t                            rc;
+    ngx_file_t                           file;
+    ngx_file_info_t                      fi;
+    ngx_http_file_cache_index_header_t   h;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
-}
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
+    file.name = cache->index->name;
+    file.log = ngx_cycle->log;
 
-time_t
-ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
-{
-    ngx_uint_t               i;
-    ngx_http_cache_valid_t  *valid;
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
 
-    if (cache_valid == NULL) {
-        return 0;
-    }
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    rc = NGX_DECLINED;
+    buf = NULL;
+
+    n = ngx_read_file(&file, (u_char *) &h, sizeof(h), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    if ((size_t) n != sizeof(h)
+        || ngx_memcmp(h.magic, ngx_http_file_cache_index_magic,
+                      sizeof(h.magic))
+           != 0
+        || h.version != NGX_HTTP_FILE_CACHE_INDEX_VERSION
+        || h.bsize != cache->bsize
+        || h.count > (uint64_t) NGX_MAX_OFF_T_VALUE
+                     / sizeof(ngx_http_file_cache_index_entry_t)
+        || (uint64_t) ngx_file_size(&fi)
+           != sizeof(h) + h.count * sizeof(ngx_http_file_cache_index_entry_t))
+    {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "http file cache index \"%V\" is invalid, ignored",
+                      &file.name);
+        goto done;
+    }
+
+    buf = ngx_alloc(NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                    * sizeof(ngx_http_file_cache_index_entry_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    /* the checksum is verified before any entry is trusted */
+
+    rc = ngx_http_file_cache_index_read(cache, &file, &h, buf, 0);
+
+    if (rc == NGX_OK) {
+        rc = ngx_http_file_cache_index_read(cache, &file, &h, buf, 1);
+    }
+
+    if (rc == NGX_OK) {
+        *since = (time_t) h.time;
+    }
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_index_read(ngx_http_file_cache_t *cache, ngx_file_t *file,
+    ngx_http_file_cache_index_header_t *h, u_char *buf, ngx_uint_t add)
+{
+    off_t                               offset;
+    size_t                              size;
+    uint32_t                            crc32;
+    uint64_t                            left;
+    ngx_uint_t                          i, n;
+    ngx_http_cache_t                    c;
+    ngx_http_file_cache_index_entry_t  *entry;
+
+    ngx_crc32_init(crc32);
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+
+    entry = (ngx_http_file_cache_index_entry_t *) buf;
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    for (left = h->count; left; left -= n) {
+
+        n = (ngx_uint_t) ngx_min(left, NGX_HTTP_FILE_CACHE_INDEX_BATCH);
+        size = n * sizeof(ngx_http_file_cache_index_entry_t);
+
+        if (ngx_read_file(file, buf, size, offset) != (ssize_t) size) {
+            return NGX_DECLINED;
+        }
+
+        offset += size;
+
+        if (!add) {
+            ngx_crc32_update(&crc32, buf, size);
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            ngx_memcpy(c.key, entry[i].key, NGX_HTTP_CACHE_KEY_LEN);
+            c.fs_size = (off_t) entry[i].fs_size;
+
+            if (ngx_http_file_cache_add(cache, &c) != NGX_OK) {
+                return NGX_DECLINED;
+            }
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            return NGX_ABORT;
+        }
+    }
+
+    if (!add) {
+        ngx_crc32_final(crc32);
+
+        if (crc32 != h->crc32) {
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "http file cache index \"%V\" is corrupted, ignored",
+                          &file->name);
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    ngx_http_file_cache_loader_t  loader;
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    ngx_memzero(&loader, sizeof(ngx_http_file_cache_loader_t));
+
+    loader.cache = cache;
+
+    if (cache->index) {
+
+        switch (ngx_http_file_cache_index_load(cache, &loader.since)) {
+
+        case NGX_OK:
+
+            /*
+             * the cache is usable right away, the walk below only adds
+             * files missing from the index
+             */
+
+            cache->sh->cold = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "http file cache: %V %.3fM restored from \"%V\"",
+                          &cache->path->name,
+                          ((double) cache->sh->size * cache->bsize)
+                          / (1024 * 1024),
+                          &cache->index->name);
+            break;
+
+        case NGX_ABORT:
+            cache->sh->loading = 0;
+            return;
+
+        default: /* NGX_DECLINED */
+            break;
+        }
+
+        ngx_time_update();
+    }
+
+    loader.last = ngx_current_msec;
+
+    if (ngx_http_file_cache_walk(&loader) == NGX_ABORT) {
+        cache->sh->loading = 0;
+        return;
+    }
+
+    cache->sh->cold = 0;
+    cache->sh->loading = 0;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %.3fM, bsize: %uz",
+                  &cache->path->name,
+                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  cache->bsize);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_walk(ngx_http_file_cache_loader_t *loader)
+{
+    ngx_tree_ctx_t  tree;
+
+#if (NGX_THREADS)
+
+    if (loader->cache->loader_threads > 1) {
+        return ngx_http_file_cache_walk_parallel(loader);
+    }
+
+#endif
+
+    ngx_http_file_cache_init_tree(&tree, loader);
+
+    return ngx_walk_tree(&tree, &loader->cache->path->name);
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_file_cache_walk_parallel(ngx_http_file_cache_loader_t *loader)
+{
+    ngx_err_t                      err;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, n;
+    ngx_pool_t                    *pool;
+    ngx_atomic_t                   next, abort;
+    ngx_tree_ctx_t                 tree;
+    ngx_http_file_cache_loader_t  *threads;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ABORT;
+    }
+
+    rc = NGX_ABORT;
+
+    loader->dirs = ngx_array_create(pool, 256, sizeof(ngx_str_t));
+    if (loader->dirs == NULL) {
+        goto done;
+    }
+
+    next = 0;
+    abort = 0;
+
+    loader->next = &next;
+    loader->abort = &abort;
+
+    /*
+     * files in the cache directory itself are added right away,
+     * its subdirectories are collected and shared between the threads
+     */
+
+    ngx_http_file_cache_init_tree(&tree, loader);
+    tree.pre_tree_handler = ngx_http_file_cache_collect_directory;
+
+    if (ngx_walk_tree(&tree, &loader->cache->path->name) == NGX_ABORT) {
+        goto done;
+    }
+
+    n = ngx_min(loader->cache->loader_threads, loader->dirs->nelts);
+
+    threads = ngx_palloc(pool, (n + 1) * sizeof(ngx_http_file_cache_loader_t));
+    if (threads == NULL) {
+        goto done;
+    }
+
+    for (i = 1; i < n; i++) {
+        threads[i] = *loader;
+
+        err = pthread_create(&threads[i].tid, NULL,
+                             ngx_http_file_cache_walk_thread, &threads[i]);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "pthread_create() failed");
+            break;
+        }
+    }
+
+    n = i;
+
+    ngx_http_file_cache_walk_dirs(loader);
+
+    for (i = 1; i < n; i++) {
+        err = pthread_join(threads[i].tid, NULL);
+        if (err) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                          "pthread_join() failed");
+        }
+    }
+
+    rc = abort ? NGX_ABORT : NGX_OK;
+
+done:
+
+    ngx_destroy_pool(pool);
+
+    return rc;
+}
+
+
+static void *
+ngx_http_file_cache_walk_thread(void *data)
+{
+    ngx_http_file_cache_loader_t  *loader = data;
+
+    int       err;
+    sigset_t  set;
+
+    sigfillset(&set);
+
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+
+    err = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                      "pthread_sigmask() failed");
+        return NULL;
+    }
+
+    ngx_http_file_cache_walk_dirs(loader);
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_walk_dirs(ngx_http_file_cache_loader_t *loader)
+{
+    ngx_str_t       *dirs;
+    ngx_uint_t       i;
+    ngx_tree_ctx_t   tree;
+
+    ngx_http_file_cache_init_tree(&tree, loader);
+
+    dirs = loader->dirs->elts;
+
+    while (!*loader->abort) {
+
+        i = (ngx_uint_t) ngx_atomic_fetch_add(loader->next, 1);
+
+        if (i >= loader->dirs->nelts) {
+            break;
+        }
+
+        if (ngx_walk_tree(&tree, &dirs[i]) == NGX_ABORT) {
+            *loader->abort = 1;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_collect_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_str_t                     *dir;
+    ngx_http_file_cache_loader_t  *loader;
+
+    if (ngx_http_file_cache_manage_directory(ctx, path) == NGX_DECLINED) {
+        return NGX_DECLINED;
+    }
+
+    loader = ctx->data;
+
+    dir = ngx_array_push(loader->dirs);
+    if (dir == NULL) {
+        return NGX_ABORT;
+    }
+
+    dir->len = path->len;
+    dir->data = ngx_pnalloc(loader->dirs->pool, path->len + 1);
+    if (dir->data == NULL) {
+        return NGX_ABORT;
+    }
+
+    ngx_cpystrn(dir->data, path->data, path->len + 1);
+
+    return NGX_DECLINED;
+}
+
+#endif
+
+
+static void
+ngx_http_file_cache_init_tree(ngx_tree_ctx_t *tree,
+    ngx_http_file_cache_loader_t *loader)
+{
+    tree->init_handler = NULL;
+    tree->file_handler = ngx_http_file_cache_manage_file;
+    tree->pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree->post_tree_handler = ngx_http_file_cache_noop;
+    tree->spec_handler = ngx_http_file_cache_delete_file;
+    tree->data = loader;
+    tree->alloc = 0;
+    tree->log = ngx_cycle->log;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_msec_t                     elapsed;
+    ngx_http_file_cache_loader_t  *loader;
+
+    loader = ctx->data;
+
+    if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
+        (void) ngx_http_file_cache_delete_file(ctx, path);
+    }
+
+    if (++loader->files >= loader->cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(loader);
+
+    } else {
+        ngx_time_update();
+
+        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - loader->last));
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache loader time elapsed: %M", elapsed);
+
+        if (elapsed >= loader->cache->loader_threshold) {
+            ngx_http_file_cache_loader_sleep(loader);
+        }
+    }
+
+    return (ngx_quit || ngx_terminate) ? NGX_ABORT : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    if (path->len >= 5
+        && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_loader_t *loader)
+{
+    ngx_msleep(loader->cache->loader_sleep);
+
+    ngx_time_update();
+
+    loader->last = ngx_current_msec;
+    loader->files = 0;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                        *p;
+    ngx_int_t                      n;
+    ngx_uint_t                     i;
+    ngx_http_cache_t               c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_node_t    *fcn;
+    ngx_http_file_cache_loader_t  *loader;
+
+    if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * Temporary files in cache have a suffix consisting of a dot
+     * followed by 10 digits.
+     */
+
+    if (name->len >= 2 * NGX_HTTP_CACHE_KEY_LEN + 1 + 10
+        && name->data[name->len - 10 - 1] == '.')
+    {
+        return NGX_OK;
+    }
+
+    if (ctx->size < (off_t) sizeof(ngx_http_file_cache_header_t)) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, 0,
+                      "cache file \"%s\" is too small", name->data);
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_http_cache_t));
+
+    loader = ctx->data;
+    cache = loader->cache;
+
+    c.length = ctx->size;
+    c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
+
+    p = &name->data[name->len - 2 * NGX_HTTP_CACHE_KEY_LEN];
+
+    for (i = 0; i < NGX_HTTP_CACHE_KEY_LEN; i++) {
+        n = ngx_hextoi(p, 2);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        p += 2;
+
+        c.key[i] = (u_char) n;
+    }
+
+    /*
+     * files older than a restored index are mostly in the cache already,
+     * and are left where the index put them; one missing from the index,
+     * such as a temporary file renamed after its directory was saved,
+     * is added
+     */
+
+    if (ctx->mtime < loader->since) {
+        ngx_shmtx_lock(&cache->shpool->mutex);
+        fcn = ngx_http_file_cache_lookup(cache, c.key);
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        if (fcn) {
+            return NGX_OK;
+        }
+    }
+
+    return ngx_http_file_cache_add(cache, &c);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(cache, c->key);
+
+    if (fcn == NULL) {
+
+        fcn = ngx_slab_calloc_locked(cache->shpool,
+                                     sizeof(ngx_http_file_cache_node_t));
+        if (fcn == NULL) {
+            ngx_http_file_cache_set_watermark(cache);
+
+            if (cache->fail_time != ngx_time()) {
+                cache->fail_time = ngx_time();
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                           "could not allocate node%s", cache->shpool->log_ctx);
+            }
+
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        cache->sh->count++;
+
+        ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+        ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+
+        fcn->uses = 1;
+        fcn->exists = 1;
+        fcn->fs_size = c->fs_size;
+
+        cache->sh->size += c->fs_size;
+
+    } else {
+        ngx_queue_remove(&fcn->queue);
+    }
+
+    fcn->expire = ngx_time() + cache->inactive;
+
+    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
+                   "http file cache delete: \"%s\"", path->data);
+
+    if (ngx_delete_file(path->data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ctx->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", path->data);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+{
+    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache watermark: %ui", cache->sh->watermark);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_ram_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_ram_t  *oram = data;
+
+    size_t                         len;
+    ngx_uint_t                     width;
+    ngx_http_file_cache_ram_t     *ram;
+    ngx_http_file_cache_ram_sh_t  *sh;
+
+    ram = shm_zone->data;
+
+    if (oram) {
+        ram->sh = oram->sh;
+        ram->shpool = oram->shpool;
+        return NGX_OK;
+    }
+
+    ram->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        ram->sh = ram->shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(ram->shpool, sizeof(ngx_http_file_cache_ram_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ram->sh = sh;
+    ram->shpool->data = sh;
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel,
+                    ngx_http_file_cache_ram_rbtree_insert_value);
+
+    ngx_queue_init(&sh->queue);
+
+    /* a sketch column per 4k of the zone */
+
+    for (width = 64; width < shm_zone->shm.size / 4096; width <<= 1) {
+        /* void */
+    }
+
+    len = NGX_HTTP_FILE_CACHE_RAM_ROWS * width;
+
+    sh->sketch = ngx_slab_calloc(ram->shpool, len);
+    if (sh->sketch == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh->width = width;
+    sh->samples = 0;
+    sh->size = 0;
+    sh->max_size = ram->shpool->pfree * ngx_pagesize / 8 * 7;
+
+    len = sizeof(" in cache ram zone \"\"") + shm_zone->shm.name.len;
+
+    ram->shpool->log_ctx = ngx_slab_alloc(ram->shpool, len);
+    if (ram->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(ram->shpool->log_ctx, " in cache ram zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    ram->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_ram_get(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    ram = c->file_cache->ram;
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(ram, c->key);
+
+    if (rn == NULL) {
+        ngx_shmtx_unlock(&ram->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    (void) ngx_http_file_cache_ram_frequency(ram->sh, c->key, 1);
+
+    ngx_queue_remove(&rn->queue);
+    ngx_queue_insert_head(&ram->sh->queue, &rn->queue);
+
+    c->buf = ngx_create_temp_buf(r->pool, rn->len);
+    if (c->buf == NULL) {
+        ngx_shmtx_unlock(&ram->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->buf->pos, rn->data, rn->len);
+
+    c->length = rn->len;
+
+    ngx_shmtx_unlock(&ram->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram hit: %O", c->length);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_ram_add(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    size_t                           size;
+    ngx_uint_t                       freq;
+    ngx_queue_t                     *q;
+    ngx_http_file_cache_t           *cache;
+    ngx_http_file_cache_ram_t       *ram;
+    ngx_http_file_cache_ram_sh_t    *sh;
+    ngx_http_file_cache_ram_node_t  *rn;
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+
+    cache = c->file_cache;
+    ram = cache->ram;
+    sh = ram->sh;
+
+    size = ngx_http_file_cache_ram_size((size_t) c->length);
+
+    /*
+     * the keys zone lock is held throughout, so the response cannot be
+     * replaced on disk, and its copy invalidated, while it is being added
+     */
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (!c->node->exists || c->node->deleting || c->node->uniq != c->uniq) {
+        goto done;
+    }
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    freq = ngx_http_file_cache_ram_frequency(sh, c->key, 1);
+
+    if (ngx_http_file_cache_ram_lookup(ram, c->key)) {
+        goto unlock;
+    }
+
+    /*
+     * admit a response only if it is used more often than the ones evicted
+     * to make room for it, either in the budget or in the fragmented zone
+     */
+
+    for ( ;; ) {
+
+        if (sh->size + size <= sh->max_size) {
+            rn = ngx_slab_alloc_locked(ram->shpool,
+                                 offsetof(ngx_http_file_cache_ram_node_t, data)
+                                 + c->length);
+            if (rn) {
+                break;
+            }
+        }
+
+        if (ngx_queue_empty(&sh->queue)) {
+            goto unlock;
+        }
+
+        q = ngx_queue_last(&sh->queue);
+        rn = ngx_queue_data(q, ngx_http_file_cache_ram_node_t, queue);
+
+        ngx_memcpy(key, &rn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(key + sizeof(ngx_rbtree_key_t), rn->key,
+                   NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (freq <= ngx_http_file_cache_ram_frequency(sh, key, 0)) {
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http file cache ram reject: %ui", freq);
+            goto unlock;
+        }
+
+        ngx_http_file_cache_ram_evict(ram, rn);
+    }
+
+    ngx_memcpy((u_char *) &rn->node.key, c->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(rn->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    rn->len = (size_t) c->length;
+    ngx_memcpy(rn->data, c->buf->pos, rn->len);
+
+    ngx_rbtree_insert(&sh->rbtree, &rn->node);
+    ngx_queue_insert_head(&sh->queue, &rn->queue);
+
+    sh->size += size;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache ram add: %O", c->length);
+
+unlock:
+
+    ngx_shmtx_unlock(&ram->shpool->mutex);
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static void
+ngx_http_file_cache_ram_delete(ngx_http_file_cache_ram_t *ram, u_char *key)
+{
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    ngx_shmtx_lock(&ram->shpool->mutex);
+
+    rn = ngx_http_file_cache_ram_lookup(ram, key);
+
+    if (rn) {
+        ngx_http_file_cache_ram_evict(ram, rn);
+    }
+
+    ngx_shmtx_unlock(&ram->shpool->mutex);
+}
+
+
+static ngx_http_file_cache_ram_node_t *
+ngx_http_file_cache_ram_lookup(ngx_http_file_cache_ram_t *ram, u_char *key)
+{
+    ngx_int_t                        rc;
+    ngx_rbtree_key_t                 node_key;
+    ngx_rbtree_node_t               *node, *sentinel;
+    ngx_http_file_cache_ram_node_t  *rn;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = ram->sh->rbtree.root;
+    sentinel = ram->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        rn = (ngx_http_file_cache_ram_node_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], rn->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return rn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_ram_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t               **p;
+    ngx_http_file_cache_ram_node_t   *rn, *rnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            rn = (ngx_http_file_cache_ram_node_t *) node;
+            rnt = (ngx_http_file_cache_ram_node_t *) temp;
+
+            p = (ngx_memcmp(rn->key, rnt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+/*
+ * a count-min sketch: each row is indexed by its own 32 bits of the md5 key,
+ * and all counters are halved once there were 10 samples per column,
+ * so that a formerly popular response does not stay in memory forever
+ */
+
+static ngx_uint_t
+ngx_http_file_cache_ram_frequency(ngx_http_file_cache_ram_sh_t *sh,
+    u_char *key, ngx_uint_t increment)
+{
+    u_char      *counter;
+    uint32_t     hash;
+    ngx_uint_t   i, freq;
+
+    freq = NGX_HTTP_FILE_CACHE_RAM_FREQ;
+
+    for (i = 0; i < NGX_HTTP_FILE_CACHE_RAM_ROWS; i++) {
+        ngx_memcpy(&hash, &key[i * sizeof(uint32_t)], sizeof(uint32_t));
+
+        counter = &sh->sketch[i * sh->width + (hash & (sh->width - 1))];
+
+        if (increment && *counter < NGX_HTTP_FILE_CACHE_RAM_FREQ) {
+            (*counter)++;
+        }
+
+        if (*counter < freq) {
+            freq = *counter;
+        }
+    }
+
+    if (increment && ++sh->samples >= 10 * sh->width) {
+
+        for (i = 0; i < NGX_HTTP_FILE_CACHE_RAM_ROWS * sh->width; i++) {
+            sh->sketch[i] >>= 1;
+        }
+
+        sh->samples /= 2;
+    }
+
+    return freq;
+}
+
+
+static size_t
+ngx_http_file_cache_ram_size(size_t len)
+{
+    size_t  size;
+
+    /* the size of the slab chunk which holds the response */
+
+    len += offsetof(ngx_http_file_cache_ram_node_t, data);
+
+    if (len > ngx_pagesize / 2) {
+        return ngx_align(len, ngx_pagesize);
+    }
+
+    for (size = 8; size < len; size <<= 1) {
+        /* void */
+    }
+
+    return size;
+}
+
+
+static void
+ngx_http_file_cache_ram_evict(ngx_http_file_cache_ram_t *ram,
+    ngx_http_file_cache_ram_node_t *rn)
+{
+    ram->sh->size -= ngx_http_file_cache_ram_size(rn->len);
+
+    ngx_queue_remove(&rn->queue);
+    ngx_rbtree_delete(&ram->sh->rbtree, &rn->node);
+    ngx_slab_free_locked(ram->shpool, rn);
+}
+
+
+time_t
+ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status)
+{
+    ngx_uint_t               i;
+    ngx_http_cache_valid_t  *valid;
+
+    if (cache_valid == NULL) {
+        return 0;
+    }
 
     valid = cache_valid->elts;
     for (i = 0; i < cache_valid->nelts; i++) {
@@ -2322,9 +3513,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     off_t                   max_size, min_free;
     u_char                 *last, *p;
     time_t                  inactive;
-    ssize_t                 size;
-    ngx_str_t               s, name, *value;
-    ngx_int_t               loader_files, manager_files;
+    ssize_t                 size, ram_size, ram_max_object;
+    ngx_str_t               s, name, index_path, *value;
+    time_t                  index_interval;
+    ngx_int_t               loader_files, manager_files, loader_threads;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
     ngx_uint_t              i, n, use_temp_path;
@@ -2348,6 +3540,10 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     loader_files = 100;
     loader_sleep = 50;
     loader_threshold = 200;
+    loader_threads = 1;
+
+    index_path.len = 0;
+    index_interval = 600;
 
     manager_files = 100;
     manager_sleep = 50;
@@ -2355,6 +3551,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     name.len = 0;
     size = 0;
+    ram_size = 0;
+    ram_max_object = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
     min_free = 0;
 
@@ -2462,6 +3660,44 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "ram_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            ram_size = ngx_parse_size(&s);
+
+            if (ram_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid ram_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (ram_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "ram zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ram_max_object=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            ram_max_object = ngx_parse_size(&s);
+
+            if (ram_max_object == NGX_ERROR || ram_max_object == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid ram_max_object value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2557,6 +3793,54 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "loader_threads=", 15) == 0) {
+
+            loader_threads = ngx_atoi(value[i].data + 15, value[i].len - 15);
+            if (loader_threads == NGX_ERROR || loader_threads == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid loader_threads value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_THREADS)
+            if (loader_threads > 1) {
+                ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                                   "loader_threads requires threads support, "
+                                   "ignored");
+                loader_threads = 1;
+            }
+#endif
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index=", 6) == 0) {
+
+            index_path.len = value[i].len - 6;
+            index_path.data = value[i].data + 6;
+
+            if (ngx_conf_full_name(cf->cycle, &index_path, 0) != NGX_OK) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval == (time_t) NGX_ERROR || index_interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
 
             manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
@@ -2619,10 +3903,54 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->loader_files = loader_files;
     cache->loader_sleep = loader_sleep;
     cache->loader_threshold = loader_threshold;
+    cache->loader_threads = loader_threads;
     cache->manager_files = manager_files;
     cache->manager_sleep = manager_sleep;
     cache->manager_threshold = manager_threshold;
 
+    if (index_path.len) {
+
+        /* the loader would take the index for a broken cache file */
+
+        if (index_path.len > cache->path->name.len
+            && index_path.data[cache->path->name.len] == '/'
+            && ngx_strncmp(index_path.data, cache->path->name.data,
+                           cache->path->name.len)
+               == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "cache index \"%V\" must not be placed "
+                               "in the cache directory", &index_path);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->index = ngx_pcalloc(cf->pool,
+                                   sizeof(ngx_http_file_cache_index_t));
+        if (cache->index == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->index->name = index_path;
+        cache->index->interval = index_interval;
+        cache->index->file.fd = NGX_INVALID_FILE;
+
+        cache->index->temp.len = index_path.len + 1 + NGX_INT64_LEN;
+        cache->index->temp.data = ngx_pnalloc(cf->pool,
+                                              cache->index->temp.len + 1);
+        if (cache->index->temp.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->index->file.name = cache->index->temp;
+
+        cache->index->buf = ngx_palloc(cf->pool,
+                                   NGX_HTTP_FILE_CACHE_INDEX_BATCH
+                                   * sizeof(ngx_http_file_cache_index_entry_t));
+        if (cache->index->buf == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     if (ngx_add_path(cf, &cache->path) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
@@ -2642,6 +3970,44 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (ram_size) {
+
+        if (ram_max_object == 0) {
+            ram_max_object = ngx_min(16384, ram_size / 8);
+
+        } else if (ram_max_object > ram_size / 8) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"ram_max_object\" must not be greater "
+                               "than 1/8 of \"ram_size\"");
+            return NGX_CONF_ERROR;
+        }
+
+        cache->ram = ngx_pcalloc(cf->pool, sizeof(ngx_http_file_cache_ram_t));
+        if (cache->ram == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        /* keys zone names cannot contain a colon, so the name is unique */
+
+        s.len = name.len + sizeof(":ram") - 1;
+        s.data = ngx_pnalloc(cf->pool, s.len);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V:ram", &name);
+
+        cache->ram->shm_zone = ngx_shared_memory_add(cf, &s, ram_size,
+                                                     cmd->post);
+        if (cache->ram->shm_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->ram->shm_zone->init = ngx_http_file_cache_ram_init;
+        cache->ram->shm_zone->data = cache->ram;
+        cache->ram->max_object = ram_max_object;
+    }
+
     cache->use_temp_path = use_temp_path;
 
     cache->inactive = inactive;
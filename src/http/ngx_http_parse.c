@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
+
 
 static uint32_t  usual[] = {
     0x00000000, /* 0000 0000 0000 0000  0000 0000 0000 0000 */
@@ -98,6 +102,362 @@ static uint32_t  usual[] = {
 #endif
 
 
+#if (NGX_HAVE_X86_SIMD)
+
+/*
+ * SSE4.2 and AVX2 fast paths, selected at run time by ngx_cpu_features.
+ * They only skip bytes the state machines would pass over unchanged, or
+ * parse a header line that is complete in the buffer and has nothing
+ * unusual in it; anything else is left to the state machines.
+ */
+
+static u_char *ngx_http_parse_usual_sse42(u_char *p, u_char *last,
+    ngx_uint_t args);
+static u_char *ngx_http_parse_usual_avx2(u_char *p, u_char *last,
+    ngx_uint_t args);
+static u_char *ngx_http_parse_eol_sse42(u_char *p, u_char *last);
+static u_char *ngx_http_parse_eol_avx2(u_char *p, u_char *last);
+static ngx_int_t ngx_http_parse_header_line_simd(ngx_http_request_t *r,
+    ngx_buf_t *b, ngx_uint_t allow_underscores);
+static void ngx_http_parse_hash_init(void);
+
+
+/* the "usual" bytes of sw_check_uri and of sw_uri as PCMPESTRI ranges */
+
+static char  ngx_http_parse_usual_ranges[2][16] = {
+    "!\"$$&*,-0>@~\x80\xff",
+    "!\"$~\x80\xff"
+};
+
+static int  ngx_http_parse_usual_len[2] = { 14, 6 };
+
+
+/* 31^(31 - k) split into 32-bit halves, zero from k = 32 on */
+
+static uint32_t  ngx_http_parse_hash_lo[64];
+static uint32_t  ngx_http_parse_hash_hi[64];
+
+
+static ngx_inline u_char *
+ngx_http_parse_usual(u_char *p, u_char *last, ngx_uint_t args)
+{
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        return ngx_http_parse_usual_avx2(p, last, args);
+    }
+
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_http_parse_usual_sse42(p, last, args);
+    }
+
+    return p;
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_usual_sse42(u_char *p, u_char *last, ngx_uint_t args)
+{
+    int      n, len;
+    __m128i  ranges, v;
+
+    ranges = _mm_loadu_si128((__m128i *) ngx_http_parse_usual_ranges[args]);
+    len = ngx_http_parse_usual_len[args];
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(ranges, len, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_parse_usual_avx2(u_char *p, u_char *last, ngx_uint_t args)
+{
+    uint32_t  mask;
+    __m256i   v, m;
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((__m256i *) p);
+
+        /* 0x00-0x20, the signed compare keeps 0x80-0xff out */
+
+        m = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8(0x21), v));
+
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+
+        if (!args) {
+            m = _mm256_or_si256(m,
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('%')));
+            m = _mm256_or_si256(m,
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')));
+            m = _mm256_or_si256(m,
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.')));
+            m = _mm256_or_si256(m,
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+            m = _mm256_or_si256(m,
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('?')));
+        }
+
+        mask = _mm256_movemask_epi8(m);
+
+        if (mask) {
+            _mm256_zeroupper();
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    /* the callers are built without VEX, avoid the AVX-SSE transition */
+
+    _mm256_zeroupper();
+
+    return p;
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_eol_sse42(u_char *p, u_char *last)
+{
+    int      n;
+    __m128i  set, v;
+
+    set = _mm_setr_epi8(CR, LF, '\0', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((__m128i *) p);
+
+        n = _mm_cmpestri(set, 3, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+        if (n != 16) {
+            return p + n;
+        }
+
+        p += 16;
+    }
+
+    while (p < last && *p != CR && *p != LF && *p != '\0') {
+        p++;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_parse_eol_avx2(u_char *p, u_char *last)
+{
+    uint32_t  mask;
+    __m256i   v, m;
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((__m256i *) p);
+
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(CR)),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(LF)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+        mask = _mm256_movemask_epi8(m);
+
+        if (mask) {
+            _mm256_zeroupper();
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    /* the callers are built without VEX, avoid the AVX-SSE transition */
+
+    _mm256_zeroupper();
+
+    while (p < last && *p != CR && *p != LF && *p != '\0') {
+        p++;
+    }
+
+    return p;
+}
+
+
+/*
+ * ngx_hash() over a name of n bytes is sum(c[k] * 31^(n - 1 - k)), so
+ * every 4 lowercased bytes are multiplied with 4 powers at once; a power
+ * of 31 modulo 2^64 is split into halves that fit _mm_mul_epu32() and
+ * _mm_mullo_epi32().
+ */
+
+#define ngx_http_parse_hash4(lc, k)                                           \
+    c = _mm_cvtepu8_epi32(lc);                                                \
+    lo = _mm_loadu_si128((__m128i *) &ngx_http_parse_hash_lo[k + 32 - n]);    \
+    hi = _mm_loadu_si128((__m128i *) &ngx_http_parse_hash_hi[k + 32 - n]);    \
+    acc_hi = _mm_add_epi32(acc_hi, _mm_mullo_epi32(c, hi));                   \
+    acc_lo = _mm_add_epi64(acc_lo, _mm_mul_epu32(c, lo));                     \
+    acc_lo = _mm_add_epi64(acc_lo, _mm_mul_epu32(_mm_srli_epi64(c, 32),       \
+                                                 _mm_srli_epi64(lo, 32)))
+
+
+__attribute__((target("sse4.2")))
+static ngx_int_t
+ngx_http_parse_header_line_simd(ngx_http_request_t *r, ngx_buf_t *b,
+    ngx_uint_t allow_underscores)
+{
+    int       n, len;
+    u_char   *name, *p, *start, *end, *eol, *last;
+    uint32_t  sum_hi[4];
+    uint64_t  sum_lo[2];
+    __m128i   ranges, v0, v1, upper, c, lo, hi, acc_lo, acc_hi;
+
+    static char  token[] = "--09AZaz__";
+
+    name = b->pos;
+    last = b->last;
+
+    if (last - name < 32) {
+        return NGX_DECLINED;
+    }
+
+    /* header name: '-', digits, letters and maybe '_', then ':' */
+
+    ranges = _mm_loadu_si128((__m128i *) token);
+    len = allow_underscores ? 10 : 8;
+
+    v0 = _mm_loadu_si128((__m128i *) name);
+    v1 = _mm_loadu_si128((__m128i *) (name + 16));
+
+    n = _mm_cmpestri(ranges, len, v0, 16,
+                     _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                     |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+
+    if (n == 16) {
+        n += _mm_cmpestri(ranges, len, v1, 16,
+                          _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                          |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+
+        /* longer names wrap around lowcase_header */
+
+        if (n == 32) {
+            return NGX_DECLINED;
+        }
+    }
+
+    if (n == 0 || name[n] != ':') {
+        return NGX_DECLINED;
+    }
+
+    /* header value up to CR LF or LF, a NUL or a lone CR are errors */
+
+    for (p = name + n + 1; p < last && *p == ' '; p++) { /* void */ }
+
+    start = p;
+
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        eol = ngx_http_parse_eol_avx2(p, last);
+
+    } else {
+        eol = ngx_http_parse_eol_sse42(p, last);
+    }
+
+    if (eol == last || *eol == '\0') {
+        return NGX_DECLINED;
+    }
+
+    if (*eol == CR) {
+        if (eol + 1 == last || eol[1] != LF) {
+            return NGX_DECLINED;
+        }
+
+        b->pos = eol + 2;
+
+    } else {
+        b->pos = eol + 1;
+    }
+
+    for (end = eol; end > start && end[-1] == ' '; end--) { /* void */ }
+
+    /* lowercase 'A'-'Z' only, the name has no bytes above 0x7f */
+
+    upper = _mm_and_si128(_mm_cmpgt_epi8(v0, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(v0, _mm_set1_epi8('Z' + 1)));
+    v0 = _mm_or_si128(v0, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    _mm_storeu_si128((__m128i *) r->lowcase_header, v0);
+
+    if (ngx_http_parse_hash_lo[31] == 0) {
+        ngx_http_parse_hash_init();
+    }
+
+    acc_lo = _mm_setzero_si128();
+    acc_hi = _mm_setzero_si128();
+
+    ngx_http_parse_hash4(v0, 0);
+    ngx_http_parse_hash4(_mm_srli_si128(v0, 4), 4);
+    ngx_http_parse_hash4(_mm_srli_si128(v0, 8), 8);
+    ngx_http_parse_hash4(_mm_srli_si128(v0, 12), 12);
+
+    if (n > 16) {
+        upper = _mm_and_si128(_mm_cmpgt_epi8(v1, _mm_set1_epi8('A' - 1)),
+                              _mm_cmplt_epi8(v1, _mm_set1_epi8('Z' + 1)));
+        v1 = _mm_or_si128(v1, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128((__m128i *) (r->lowcase_header + 16), v1);
+
+        ngx_http_parse_hash4(v1, 16);
+        ngx_http_parse_hash4(_mm_srli_si128(v1, 4), 20);
+        ngx_http_parse_hash4(_mm_srli_si128(v1, 8), 24);
+        ngx_http_parse_hash4(_mm_srli_si128(v1, 12), 28);
+    }
+
+    _mm_storeu_si128((__m128i *) sum_lo, acc_lo);
+    _mm_storeu_si128((__m128i *) sum_hi, acc_hi);
+
+    r->header_name_start = name;
+    r->header_name_end = name + n;
+    r->header_start = start;
+    r->header_end = end;
+    r->invalid_header = 0;
+
+    r->state = 0;
+    r->header_hash = (ngx_uint_t) (sum_lo[0] + sum_lo[1]
+                     + ((uint64_t) (sum_hi[0] + sum_hi[1] + sum_hi[2]
+                                    + sum_hi[3]) << 32));
+    r->lowcase_index = n;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_parse_hash_init(void)
+{
+    int       k;
+    uint64_t  pow;
+
+    pow = 1;
+
+    for (k = 31; k >= 0; k--) {
+        ngx_http_parse_hash_lo[k] = (uint32_t) pow;
+        ngx_http_parse_hash_hi[k] = (uint32_t) (pow >> 32);
+        pow *= 31;
+    }
+}
+
+#endif
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -660,6 +1020,19 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* check "/", "%" and "\" (Win32) in URI */
         case sw_check_uri:
 
+#if (NGX_HAVE_X86_SIMD)
+            p = ngx_http_parse_usual(p, b->last, 0);
+
+            if (p == b->last) {
+                b->pos = p;
+                r->state = state;
+
+                return NGX_AGAIN;
+            }
+
+            ch = *p;
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -724,6 +1097,19 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         /* URI */
         case sw_uri:
 
+#if (NGX_HAVE_X86_SIMD)
+            p = ngx_http_parse_usual(p, b->last, 1);
+
+            if (p == b->last) {
+                b->pos = p;
+                r->state = state;
+
+                return NGX_AGAIN;
+            }
+
+            ch = *p;
+#endif
+
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
                 break;
             }
@@ -941,6 +1327,9 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
 {
     u_char      c, ch, *p;
     ngx_uint_t  hash, i;
+#if (NGX_HAVE_X86_SIMD)
+    ngx_int_t   rc;
+#endif
     enum {
         sw_start = 0,
         sw_name,
@@ -964,6 +1353,18 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
         "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
         "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 
+#if (NGX_HAVE_X86_SIMD)
+
+    if (r->state == sw_start && (ngx_cpu_features & NGX_CPU_SSE42)) {
+        rc = ngx_http_parse_header_line_simd(r, b, allow_underscores);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+#endif
+
     state = r->state;
     hash = r->header_hash;
     i = r->lowcase_index;
@@ -469,6 +469,7 @@ struct ngx_http_request_s {
     ngx_uint_t                        access_code;
 
     ngx_http_variable_value_t        *variables;
+    ngx_http_complex_value_cache_t   *complex_values;
 
 #if (NGX_PCRE)
     ngx_uint_t                        ncaptures;
@@ -25,12 +25,26 @@ static ngx_int_t
     ngx_http_script_add_full_name_code(ngx_http_script_compile_t *sc);
 static size_t ngx_http_script_full_name_len_code(ngx_http_script_engine_t *e);
 static void ngx_http_script_full_name_code(ngx_http_script_engine_t *e);
+static ngx_int_t ngx_http_complex_value_one_pass(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value);
+static ngx_uint_t ngx_http_complex_value_cacheable(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val);
+static ngx_int_t ngx_http_complex_value_intern(
+    ngx_http_compile_complex_value_t *ccv, ngx_http_script_compile_t *sc);
 
 
 #define ngx_http_script_exit  (u_char *) &ngx_http_script_exit_code
 
 static uintptr_t ngx_http_script_exit_code = (uintptr_t) NULL;
 
+static ngx_uint_t  ngx_http_complex_value_id;
+
+
+typedef struct {
+    ngx_str_node_t              sn;
+    ngx_uint_t                  id;
+} ngx_http_complex_value_node_t;
+
 
 void
 ngx_http_script_flush_complex_value(ngx_http_request_t *r,
@@ -58,18 +72,52 @@ ngx_int_t
 ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
     ngx_str_t *value)
 {
-    size_t                        len;
-    ngx_http_script_code_pt       code;
-    ngx_http_script_len_code_pt   lcode;
-    ngx_http_script_engine_t      e;
+    size_t                           len;
+    ngx_uint_t                       slot;
+    ngx_http_script_code_pt          code;
+    ngx_http_script_len_code_pt      lcode;
+    ngx_http_script_engine_t         e;
+    ngx_http_complex_value_cache_t  *cache;
 
     if (val->lengths == NULL) {
         *value = val->value;
         return NGX_OK;
     }
 
+    cache = r->complex_values;
+    slot = val->id % NGX_HTTP_COMPLEX_VALUE_CACHE;
+
+    if (val->id
+        && cache
+        && cache->id[slot] == val->id
+        && ngx_http_complex_value_cacheable(r, val))
+    {
+        /* callers may change the value in place, e.g. sub_filter */
+
+        value->len = cache->value[slot].len;
+        value->data = ngx_pnalloc(r->pool, value->len);
+        if (value->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(value->data, cache->value[slot].data, value->len);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http complex value cached: \"%V\"", value);
+
+        return NGX_OK;
+    }
+
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->one_pass) {
+        if (ngx_http_complex_value_one_pass(r, val, value) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        goto done;
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -100,10 +148,167 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     *value = e.buf;
 
+done:
+
+    if (val->id && ngx_http_complex_value_cacheable(r, val)) {
+
+        if (cache == NULL) {
+            cache = ngx_pcalloc(r->pool,
+                                sizeof(ngx_http_complex_value_cache_t));
+            if (cache == NULL) {
+                return NGX_OK;
+            }
+
+            r->complex_values = cache;
+        }
+
+        cache->value[slot].data = ngx_pstrdup(r->pool, value);
+        if (cache->value[slot].data == NULL) {
+            cache->id[slot] = 0;
+            return NGX_OK;
+        }
+
+        cache->id[slot] = val->id;
+        cache->value[slot].len = value->len;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_complex_value_one_pass(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val, ngx_str_t *value)
+{
+    u_char                      *p, *last;
+    size_t                       len, size;
+    ngx_http_script_code_pt      code;
+    ngx_http_script_engine_t     e;
+    ngx_http_variable_value_t   *vv;
+    ngx_http_script_var_code_t  *vcode;
+#if (NGX_PCRE)
+    ngx_uint_t                   n;
+#endif
+
+    /*
+     * the values are copied to a buffer sized after the last value,
+     * which grows if needed, instead of running the length codes first
+     */
+
+    size = ngx_align(val->hint + 1, 64);
+
+    value->data = ngx_pnalloc(r->pool, size);
+    if (value->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    last = value->data + size;
+
+    ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
+
+    e.ip = val->values;
+    e.pos = value->data;
+    e.request = r;
+    e.flushed = 1;
+
+    while (*(uintptr_t *) e.ip) {
+        code = *(ngx_http_script_code_pt *) e.ip;
+
+        vv = NULL;
+
+        if (code == ngx_http_script_copy_var_code) {
+            vcode = (ngx_http_script_var_code_t *) e.ip;
+            vv = ngx_http_get_indexed_variable(r, vcode->index);
+
+            len = (vv && !vv->not_found) ? vv->len : 0;
+
+#if (NGX_PCRE)
+        } else if (code == ngx_http_script_copy_capture_code) {
+            n = ((ngx_http_script_copy_capture_code_t *) e.ip)->n;
+
+            len = (n < r->ncaptures) ? r->captures[n + 1] - r->captures[n]
+                                     : 0;
+#endif
+
+        } else {
+            /* ngx_http_script_copy_code */
+            len = ((ngx_http_script_copy_code_t *) e.ip)->len;
+        }
+
+        if ((size_t) (last - e.pos) < len) {
+            size = ngx_max(2 * size, (size_t) (e.pos - value->data) + len);
+
+            p = ngx_pnalloc(r->pool, size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            e.pos = ngx_cpymem(p, value->data, e.pos - value->data);
+            value->data = p;
+            last = p + size;
+        }
+
+        if (code != ngx_http_script_copy_var_code) {
+            code((ngx_http_script_engine_t *) &e);
+            continue;
+        }
+
+        e.ip += sizeof(ngx_http_script_var_code_t);
+
+        if (len) {
+            p = e.pos;
+            e.pos = ngx_cpymem(p, vv->data, len);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http script var: \"%*s\"", len, p);
+        }
+    }
+
+    value->len = e.pos - value->data;
+
+    val->hint = value->len;
+
     return NGX_OK;
 }
 
 
+static ngx_uint_t
+ngx_http_complex_value_cacheable(ngx_http_request_t *r,
+    ngx_http_complex_value_t *val)
+{
+    ngx_uint_t                 *index;
+    ngx_http_variable_t        *v;
+    ngx_http_variable_value_t  *vv;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    /*
+     * a value is only reused while all its variables keep the values
+     * cached in the request, so it changes no more often than they do
+     */
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    v = cmcf->variables.elts;
+
+    for (index = val->flushes; *index != (ngx_uint_t) -1; index++) {
+
+        if (v[*index].flags
+            & (NGX_HTTP_VAR_CHANGEABLE|NGX_HTTP_VAR_NOCACHEABLE))
+        {
+            return 0;
+        }
+
+        vv = &r->variables[*index];
+
+        if (vv->no_cacheable || !(vv->valid || vv->not_found)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
 size_t
 ngx_http_complex_value_size(ngx_http_request_t *r,
     ngx_http_complex_value_t *val, size_t default_value)
@@ -174,6 +379,9 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->id = 0;
+    ccv->complex_value->hint = 0;
+    ccv->complex_value->one_pass = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -235,6 +443,77 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    /*
+     * values with captures change with regex matches and are not cached;
+     * the full name code makes its own buffer and needs the length pass
+     */
+
+    if (nc == 0 && flushes.nelts) {
+        if (ngx_http_complex_value_intern(ccv, &sc) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (!sc.conf_prefix && !sc.root_prefix) {
+        ccv->complex_value->one_pass = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_complex_value_intern(ngx_http_compile_complex_value_t *ccv,
+    ngx_http_script_compile_t *sc)
+{
+    u_char                         *p;
+    uint32_t                        hash;
+    ngx_str_t                       key;
+    ngx_http_core_main_conf_t      *cmcf;
+    ngx_http_complex_value_node_t  *node;
+
+    /*
+     * the same value in different directives gets the same id, so that
+     * it is evaluated once per request; values compiled with different
+     * options get different code and are told apart by a leading byte
+     */
+
+    cmcf = ngx_http_conf_get_module_main_conf(ccv->cf, ngx_http_core_module);
+
+    key.len = 1 + ccv->complex_value->value.len;
+    key.data = ngx_pnalloc(ccv->cf->pool, key.len);
+    if (key.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = key.data;
+    *p++ = (u_char) (sc->zero | sc->conf_prefix << 1 | sc->root_prefix << 2);
+    ngx_memcpy(p, ccv->complex_value->value.data,
+               ccv->complex_value->value.len);
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    node = (ngx_http_complex_value_node_t *)
+               ngx_str_rbtree_lookup(&cmcf->complex_values, &key, hash);
+
+    if (node) {
+        ccv->complex_value->id = node->id;
+        return NGX_OK;
+    }
+
+    node = ngx_palloc(ccv->cf->pool, sizeof(ngx_http_complex_value_node_t));
+    if (node == NULL) {
+        return NGX_ERROR;
+    }
+
+    node->sn.str = key;
+    node->sn.node.key = hash;
+    node->id = ++ngx_http_complex_value_id;
+
+    ngx_rbtree_insert(&cmcf->complex_values, &node->sn.node);
+
+    ccv->complex_value->id = node->id;
+
     return NGX_OK;
 }
 
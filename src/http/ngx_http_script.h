@@ -69,12 +69,29 @@ typedef struct {
     void                       *lengths;
     void                       *values;
 
+    ngx_uint_t                  id;        /* 0 if the value is not cached */
+    size_t                      hint;      /* length of the last value */
+    unsigned                    one_pass:1;
+
     union {
         size_t                  size;
     } u;
 } ngx_http_complex_value_t;
 
 
+#define NGX_HTTP_COMPLEX_VALUE_CACHE  16
+
+/*
+ * complex values evaluated in a request, for those of them which only
+ * use cacheable variables; direct mapped by the value id
+ */
+
+struct ngx_http_complex_value_cache_s {
+    ngx_uint_t                  id[NGX_HTTP_COMPLEX_VALUE_CACHE];
+    ngx_str_t                   value[NGX_HTTP_COMPLEX_VALUE_CACHE];
+};
+
+
 typedef struct {
     ngx_conf_t                 *cf;
     ngx_str_t                  *value;
@@ -37,6 +37,8 @@ static ngx_int_t ngx_http_upstream_cache_etag(ngx_http_request_t *r,
 #endif
 
 static void ngx_http_upstream_init_request(ngx_http_request_t *r);
+static void ngx_http_upstream_init_peer(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
 static void ngx_http_upstream_resolve_handler(ngx_resolver_ctx_t *ctx);
 static void ngx_http_upstream_rd_check_broken_connection(ngx_http_request_t *r);
 static void ngx_http_upstream_wr_check_broken_connection(ngx_http_request_t *r);
@@ -185,6 +187,18 @@ static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+static ngx_int_t ngx_http_upstream_limit_acquire(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_limit_handler(ngx_event_t *ev);
+static void ngx_http_upstream_limit_release(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_int_t rc);
+static void ngx_http_upstream_limit_update(ngx_http_upstream_limit_t *lim,
+    ngx_msec_t rtt, ngx_uint_t failed);
+static char *ngx_http_upstream_adaptive_limit(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#endif
+
 static ngx_int_t ngx_http_upstream_set_local(ngx_http_request_t *r,
   ngx_http_upstream_t *u, ngx_http_upstream_local_t *local);
 
@@ -368,6 +382,15 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+    { ngx_string("adaptive_limit"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_adaptive_limit,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+#endif
+
       ngx_null_command
 };
 
@@ -871,6 +894,23 @@ found:
     u->ssl_name = uscf->host;
 #endif
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+    if (uscf->limit && ngx_http_upstream_limit_acquire(r, u) != NGX_OK) {
+        return;
+    }
+#endif
+
+    ngx_http_upstream_init_peer(r, u);
+}
+
+
+static void
+ngx_http_upstream_init_peer(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = u->upstream;
+
     if (uscf->peer.init(r, uscf) != NGX_OK) {
         ngx_http_upstream_finalize_request(r, u,
                                            NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -889,6 +929,263 @@ found:
 }
 
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+
+#define NGX_HTTP_UPSTREAM_LIMIT_QUEUED  1
+#define NGX_HTTP_UPSTREAM_LIMIT_ACTIVE  2
+
+
+static ngx_int_t
+ngx_http_upstream_limit_acquire(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_limit_t      *lim;
+    ngx_http_upstream_limit_ctx_t  *ctx;
+
+    lim = u->upstream->limit;
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_limit_ctx_t));
+    if (ctx == NULL) {
+        ngx_http_upstream_finalize_request(r, u,
+                                           NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return NGX_DONE;
+    }
+
+    ctx->limit = lim;
+    u->limit = ctx;
+
+    if (lim->queued == 0 && lim->inflight < lim->limit / 1000) {
+        lim->inflight++;
+        ctx->state = NGX_HTTP_UPSTREAM_LIMIT_ACTIVE;
+        return NGX_OK;
+    }
+
+    if (lim->queued < lim->queue_size) {
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "upstream limit queued, inflight:%ui limit:%ui "
+                       "queued:%ui", lim->inflight, lim->limit / 1000,
+                       lim->queued);
+
+        ngx_queue_insert_tail(&lim->queue, &ctx->queue);
+        lim->queued++;
+
+        ctx->state = NGX_HTTP_UPSTREAM_LIMIT_QUEUED;
+
+        ctx->event.handler = ngx_http_upstream_limit_handler;
+        ctx->event.data = r;
+        ctx->event.log = r->connection->log;
+
+        ngx_add_timer(&ctx->event, lim->timeout);
+
+        return NGX_DONE;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream \"%V\" concurrency limit %ui exceeded",
+                  &u->upstream->host, lim->limit / 1000);
+
+    ngx_http_upstream_finalize_request(r, u, lim->status);
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_upstream_limit_handler(ngx_event_t *ev)
+{
+    ngx_connection_t               *c;
+    ngx_http_request_t             *r;
+    ngx_http_upstream_t            *u;
+    ngx_http_upstream_limit_t      *lim;
+    ngx_http_upstream_limit_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
+    ctx = u->limit;
+    lim = ctx->limit;
+
+    ngx_http_set_log_request(c->log, r);
+
+    if (ev->timedout) {
+        ngx_queue_remove(&ctx->queue);
+        lim->queued--;
+
+        ctx->state = 0;
+
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "upstream \"%V\" concurrency limit %ui exceeded "
+                      "while waiting in queue",
+                      &u->upstream->host, lim->limit / 1000);
+
+        ngx_http_upstream_finalize_request(r, u, lim->status);
+
+    } else {
+        ngx_http_upstream_init_peer(r, u);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_limit_release(ngx_http_request_t *r, ngx_http_upstream_t *u,
+    ngx_int_t rc)
+{
+    ngx_queue_t                    *q;
+    ngx_http_upstream_limit_t      *lim;
+    ngx_http_upstream_limit_ctx_t  *ctx;
+
+    ctx = u->limit;
+    lim = ctx->limit;
+
+    if (ctx->state == NGX_HTTP_UPSTREAM_LIMIT_QUEUED) {
+        ngx_queue_remove(&ctx->queue);
+        lim->queued--;
+
+        if (ctx->event.timer_set) {
+            ngx_del_timer(&ctx->event);
+        }
+
+        ctx->state = 0;
+        return;
+    }
+
+    if (ctx->state != NGX_HTTP_UPSTREAM_LIMIT_ACTIVE) {
+        return;
+    }
+
+    ctx->state = 0;
+
+    if (ctx->event.posted) {
+        ngx_delete_posted_event(&ctx->event);
+    }
+
+    lim->inflight--;
+
+    /*
+     * gateway errors shrink the limit, while the time to the response
+     * header of the last tried server is taken as the round trip time
+     */
+
+    if (rc == NGX_HTTP_BAD_GATEWAY || rc == NGX_HTTP_GATEWAY_TIME_OUT) {
+        ngx_http_upstream_limit_update(lim, 0, 1);
+
+    } else if (u->state && u->state->header_time != (ngx_msec_t) -1) {
+        ngx_http_upstream_limit_update(lim, u->state->header_time, 0);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "upstream limit release, inflight:%ui limit:%ui "
+                   "queued:%ui", lim->inflight, lim->limit / 1000,
+                   lim->queued);
+
+    while (!ngx_queue_empty(&lim->queue)
+           && lim->inflight < lim->limit / 1000)
+    {
+        q = ngx_queue_head(&lim->queue);
+        ngx_queue_remove(q);
+        lim->queued--;
+
+        ctx = ngx_queue_data(q, ngx_http_upstream_limit_ctx_t, queue);
+
+        ctx->state = NGX_HTTP_UPSTREAM_LIMIT_ACTIVE;
+        lim->inflight++;
+
+        if (ctx->event.timer_set) {
+            ngx_del_timer(&ctx->event);
+        }
+
+        ngx_post_event(&ctx->event, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_upstream_limit_update(ngx_http_upstream_limit_t *lim,
+    ngx_msec_t rtt, ngx_uint_t failed)
+{
+    uint64_t    limit, gradient;
+    ngx_uint_t  sample, queue, n;
+
+    limit = lim->limit;
+
+    if (failed) {
+
+        /* multiplicative decrease */
+
+        limit = limit * 9 / 10;
+        goto done;
+    }
+
+    sample = (rtt + 1) * 1000;
+
+    if (lim->long_rtt == 0) {
+        lim->long_rtt = sample;
+        lim->short_rtt = sample;
+    }
+
+    /* moving averages over about 10 and 100 responses */
+
+    if (sample > lim->short_rtt) {
+        lim->short_rtt += (sample - lim->short_rtt) / 10;
+
+    } else {
+        lim->short_rtt -= (lim->short_rtt - sample) / 10;
+    }
+
+    if (sample > lim->long_rtt) {
+        lim->long_rtt += (sample - lim->long_rtt) / 100;
+
+    } else {
+        lim->long_rtt -= (lim->long_rtt - sample) / 100;
+    }
+
+    /* let the long average follow a drop in latency faster */
+
+    if (lim->long_rtt > 2 * lim->short_rtt) {
+        lim->long_rtt = lim->long_rtt * 95 / 100;
+    }
+
+    /* the limit does not matter while it is not reached */
+
+    if ((lim->inflight + 1) * 2000 < lim->limit) {
+        return;
+    }
+
+    /*
+     * the gradient of 1.5 * long / short round trip time, in 0.5 .. 1,
+     * scales the limit down as the latency grows, and the square root
+     * of the limit is added to let it probe for more concurrency
+     */
+
+    gradient = (uint64_t) lim->long_rtt * 1500 / lim->short_rtt;
+    gradient = ngx_max(gradient, 500);
+    gradient = ngx_min(gradient, 1000);
+
+    n = lim->limit / 1000;
+
+    for (queue = 1; (queue + 1) * (queue + 1) <= n; queue++) {
+        /* void */
+    }
+
+    limit = limit * gradient / 1000 + queue * 1000;
+
+    /* smoothing of 0.2 */
+
+    limit = ((uint64_t) lim->limit * 4 + limit) / 5;
+
+done:
+
+    limit = ngx_max(limit, (uint64_t) lim->min * 1000);
+    limit = ngx_min(limit, (uint64_t) lim->max * 1000);
+
+    lim->limit = (ngx_uint_t) limit;
+}
+
+#endif
+
+
 #if (NGX_HTTP_CACHE)
 
 static ngx_int_t
@@ -4785,6 +5082,12 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         u->peer.sockaddr = NULL;
     }
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+    if (u->limit) {
+        ngx_http_upstream_limit_release(r, u, rc);
+    }
+#endif
+
     if (u->peer.connection) {
 
 #if (NGX_HTTP_SSL)
@@ -6434,6 +6737,140 @@ not_supported:
 }
 
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+
+static char *
+ngx_http_upstream_adaptive_limit(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t                   n;
+    ngx_str_t                  *value, s;
+    ngx_uint_t                  i, initial;
+    ngx_msec_t                  timeout;
+    ngx_http_upstream_limit_t  *lim;
+
+    if (uscf->limit) {
+        return "is duplicate";
+    }
+
+    lim = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_limit_t));
+    if (lim == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    lim->min = 1;
+    lim->max = 1000;
+    lim->status = NGX_HTTP_SERVICE_UNAVAILABLE;
+    lim->timeout = 1000;
+
+    initial = 20;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "initial=", 8) == 0) {
+
+            n = ngx_atoi(&value[i].data[8], value[i].len - 8);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            initial = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "min=", 4) == 0) {
+
+            n = ngx_atoi(&value[i].data[4], value[i].len - 4);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            lim->min = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            n = ngx_atoi(&value[i].data[4], value[i].len - 4);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            lim->max = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "queue=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR) {
+                goto invalid;
+            }
+
+            lim->queue_size = n;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            timeout = ngx_parse_time(&s, 0);
+            if (timeout == (ngx_msec_t) NGX_ERROR || timeout == 0) {
+                goto invalid;
+            }
+
+            lim->timeout = timeout;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n < 400 || n > 599) {
+                goto invalid;
+            }
+
+            lim->status = n;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (lim->min > lim->max) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"min\" is greater than \"max\"");
+        return NGX_CONF_ERROR;
+    }
+
+    initial = ngx_max(initial, lim->min);
+    initial = ngx_min(initial, lim->max);
+
+    lim->limit = initial * 1000;
+
+    ngx_queue_init(&lim->queue);
+
+    uscf->limit = lim;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+#endif
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -138,6 +138,37 @@ typedef struct {
 #endif
 
 
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+
+typedef struct {
+    /* the limit and round trip times are kept in 1/1000 */
+    ngx_uint_t                       limit;
+    ngx_uint_t                       long_rtt;
+    ngx_uint_t                       short_rtt;
+
+    ngx_uint_t                       min;
+    ngx_uint_t                       max;
+    ngx_uint_t                       inflight;
+
+    ngx_uint_t                       queued;
+    ngx_uint_t                       queue_size;
+    ngx_msec_t                       timeout;
+    ngx_uint_t                       status;
+
+    ngx_queue_t                      queue;
+} ngx_http_upstream_limit_t;
+
+
+typedef struct {
+    ngx_http_upstream_limit_t       *limit;
+    ngx_queue_t                      queue;
+    ngx_event_t                      event;
+    ngx_uint_t                       state;
+} ngx_http_upstream_limit_ctx_t;
+
+#endif
+
+
 struct ngx_http_upstream_srv_conf_s {
 #if (NGX_HTTP_UPSTREAM_RBTREE)
     ngx_rbtree_node_t                node;
@@ -163,6 +194,10 @@ struct ngx_http_upstream_srv_conf_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
 #endif
+
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+    ngx_http_upstream_limit_t       *limit;
+#endif
 };
 
 
@@ -387,6 +422,9 @@ struct ngx_http_upstream_s {
 #if (T_NGX_HTTP_DYNAMIC_RESOLVE)
     ngx_resolver_ctx_t              *dyn_resolve_ctx;
 #endif
+#if (T_NGX_HTTP_UPSTREAM_ADAPTIVE_LIMIT)
+    ngx_http_upstream_limit_ctx_t   *limit;
+#endif
 
     ngx_buf_t                        from_client;
 
@@ -498,6 +536,8 @@ ngx_uint_t ngx_http_upstream_check_upstream_down(ngx_str_t *upstream);
 
 void ngx_http_upstream_check_get_peer(ngx_uint_t index);
 void ngx_http_upstream_check_free_peer(ngx_uint_t index);
+void ngx_http_upstream_check_report_peer(ngx_uint_t index, ngx_uint_t failed,
+    ngx_msec_t time);
 
 ngx_uint_t ngx_http_upstream_check_add_dynamic_peer(ngx_pool_t *pool,
     ngx_http_upstream_srv_conf_t *us, ngx_addr_t *peer);
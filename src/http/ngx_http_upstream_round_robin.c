@@ -332,6 +332,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = us->peer.data;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->start_time = ngx_current_msec;
 
     n = rrp->peers->number;
 
@@ -475,6 +476,7 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = peers;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->start_time = ngx_current_msec;
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
@@ -776,6 +778,15 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
     ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
+#if (NGX_HTTP_UPSTREAM_CHECK)
+    ngx_http_upstream_check_report_peer(peer->check_index,
+                                        state & NGX_PEER_FAILED,
+                                        ngx_current_msec - rrp->start_time);
+#endif
+
+    /* the next try, if any, starts right after this one is released */
+    rrp->start_time = ngx_current_msec;
+
     if (pc->tries) {
         pc->tries--;
     }
@@ -42,6 +42,7 @@ typedef struct {
 #define NGX_HTTP_V2_PING_SIZE                    8
 #define NGX_HTTP_V2_GOAWAY_SIZE                  8
 #define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+#define NGX_HTTP_V2_PRIORITY_UPDATE_SIZE         4
 
 #define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
 
@@ -95,6 +96,8 @@ static u_char *ngx_http_v2_handle_continuation(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end, ngx_http_v2_handler_pt handler);
 static u_char *ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
+static u_char *ngx_http_v2_state_priority_update(
+    ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
 static u_char *ngx_http_v2_state_settings(ngx_http_v2_connection_t *h2c,
@@ -191,6 +194,14 @@ static ngx_int_t ngx_http_v2_adjust_windows(ngx_http_v2_connection_t *h2c,
 static void ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_node_t *node, ngx_uint_t depend, ngx_uint_t exclusive);
 static void ngx_http_v2_node_children_update(ngx_http_v2_node_t *node);
+static ngx_int_t ngx_http_v2_parse_priority(u_char *p, u_char *end,
+    ngx_uint_t *urgency, ngx_uint_t *incremental);
+static ngx_int_t ngx_http_v2_set_priority(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_node_t *node, u_char *p, u_char *end, ngx_uint_t update);
+static ngx_http_v2_out_frame_t *ngx_http_v2_schedule_frame(
+    ngx_http_v2_connection_t *h2c);
+static void ngx_http_v2_requeue_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame);
 
 static void ngx_http_v2_pool_cleanup(void *data);
 
@@ -232,6 +243,7 @@ static ngx_http_v2_parse_header_t  ngx_http_v2_parse_headers[] = {
 void
 ngx_http_v2_init(ngx_event_t *rev)
 {
+    ngx_uint_t                 i;
     ngx_connection_t          *c;
     ngx_pool_cleanup_t        *cln;
     ngx_http_connection_t     *hc;
@@ -279,6 +291,13 @@ ngx_http_v2_init(ngx_event_t *rev)
     h2c->concurrent_pushes = h2scf->concurrent_pushes;
     h2c->priority_limit = ngx_max(h2scf->concurrent_streams, 100);
 
+    /* the table size of the client decoder before its settings arrive */
+
+    h2c->hpack_enc.size = NGX_HTTP_V2_TABLE_SIZE;
+    h2c->hpack_enc.max = h2scf->header_table_size;
+
+    ngx_http_v2_encode_table_size(h2c, NGX_HTTP_V2_TABLE_SIZE);
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -318,6 +337,11 @@ ngx_http_v2_init(ngx_event_t *rev)
                                             : ngx_http_v2_state_preface;
 
     ngx_queue_init(&h2c->waiting);
+
+    for (i = 0; i < NGX_HTTP_V2_URGENCY_LEVELS; i++) {
+        ngx_queue_init(&h2c->schedule[i]);
+    }
+
     ngx_queue_init(&h2c->dependencies);
     ngx_queue_init(&h2c->closed);
 
@@ -455,7 +479,9 @@ ngx_http_v2_read_handler(ngx_event_t *rev)
         return;
     }
 
-    if (h2c->last_out && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+    if ((h2c->last_out || h2c->scheduled)
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
         ngx_http_v2_finalize_connection(h2c, 0);
         return;
     }
@@ -487,7 +513,7 @@ ngx_http_v2_write_handler(ngx_event_t *wev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 write handler");
 
-    if (h2c->last_out == NULL && !c->buffered) {
+    if (h2c->last_out == NULL && !h2c->scheduled && !c->buffered) {
 
         if (wev->timer_set) {
             ngx_del_timer(wev);
@@ -523,7 +549,8 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
     ngx_chain_t               *cl;
     ngx_event_t               *wev;
     ngx_connection_t          *c;
-    ngx_http_v2_out_frame_t   *out, *frame, *fn;
+    ngx_uint_t                 requeue;
+    ngx_http_v2_out_frame_t   *out, *frame, *fn, *last, *rest, *unsent;
     ngx_http_core_loc_conf_t  *clcf;
 
     c = h2c->connection;
@@ -537,6 +564,17 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         return NGX_AGAIN;
     }
 
+    /* scheduled frames of streams follow the frames queued in order */
+
+    last = h2c->last_out;
+
+    while (h2c->scheduled) {
+        frame = ngx_http_v2_schedule_frame(h2c);
+
+        frame->next = h2c->last_out;
+        h2c->last_out = frame;
+    }
+
     cl = NULL;
     out = NULL;
 
@@ -584,6 +622,8 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         goto error;
     }
 
+    requeue = (last == NULL);
+
     for ( /* void */ ; out; out = fn) {
         fn = out->next;
 
@@ -596,18 +636,46 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
                        "http2 frame sent: %p sid:%ui bl:%d len:%uz",
                        out, out->stream ? out->stream->node->id : 0,
                        out->blocked, out->length);
+
+        if (out == last) {
+            requeue = 1;
+        }
     }
 
+    /*
+     * The first frame not sent is blocked: the rest of it, if any, must go
+     * out before anything else.  Other unsent scheduled frames are returned
+     * to their streams, so that frames queued meanwhile can overtake them.
+     */
+
     frame = NULL;
+    rest = NULL;
+    unsent = out;
 
     for ( /* void */ ; out; out = fn) {
         fn = out->next;
-        out->next = frame;
-        frame = out;
+
+        if (requeue && out != unsent) {
+            out->next = rest;
+            rest = out;
+
+        } else {
+            out->next = frame;
+            frame = out;
+        }
+
+        if (out == last) {
+            requeue = 1;
+        }
     }
 
     h2c->last_out = frame;
 
+    for ( /* void */ ; rest; rest = fn) {
+        fn = rest->next;
+        ngx_http_v2_requeue_frame(h2c, rest);
+    }
+
     if (!wev->ready) {
         ngx_add_timer(wev, clcf->send_timeout);
         return NGX_AGAIN;
@@ -638,7 +706,7 @@ ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
     ngx_connection_t          *c;
     ngx_http_core_loc_conf_t  *clcf;
 
-    if (h2c->last_out || h2c->processing || h2c->pushing) {
+    if (h2c->last_out || h2c->scheduled || h2c->processing || h2c->pushing) {
         return;
     }
 
@@ -938,6 +1006,10 @@ ngx_http_v2_state_head(ngx_http_v2_connection_t *h2c, u_char *pos, u_char *end)
                    "http2 frame type:%ui f:%Xd l:%uz sid:%ui",
                    type, h2c->state.flags, h2c->state.length, h2c->state.sid);
 
+    if (type == NGX_HTTP_V2_PRIORITY_UPDATE_FRAME) {
+        return ngx_http_v2_state_priority_update(h2c, pos, end);
+    }
+
     if (type >= NGX_HTTP_V2_FRAME_STATES) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
                       "client sent frame with unknown type %ui", type);
@@ -1737,6 +1809,7 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
     ngx_http_core_main_conf_t  *cmcf;
 
     static ngx_str_t cookie = ngx_string("cookie");
+    static ngx_str_t priority = ngx_string("priority");
 
     header = &h2c->state.header;
 
@@ -1874,6 +1947,19 @@ ngx_http_v2_state_process_header(ngx_http_v2_connection_t *h2c, u_char *pos,
         if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
             goto error;
         }
+
+        if (header->name.len == priority.len
+            && ngx_memcmp(header->name.data, priority.data, priority.len) == 0
+            && ngx_http_v2_set_priority(h2c, h2c->state.stream->node,
+                                        header->value.data,
+                                        header->value.data + header->value.len,
+                                        0)
+               != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "client sent invalid priority header: \"%V\"",
+                          &header->value);
+        }
     }
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -2074,6 +2160,95 @@ ngx_http_v2_state_priority(ngx_http_v2_connection_t *h2c, u_char *pos,
 }
 
 
+static u_char *
+ngx_http_v2_state_priority_update(ngx_http_v2_connection_t *h2c, u_char *pos,
+    u_char *end)
+{
+    u_char              *last;
+    ngx_uint_t           sid;
+    ngx_http_v2_node_t  *node;
+
+    if (h2c->state.length < NGX_HTTP_V2_PRIORITY_UPDATE_SIZE) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect length %uz", h2c->state.length);
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_SIZE_ERROR);
+    }
+
+    if (h2c->state.sid) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    if ((size_t) (end - pos) < h2c->state.length) {
+
+        if (h2c->state.length > NGX_HTTP_V2_STATE_BUFFER_SIZE) {
+            ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                          "client sent too long PRIORITY_UPDATE frame, "
+                          "ignored");
+
+            return ngx_http_v2_state_skip(h2c, pos, end);
+        }
+
+        return ngx_http_v2_state_save(h2c, pos, end,
+                                      ngx_http_v2_state_priority_update);
+    }
+
+    if (--h2c->priority_limit == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent too many PRIORITY_UPDATE frames");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_ENHANCE_YOUR_CALM);
+    }
+
+    sid = ngx_http_v2_parse_sid(pos);
+
+    last = pos + h2c->state.length;
+    pos += NGX_HTTP_V2_PRIORITY_UPDATE_SIZE;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 PRIORITY_UPDATE frame sid:%ui \"%*s\"",
+                   sid, last - pos, pos);
+
+    if (sid == 0) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent PRIORITY_UPDATE frame "
+                      "with incorrect prioritized identifier");
+
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_PROTOCOL_ERROR);
+    }
+
+    node = ngx_http_v2_get_node_by_id(h2c, sid, 1);
+
+    if (node == NULL) {
+        return ngx_http_v2_connection_error(h2c, NGX_HTTP_V2_INTERNAL_ERROR);
+    }
+
+    if (node->stream == NULL && node->parent == NULL) {
+
+        /* an idle stream is kept until its request like with PRIORITY */
+
+        h2c->closed_nodes++;
+        ngx_queue_insert_tail(&h2c->closed, &node->reuse);
+
+        node->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
+        ngx_http_v2_set_dependency(h2c, node, 0, 0);
+    }
+
+    if (ngx_http_v2_set_priority(h2c, node, pos, last, 1) != NGX_OK) {
+        ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                      "client sent invalid priority \"%*s\" "
+                      "in PRIORITY_UPDATE frame, ignored", last - pos, pos);
+    }
+
+    return ngx_http_v2_state_complete(h2c, last, end);
+}
+
+
 static u_char *
 ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
@@ -2282,7 +2457,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
-            h2c->table_update = 1;
+            ngx_http_v2_encode_table_size(h2c, value);
             break;
 
         default:
@@ -2803,6 +2978,9 @@ ngx_http_v2_push_stream(ngx_http_v2_stream_t *parent, ngx_str_t *path)
     node->weight = NGX_HTTP_V2_DEFAULT_WEIGHT;
     ngx_http_v2_set_dependency(h2c, node, parent->node->id, 0);
 
+    node->urgency = parent->node->urgency;
+    node->incremental = parent->node->incremental;
+
     r->method_name = ngx_http_core_get_method;
     r->method = NGX_HTTP_GET;
 
@@ -3290,6 +3468,8 @@ ngx_http_v2_create_stream(ngx_http_v2_connection_t *h2c, ngx_uint_t push)
 
     h2scf = ngx_http_get_module_srv_conf(r, ngx_http_v2_module);
 
+    stream->last_out = &stream->out;
+
     stream->send_window = h2c->init_window;
     stream->recv_window = h2scf->preread_size;
 
@@ -3345,6 +3525,7 @@ ngx_http_v2_get_node_by_id(ngx_http_v2_connection_t *h2c, ngx_uint_t sid,
     }
 
     node->id = sid;
+    node->urgency = NGX_HTTP_V2_DEFAULT_URGENCY;
 
     ngx_queue_init(&node->children);
 
@@ -4790,7 +4971,9 @@ ngx_http_v2_handle_connection_handler(ngx_event_t *rev)
         return;
     }
 
-    if (h2c->last_out && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+    if ((h2c->last_out || h2c->scheduled)
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
         ngx_http_v2_finalize_connection(h2c, 0);
         return;
     }
@@ -4899,6 +5082,12 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
 
     h2c->last_out = NULL;
 
+    for (i = 0; i < NGX_HTTP_V2_URGENCY_LEVELS; i++) {
+        ngx_queue_init(&h2c->schedule[i]);
+    }
+
+    h2c->scheduled = 0;
+
     h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
                                          ngx_http_v2_module);
 
@@ -5127,6 +5316,224 @@ ngx_http_v2_node_children_update(ngx_http_v2_node_t *node)
 }
 
 
+/*
+ * The urgency and incremental parameters of an RFC 9218 priority field
+ * value, a structured field dictionary; other members, parameters, and
+ * values of unexpected types are ignored.
+ */
+
+static ngx_int_t
+ngx_http_v2_parse_priority(u_char *p, u_char *end, ngx_uint_t *urgency,
+    ngx_uint_t *incremental)
+{
+    u_char     ch, *key, *value, *last;
+    size_t     len;
+    ngx_int_t  n;
+
+    for ( ;; ) {
+
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+
+        if (p == end) {
+            return NGX_OK;
+        }
+
+        key = p;
+
+        for ( /* void */ ; p < end; p++) {
+            ch = *p;
+
+            if ((ch >= 'a' && ch <= 'z') || ch == '*'
+                || (p != key
+                    && ((ch >= '0' && ch <= '9')
+                        || ch == '_' || ch == '-' || ch == '.')))
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        if (p == key) {
+            return NGX_DECLINED;
+        }
+
+        len = p - key;
+
+        value = NULL;
+        last = NULL;
+
+        if (p < end && *p == '=') {
+            value = ++p;
+        }
+
+        /* the value ends at parameters or whitespace, the member at a comma */
+
+        for ( /* void */ ; p < end && *p != ','; p++) {
+
+            if (*p == '"') {
+                for (p++; p < end && *p != '"'; p++) {
+                    if (*p == '\\' && p + 1 < end) {
+                        p++;
+                    }
+                }
+
+                if (p == end) {
+                    return NGX_DECLINED;
+                }
+
+                continue;
+            }
+
+            if (value && last == NULL
+                && (*p == ';' || *p == ' ' || *p == '\t'))
+            {
+                last = p;
+            }
+        }
+
+        if (value && last == NULL) {
+            last = p;
+        }
+
+        if (len == 1 && key[0] == 'u' && value) {
+            n = ngx_atoi(value, last - value);
+
+            if (n != NGX_ERROR && n < NGX_HTTP_V2_URGENCY_LEVELS) {
+                *urgency = n;
+            }
+
+        } else if (len == 1 && key[0] == 'i') {
+
+            if (value == NULL
+                || (last - value == 2 && value[0] == '?' && value[1] == '1'))
+            {
+                *incremental = 1;
+
+            } else if (last - value == 2 && value[0] == '?' && value[1] == '0')
+            {
+                *incremental = 0;
+            }
+        }
+
+        if (p < end) {
+            p++;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_v2_set_priority(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_node_t *node, u_char *p, u_char *end, ngx_uint_t update)
+{
+    ngx_uint_t             urgency, incremental, scheduled;
+    ngx_http_v2_stream_t  *stream;
+
+    /*
+     * A PRIORITY_UPDATE frame carries a complete priority and overrides
+     * the priority header field of the request.
+     */
+
+    if (update) {
+        urgency = NGX_HTTP_V2_DEFAULT_URGENCY;
+        incremental = 0;
+
+    } else if (node->updated) {
+        return NGX_OK;
+
+    } else {
+        urgency = node->urgency;
+        incremental = node->incremental;
+    }
+
+    if (ngx_http_v2_parse_priority(p, end, &urgency, &incremental)
+        != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 stream %ui priority u:%ui i:%ui",
+                   node->id, urgency, incremental);
+
+    stream = node->stream;
+    scheduled = (stream && stream->out);
+
+    if (scheduled) {
+        ngx_http_v2_unschedule_stream(h2c, stream);
+    }
+
+    node->urgency = urgency;
+    node->incremental = incremental;
+
+    if (update) {
+        node->updated = 1;
+    }
+
+    if (scheduled) {
+        ngx_http_v2_schedule_stream(h2c, stream);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_v2_out_frame_t *
+ngx_http_v2_schedule_frame(ngx_http_v2_connection_t *h2c)
+{
+    ngx_uint_t                urgency;
+    ngx_queue_t              *q;
+    ngx_http_v2_stream_t     *stream;
+    ngx_http_v2_out_frame_t  *frame;
+
+    for (urgency = 0; !(h2c->scheduled & (1 << urgency)); urgency++) {
+        /* void */
+    }
+
+    q = ngx_queue_head(&h2c->schedule[urgency]);
+    stream = ngx_queue_data(q, ngx_http_v2_stream_t, schedule);
+
+    frame = stream->out;
+    stream->out = frame->next;
+
+    if (stream->out == NULL) {
+        stream->last_out = &stream->out;
+        ngx_http_v2_unschedule_stream(h2c, stream);
+
+    } else if (stream->node->incremental) {
+        ngx_queue_remove(q);
+        ngx_queue_insert_tail(&h2c->schedule[urgency], q);
+    }
+
+    return frame;
+}
+
+
+static void
+ngx_http_v2_requeue_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_http_v2_stream_t  *stream;
+
+    stream = frame->stream;
+
+    if (stream->out == NULL) {
+        stream->last_out = &frame->next;
+
+        ngx_queue_insert_head(&h2c->schedule[stream->node->urgency],
+                              &stream->schedule);
+
+        h2c->scheduled |= 1 << stream->node->urgency;
+    }
+
+    frame->next = stream->out;
+    stream->out = frame;
+}
+
+
 static void
 ngx_http_v2_pool_cleanup(void *data)
 {
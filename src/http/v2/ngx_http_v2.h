@@ -28,6 +28,10 @@
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
 
+#define NGX_HTTP_V2_STATIC_TABLE_SIZE    61
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 /* frame types */
 #define NGX_HTTP_V2_DATA_FRAME           0x0
 #define NGX_HTTP_V2_HEADERS_FRAME        0x1
@@ -39,6 +43,7 @@
 #define NGX_HTTP_V2_GOAWAY_FRAME         0x7
 #define NGX_HTTP_V2_WINDOW_UPDATE_FRAME  0x8
 #define NGX_HTTP_V2_CONTINUATION_FRAME   0x9
+#define NGX_HTTP_V2_PRIORITY_UPDATE_FRAME  0x10
 
 /* frame flags */
 #define NGX_HTTP_V2_NO_FLAG              0x00
@@ -53,6 +58,9 @@
 
 #define NGX_HTTP_V2_DEFAULT_WEIGHT       16
 
+#define NGX_HTTP_V2_URGENCY_LEVELS       8
+#define NGX_HTTP_V2_DEFAULT_URGENCY      3
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -114,6 +122,32 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    u_char                          *name;
+    size_t                           name_len;
+    size_t                           value_len;
+    ngx_uint_t                       name_hash;
+    ngx_uint_t                       hash;
+} ngx_http_v2_hpack_entry_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_entry_t       *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           size;
+    size_t                           used;
+    size_t                           limit;
+    size_t                           lowest;
+    size_t                           max;
+    u_char                          *storage;
+    u_char                          *pos;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -140,6 +174,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -150,6 +185,9 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_out_frame_t         *last_out;
 
+    ngx_queue_t                      schedule[NGX_HTTP_V2_URGENCY_LEVELS];
+    ngx_uint_t                       scheduled;
+
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
 
@@ -178,6 +216,10 @@ struct ngx_http_v2_node_s {
     ngx_uint_t                       weight;
     double                           rel_weight;
     ngx_http_v2_stream_t            *stream;
+
+    unsigned                         urgency:3;
+    unsigned                         incremental:1;
+    unsigned                         updated:1;
 };
 
 
@@ -205,6 +247,10 @@ struct ngx_http_v2_stream_s {
 
     ngx_queue_t                      queue;
 
+    ngx_http_v2_out_frame_t         *out;
+    ngx_http_v2_out_frame_t        **last_out;
+    ngx_queue_t                      schedule;
+
     ngx_array_t                     *cookies;
 
     ngx_pool_t                      *pool;
@@ -235,47 +281,62 @@ struct ngx_http_v2_out_frame_s {
 };
 
 
+/*
+ * Frames of streams are scheduled per RFC 9218: a stream with output is
+ * kept in the queue of its urgency, the lowest nonempty urgency is served
+ * first, the frames of a non-incremental stream are sent one after another,
+ * and incremental streams of the same urgency take turns frame by frame.
+ * The "scheduled" bitmask has a bit set for every nonempty queue.
+ */
+
 static ngx_inline void
-ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
-    ngx_http_v2_out_frame_t *frame)
+ngx_http_v2_schedule_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_queue_insert_tail(&h2c->schedule[stream->node->urgency],
+                          &stream->schedule);
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    h2c->scheduled |= 1 << stream->node->urgency;
+}
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
-            break;
-        }
-    }
+static ngx_inline void
+ngx_http_v2_unschedule_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream)
+{
+    ngx_queue_remove(&stream->schedule);
 
-    frame->next = *out;
-    *out = frame;
+    if (ngx_queue_empty(&h2c->schedule[stream->node->urgency])) {
+        h2c->scheduled &= ~(1 << stream->node->urgency);
+    }
 }
 
 
 static ngx_inline void
-ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
+ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_http_v2_stream_t  *stream;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    stream = frame->stream;
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    if (stream->out == NULL) {
+        ngx_http_v2_schedule_stream(h2c, stream);
     }
 
-    frame->next = *out;
-    *out = frame;
+    frame->next = NULL;
+
+    *stream->last_out = frame;
+    stream->last_out = &frame->next;
+}
+
+
+static ngx_inline void
+ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    frame->next = h2c->last_out;
+    h2c->last_out = frame;
 }
 
 
@@ -309,6 +370,10 @@ ngx_int_t ngx_http_v2_get_indexed_header(ngx_http_v2_connection_t *h2c,
 ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
+ngx_uint_t ngx_http_v2_get_static_index(ngx_str_t *name);
+
+void ngx_http_v2_encode_table_size(ngx_http_v2_connection_t *h2c,
+    size_t size);
 
 
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
@@ -376,6 +441,12 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 #define NGX_HTTP_V2_ENCODE_RAW            0
 #define NGX_HTTP_V2_ENCODE_HUFF           0x80
 
+#define NGX_HTTP_V2_INDEXING              0
+#define NGX_HTTP_V2_NO_INDEXING           1
+
+/* two dynamic table size updates, see ngx_http_v2_write_table_update() */
+#define NGX_HTTP_V2_TABLE_UPDATE_SIZE     (2 * NGX_HTTP_V2_INT_OCTETS)
+
 #define NGX_HTTP_V2_AUTHORITY_INDEX       1
 
 #define NGX_HTTP_V2_METHOD_INDEX          2
@@ -411,6 +482,11 @@ ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+u_char *ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
+u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t flags);
 
 
 #endif /* _NGX_HTTP_V2_H_INCLUDED_ */
@@ -10,8 +10,37 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_str_t                    name;
+    ngx_uint_t                   flags;
+} ngx_http_v2_index_policy_t;
+
+
 static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
     ngx_uint_t value);
+static ngx_uint_t ngx_http_v2_index_policy(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+static void ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t name_hash, ngx_uint_t hash);
+static void ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c,
+    size_t size);
+
+
+/*
+ * Response headers which are mostly unique to a response: inserting them
+ * would only push out the entries that are reused.
+ */
+
+static ngx_http_v2_index_policy_t  ngx_http_v2_index_policies[] = {
+    { ngx_string("age"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("content-length"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("content-range"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("etag"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("last-modified"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("location"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_string("set-cookie"), NGX_HTTP_V2_NO_INDEXING },
+    { ngx_null_string, 0 }
+};
 
 
 u_char *
@@ -60,3 +89,306 @@ ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 
     return pos;
 }
+
+
+void
+ngx_http_v2_encode_table_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    enc->limit = ngx_min(size, enc->max);
+
+    if (!h2c->table_update || enc->limit < enc->lowest) {
+        enc->lowest = enc->limit;
+    }
+
+    if (enc->limit != enc->size || enc->lowest != enc->size) {
+        h2c->table_update = 1;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder table size: %uz was:%uz",
+                   enc->limit, enc->size);
+}
+
+
+u_char *
+ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    if (!h2c->table_update) {
+        return pos;
+    }
+
+    h2c->table_update = 0;
+
+    enc = &h2c->hpack_enc;
+
+    /*
+     * If the size was lowered and then raised again before this header
+     * block, the lowest size is signalled first (RFC 7541, 4.2).
+     */
+
+    if (enc->lowest < enc->limit) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", enc->lowest);
+
+        ngx_http_v2_table_evict(h2c, enc->lowest);
+
+        *pos = 32;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->lowest);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", enc->limit);
+
+    ngx_http_v2_table_evict(h2c, enc->limit);
+
+    enc->size = enc->limit;
+    enc->lowest = enc->limit;
+
+    *pos = 32;
+    return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), enc->limit);
+}
+
+
+/*
+ * Encodes a header field.  With NGX_HTTP_V2_INDEXING, the field is written as
+ * an index into the dynamic table if the same field is there, or else as
+ * a literal inserted into the dynamic table if the insertion policy allows;
+ * such a header block must start with ngx_http_v2_write_table_update(), and
+ * its frame must be sent in the order of encoding, that is, queued with
+ * ngx_http_v2_queue_blocked_frame().  With NGX_HTTP_V2_NO_INDEXING, the
+ * dynamic table is not used.
+ *
+ * The "index" is that of the name in the static table, or 0.  The buffer
+ * must have space for NGX_HTTP_V2_INT_OCTETS, name length with
+ * NGX_HTTP_V2_INT_OCTETS, and value length with NGX_HTTP_V2_INT_OCTETS.
+ */
+
+u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp,
+    ngx_uint_t flags)
+{
+    ngx_uint_t                  i, n, hash, name_hash, name_index;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    if (index) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    name_index = index;
+    name_hash = 0;
+    hash = 0;
+
+    if (flags == NGX_HTTP_V2_INDEXING) {
+
+        for (i = 0; i < name->len; i++) {
+            name_hash = ngx_hash(name_hash, ngx_tolower(name->data[i]));
+        }
+
+        hash = name_hash;
+
+        for (i = 0; i < value->len; i++) {
+            hash = ngx_hash(hash, value->data[i]);
+        }
+
+        /* the most recently inserted entry has the lowest index */
+
+        for (n = enc->added; n != enc->deleted; /* void */) {
+            entry = &enc->entries[--n % enc->allocated];
+
+            if (entry->name_hash != name_hash
+                || entry->name_len != name->len
+                || ngx_strncasecmp(entry->name, name->data, name->len) != 0)
+            {
+                continue;
+            }
+
+            if (entry->hash == hash
+                && entry->value_len == value->len
+                && ngx_memcmp(entry->name + entry->name_len, value->data,
+                              value->len)
+                   == 0)
+            {
+                index = NGX_HTTP_V2_STATIC_TABLE_SIZE + enc->added - n;
+
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                               "http2 hpack indexed: %ui", index);
+
+                *pos = 128;
+                return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
+                                             index);
+            }
+
+            if (name_index == 0) {
+                name_index = NGX_HTTP_V2_STATIC_TABLE_SIZE + enc->added - n;
+            }
+        }
+    }
+
+    if (index == 0) {
+        index = ngx_http_v2_get_static_index(name);
+
+        if (index) {
+            name_index = index;
+        }
+    }
+
+    if (flags == NGX_HTTP_V2_INDEXING) {
+        flags = ngx_http_v2_index_policy(h2c, name, value);
+    }
+
+    if (flags == NGX_HTTP_V2_INDEXING) {
+        *pos = 64;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), name_index);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), name_index);
+    }
+
+    if (name_index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    pos = ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+
+    if (flags == NGX_HTTP_V2_INDEXING) {
+        ngx_http_v2_table_insert(h2c, name, value, name_hash, hash);
+    }
+
+    return pos;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_index_policy(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    size_t                       size;
+    ngx_http_v2_hpack_enc_t     *enc;
+    ngx_http_v2_index_policy_t  *policy;
+
+    for (policy = ngx_http_v2_index_policies; policy->name.len; policy++) {
+        if (policy->name.len == name->len
+            && ngx_strncasecmp(policy->name.data, name->data, name->len) == 0)
+        {
+            return policy->flags;
+        }
+    }
+
+    enc = &h2c->hpack_enc;
+
+    /* a large entry would push out many smaller ones */
+
+    size = 32 + name->len + value->len;
+
+    if (size > enc->size / 4) {
+        return NGX_HTTP_V2_NO_INDEXING;
+    }
+
+    if (enc->storage == NULL) {
+        enc->allocated = enc->max / 32;
+
+        enc->entries = ngx_palloc(h2c->connection->pool,
+                                  sizeof(ngx_http_v2_hpack_entry_t)
+                                  * enc->allocated);
+        if (enc->entries == NULL) {
+            return NGX_HTTP_V2_NO_INDEXING;
+        }
+
+        enc->storage = ngx_palloc(h2c->connection->pool, enc->max);
+        if (enc->storage == NULL) {
+            return NGX_HTTP_V2_NO_INDEXING;
+        }
+
+        enc->pos = enc->storage;
+    }
+
+    return NGX_HTTP_V2_INDEXING;
+}
+
+
+static void
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t name_hash, ngx_uint_t hash)
+{
+    u_char                     *p;
+    size_t                      size, avail;
+    ngx_uint_t                  n;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    size = 32 + name->len + value->len;
+
+    ngx_http_v2_table_evict(h2c, enc->size - size);
+
+    avail = enc->storage + enc->max - enc->pos;
+
+    if (avail < name->len + value->len) {
+
+        /*
+         * The entries are stored in the order of insertion; the evicted
+         * ones are reclaimed by moving the rest to the start of the storage,
+         * where they always fit with the new one, as the sizes of entries
+         * count 32 octets more than they take.
+         */
+
+        if (enc->added == enc->deleted) {
+            enc->pos = enc->storage;
+
+        } else {
+            p = enc->entries[enc->deleted % enc->allocated].name;
+
+            ngx_memmove(enc->storage, p, enc->pos - p);
+
+            for (n = enc->deleted; n != enc->added; n++) {
+                enc->entries[n % enc->allocated].name -= p - enc->storage;
+            }
+
+            enc->pos -= p - enc->storage;
+        }
+    }
+
+    entry = &enc->entries[enc->added++ % enc->allocated];
+
+    entry->name = enc->pos;
+    entry->name_len = name->len;
+    entry->value_len = value->len;
+    entry->name_hash = name_hash;
+    entry->hash = hash;
+
+    ngx_strlow(enc->pos, name->data, name->len);
+    enc->pos = ngx_cpymem(enc->pos + name->len, value->data, value->len);
+
+    enc->used += size;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack insert: \"%V: %V\" used:%uz",
+                   name, value, enc->used);
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    while (enc->used > size) {
+        entry = &enc->entries[enc->deleted++ % enc->allocated];
+        enc->used -= 32 + entry->name_len + entry->value_len;
+    }
+}
@@ -56,10 +56,14 @@ static ngx_int_t ngx_http_v2_push_resources(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_push_resource(ngx_http_request_t *r,
     ngx_str_t *path, ngx_str_t *binary);
 
+static ngx_http_v2_out_frame_t *ngx_http_v2_alloc_frame(
+    ngx_http_request_t *r, size_t len, size_t extra);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_headers_frame(
     ngx_http_request_t *r, u_char *pos, u_char *end, ngx_uint_t fin);
-static ngx_http_v2_out_frame_t *ngx_http_v2_create_push_frame(
-    ngx_http_request_t *r, u_char *pos, u_char *end);
+static void ngx_http_v2_fill_headers_frame(ngx_http_request_t *r,
+    ngx_http_v2_out_frame_t *frame, u_char *pos, u_char *end, ngx_uint_t fin);
+static void ngx_http_v2_fill_push_frame(ngx_http_request_t *r,
+    ngx_http_v2_out_frame_t *frame, u_char *pos, u_char *end);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_trailers_frame(
     ngx_http_request_t *r);
 
@@ -135,7 +139,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, server, value;
     ngx_uint_t                 i, port, fin;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -147,32 +151,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
-
-#if (T_NGX_SERVER_INFO)
-    static const u_char nginx[6] = "\x85\xde\x5a\xa6\x35\x45";
-#else
-    static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
-#endif
-#if (NGX_HTTP_GZIP)
-    static const u_char accept_encoding[12] =
-        "\x8b\x84\x84\x2d\x69\x5b\x05\x44\x3c\x86\xaa\x6f";
-#endif
-
-#if (T_NGX_SERVER_INFO)
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(TENGINE_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(TENGINE_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(TENGINE_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(TENGINE_VER_BUILD)];
-#else
-    static size_t nginx_ver_len = ngx_http_v2_literal_size(NGINX_VER);
-    static u_char nginx_ver[ngx_http_v2_literal_size(NGINX_VER)];
-
-    static size_t nginx_ver_build_len =
-                                  ngx_http_v2_literal_size(NGINX_VER_BUILD);
-    static u_char nginx_ver_build[ngx_http_v2_literal_size(NGINX_VER_BUILD)];
-#endif
+    u_char                     number[NGX_OFF_T_LEN];
+    u_char                     time[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
     stream = r->stream;
 
@@ -266,49 +246,88 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? NGX_HTTP_V2_TABLE_UPDATE_SIZE : 0;
 
-    len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
+    len += status ? 1 : NGX_HTTP_V2_INT_OCTETS
+                        + ngx_http_v2_literal_size("418");
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            len += 1 + nginx_ver_len;
+#if (T_NGX_SERVER_INFO)
+            ngx_str_set(&server, TENGINE_VER);
+#else
+            ngx_str_set(&server, NGINX_VER);
+#endif
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            len += 1 + nginx_ver_build_len;
+#if (T_NGX_SERVER_INFO)
+            ngx_str_set(&server, TENGINE_VER_BUILD);
+#else
+            ngx_str_set(&server, NGINX_VER_BUILD);
+#endif
 
         } else {
-            len += 1 + sizeof(nginx);
+#if (T_NGX_SERVER_INFO)
+            ngx_str_set(&server, TENGINE);
+#else
+            ngx_str_set(&server, "nginx");
+#endif
         }
+
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + server.len;
     }
 
     if (r->headers_out.date == NULL) {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.content_type.len) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            tmp_len = r->headers_out.content_type.len
+                      + sizeof("; charset=") - 1 + r->headers_out.charset.len;
+
+            p = ngx_pnalloc(r->pool, tmp_len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_cpymem(p, r->headers_out.content_type.data,
+                           r->headers_out.content_type.len);
+
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+
+            p = ngx_cpymem(p, r->headers_out.charset.data,
+                           r->headers_out.charset.len);
+
+            /* updated r->headers_out.content_type is also needed for logging */
+
+            r->headers_out.content_type.len = tmp_len;
+            r->headers_out.content_type.data = p - tmp_len;
         }
+
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS
+               + r->headers_out.content_type.len;
     }
 
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        len += 1 + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_integer_octets(NGX_OFF_T_LEN) + NGX_OFF_T_LEN;
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        len += 1 + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
+        len += NGX_HTTP_V2_INT_OCTETS
+               + ngx_http_v2_literal_size("Wed, 31 Dec 1986 18:00:00 GMT");
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -386,7 +405,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         r->headers_out.location->hash = 0;
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+        len += NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS
+               + r->headers_out.location->value.len;
     }
 
     tmp_len = len;
@@ -394,7 +414,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
         if (clcf->gzip_vary) {
-            len += 1 + sizeof(accept_encoding);
+            len += NGX_HTTP_V2_INT_OCTETS
+                   + ngx_http_v2_literal_size("Accept-Encoding");
 
         } else {
             r->gzip_vary = 0;
@@ -435,8 +456,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             return NGX_ERROR;
         }
 
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
-                 + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
+        len += NGX_HTTP_V2_INT_OCTETS
+               + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
+               + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
 
         if (header[i].key.len > tmp_len) {
             tmp_len = header[i].key.len;
@@ -454,15 +476,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
-    start = pos;
+    /* nothing may fail once the dynamic table is changed */
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+    frame = ngx_http_v2_alloc_frame(r, len, 0);
+    if (frame == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_http_cleanup_add(r, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
     }
 
+    start = pos;
+
+    pos = ngx_http_v2_write_table_update(h2c, pos);
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 output header: \":status: %03ui\"",
                    r->headers_out.status);
@@ -471,63 +500,20 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        value.data = number;
+        value.len = ngx_sprintf(number, "%03ui", r->headers_out.status)
+                    - number;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       NULL, &value, tmp, NGX_HTTP_V2_INDEXING);
     }
 
     if (r->headers_out.server == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &server);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
-
-        } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
-        }
-
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
-
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-#if (T_NGX_SERVER_INFO)
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) TENGINE_VER,
-                                            sizeof(TENGINE_VER) - 1, tmp);
-#else
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-#endif
-                nginx_ver_len = p - nginx_ver;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
-
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-#if (T_NGX_SERVER_INFO)
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) TENGINE_VER_BUILD,
-                                            sizeof(TENGINE_VER_BUILD) - 1, tmp);
-#else
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-#endif
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
-
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
-
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
-        }
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       NULL, &server, tmp, NGX_HTTP_V2_INDEXING);
     }
 
     if (r->headers_out.date == NULL) {
@@ -535,45 +521,21 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        value = ngx_cached_http_time;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                       NULL, &value, tmp, NGX_HTTP_V2_INDEXING);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
-
-        if (r->headers_out.content_type_len == r->headers_out.content_type.len
-            && r->headers_out.charset.len)
-        {
-            len = r->headers_out.content_type.len + sizeof("; charset=") - 1
-                  + r->headers_out.charset.len;
-
-            p = ngx_pnalloc(r->pool, len);
-            if (p == NULL) {
-                return NGX_ERROR;
-            }
-
-            p = ngx_cpymem(p, r->headers_out.content_type.data,
-                           r->headers_out.content_type.len);
-
-            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
-
-            p = ngx_cpymem(p, r->headers_out.charset.data,
-                           r->headers_out.charset.len);
-
-            /* updated r->headers_out.content_type is also needed for logging */
-
-            r->headers_out.content_type.len = len;
-            r->headers_out.content_type.data = p - len;
-        }
-
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX, NULL,
+                                       &r->headers_out.content_type, tmp,
+                                       NGX_HTTP_V2_INDEXING);
     }
 
     if (r->headers_out.content_length == NULL
@@ -583,30 +545,28 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        value.data = number;
+        value.len = ngx_sprintf(number, "%O", r->headers_out.content_length_n)
+                    - number;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX, NULL,
+                                       &value, tmp, NGX_HTTP_V2_NO_INDEXING);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        value.data = time;
+        value.len = ngx_http_time(time, r->headers_out.last_modified_time)
+                    - time;
 
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
-
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"", &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX, NULL,
+                                       &value, tmp, NGX_HTTP_V2_NO_INDEXING);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -614,9 +574,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       NULL, &r->headers_out.location->value,
+                                       tmp, NGX_HTTP_V2_NO_INDEXING);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -624,8 +584,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        ngx_str_set(&value, "Accept-Encoding");
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       NULL, &value, tmp, NGX_HTTP_V2_INDEXING);
     }
 #endif
 
@@ -658,32 +620,20 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
-
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &header[i].key,
+                                       &header[i].value, tmp,
+                                       NGX_HTTP_V2_INDEXING);
     }
 
     fin = r->header_only
           || (r->headers_out.content_length_n == 0 && !r->expect_trailers);
 
-    frame = ngx_http_v2_create_headers_frame(r, start, pos, fin);
-    if (frame == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_http_v2_fill_headers_frame(r, frame, start, pos, fin);
 
     ngx_http_v2_queue_blocked_frame(h2c, frame);
 
     stream->queued++;
 
-    cln = ngx_http_cleanup_add(r, 0);
-    if (cln == NULL) {
-        return NGX_ERROR;
-    }
-
     cln->handler = ngx_http_v2_filter_cleanup;
     cln->data = stream;
 
@@ -999,7 +949,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             value = &(*h)->value;
 
-            len = 1 + NGX_HTTP_V2_INT_OCTETS + value->len;
+            len = NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + value->len;
 
             pos = ngx_pnalloc(r->pool, len);
             if (pos == NULL) {
@@ -1008,17 +958,17 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             binary[i].data = pos;
 
-            *pos++ = ngx_http_v2_inc_indexed(ph[i].index);
-            pos = ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+            pos = ngx_http_v2_write_header(h2c, pos, ph[i].index, NULL, value,
+                                           tmp, NGX_HTTP_V2_NO_INDEXING);
 
             binary[i].len = pos - binary[i].data;
         }
     }
 
-    len = (h2c->table_update ? 1 : 0)
+    len = (h2c->table_update ? NGX_HTTP_V2_TABLE_UPDATE_SIZE : 0)
           + 1
-          + 1 + NGX_HTTP_V2_INT_OCTETS + path->len
-          + 1 + NGX_HTTP_V2_INT_OCTETS + r->schema.len;
+          + NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + path->len
+          + NGX_HTTP_V2_INT_OCTETS + NGX_HTTP_V2_INT_OCTETS + r->schema.len;
 
     for (i = 0; i < NGX_HTTP_V2_PUSH_HEADERS; i++) {
         len += binary[i].len;
@@ -1029,15 +979,17 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         return NGX_ERROR;
     }
 
-    start = pos;
+    /* nothing may fail once the dynamic table size update is written */
 
-    if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+    frame = ngx_http_v2_alloc_frame(r, len, NGX_HTTP_V2_STREAM_ID_SIZE);
+    if (frame == NULL) {
+        return NGX_ERROR;
     }
 
+    start = pos;
+
+    pos = ngx_http_v2_write_table_update(h2c, pos);
+
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":method: GET\"");
 
@@ -1046,8 +998,8 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":path: %V\"", path);
 
-    *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
-    pos = ngx_http_v2_write_value(pos, path->data, path->len, tmp);
+    pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_PATH_INDEX, NULL,
+                                   path, tmp, NGX_HTTP_V2_NO_INDEXING);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":scheme: %V\"", &r->schema);
@@ -1061,8 +1013,9 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->schema.data, r->schema.len, tmp);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SCHEME_HTTP_INDEX,
+                                       NULL, &r->schema, tmp,
+                                       NGX_HTTP_V2_NO_INDEXING);
     }
 
     for (i = 0; i < NGX_HTTP_V2_PUSH_HEADERS; i++) {
@@ -1079,10 +1032,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         pos = ngx_cpymem(pos, binary[i].data, binary[i].len);
     }
 
-    frame = ngx_http_v2_create_push_frame(r, start, pos);
-    if (frame == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_http_v2_fill_push_frame(r, frame, start, pos);
 
     ngx_http_v2_queue_blocked_frame(h2c, frame);
 
@@ -1099,52 +1049,42 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 }
 
 
+/*
+ * Allocates a frame with the HEADERS or PUSH_PROMISE frame and as many
+ * CONTINUATION frames as a header block of up to "len" bytes may need,
+ * "extra" bytes are added to the first frame header.  Header blocks are
+ * encoded after that, as the encoder's dynamic table must not change for
+ * a block which then fails to be sent.
+ */
+
 static ngx_http_v2_out_frame_t *
-ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
-    u_char *end, ngx_uint_t fin)
+ngx_http_v2_alloc_frame(ngx_http_request_t *r, size_t len, size_t extra)
 {
-    u_char                    type, flags;
-    size_t                    rest, frame_size;
+    size_t                    frame_size;
     ngx_buf_t                *b;
+    ngx_uint_t                i, n;
     ngx_chain_t              *cl, **ll;
-    ngx_http_v2_stream_t     *stream;
     ngx_http_v2_out_frame_t  *frame;
 
-    stream = r->stream;
-    rest = end - pos;
-
     frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
     if (frame == NULL) {
         return NULL;
     }
 
-    frame->handler = ngx_http_v2_headers_frame_handler;
-    frame->stream = stream;
-    frame->length = rest;
-    frame->blocked = 1;
-    frame->fin = fin;
-
-    ll = &frame->first;
+    frame_size = r->stream->connection->frame_size;
 
-    type = NGX_HTTP_V2_HEADERS_FRAME;
-    flags = fin ? NGX_HTTP_V2_END_STREAM_FLAG : NGX_HTTP_V2_NO_FLAG;
-    frame_size = stream->connection->frame_size;
+    len += extra;
+    n = (len > frame_size) ? (len + frame_size - 1) / frame_size : 1;
 
-    for ( ;; ) {
-        if (rest <= frame_size) {
-            frame_size = rest;
-            flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
-        }
+    ll = &frame->first;
 
-        b = ngx_create_temp_buf(r->pool, NGX_HTTP_V2_FRAME_HEADER_SIZE);
+    for (i = 0; i < n; i++) {
+        b = ngx_create_temp_buf(r->pool, NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                         + (i == 0 ? extra : 0));
         if (b == NULL) {
             return NULL;
         }
 
-        b->last = ngx_http_v2_write_len_and_type(b->last, frame_size, type);
-        *b->last++ = flags;
-        b->last = ngx_http_v2_write_sid(b->last, stream->node->id);
-
         b->tag = (ngx_buf_tag_t) &ngx_http_v2_module;
 
         cl = ngx_alloc_chain_link(r->pool);
@@ -1162,15 +1102,6 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
             return NULL;
         }
 
-        b->pos = pos;
-
-        pos += frame_size;
-
-        b->last = pos;
-        b->start = b->pos;
-        b->end = b->last;
-        b->temporary = 1;
-
         cl = ngx_alloc_chain_link(r->pool);
         if (cl == NULL) {
             return NULL;
@@ -1180,6 +1111,79 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
 
         *ll = cl;
         ll = &cl->next;
+    }
+
+    *ll = NULL;
+
+    return frame;
+}
+
+
+static ngx_http_v2_out_frame_t *
+ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
+    u_char *end, ngx_uint_t fin)
+{
+    ngx_http_v2_out_frame_t  *frame;
+
+    frame = ngx_http_v2_alloc_frame(r, end - pos, 0);
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    ngx_http_v2_fill_headers_frame(r, frame, pos, end, fin);
+
+    return frame;
+}
+
+
+static void
+ngx_http_v2_fill_headers_frame(ngx_http_request_t *r,
+    ngx_http_v2_out_frame_t *frame, u_char *pos, u_char *end, ngx_uint_t fin)
+{
+    u_char                 type, flags;
+    size_t                 rest, frame_size;
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl;
+    ngx_http_v2_stream_t  *stream;
+
+    stream = r->stream;
+    rest = end - pos;
+
+    frame->handler = ngx_http_v2_headers_frame_handler;
+    frame->stream = stream;
+    frame->length = rest;
+    frame->blocked = 1;
+    frame->fin = fin;
+
+    cl = frame->first;
+
+    type = NGX_HTTP_V2_HEADERS_FRAME;
+    flags = fin ? NGX_HTTP_V2_END_STREAM_FLAG : NGX_HTTP_V2_NO_FLAG;
+    frame_size = stream->connection->frame_size;
+
+    for ( ;; ) {
+        if (rest <= frame_size) {
+            frame_size = rest;
+            flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
+        }
+
+        b = cl->buf;
+
+        b->last = ngx_http_v2_write_len_and_type(b->last, frame_size, type);
+        *b->last++ = flags;
+        b->last = ngx_http_v2_write_sid(b->last, stream->node->id);
+
+        cl = cl->next;
+        b = cl->buf;
+
+        b->pos = pos;
+
+        pos += frame_size;
+
+        b->last = pos;
+        b->start = b->pos;
+        b->end = b->last;
+        b->temporary = 1;
 
         rest -= frame_size;
 
@@ -1188,6 +1192,8 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
 
             type = NGX_HTTP_V2_CONTINUATION_FRAME;
             flags = NGX_HTTP_V2_NO_FLAG;
+
+            cl = cl->next;
             continue;
         }
 
@@ -1199,38 +1205,33 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
                        "http2:%ui create HEADERS frame %p: len:%uz fin:%ui",
                        stream->node->id, frame, frame->length, fin);
 
-        return frame;
+        return;
     }
 }
 
 
-static ngx_http_v2_out_frame_t *
-ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
+static void
+ngx_http_v2_fill_push_frame(ngx_http_request_t *r,
+    ngx_http_v2_out_frame_t *frame, u_char *pos, u_char *end)
 {
     u_char                     type, flags;
     size_t                     rest, frame_size, len;
     ngx_buf_t                 *b;
-    ngx_chain_t               *cl, **ll;
+    ngx_chain_t               *cl;
     ngx_http_v2_stream_t      *stream;
-    ngx_http_v2_out_frame_t   *frame;
     ngx_http_v2_connection_t  *h2c;
 
     stream = r->stream;
     h2c = stream->connection;
     rest = NGX_HTTP_V2_STREAM_ID_SIZE + (end - pos);
 
-    frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
-    if (frame == NULL) {
-        return NULL;
-    }
-
     frame->handler = ngx_http_v2_push_frame_handler;
     frame->stream = stream;
     frame->length = rest;
     frame->blocked = 1;
     frame->fin = 0;
 
-    ll = &frame->first;
+    cl = frame->first;
 
     type = NGX_HTTP_V2_PUSH_PROMISE_FRAME;
     flags = NGX_HTTP_V2_NO_FLAG;
@@ -1242,20 +1243,12 @@ ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
             flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
         }
 
-        b = ngx_create_temp_buf(r->pool,
-                                NGX_HTTP_V2_FRAME_HEADER_SIZE
-                                + ((type == NGX_HTTP_V2_PUSH_PROMISE_FRAME)
-                                   ? NGX_HTTP_V2_STREAM_ID_SIZE : 0));
-        if (b == NULL) {
-            return NULL;
-        }
+        b = cl->buf;
 
         b->last = ngx_http_v2_write_len_and_type(b->last, frame_size, type);
         *b->last++ = flags;
         b->last = ngx_http_v2_write_sid(b->last, stream->node->id);
 
-        b->tag = (ngx_buf_tag_t) &ngx_http_v2_module;
-
         if (type == NGX_HTTP_V2_PUSH_PROMISE_FRAME) {
             h2c->last_push += 2;
 
@@ -1266,20 +1259,8 @@ ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
             len = frame_size;
         }
 
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == NULL) {
-            return NULL;
-        }
-
-        cl->buf = b;
-
-        *ll = cl;
-        ll = &cl->next;
-
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NULL;
-        }
+        cl = cl->next;
+        b = cl->buf;
 
         b->pos = pos;
 
@@ -1290,22 +1271,14 @@ ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
         b->end = b->last;
         b->temporary = 1;
 
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == NULL) {
-            return NULL;
-        }
-
-        cl->buf = b;
-
-        *ll = cl;
-        ll = &cl->next;
-
         rest -= frame_size;
 
         if (rest) {
             frame->length += NGX_HTTP_V2_FRAME_HEADER_SIZE;
 
             type = NGX_HTTP_V2_CONTINUATION_FRAME;
+
+            cl = cl->next;
             continue;
         }
 
@@ -1318,7 +1291,7 @@ ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
                        stream->node->id, frame, h2c->last_push,
                        frame->length);
 
-        return frame;
+        return;
     }
 }
 
@@ -1824,9 +1797,13 @@ ngx_http_v2_waiting_queue(ngx_http_v2_connection_t *h2c,
     {
         s = ngx_queue_data(q, ngx_http_v2_stream_t, queue);
 
-        if (s->node->rank < stream->node->rank
-            || (s->node->rank == stream->node->rank
-                && s->node->rel_weight >= stream->node->rel_weight))
+        /* urgency first, then the weight in the dependency tree */
+
+        if (s->node->urgency < stream->node->urgency
+            || (s->node->urgency == stream->node->urgency
+                && (s->node->rank < stream->node->rank
+                    || (s->node->rank == stream->node->rank
+                        && s->node->rel_weight >= stream->node->rel_weight))))
         {
             break;
         }
@@ -2137,7 +2114,7 @@ ngx_http_v2_filter_cleanup(void *data)
     size_t                     window;
     ngx_event_t               *wev;
     ngx_queue_t               *q;
-    ngx_http_v2_out_frame_t   *frame, **fn;
+    ngx_http_v2_out_frame_t   *frame;
     ngx_http_v2_connection_t  *h2c;
 
     if (stream->waiting) {
@@ -2149,31 +2126,22 @@ ngx_http_v2_filter_cleanup(void *data)
         return;
     }
 
+    if (stream->out == NULL) {
+        return;
+    }
+
     window = 0;
     h2c = stream->connection;
-    fn = &h2c->last_out;
-
-    for ( ;; ) {
-        frame = *fn;
-
-        if (frame == NULL) {
-            break;
-        }
-
-        if (frame->stream == stream && !frame->blocked) {
-            *fn = frame->next;
-
-            window += frame->length;
 
-            if (--stream->queued == 0) {
-                break;
-            }
+    for (frame = stream->out; frame; frame = frame->next) {
+        window += frame->length;
+        stream->queued--;
+    }
 
-            continue;
-        }
+    ngx_http_v2_unschedule_stream(h2c, stream);
 
-        fn = &frame->next;
-    }
+    stream->out = NULL;
+    stream->last_out = &stream->out;
 
     if (h2c->send_window == 0 && window) {
 
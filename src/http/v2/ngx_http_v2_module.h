@@ -25,6 +25,7 @@ typedef struct {
     ngx_uint_t                      concurrent_streams;
     ngx_uint_t                      concurrent_pushes;
     size_t                          preread_size;
+    size_t                          header_table_size;
     ngx_uint_t                      streams_index_mask;
 #if (T_NGX_HTTP2_SRV_ENABLE)
     ngx_flag_t                      enable;
@@ -19,6 +19,9 @@ static ngx_int_t ngx_stream_init_phase_handlers(ngx_conf_t *cf,
 static ngx_int_t ngx_stream_add_ports(ngx_conf_t *cf, ngx_array_t *ports,
     ngx_stream_listen_t *listen);
 static char *ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports);
+#if (T_NGX_HAVE_XUDP)
+static ngx_int_t ngx_stream_addr_is_loopback(struct sockaddr *sa);
+#endif
 static ngx_int_t ngx_stream_add_addrs(ngx_conf_t *cf, ngx_stream_port_t *stport,
     ngx_stream_conf_addr_t *addr);
 #if (NGX_HAVE_INET6)
@@ -744,6 +747,18 @@ ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports)
             ls->kcp_mode = addr[i].opt.kcp_mode;
 #endif
 
+#if (T_NGX_HAVE_XUDP)
+            if (addr[i].opt.xudp) {
+                if (ngx_stream_addr_is_loopback(addr[i].opt.sockaddr)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "xudp don't support loopback address");
+                    return NGX_CONF_ERROR;
+                }
+
+                ls->xudp = 1;
+            }
+#endif
+
             stport = ngx_palloc(cf->pool, sizeof(ngx_stream_port_t));
             if (stport == NULL) {
                 return NGX_CONF_ERROR;
@@ -787,6 +802,33 @@ ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports)
 }
 
 
+#if (T_NGX_HAVE_XUDP)
+
+static ngx_int_t
+ngx_stream_addr_is_loopback(struct sockaddr *sa)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+        return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr);
+#endif
+
+    default: /* AF_INET */
+        sin = (struct sockaddr_in *) sa;
+        return sin->sin_addr.s_addr == htonl(INADDR_LOOPBACK);
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_stream_add_addrs(ngx_conf_t *cf, ngx_stream_port_t *stport,
     ngx_stream_conf_addr_t *addr)
@@ -61,6 +61,9 @@ typedef struct {
 
 #if (NGX_KCP)
     unsigned                       kcp:1;
+#endif
+#if (T_NGX_HAVE_XUDP)
+    unsigned                       xudp:1;
 #endif
     unsigned                       reuseport:1;
     unsigned                       so_keepalive:2;
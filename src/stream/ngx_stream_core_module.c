@@ -740,6 +740,18 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
 #endif // if (NGX_KCP)
 
+        if (ngx_strcmp(value[i].data, "xudp") == 0) {
+#if (T_NGX_HAVE_XUDP)
+            ls->xudp = 1;
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"xudp\" parameter requires "
+                               "mod_xudp");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
 #endif
 
 #if (T_NGX_STREAM_SNI)
@@ -1012,6 +1024,18 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 #endif
 
+#if (T_NGX_HAVE_XUDP)
+    /* xudp dispatches by kcp conv, plain udp stays on the kernel path */
+#if (NGX_KCP)
+    if (ls->xudp && !ls->kcp)
+#else
+    if (ls->xudp)
+#endif
+    {
+        return "\"xudp\" parameter requires \"kcp\"";
+    }
+#endif
+
     als = cmcf->listen.elts;
 
     for (n = 0; n < u.naddrs; n++) {
@@ -9,6 +9,16 @@
 #include <ngx_stream.h>
 
 
+#define NGX_STREAM_UPSTREAM_RANDOM_CONNECT     1
+#define NGX_STREAM_UPSTREAM_RANDOM_FIRST_BYTE  2
+#define NGX_STREAM_UPSTREAM_RANDOM_LAST_BYTE   3
+
+/* response times are kept in 1/1024 ms, decaying over about 10 seconds */
+
+#define NGX_STREAM_UPSTREAM_RANDOM_EWMA_SHIFT  10
+#define NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY  10000
+
+
 typedef struct {
     ngx_stream_upstream_rr_peer_t          *peer;
     ngx_uint_t                              range;
@@ -17,6 +27,7 @@ typedef struct {
 
 typedef struct {
     ngx_uint_t                              two;
+    ngx_uint_t                              least_time;
     ngx_stream_upstream_random_range_t     *ranges;
 } ngx_stream_upstream_random_srv_conf_t;
 
@@ -26,6 +37,8 @@ typedef struct {
     ngx_stream_upstream_rr_peer_data_t      rrp;
 
     ngx_stream_upstream_random_srv_conf_t  *conf;
+    ngx_stream_upstream_t                  *upstream;
+    ngx_msec_t                              start_time;
     u_char                                  tries;
 } ngx_stream_upstream_random_peer_data_t;
 
@@ -44,6 +57,10 @@ static ngx_int_t ngx_stream_upstream_get_random2_peer(ngx_peer_connection_t *pc,
 static ngx_uint_t ngx_stream_upstream_peek_random_peer(
     ngx_stream_upstream_rr_peers_t *peers,
     ngx_stream_upstream_random_peer_data_t *rp);
+static ngx_int_t ngx_stream_upstream_random_slower(
+    ngx_stream_upstream_rr_peer_t *peer, ngx_stream_upstream_rr_peer_t *prev);
+static void ngx_stream_upstream_free_random_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
 static void *ngx_stream_upstream_random_create_conf(ngx_conf_t *cf);
 static char *ngx_stream_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -180,7 +197,13 @@ ngx_stream_upstream_init_random_peer(ngx_stream_session_t *s,
         s->upstream->peer.get = ngx_stream_upstream_get_random_peer;
     }
 
+    if (rcf->least_time) {
+        s->upstream->peer.free = ngx_stream_upstream_free_random_peer;
+    }
+
     rp->conf = rcf;
+    rp->upstream = s->upstream;
+    rp->start_time = ngx_current_msec;
     rp->tries = 0;
 
     ngx_stream_upstream_rr_peers_rlock(rp->rrp.peers);
@@ -323,6 +346,8 @@ ngx_stream_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
     rrp = &rp->rrp;
     peers = rrp->peers;
 
+    rp->start_time = ngx_current_msec;
+
     ngx_stream_upstream_rr_peers_wlock(peers);
 
     if (rp->tries > 20 || peers->single) {
@@ -374,7 +399,10 @@ ngx_stream_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
         }
 
         if (prev) {
-            if (peer->conns * prev->weight > prev->conns * peer->weight) {
+            if (rp->conf->least_time
+                ? ngx_stream_upstream_random_slower(peer, prev)
+                : peer->conns * prev->weight > prev->conns * peer->weight)
+            {
                 peer = prev;
                 n = p / (8 * sizeof(uintptr_t));
                 m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
@@ -425,6 +453,109 @@ ngx_stream_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
 }
 
 
+static ngx_int_t
+ngx_stream_upstream_random_slower(ngx_stream_upstream_rr_peer_t *peer,
+    ngx_stream_upstream_rr_peer_t *prev)
+{
+    uint64_t    a, b;
+    ngx_msec_t  now;
+
+    /*
+     * the load of a peer is its response time multiplied by the number
+     * of its connections and the one to come; the response time decays
+     * while the peer is not chosen, so a slow peer is tried again later
+     */
+
+    now = ngx_current_msec;
+
+    a = (uint64_t) peer->ewma * NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY
+        / (NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY + (now - peer->ewma_time));
+    b = (uint64_t) prev->ewma * NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY
+        / (NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY + (now - prev->ewma_time));
+
+    return (a + 1) * (peer->conns + 1) * prev->weight
+           > (b + 1) * (prev->conns + 1) * peer->weight;
+}
+
+
+static void
+ngx_stream_upstream_free_random_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_stream_upstream_random_peer_data_t  *rp = data;
+
+    uint64_t                             sample, ewma;
+    ngx_msec_t                           time, elapsed;
+    ngx_stream_upstream_state_t         *us;
+    ngx_stream_upstream_rr_peer_t       *peer;
+    ngx_stream_upstream_rr_peer_data_t  *rrp;
+
+    rrp = &rp->rrp;
+    peer = rrp->current;
+    us = rp->upstream->state;
+
+    if (peer == NULL) {
+        ngx_stream_upstream_free_round_robin_peer(pc, rrp, state);
+        return;
+    }
+
+    time = ngx_current_msec - rp->start_time;
+
+    if (us && !(state & NGX_PEER_FAILED)) {
+
+        switch (rp->conf->least_time) {
+
+        case NGX_STREAM_UPSTREAM_RANDOM_CONNECT:
+            if (us->connect_time != (ngx_msec_t) -1) {
+                time = us->connect_time;
+            }
+            break;
+
+        case NGX_STREAM_UPSTREAM_RANDOM_FIRST_BYTE:
+            if (us->first_byte_time != (ngx_msec_t) -1) {
+                time = us->first_byte_time;
+            }
+            break;
+        }
+    }
+
+    sample = (uint64_t) time << NGX_STREAM_UPSTREAM_RANDOM_EWMA_SHIFT;
+
+    ngx_stream_upstream_rr_peers_rlock(rrp->peers);
+    ngx_stream_upstream_rr_peer_lock(rrp->peers, peer);
+
+    ewma = peer->ewma;
+    elapsed = ngx_max(ngx_current_msec - peer->ewma_time, 1);
+
+    if (sample > ewma) {
+
+        /* peaks are taken as is */
+
+        ewma = sample;
+
+    } else if (!(state & NGX_PEER_FAILED)) {
+
+        /* a failure may only make a peer look slower */
+
+        ewma = (ewma * NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY + sample * elapsed)
+               / (NGX_STREAM_UPSTREAM_RANDOM_EWMA_DECAY + elapsed);
+    }
+
+    peer->ewma = (ngx_uint_t) ewma;
+    peer->ewma_time = ngx_current_msec;
+
+    ngx_stream_upstream_rr_peer_unlock(rrp->peers, peer);
+    ngx_stream_upstream_rr_peers_unlock(rrp->peers);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_STREAM, pc->log, 0,
+                   "free random peer %V time:%M ewma:%uL",
+                   &peer->name, time,
+                   ewma >> NGX_STREAM_UPSTREAM_RANDOM_EWMA_SHIFT);
+
+    ngx_stream_upstream_free_round_robin_peer(pc, rrp, state);
+}
+
+
 static ngx_uint_t
 ngx_stream_upstream_peek_random_peer(ngx_stream_upstream_rr_peers_t *peers,
     ngx_stream_upstream_random_peer_data_t *rp)
@@ -465,6 +596,7 @@ ngx_stream_upstream_random_create_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->two = 0;
+     *     conf->least_time = 0;
      */
 
     return conf;
@@ -514,11 +646,26 @@ ngx_stream_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_OK;
     }
 
-    if (ngx_strcmp(value[2].data, "least_conn") != 0) {
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "invalid parameter \"%V\"", &value[2]);
-        return NGX_CONF_ERROR;
+    if (ngx_strcmp(value[2].data, "least_conn") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "least_time=connect") == 0) {
+        rcf->least_time = NGX_STREAM_UPSTREAM_RANDOM_CONNECT;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "least_time=first_byte") == 0) {
+        rcf->least_time = NGX_STREAM_UPSTREAM_RANDOM_FIRST_BYTE;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "least_time=last_byte") == 0) {
+        rcf->least_time = NGX_STREAM_UPSTREAM_RANDOM_LAST_BYTE;
+        return NGX_CONF_OK;
     }
 
-    return NGX_CONF_OK;
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[2]);
+    return NGX_CONF_ERROR;
 }
@@ -38,6 +38,9 @@ struct ngx_stream_upstream_rr_peer_s {
     ngx_msec_t                       slow_start;
     ngx_msec_t                       start_time;
 
+    ngx_uint_t                       ewma;
+    ngx_msec_t                       ewma_time;
+
     ngx_uint_t                       down;
 
     void                            *ssl_session;
@@ -59,7 +62,7 @@ struct ngx_stream_upstream_rr_peer_s {
 
     ngx_stream_upstream_rr_peer_t   *next;
 
-    NGX_COMPAT_BEGIN(25)
+    NGX_COMPAT_BEGIN(23)
     NGX_COMPAT_END
 };
 
@@ -0,0 +1,127 @@
+#!/usr/bin/perl
+
+# Tests for asynchronous access logs written by the http_log process.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http gzip/)->plan(6)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+processes {
+    process http_log {
+        delay_start 0;
+    }
+}
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    log_format  short  '$uri:$status:$arg_a:$http_x_none';
+    log_format  json   escape=json  '{"a":"$arg_a","h":"$http_x_none"}';
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            access_log  %%TESTDIR%%/short.log  short  async=64k  flush=100ms;
+            access_log  %%TESTDIR%%/json.log  json  async=64k  flush=100ms;
+            access_log  %%TESTDIR%%/gzip.log  short  async=64k  gzip;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+$t->run();
+
+###############################################################################
+
+http_get('/t.html?a=1');
+http_get('/t.html?a=%22');
+http_get('/none');
+
+# entries are written by the logger process
+
+wait_for(sub { ($t->read_file('short.log') =~ tr/\n//) == 3 }, 5);
+
+is($t->read_file('short.log'),
+	"/t.html:200:1:-\n/t.html:200:%22:-\n/none:404:-:-\n", 'log');
+
+wait_for(sub { ($t->read_file('json.log') =~ tr/\n//) == 3 }, 5);
+
+is($t->read_file('json.log'),
+	qq({"a":"1","h":""}\n{"a":"%22","h":""}\n{"a":"","h":""}\n),
+	'log json');
+
+http_get('/t.html?a=%22%0A');
+
+wait_for(sub { ($t->read_file('short.log') =~ tr/\n//) == 4 }, 5);
+like($t->read_file('short.log'), qr!^/t.html:200:%22%0A:-$!m, 'log args');
+
+http(<<EOF);
+GET /t.html HTTP/1.0
+Host: localhost
+X-None: "\x01ö
+
+EOF
+
+wait_for(sub { ($t->read_file('short.log') =~ tr/\n//) == 5 }, 5);
+like($t->read_file('short.log'), qr!^/t.html:200:-:\\x22\\x01\\xC3\\xB6$!m,
+	'log escaped');
+
+wait_for(sub { ($t->read_file('json.log') =~ tr/\n//) == 5 }, 5);
+like($t->read_file('json.log'), qr/^\{"a":"","h":"\\"\\u0001\xC3\xB6"}$/m,
+	'log json escaped');
+
+$t->stop();
+
+# the logger process writes the rest on exit
+
+SKIP: {
+	eval { require IO::Uncompress::Gunzip; };
+	skip("IO::Uncompress::Gunzip not installed", 1) if $@;
+
+	my $in = $t->read_file('gzip.log');
+	my $out;
+
+	IO::Uncompress::Gunzip::gunzip(\$in => \$out, MultiStream => 1);
+
+	is(($out =~ tr/\n//), 5, 'log gzip');
+}
+
+###############################################################################
+
+sub wait_for {
+	my ($cb, $timeout) = @_;
+
+	for (1 .. $timeout * 10) {
+		return if $cb->();
+		select undef, undef, undef, 0.1;
+	}
+}
+
+###############################################################################
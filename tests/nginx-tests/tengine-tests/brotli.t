@@ -0,0 +1,111 @@
+#!/usr/bin/perl
+
+# Tests for brotli filter and brotli_static modules.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http brotli sysguard/)->plan(9)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon         off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    brotli_types text/plain;
+    gzip_types text/plain;
+    gzip_http_version 1.0;
+    gzip_vary on;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            brotli on;
+            gzip on;
+        }
+
+        location /small/ {
+            brotli on;
+            brotli_buffers 2 64;
+            brotli_comp_level 11;
+            brotli_window 1k;
+            alias %%TESTDIR%%/;
+        }
+
+        location /adaptive/ {
+            brotli on;
+            brotli_adaptive_level usage=50 level=1;
+            alias %%TESTDIR%%/;
+        }
+
+        location /static/ {
+            brotli_static on;
+            alias %%TESTDIR%%/;
+        }
+    }
+}
+
+EOF
+
+my $text = join '', map { "common phrase number $_\n" } (0 .. 399);
+
+$t->write_file('text.txt', $text);
+$t->write_file('tiny.txt', 'x');
+$t->write_file('file.txt', 'plain');
+$t->write_file('file.txt.br', 'compressed');
+$t->run();
+
+###############################################################################
+
+like(get('/text.txt', 'gzip, br'), qr/Content-Encoding: br/, 'brotli');
+unlike(get('/text.txt', 'br'), qr/Content-Length|\Q$text\E/,
+	'brotli body');
+like(get('/text.txt', 'gzip, br;q=0'), qr/Content-Encoding: gzip/,
+	'brotli refused');
+unlike(get('/tiny.txt', 'br'), qr/Content-Encoding/, 'min length');
+like(get('/small/text.txt', 'br'), qr/Content-Encoding: br/,
+	'small buffers');
+like(get('/adaptive/text.txt', 'br'), qr/Content-Encoding: br/,
+	'adaptive level');
+
+like(get('/static/file.txt', 'br'), qr/Content-Encoding: br.*compressed/s,
+	'static');
+unlike(get('/static/file.txt', 'gzip'), qr/Content-Encoding/,
+	'static not accepted');
+like(get('/static/file.txt', 'gzip, br'), qr/Vary: Accept-Encoding/,
+	'static vary');
+
+###############################################################################
+
+sub get {
+	my ($uri, $ae) = @_;
+	$ae = defined $ae ? "Accept-Encoding: $ae" . CRLF : '';
+	return http("GET $uri HTTP/1.0" . CRLF . "Host: localhost" . CRLF
+		. $ae . CRLF);
+}
+
+###############################################################################
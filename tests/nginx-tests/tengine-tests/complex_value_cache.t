@@ -0,0 +1,143 @@
+#!/usr/bin/perl
+
+# Tests for complex values cached in a request.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http sub/)->plan(9)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            add_header  X-Key  "$host:$http_x_v";
+            add_header  X-Uri  "$uri";
+
+            sub_filter       KEY  "$host:$http_x_v";
+            sub_filter       URI  "$uri";
+            sub_filter_once  off;
+        }
+
+        location /old/ {
+            error_page  404 = /t.html;
+        }
+
+        location /id.html {
+            add_header  X-A  "id:$request_id";
+            add_header  X-B  "id:$request_id";
+        }
+
+        location /m.html {
+            sub_filter  "M:$http_x_m"  "M:$http_x_m";
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'KEY URI KEY URI');
+$t->write_file('id.html', '');
+$t->write_file('m.html', 'M:ABC');
+$t->run();
+
+###############################################################################
+
+like(get('/t.html', 'a'), qr/X-Key: localhost:a.*localhost:a \/t.html /s,
+	'cached value');
+like(get('/t.html', 'b'), qr/X-Key: localhost:b.*localhost:b \/t.html /s,
+	'next request');
+
+# a value with a variable which is not cacheable follows it
+
+like(get('/old/t.html', 'c'), qr/X-Uri: \/t.html.*c \/t.html localhost/s,
+	'not cacheable');
+
+# requests on a keepalive connection have their own values
+
+my $r = http(<<EOF);
+GET /t.html HTTP/1.1
+Host: localhost
+X-V: d
+
+GET /t.html HTTP/1.1
+Host: localhost
+X-V: e
+Connection: close
+
+EOF
+
+like($r, qr/X-Key: localhost:d.*X-Key: localhost:e/s, 'keepalive headers');
+like($r, qr/localhost:d \/t.html.*localhost:e \/t.html/s, 'keepalive body');
+
+# equal values of different directives share the value of a request
+
+my ($a1, $b1) = ids();
+my ($a2, $b2) = ids();
+
+ok($a1 && $a1 eq $b1, 'same value');
+ok($a2 && $a2 eq $b2 && $a1 ne $a2, 'same value next request');
+
+SKIP: {
+skip 'no --with-debug', 1 unless $t->has_module('--with-debug');
+
+my $log = $t->read_file('error.log');
+my $n = () = $log =~ /http complex value cached: "\Q$a2\E"/g;
+
+is($n, 1, 'evaluated once');
+
+}
+
+# a cached value is not changed by a directive which lowercases its own
+
+like(http(<<EOF), qr/\x0d\x0a\x0d\x0aM:AbC$/, 'not lowercased');
+GET /m.html HTTP/1.0
+Host: localhost
+X-M: AbC
+
+EOF
+
+###############################################################################
+
+sub ids {
+	my $r = http_get('/id.html');
+	return ($r =~ /^X-A: (.*?)\x0d$/m, $r =~ /^X-B: (.*?)\x0d$/m);
+}
+
+sub get {
+	my ($uri, $v) = @_;
+	return http(<<EOF);
+GET $uri HTTP/1.0
+Host: localhost
+X-V: $v
+
+EOF
+}
+
+###############################################################################
@@ -0,0 +1,106 @@
+#!/usr/bin/perl
+
+# Tests for the maglev lookup table of the consistent hash module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        consistent_hash $args maglev;
+        server 127.0.0.1:8081 id=8081;
+        server 127.0.0.1:8082 id=8082;
+        server 127.0.0.1:8083 id=8083;
+    }
+
+    upstream d {
+        consistent_hash $args maglev table_size=101;
+        server 127.0.0.1:8081 id=8081 max_fails=0;
+        server 127.0.0.1:8084 id=8084 max_fails=0;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://u/;
+        }
+
+        location /d {
+            proxy_pass http://d/;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            root %%TESTDIR%%;
+            try_files /$server_port.html =404;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('8081.html', '8081');
+$t->write_file('8082.html', '8082');
+$t->write_file('8083.html', '8083');
+$t->try_run('no consistent_hash maglev')->plan(4);
+
+###############################################################################
+
+my ($port) = http_get('/?abcdef') =~ /(808\d)$/;
+
+like(http_get('/?abcdef'), qr/$port$/, 'same key, same server');
+like(http_get('/?abcdef'), qr/$port$/, 'same key, same server again');
+
+my %seen;
+
+for my $i (1 .. 60) {
+	my ($p) = http_get("/?key$i") =~ /(808\d)$/;
+	$seen{$p}++ if defined $p;
+}
+
+is(scalar keys %seen, 3, 'keys spread over all servers');
+
+# the request that finds a server down is not retried, later ones avoid it
+
+http_get("/d?key$_") for (1 .. 10);
+
+my $res = '';
+$res .= http_get("/d?key$_") for (1 .. 10);
+
+unlike($res, qr/502 Bad Gateway/, 'down server skipped');
+
+###############################################################################
@@ -0,0 +1,164 @@
+#!/usr/bin/perl
+
+# Tests for dubbo_send_batch, requests coalesced on a multi connection.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream dubbo {
+        multi 1;
+        server 127.0.0.1:8081;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /batch {
+            dubbo_pass org.apache.dubbo.demo.DemoService 0.0.0 batch dubbo;
+            dubbo_send_batch size=1k delay=500ms;
+        }
+
+        location /single {
+            dubbo_pass org.apache.dubbo.demo.DemoService 0.0.0 single dubbo;
+        }
+
+        location /quit {
+            dubbo_pass org.apache.dubbo.demo.DemoService 0.0.0 quit dubbo;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&dubbo_daemon, port(8081));
+$t->try_run('no dubbo')->plan(5);
+$t->waitforsocket('127.0.0.1:' . port(8081));
+
+###############################################################################
+
+# the response body is the number of requests the backend got in one read
+
+like(http_get('/single'), qr/ 200 .*\x0d\x0a\x0d\x0a1$/s, 'connected');
+
+my @s = map {
+	select undef, undef, undef, 0.1;
+	http_get('/single', start => 1);
+} 1 .. 2;
+
+is(join(' ', map { body(http_end($_)) } @s), '1 1', 'written one by one');
+
+@s = map {
+	select undef, undef, undef, 0.1;
+	http_get('/batch', start => 1);
+} 1 .. 3;
+
+is(join(' ', map { body(http_end($_)) } @s), '3 3 3', 'written together');
+
+# the batch is written out at once beyond its size
+
+my $s = http_get('/batch', start => 1);
+select undef, undef, undef, 0.1;
+
+like(http(<<EOF), qr/ 200 .*\x0d\x0a\x0d\x0a2$/s, 'size');
+GET /batch HTTP/1.0
+Host: localhost
+X-Pad: ${\('x' x 2048)}
+
+EOF
+
+is(body(http_end($s)), 2, 'size written together');
+
+# the backend closes the connection, so that nginx exits at once
+
+http_get('/quit');
+
+###############################################################################
+
+sub body {
+	my ($r) = @_;
+	return '' unless defined $r;
+	$r =~ /\x0d\x0a\x0d\x0a(.*)$/s;
+	return $1;
+}
+
+sub dubbo_daemon {
+	my ($port) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:' . $port,
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		my $buf = '';
+
+		READ: while ($client->sysread($buf, 65536, length $buf)) {
+			my @ids;
+
+			while (length $buf >= 16) {
+				my ($flag, $id, $len) = unpack('x2Cxa8N', $buf);
+				last if length $buf < 16 + $len;
+
+				my $payload = substr($buf, 0, 16 + $len, '');
+				last READ if $payload =~ /\x04quit/;
+
+				# heartbeats are not counted
+
+				next if $flag & 0x20;
+				push @ids, $id;
+			}
+
+			for my $id (@ids) {
+				my $body = scalar @ids;
+
+				# RESPONSE_VALUE, map { "status": "200", "body": ... }
+
+				my $payload = "\x91H" . "\x06status" . "\x03200"
+					. "\x04body" . chr(0x20 + length $body) . $body
+					. 'Z';
+
+				print $client pack('nCCa8N', 0xdabb, 0x02, 20, $id,
+					length $payload) . $payload;
+			}
+		}
+
+		close $client;
+	}
+}
+
+###############################################################################
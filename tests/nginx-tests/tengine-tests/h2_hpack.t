@@ -0,0 +1,106 @@
+#!/usr/bin/perl
+
+# Tests for HTTP/2 response header compression with the dynamic table.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+use Test::Nginx::HTTP2;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http http_v2/)->plan(9)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080 http2;
+        server_name  localhost;
+
+        location / {
+            add_header Cache-Control "public, max-age=3600";
+            add_header X-Frame-Options SAMEORIGIN;
+            add_header X-Uri $uri;
+            add_header Set-Cookie "id=1; Path=/";
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081 http2;
+        server_name  localhost;
+
+        http2_header_table_size 0;
+
+        location / {
+            add_header Cache-Control "public, max-age=3600";
+            add_header X-Frame-Options SAMEORIGIN;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t1.html', 'SEE-THIS');
+$t->write_file('t2.html', 'SEE-THIS');
+$t->run();
+
+###############################################################################
+
+my $s = Test::Nginx::HTTP2->new();
+my ($first, $second) = (get($s, '/t1.html'), get($s, '/t2.html'));
+
+is($first->{headers}{'cache-control'}, 'public, max-age=3600', 'first');
+is($second->{headers}{'cache-control'}, 'public, max-age=3600', 'indexed');
+is($second->{headers}{'x-frame-options'}, 'SAMEORIGIN', 'indexed custom');
+is($second->{headers}{'x-uri'}, '/t2.html', 'indexed name');
+is($second->{headers}{'set-cookie'}, 'id=1; Path=/', 'not indexed');
+cmp_ok($second->{length}, '<', $first->{length} / 2, 'compressed');
+
+# a header table size of 0 in the configuration or in the client settings
+
+$s = Test::Nginx::HTTP2->new(port(8081));
+($first, $second) = (get($s, '/t1.html'), get($s, '/t2.html'));
+
+cmp_ok($second->{length}, '>', $first->{length} / 2, 'disabled');
+
+$s = Test::Nginx::HTTP2->new();
+$s->h2_settings(0, 0x1 => 0);
+($first, $second) = (get($s, '/t1.html'), get($s, '/t2.html'));
+
+is($second->{headers}{'x-uri'}, '/t2.html', 'client disabled');
+cmp_ok($second->{length}, '>', $first->{length} / 2,
+	'client disabled not compressed');
+
+###############################################################################
+
+sub get {
+	my ($s, $uri) = @_;
+
+	my $sid = $s->new_stream({ path => $uri });
+	my $frames = $s->read(all => [{ sid => $sid, fin => 1 }]);
+
+	my ($frame) = grep { $_->{type} eq "HEADERS" } @$frames;
+	return $frame;
+}
+
+###############################################################################
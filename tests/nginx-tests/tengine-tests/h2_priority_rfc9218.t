@@ -0,0 +1,194 @@
+#!/usr/bin/perl
+
+# Tests for HTTP/2 extensible priorities, RFC 9218.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+use Test::Nginx::HTTP2;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http http_v2/)->plan(13)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080 http2;
+        server_name  localhost;
+    }
+
+    server {
+        listen       127.0.0.1:8081 http2 sndbuf=32k;
+        server_name  localhost;
+
+        output_buffers  1 4m;
+    }
+}
+
+EOF
+
+$t->run();
+
+# file size is slightly beyond initial window size: 2**16 + 80 bytes
+
+$t->write_file('t1.html',
+	join('', map { sprintf "X%04dXXX", $_ } (1 .. 8202)));
+
+$t->write_file('t2.html', 'SEE-THIS');
+$t->write_file('t3.html', 'X' x 2**20);
+
+###############################################################################
+
+# the second stream waits for the connection window first,
+# the first stream joins it when its own window is updated
+
+is(order({}, {}), '3 1', 'default urgency');
+
+# the priority header field
+
+is(order({ priority => 'u=0' }, {}), '1 3', 'urgency');
+is(order({ priority => 'u=2, i' }, { priority => 'u=5;x=1' }), '1 3',
+	'urgency parameters');
+is(order({ priority => 'u=8' }, { priority => 'u=3' }), '3 1',
+	'urgency out of range');
+is(order({ priority => 'U=0' }, {}), '3 1', 'invalid priority');
+
+# PRIORITY_UPDATE frames, also overriding the header field
+
+is(order({}, { update => 'u=7' }), '1 3', 'update');
+is(order({}, { update => 'u=6, i', early => 1, priority => 'u=0' }), '1 3',
+	'update before request');
+
+# open windows, frames of both streams queued while the socket is blocked
+
+my @sids = queued({ priority => 'u=7' }, { priority => 'u=0' });
+is($sids[-1], 1, 'urgency open windows');
+
+@sids = queued({ priority => 'u=3' }, { priority => 'u=3' });
+is(switches(@sids), 1, 'non-incremental sequential');
+
+@sids = queued({ priority => 'u=3, i' }, { priority => 'u=3, i' });
+cmp_ok(switches(@sids), '>', 16, 'incremental round-robin');
+
+# PRIORITY_UPDATE on an open stream with frames queued
+
+@sids = queued({}, { update => 'u=0' });
+is($sids[-1], 1, 'update open stream');
+
+# frame errors
+
+my $s = Test::Nginx::HTTP2->new();
+$s->raw_write(pack("x2C2xNNa*", 7, 0x10, 1, 1, 'u=0'));
+
+my $frames = $s->read(all => [{ type => 'GOAWAY' }]);
+my ($frame) = grep { $_->{type} eq "GOAWAY" } @$frames;
+is($frame->{code}, 1, 'update on stream - PROTOCOL_ERROR');
+
+$s = Test::Nginx::HTTP2->new();
+$s->raw_write(pack("x2C2xNa*", 3, 0x10, 0, 'u=0'));
+
+$frames = $s->read(all => [{ type => 'GOAWAY' }]);
+($frame) = grep { $_->{type} eq "GOAWAY" } @$frames;
+is($frame->{code}, 6, 'update length - FRAME_SIZE_ERROR');
+
+###############################################################################
+
+sub order {
+	my ($p1, $p2) = @_;
+
+	my $s = Test::Nginx::HTTP2->new();
+	my $sid = $s->new_stream(request('/t1.html', $p1));
+	$s->read(all => [{ sid => $sid, length => 2**16 - 1 }]);
+
+	update($s, $sid + 2, $p2->{update}) if $p2->{early};
+
+	my $sid2 = $s->new_stream(request('/t2.html', $p2));
+	$s->read(all => [{ sid => $sid2, fin => 0x4 }]);
+
+	update($s, $sid2, $p2->{update}) if $p2->{update} && !$p2->{early};
+
+	$s->h2_window(2**17, $sid);
+	$s->h2_window(2**17, $sid2);
+	$s->h2_window(2**17);
+
+	my $frames = $s->read(all => [
+		{ sid => $sid, fin => 1 },
+		{ sid => $sid2, fin => 1 }
+	]);
+
+	my @data = grep { $_->{type} eq "DATA" } @$frames;
+	return join(' ', map { $_->{sid} } @data);
+}
+
+sub queued {
+	my ($p1, $p2) = @_;
+
+	my $s = Test::Nginx::HTTP2->new(port(8081));
+	$s->h2_settings(0, 0x4 => 2**30);
+	$s->h2_window(2**30);
+
+	$s->start_chain();
+	my $sid = $s->new_stream(request('/t3.html', $p1));
+	my $sid2 = $s->new_stream(request('/t3.html', $p2));
+	$s->send_chain();
+
+	select undef, undef, undef, 0.2;
+	update($s, $sid2, $p2->{update}) if $p2->{update};
+	select undef, undef, undef, 0.2;
+
+	my $frames = $s->read(all => [
+		{ sid => $sid, fin => 1 },
+		{ sid => $sid2, fin => 1 }
+	]);
+
+	return map { $_->{sid} } grep { $_->{type} eq "DATA" } @$frames;
+}
+
+sub switches {
+	my (@sids) = @_;
+
+	return scalar grep { $sids[$_] != $sids[$_ - 1] } 1 .. $#sids;
+}
+
+sub request {
+	my ($uri, $p) = @_;
+
+	return { path => $uri } unless defined $p->{priority};
+
+	return { headers => [
+		{ name => ':method', value => 'GET', mode => 0 },
+		{ name => ':scheme', value => 'http', mode => 0 },
+		{ name => ':path', value => $uri, mode => 2 },
+		{ name => ':authority', value => 'localhost', mode => 1 },
+		{ name => 'priority', value => $p->{priority}, mode => 2 }]};
+}
+
+sub update {
+	my ($s, $sid, $value) = @_;
+
+	$s->raw_write(pack("x2C2xNNa*", 4 + length($value), 0x10, 0,
+		$sid, $value));
+}
+
+###############################################################################
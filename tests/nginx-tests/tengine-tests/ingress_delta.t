@@ -0,0 +1,337 @@
+#!/usr/bin/perl
+
+# Tests for incremental config deltas of ngx_ingress_module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::MD5 qw/md5_hex/;
+use Fcntl qw/:flock/;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'no /dev/shm') unless -d '/dev/shm';
+
+my $t = Test::Nginx->new()->has(qw/http/);
+
+my $shm = "ngx_ingress_delta_$$";
+my $lock = $t->testdir() . '/ingress.lock';
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+processes {
+    process strategy {
+    }
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    ingress_gateway_shm_config gw /$shm 64k $lock;
+    ingress_gateway_update_interval gw 50ms;
+    ingress_gateway_pool_size gw 64k;
+    ingress_gateway_hash_num gw 31;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            ingress_gateway gw;
+            add_header X-Target \$ingress_route_target always;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('index.html', '');
+$t->write_file('ingress.lock', '');
+
+my $version = 0;
+my $big = 'x' x 8192;
+
+publish(1, config(
+	[ 'a.example.com', 'svc-a', [ '/p', 'svc-b' ] ],
+	[ 'b.example.com', 'svc-b' ],
+	[ 'c.example.com', 'svc-b' ],
+	[ 'svc-a', 'a:1' ],
+	[ 'svc-b', 'b:1' ]));
+
+$t->try_run('no ingress')->plan(17);
+
+###############################################################################
+
+is(target('a.example.com', '/'), 'a:1', 'full config');
+is(target('a.example.com', '/p/'), 'b:1', 'full config path');
+
+# services and hosts are replaced, added and removed by one delta
+
+publish(2, delta($version,
+	[ 'c.example.com', 'svc-a' ],
+	[ 'd.example.com', 'svc-c' ],
+	[ 'svc-a', 'a:2' ],
+	[ 'svc-c', 'c:1' ],
+	'-b.example.com'));
+
+wait_target('d.example.com', '/', 'c:1');
+
+is(target('a.example.com', '/'), 'a:2', 'service replaced');
+is(target('a.example.com', '/p/'), 'b:1', 'untouched router kept');
+is(target('b.example.com', '/'), '', 'host removed');
+is(target('c.example.com', '/'), 'a:2', 'host replaced');
+is(target('d.example.com', '/'), 'c:1', 'host added');
+
+# the strategy process applies the delta to the reserved slot and switches
+# to it, then brings the other slot up to date; the old objects stay in the
+# pool of each slot as retired bytes
+
+my @u = grep { $_->[0] == $version } updates($t->read_file('error.log'));
+
+is(join(' ', sort map { $_->[2] } @u), '0 1', 'delta switched both slots');
+is(scalar(grep { $_->[1] > 0 } @u), 2, 'replaced objects retired');
+
+# a removed service disables the routers still referring to it
+
+publish(2, delta($version, '-svc-b'));
+
+wait_target('a.example.com', '/p/', 'a:2');
+
+is(target('a.example.com', '/p/'), 'a:2', 'service removed');
+
+# a delta that fails to build leaves the slots untouched
+
+publish(2, delta($version, [ 'svc-c', 'c:2' ], [ 'svc-a' ]));
+
+wait_status();
+
+is(status(), 1, 'bad delta rejected');
+is(target('d.example.com', '/'), 'c:1', 'bad delta not applied');
+
+# replaced objects are retired, and once they outweigh the live ones
+# the producer is asked for a full config instead of running out of pool
+
+my ($errors, $full) = (0, 0);
+
+for my $n (1 .. 24) {
+	my $base = $version;
+
+	publish(2, delta($base, [ 'svc-a', "a:1$n", $big ]));
+
+	wait_status();
+	next if status() == 0;
+
+	$errors++;
+
+	publish(1, config(
+		[ 'a.example.com', 'svc-a' ],
+		[ 'svc-a', "a:1$n", $big ]));
+
+	wait_status();
+	$full++ if status() == 0;
+}
+
+wait_target('a.example.com', '/', 'a:124');
+
+is(target('a.example.com', '/'), 'a:124', 'last delta applied');
+ok($errors && $errors == $full, 'full config applied');
+
+# the full config resets the pool of a slot, so retired bytes start over
+
+my %slots;
+push @{$slots{$_->[2]}}, $_->[1] for updates($t->read_file('error.log'));
+
+is(scalar(grep { my $r = $_; grep { $r->[$_] < $r->[$_ - 1] } 1 .. $#$r }
+	values %slots), 2, 'retired reset by full config');
+
+$t->stop();
+
+like($t->read_file('error.log'),
+	qr/retired \d+ of \d+ pool bytes, need full config/,
+	'full config requested');
+unlike($t->read_file('error.log'), qr/alloc .* failed|out of memory/,
+	'pool not exhausted');
+
+unlink("/dev/shm/$shm");
+
+###############################################################################
+
+sub varint {
+	my ($n) = @_;
+	my $s = '';
+
+	while ($n >= 0x80) {
+		$s .= chr(($n & 0x7f) | 0x80);
+		$n >>= 7;
+	}
+
+	return $s . chr($n);
+}
+
+sub bytes {
+	my ($field, $value) = @_;
+	return varint($field << 3 | 2) . varint(length $value) . $value;
+}
+
+sub number {
+	my ($field, $value) = @_;
+	return varint($field << 3) . varint($value);
+}
+
+# [ host, service, [ prefix, service ] ... ] is a Router,
+# [ service, target, metadata ] a VirtualService, "-name" a removal
+
+sub router {
+	my ($host, $service, @paths) = @{$_[0]};
+
+	my $hr = bytes(1, $host) . bytes(2, $service);
+	$hr .= bytes(3, bytes(1, $_->[0]) . bytes(2, $_->[1])) for @paths;
+
+	return bytes(1, $hr);
+}
+
+sub service {
+	my ($name, $target, $meta) = @{$_[0]};
+
+	my $vs = bytes(1, $name);
+	$vs .= bytes(2, bytes(1, $target) . number(2, 100)) if defined $target;
+	$vs .= bytes(5, bytes(1, 'm') . bytes(2, $meta)) if defined $meta;
+
+	return $vs;
+}
+
+sub is_router {
+	return $_[0]->[0] =~ /\./;
+}
+
+sub config {
+	my $pb = '';
+
+	$pb .= bytes(1, router($_)) for grep { is_router($_) } @_;
+	$pb .= bytes(2, service($_)) for grep { !is_router($_) } @_;
+
+	return $pb;
+}
+
+sub delta {
+	my ($base, @items) = @_;
+	my $pb = number(1, $base);
+
+	for my $item (@items) {
+		if (!ref $item) {
+			my $name = substr($item, 1);
+			$pb .= bytes($name =~ /\./ ? 4 : 5, $name);
+
+		} elsif (is_router($item)) {
+			$pb .= bytes(2, router($item));
+
+		} else {
+			$pb .= bytes(3, service($item));
+		}
+	}
+
+	return $pb;
+}
+
+# shared memory layout: status, version, type, md5 of the message,
+# message length, message; numbers in network byte order
+
+sub publish {
+	my ($type, $pb) = @_;
+
+	$version++;
+
+	my $data = pack('NNNN', 2, 0, $version, $type) . md5_hex($pb)
+		. pack('N', length $pb) . $pb;
+
+	open my $lfh, '<', $lock or die "Can't open $lock: $!";
+	flock($lfh, LOCK_EX) or die "Can't lock $lock: $!";
+
+	# rewritten in place, the file is mapped by nginx
+	open my $fh, -e "/dev/shm/$shm" ? '+<' : '>', "/dev/shm/$shm"
+		or die "Can't open shm: $!";
+	binmode $fh;
+	print $fh $data . "\0" x (65536 - length $data);
+	close $fh;
+
+	close $lfh;
+}
+
+sub status {
+	open my $fh, '<', "/dev/shm/$shm" or die "Can't open shm: $!";
+	binmode $fh;
+	read($fh, my $buf, 4);
+	close $fh;
+
+	return unpack('N', $buf);
+}
+
+# both slots are given the time to catch up
+
+sub wait_status {
+	for (1 .. 50) {
+		last if status() != 2;
+		select undef, undef, undef, 0.05;
+	}
+
+	select undef, undef, undef, 0.2;
+}
+
+sub wait_target {
+	my ($host, $uri, $expect) = @_;
+
+	for (1 .. 50) {
+		last if target($host, $uri) eq $expect;
+		select undef, undef, undef, 0.05;
+	}
+
+	select undef, undef, undef, 0.2;
+}
+
+# slot updates by deltas in the log as [ version, retired bytes, current slot ]
+
+sub updates {
+	my ($log) = @_;
+	my @u;
+
+	for ($log =~ /(?:delta succ|update area rule).*/g) {
+		push @u, [ $1, $2 ] if /delta succ\|(\d+)\|\w+\|retired (\d+)\|/;
+		$u[-1][2] = $1 if /current=(\d+)/ && @u && !defined $u[-1][2];
+	}
+
+	return grep { defined $_->[2] } @u;
+}
+
+sub target {
+	my ($host, $uri) = @_;
+
+	my $r = http(<<EOF);
+GET $uri HTTP/1.0
+Host: $host
+
+EOF
+
+	return '' unless defined $r;
+	return $r =~ /^X-Target: (.*?)\x0d?$/mi ? $1 : '';
+}
+
+###############################################################################
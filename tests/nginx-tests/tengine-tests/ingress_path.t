@@ -0,0 +1,332 @@
+#!/usr/bin/perl
+
+# Tests for path and tag routing of ngx_ingress_module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::MD5 qw/md5_hex/;
+use Fcntl qw/:flock/;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'no /dev/shm') unless -d '/dev/shm';
+
+my $t = Test::Nginx->new()->has(qw/http/);
+
+my $shm = "ngx_ingress_path_$$";
+my $lock = $t->testdir() . '/ingress.lock';
+
+$t->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+processes {
+    process strategy {
+    }
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    ingress_gateway_shm_config gw /$shm 64k $lock;
+    ingress_gateway_update_interval gw 50ms;
+    ingress_gateway_pool_size gw 64k;
+    ingress_gateway_hash_num gw 31;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            ingress_gateway gw;
+            add_header X-Target \$ingress_route_target always;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('index.html', '');
+$t->write_file('ingress.lock', '');
+
+# overlapping prefixes, matched as plain case-insensitive string prefixes;
+# tags are [ service, rule, ... ], a rule is a list of header and value
+
+my $host = {
+	host => 'p.example.com',
+	service => 'svc-h',
+	paths => [
+		[ '/a', 'svc-1' ],
+		[ '/a/b', 'svc-2' ],
+		[ '/a/bc', 'svc-3' ],
+		[ '/A/B/C/D', 'svc-4' ],
+		[ '/a/b/c', 'svc-5' ],
+		[ '/t', 'svc-1',
+			[ 'svc-2', [ 'X-Tag' => 'two' ] ],
+			[ 'svc-3', [ 'X-Tag' => 'three', 'X-Env' => 'prod' ],
+				[ 'X-Other' => 'three' ] ] ],
+		[ '/t/u', 'svc-5', [ 'svc-4', [ 'X-Tag' => 'four' ] ] ],
+	],
+	tags => [
+		[ 'svc-3', [ 'X-Tag' => 'three', 'X-Env' => 'prod' ] ],
+		[ 'svc-4', [ 'Cookie' => 'env=gray' ] ],
+	],
+};
+
+my %enabled = map { $_ => 1 } qw/svc-h svc-1 svc-2 svc-3 svc-4 svc-5/;
+
+my $version = 0;
+
+publish(1, config($host, sort keys %enabled));
+
+$t->try_run('no ingress')->plan(7);
+
+###############################################################################
+
+my @uris = qw(
+	/ /a /A /a/ /ab /a/b /a/B /a/b/ /a/bx /a/bc /a/bcd /a/b/c /a/b/cd
+	/a/b/c/d /a/B/c/D/e /a/b/c/x/d /b /t /t/ /tu /t/u /t/uv /t/v
+);
+
+my @headers = (
+	[],
+	[ 'X-Tag' => 'two' ],
+	[ 'X-Tag' => 'TWO' ],
+	[ 'X-Tag' => 'three' ],
+	[ 'X-Tag' => 'three', 'X-Env' => 'prod' ],
+	[ 'X-Env' => 'prod', 'X-Tag' => 'three' ],
+	[ 'X-Other' => 'three' ],
+	[ 'X-Tag' => 'four' ],
+	[ 'X-Tag' => 'four', 'X-Tag' => 'two' ],
+	[ 'Cookie' => 'env=gray' ],
+	[ 'Cookie' => 'env=gray; x=y' ],
+);
+
+is(mismatches(), '', 'exact and longest prefix');
+
+is(target('/a/b'), 'svc-2', 'exact path');
+is(target('/a/b/c/x'), 'svc-5', 'longest prefix');
+is(target('/t/u', 'X-Tag' => 'three', 'X-Env' => 'prod'), 'svc-5',
+	'longest prefix tags first');
+is(target('/b', 'X-Tag' => 'three', 'X-Env' => 'prod'), 'svc-3',
+	'host tags');
+
+# a router whose service is gone falls back to a shorter prefix
+
+delete @enabled{qw/svc-2 svc-5/};
+
+publish(2, number(1, $version) . bytes(5, 'svc-2') . bytes(5, 'svc-5'));
+
+for (1 .. 50) {
+	last if target('/a/b') eq 'svc-1';
+	select undef, undef, undef, 0.05;
+}
+
+select undef, undef, undef, 0.2;
+
+is(target('/a/b/c'), 'svc-1', 'fallback');
+is(mismatches(), '', 'fallback to shorter prefixes');
+
+$t->stop();
+
+unlink("/dev/shm/$shm");
+
+###############################################################################
+
+# the linear scan the trie replaced: longest prefixes first, then the
+# tags and the service of each router, then the tags and service of host
+
+sub linear {
+	my ($uri, @h) = @_;
+
+	my @paths = sort {
+		length $b->[0] <=> length $a->[0] || $a->[0] cmp $b->[0]
+	} @{$host->{paths}};
+
+	for my $path (@paths) {
+		my ($prefix, $service, @tags) = @$path;
+
+		next unless lc(substr($uri, 0, length $prefix)) eq lc $prefix;
+
+		my $tagged = tagged(\@tags, @h);
+		return $tagged if defined $tagged;
+
+		return $service if $enabled{$service};
+	}
+
+	my $tagged = tagged($host->{tags}, @h);
+	return $tagged if defined $tagged;
+
+	return $host->{service};
+}
+
+sub tagged {
+	my ($tags, @h) = @_;
+	my %h;
+
+	# the first header with a name wins
+
+	while (my ($k, $v) = splice @h, 0, 2) {
+		$h{lc $k} = $v unless exists $h{lc $k};
+	}
+
+	for my $tag (@$tags) {
+		my ($service, @rules) = @$tag;
+
+		for my $rule (@rules) {
+			my @items = @$rule;
+			my $match = 1;
+
+			while (my ($k, $v) = splice @items, 0, 2) {
+				$match = 0 unless defined $h{lc $k} && lc $h{lc $k} eq lc $v;
+			}
+
+			return $service if $match && $enabled{$service};
+		}
+	}
+
+	return undef;
+}
+
+sub mismatches {
+	my @bad;
+
+	for my $uri (@uris) {
+		for my $h (@headers) {
+			my ($got, $expect) = (target($uri, @$h), linear($uri, @$h));
+			push @bad, "$uri @$h: $got != $expect" if $got ne $expect;
+		}
+	}
+
+	return join "\n", @bad;
+}
+
+sub target {
+	my ($uri, @h) = @_;
+	my $headers = '';
+
+	while (my ($k, $v) = splice @h, 0, 2) {
+		$headers .= "$k: $v\n";
+	}
+
+	my $r = http(<<EOF);
+GET $uri HTTP/1.0
+Host: $host->{host}
+$headers
+EOF
+
+	return '' unless defined $r;
+	return $r =~ /^X-Target: (.*?)\x0d?$/mi ? $1 : '';
+}
+
+###############################################################################
+
+sub varint {
+	my ($n) = @_;
+	my $s = '';
+
+	while ($n >= 0x80) {
+		$s .= chr(($n & 0x7f) | 0x80);
+		$n >>= 7;
+	}
+
+	return $s . chr($n);
+}
+
+sub bytes {
+	my ($field, $value) = @_;
+	return varint($field << 3 | 2) . varint(length $value) . $value;
+}
+
+sub number {
+	my ($field, $value) = @_;
+	return varint($field << 3) . varint($value);
+}
+
+# TagRouter: service and rules, each rule of TagItems matched in headers
+
+sub tag_router {
+	my ($service, @rules) = @{$_[0]};
+	my $tr = bytes(1, $service);
+
+	for my $rule (@rules) {
+		my ($r, @items) = ('', @$rule);
+
+		while (my ($k, $v) = splice @items, 0, 2) {
+			$r .= bytes(1, number(1, 0) . bytes(2, $k) . bytes(3, $v)
+				. number(4, 0));
+		}
+
+		$tr .= bytes(2, $r);
+	}
+
+	return $tr;
+}
+
+sub config {
+	my ($h, @services) = @_;
+
+	my $hr = bytes(1, $h->{host}) . bytes(2, $h->{service});
+
+	for my $path (@{$h->{paths}}) {
+		my ($prefix, $service, @tags) = @$path;
+		my $pr = bytes(1, $prefix) . bytes(2, $service);
+		$pr .= bytes(3, tag_router($_)) for @tags;
+		$hr .= bytes(3, $pr);
+	}
+
+	$hr .= bytes(4, tag_router($_)) for @{$h->{tags}};
+
+	my $pb = bytes(1, bytes(1, $hr));
+
+	for my $service (@services) {
+		$pb .= bytes(2, bytes(1, $service)
+			. bytes(2, bytes(1, $service) . number(2, 100)));
+	}
+
+	return $pb;
+}
+
+# shared memory layout: status, version, type, md5 of the message,
+# message length, message; numbers in network byte order
+
+sub publish {
+	my ($type, $pb) = @_;
+
+	$version++;
+
+	my $data = pack('NNNN', 2, 0, $version, $type) . md5_hex($pb)
+		. pack('N', length $pb) . $pb;
+
+	open my $lfh, '<', $lock or die "Can't open $lock: $!";
+	flock($lfh, LOCK_EX) or die "Can't lock $lock: $!";
+
+	# rewritten in place, the file is mapped by nginx
+	open my $fh, -e "/dev/shm/$shm" ? '+<' : '>', "/dev/shm/$shm"
+		or die "Can't open shm: $!";
+	binmode $fh;
+	print $fh $data . "\0" x (65536 - length $data);
+	close $fh;
+
+	close $lfh;
+}
+
+###############################################################################
@@ -0,0 +1,129 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache, index snapshot and parallel loader.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use File::Copy;
+use File::Find;
+use File::Path qw/ mkpath /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+plan(skip_all => 'long test') unless $ENV{TEST_NGINX_UNSAFE};
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(8)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2  keys_zone=NAME:1m
+                       index=%%TESTDIR%%/cache.index  index_interval=1s
+                       loader_threads=4;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   any   1h;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / { }
+    }
+}
+
+EOF
+
+$t->write_file("t$_.html", "SEE-THIS-$_") for (1 .. 21);
+$t->run();
+
+###############################################################################
+
+my $d = $t->testdir();
+
+http_get("/t$_.html") for (1 .. 20);
+
+# the index is written once the loader has walked the cache
+
+wait_for(sub { -s "$d/cache.index" }, 75);
+
+my $index = $t->read_file('cache.index');
+
+is(substr($index, 0, 8), "NGXCIDX\0", 'index magic');
+is(length($index), 40 + 20 * 24, 'index entries');
+
+$t->stop();
+
+# an old file missing from the index is still accounted
+
+my $file;
+find(sub { $file = $File::Find::name if -f && /^[0-9a-f]{32}$/ }, "$d/cache");
+
+my $old = "$d/cache/f/ff/" . 'f' x 32;
+mkpath("$d/cache/f/ff");
+copy($file, $old);
+utime(time() - 86400, time() - 86400, $old);
+
+# a file cached before the loader runs is found by the walk
+
+$t->run();
+
+like(http_get('/t21.html'), qr/MISS/, 'new file');
+like(http_get('/t1.html'), qr/HIT.*SEE-THIS-1/s, 'indexed file');
+
+wait_for(sub { (() = $t->read_file('error.log') =~ /, bsize:/g) == 2 }, 75);
+
+my $log = $t->read_file('error.log');
+
+like($log, qr/\Q$d\E\/cache 0\.\d+M restored from "\Q$d\E\/cache.index"/,
+	'restored');
+my ($size, $bsize) = ($log =~ /cache (\d+\.\d+)M, bsize: (\d+)/g)[-2, -1];
+
+ok($bsize, 'loaded');
+is(sprintf('%.3f', 22 * $bsize / 1048576), $size, 'size');
+ok(-e $old, 'old file kept');
+
+###############################################################################
+
+sub wait_for {
+	my ($cb, $timeout) = @_;
+
+	for (1 .. $timeout * 2) {
+		return if $cb->();
+		select undef, undef, undef, 0.5;
+	}
+}
+
+###############################################################################
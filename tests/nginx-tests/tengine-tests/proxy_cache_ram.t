@@ -0,0 +1,190 @@
+#!/usr/bin/perl
+
+# Tests for http proxy cache, in-memory tier.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy cache/)->plan(15)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    proxy_cache_path   %%TESTDIR%%/cache  levels=1:2  keys_zone=NAME:1m
+                       ram_size=1m  ram_max_object=4k;
+
+    proxy_cache_path   %%TESTDIR%%/scan  levels=1:2  keys_zone=SCAN:1m
+                       ram_size=32k;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   any   1h;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /short/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   NAME;
+
+            proxy_cache_valid   any   1s;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+
+        location /scan/ {
+            proxy_pass    http://127.0.0.1:8081;
+            proxy_cache   SCAN;
+
+            proxy_cache_valid   any   1h;
+
+            add_header X-Cache-Status $upstream_cache_status;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        server_name  localhost;
+
+        location / { }
+
+        location /vary/ {
+            add_header Vary X-Variant;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('t.html', 'SEE-THIS');
+$t->write_file('big.html', 'X' x 5000);
+
+mkdir($t->testdir() . '/vary');
+$t->write_file('vary/t.html', 'VARY');
+
+mkdir($t->testdir() . '/short');
+$t->write_file('short/t.html', 'OLD');
+
+mkdir($t->testdir() . '/scan');
+$t->write_file("scan/t$_.html", "SCAN-$_") for (1 .. 100);
+$t->write_file('scan/hot.html', 'HOT');
+
+$t->run();
+
+###############################################################################
+
+my $d = $t->testdir();
+
+like(http_get('/t.html'), qr/MISS.*SEE-THIS/s, 'miss');
+like(http_get('/t.html'), qr/HIT.*SEE-THIS/s, 'hit');
+
+http_get('/big.html') for (1 .. 2);
+
+# a replaced response is not served from memory
+
+http_get('/short/t.html') for (1 .. 2);
+
+$t->write_file('short/t.html', 'NEW');
+select undef, undef, undef, 2.1;
+
+like(http_get('/short/t.html'), qr/EXPIRED.*NEW/s, 'expired');
+like(http_get('/short/t.html'), qr/HIT.*NEW/s, 'updated');
+
+# variants are kept separately
+
+like(get_variant('A'), qr/MISS/, 'variant miss');
+like(get_variant('A'), qr/HIT/, 'variant hit');
+like(get_variant('B'), qr/MISS/, 'other variant miss');
+get_variant('B');
+
+# a frequently used response survives a scan of responses used once
+
+http_get('/scan/hot.html') for (1 .. 10);
+http_get("/scan/t$_.html"), http_get("/scan/t$_.html") for (1 .. 100);
+
+# with the files gone, only the responses kept in memory are hits
+
+unlink_cache("$d/cache");
+unlink_cache("$d/scan");
+
+like(http_get('/t.html'), qr/HIT.*SEE-THIS/s, 'memory hit');
+like(http_get('/t.html'), qr/HIT.*SEE-THIS/s, 'memory hit again');
+
+like(http(<<EOF), qr/206 .*HIT.*\x0d\x0a\x0d\x0aTHI$/s, 'memory hit range');
+GET /t.html HTTP/1.0
+Host: localhost
+Range: bytes=4-6
+
+EOF
+
+like(http_get('/big.html'), qr/MISS/, 'large response');
+like(http_get('/short/t.html'), qr/HIT.*NEW/s, 'memory hit updated');
+
+like(get_variant('A') . get_variant('B'), qr/HIT.*VARY.*HIT.*VARY/s,
+	'memory hit variants');
+
+like(http_get('/scan/hot.html'), qr/HIT.*HOT/s, 'hot response kept');
+
+my $hits = grep { http_get("/scan/t$_.html") =~ /HIT/ } (1 .. 100);
+cmp_ok($hits, '<', 50, 'scan not admitted');
+
+###############################################################################
+
+sub get_variant {
+	my ($variant) = @_;
+	return http(<<EOF);
+GET /vary/t.html HTTP/1.0
+Host: localhost
+X-Variant: $variant
+
+EOF
+}
+
+sub unlink_cache {
+	my ($dir) = @_;
+
+	opendir(my $dh, $dir) or return;
+
+	for my $name (grep { !/^\./ } readdir($dh)) {
+		my $path = "$dir/$name";
+
+		if (-d $path) {
+			unlink_cache($path);
+
+		} else {
+			unlink $path;
+		}
+	}
+
+	closedir $dh;
+}
+
+###############################################################################
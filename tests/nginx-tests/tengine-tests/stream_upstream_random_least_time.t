@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2019 Alibaba Group Holding Limited
+
+# Stream tests for random balancer with least_time.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+use Test::Nginx::Stream qw/ stream /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/stream stream_return stream_upstream_zone/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+worker_processes 1;
+
+events {
+}
+
+stream {
+    %%TEST_GLOBALS_STREAM%%
+
+    upstream u {
+        random two least_time=last_byte;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    upstream z {
+        zone z 1m;
+        random two least_time=first_byte;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+    }
+
+    server {
+        listen      127.0.0.1:8081;
+        return      fast;
+    }
+
+    server {
+        listen      127.0.0.1:8091;
+        proxy_pass  u;
+    }
+
+    server {
+        listen      127.0.0.1:8092;
+        proxy_pass  z;
+    }
+}
+
+EOF
+
+$t->run_daemon(\&slow_daemon, port(8082));
+$t->try_run('no least_time')->plan(2);
+$t->waitforsocket('127.0.0.1:' . port(8082));
+
+###############################################################################
+
+is(many(8091, 10), 'fast', 'least_time last_byte');
+is(many(8092, 10), 'fast', 'least_time first_byte zone');
+
+###############################################################################
+
+# the slow peer may only be chosen before its time is known
+
+sub many {
+	my ($port, $count) = @_;
+	my %seen;
+
+	for (1 .. $count) {
+		my $r = stream('127.0.0.1:' . port($port))->read();
+		$seen{$r}++ if defined $r;
+	}
+
+	$seen{slow} = 0 if ($seen{slow} || 0) <= 1;
+
+	return join ',', grep { $seen{$_} } sort keys %seen;
+}
+
+sub slow_daemon {
+	my ($port) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:' . $port,
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+		select undef, undef, undef, 0.5;
+		print $client 'slow';
+		close $client;
+	}
+}
+
+###############################################################################
@@ -0,0 +1,136 @@
+#!/usr/bin/perl
+
+# Copyright (C) 2010-2019 Alibaba Group Holding Limited
+
+# Stream tests for upstream vnswrr balancer module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+use Test::Nginx::Stream qw/ stream /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/stream stream_return stream_upstream_zone/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+worker_processes 1;
+
+events {
+}
+
+stream {
+    %%TEST_GLOBALS_STREAM%%
+
+    upstream u {
+        vnswrr;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082;
+        server 127.0.0.1:8083 down;
+    }
+
+    upstream w {
+        vnswrr max_init=1;
+        server 127.0.0.1:8081;
+        server 127.0.0.1:8082 weight=2;
+    }
+
+    upstream z {
+        zone z 1m;
+        vnswrr;
+        server 127.0.0.1:8081 weight=2;
+        server 127.0.0.1:8082 weight=4;
+        server 127.0.0.1:8083 weight=8;
+    }
+
+    upstream b {
+        vnswrr;
+        server 127.0.0.1:8081 down;
+        server 127.0.0.1:8082 backup;
+    }
+
+    upstream f {
+        vnswrr;
+        server 127.0.0.1:8084 weight=2;
+        server 127.0.0.1:8082;
+    }
+
+    server {
+        listen      127.0.0.1:8081;
+        listen      127.0.0.1:8082;
+        listen      127.0.0.1:8083;
+        return      $server_port;
+    }
+
+    server {
+        listen      127.0.0.1:8091;
+        proxy_pass  u;
+    }
+
+    server {
+        listen      127.0.0.1:8092;
+        proxy_pass  w;
+    }
+
+    server {
+        listen      127.0.0.1:8093;
+        proxy_pass  z;
+    }
+
+    server {
+        listen      127.0.0.1:8094;
+        proxy_pass  b;
+    }
+
+    server {
+        listen      127.0.0.1:8095;
+        proxy_pass  f;
+    }
+}
+
+EOF
+
+$t->try_run('no stream vnswrr')->plan(6);
+
+###############################################################################
+
+is(many(8091, 10), '8081: 5, 8082: 5', 'vnswrr');
+is(many(8092, 30), '8081: 10, 8082: 20', 'weight');
+is(many(8093, 70), '8081: 10, 8082: 20, 8083: 40', 'weight in zone');
+is(many(8094, 4), '8082: 4', 'backup');
+is(many(8095, 6), '8082: 6', 'failed peer skipped');
+is(many(8091, 10), '8081: 5, 8082: 5', 'vnswrr again');
+
+###############################################################################
+
+sub many {
+	my ($port, $count) = @_;
+	my (%ports);
+
+	for (1 .. $count) {
+		my $r = stream("127.0.0.1:" . port($port))->read();
+
+		if ($r =~ /(\d+)/) {
+			$ports{$1} = 0 unless defined $ports{$1};
+			$ports{$1}++;
+		}
+	}
+
+	return join ', ', map { $_ . ": " . $ports{$_} } sort keys %ports;
+}
+
+###############################################################################
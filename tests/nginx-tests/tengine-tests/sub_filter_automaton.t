@@ -0,0 +1,101 @@
+#!/usr/bin/perl
+
+# Tests for sub filter with many static patterns, matched by an automaton.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $patterns = join '', map {
+	"            sub_filter http://cdn$_.example.com/ //static$_/;\n"
+} (0 .. 39);
+
+my $t = Test::Nginx->new()->has(qw/http sub/)->plan(4)
+	->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon         off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        sendfile     off;
+
+        location /links/ {
+            sub_filter_once off;
+$patterns
+            alias %%TESTDIR%%/;
+        }
+
+        location /links/small/ {
+            sub_filter_once off;
+$patterns
+            output_buffers 2 5;
+            alias %%TESTDIR%%/;
+        }
+
+        location /overlap/ {
+            sub_filter_once off;
+            sub_filter abcd 1;
+            sub_filter bc 2;
+            sub_filter cdef 3;
+            sub_filter d 4;
+            output_buffers 2 3;
+            alias %%TESTDIR%%/;
+        }
+
+        location /once/ {
+            sub_filter abc 1;
+            sub_filter ab 2;
+            sub_filter xyz 3;
+            output_buffers 2 2;
+            alias %%TESTDIR%%/;
+        }
+    }
+}
+
+EOF
+
+my $page = '<a href="http://cdn7.example.com/x">'
+	. '<a href="HTTP://CDN39.Example.com/y">'
+	. '<a href="http://cdn40.example.com/z">';
+
+$t->write_file('links.html', $page x 200);
+$t->write_file('overlap.html', 'xabcdefxbcdefxcdefxDx');
+$t->write_file('once.html', 'ababcabcxyzxyz');
+$t->run();
+
+###############################################################################
+
+my $links = '<a href="//static7/x"><a href="//static39/y">'
+	. '<a href="http://cdn40.example.com/z">';
+$links = qr/^(\Q$links\E){200}$/m;
+
+like(http_get('/links/links.html'), $links, 'many patterns');
+like(http_get('/links/small/links.html'), $links,
+	'many patterns small buffers');
+like(http_get('/overlap/overlap.html'), qr/^x1efx24efx3x4x$/m, 'leftmost');
+like(http_get('/once/once.html'), qr/^21abc3xyz$/m, 'once');
+
+###############################################################################
@@ -0,0 +1,129 @@
+#!/usr/bin/perl
+
+# Tests for adaptive concurrency limit of upstreams.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx qw/ :DEFAULT http_end /;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream reject {
+        server 127.0.0.1:8081;
+        adaptive_limit initial=1 max=1 status=429;
+    }
+
+    upstream queue {
+        server 127.0.0.1:8081;
+        adaptive_limit initial=1 max=1 queue=1 timeout=5s;
+    }
+
+    upstream short {
+        server 127.0.0.1:8081;
+        adaptive_limit initial=1 max=1 queue=1 timeout=100ms;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location /reject {
+            proxy_pass http://reject;
+        }
+
+        location /queue {
+            proxy_pass http://queue;
+        }
+
+        location /short {
+            proxy_pass http://short;
+        }
+    }
+}
+
+EOF
+
+$t->run_daemon(\&http_daemon, port(8081));
+$t->try_run('no adaptive_limit')->plan(6);
+$t->waitforsocket('127.0.0.1:' . port(8081));
+
+###############################################################################
+
+my $s = http_get('/reject', start => 1);
+select undef, undef, undef, 0.2;
+
+like(http_get('/reject'), qr/ 429 /, 'rejected over limit');
+like(http_end($s), qr/ 200 .*SEE-THIS/s, 'request within limit');
+
+$s = http_get('/queue', start => 1);
+select undef, undef, undef, 0.2;
+
+like(http_get('/queue'), qr/ 200 .*SEE-THIS/s, 'queued');
+like(http_end($s), qr/ 200 .*SEE-THIS/s, 'request before queued');
+
+$s = http_get('/short', start => 1);
+select undef, undef, undef, 0.2;
+
+like(http_get('/short'), qr/ 503 /, 'queue timeout');
+like(http_end($s), qr/ 200 .*SEE-THIS/s, 'request before timed out');
+
+###############################################################################
+
+sub http_daemon {
+	my ($port) = @_;
+
+	my $server = IO::Socket::INET->new(
+		Proto => 'tcp',
+		LocalAddr => '127.0.0.1:' . $port,
+		Listen => 5,
+		Reuse => 1
+	)
+		or die "Can't create listening socket: $!\n";
+
+	local $SIG{PIPE} = 'IGNORE';
+
+	while (my $client = $server->accept()) {
+		$client->autoflush(1);
+
+		while (<$client>) {
+			last if (/^\x0d?\x0a?$/);
+		}
+
+		select undef, undef, undef, 0.5;
+
+		print $client <<'EOF';
+HTTP/1.1 200 OK
+Connection: close
+
+SEE-THIS
+EOF
+
+		close $client;
+	}
+}
+
+###############################################################################
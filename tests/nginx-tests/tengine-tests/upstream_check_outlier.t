@@ -0,0 +1,147 @@
+#!/usr/bin/perl
+
+# Tests for passive outlier detection of ngx_http_upstream_check_module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http proxy/)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    upstream u {
+        server 127.0.0.1:8081 max_fails=0;
+        server 127.0.0.1:8082 max_fails=0;
+        server 127.0.0.1:8083 max_fails=0;
+
+        check interval=1000 rise=1 fall=5 timeout=1000 type=tcp
+              default_down=false;
+        check_outlier consecutive=3 ejection_time=60000;
+    }
+
+    upstream u2 {
+        server 127.0.0.1:8081 max_fails=0;
+        server 127.0.0.1:8082 max_fails=0;
+        server 127.0.0.1:8085 max_fails=0;
+
+        check interval=1000 rise=1 fall=5 timeout=1000 type=tcp
+              default_down=false;
+        check_outlier consecutive=3 interval=500 ejection_time=1500
+                      max_ejection_percent=1;
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://u;
+            proxy_next_upstream error timeout http_502;
+        }
+
+        location /u2/ {
+            proxy_pass http://u2/;
+            proxy_next_upstream error timeout http_502;
+        }
+
+        location /status {
+            check_status json;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8081;
+        listen       127.0.0.1:8083;
+        server_name  localhost;
+
+        location / {
+            root %%TESTDIR%%;
+            try_files /$server_port.html =404;
+        }
+    }
+
+    server {
+        listen       127.0.0.1:8082;
+        listen       127.0.0.1:8085;
+        server_name  localhost;
+
+        location / {
+            proxy_pass http://127.0.0.1:8084;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('8081.html', '8081');
+$t->write_file('8083.html', '8083');
+$t->try_run('no check_outlier')->plan(6);
+
+###############################################################################
+
+like(http_get('/status'), qr/"ejected": false/, 'nothing ejected');
+
+http_get('/') for (1 .. 9);
+
+like(http_get('/status'),
+	qr/"name": "127.0.0.1:8082", "status": "up".*"ejected": true/,
+	'failing peer ejected');
+
+my $res = '';
+$res .= http_get('/') for (1 .. 6);
+
+like($res, qr/8081/, 'good peer in use');
+
+my $r = http_get('/status');
+my $ejected = () = $r =~ /"ejected": true/g;
+
+is($ejected, 1, 'only one peer ejected');
+
+# two failing peers, one of them may be ejected at a time; the other one
+# is ejected with its next failure once the first is readmitted
+
+http_get('/u2/') for (1 .. 9);
+
+my @first = ejected();
+
+is(scalar @first, 1, 'ejections capped');
+
+select undef, undef, undef, 2.5;
+
+http_get('/u2/') for (1 .. 2);
+
+my ($second) = ejected();
+
+ok($second && $second ne $first[0], 'refused peer ejected later');
+
+###############################################################################
+
+sub ejected {
+	my $r = http_get('/status?format=json');
+	return $r =~ /"upstream": "u2", "name": "([^"]+)"[^\n]*"ejected": true/g;
+}
+
+###############################################################################
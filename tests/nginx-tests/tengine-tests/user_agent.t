@@ -0,0 +1,118 @@
+#!/usr/bin/perl
+
+# Tests for user_agent module.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+# enough keywords sharing their last bytes for wide trie states
+
+my $bots = join '', map { "        Bot$_ bot$_;\n" } (0 .. 99);
+my $tails = join '', map { "        ${_}Tail ${_}_tail;\n" } ('a' .. 'z');
+
+my $t = Test::Nginx->new()->has(qw/http/)->plan(14)
+	->write_file_expand('nginx.conf', <<"EOF");
+
+%%TEST_GLOBALS%%
+
+daemon         off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    user_agent \$browser {
+        default                     unknown;
+
+        greedy                      Safari;
+        greedy                      Mobile;
+
+        Chrome      18.0+           chrome18;
+        Chrome      17.0~17.9999    chrome17;
+        Chrome      5.0-            chrome_low;
+
+        MSIE        9.0             msie9;
+        Firefox                     firefox;
+        Edg                         edge;
+        Edge                        edge_legacy;
+        Safari      5.0+            safari;
+
+$bots$tails
+    }
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            add_header X-Browser \$browser;
+        }
+    }
+}
+
+EOF
+
+$t->write_file('index.html', '');
+$t->run();
+
+###############################################################################
+
+is(browser('Mozilla/5.0 (Windows NT 5.1) AppleWebKit/535.1 '
+	. '(KHTML, like Gecko) Chrome/13.0.782.112 Safari/535.1'),
+	'unknown', 'no interval');
+is(browser('Mozilla/5.0 (Windows NT 5.1) AppleWebKit/535.1 '
+	. '(KHTML, like Gecko) Chrome/17.0.963.56 Safari/535.11'),
+	'chrome17', 'greedy safari');
+is(browser('Mozilla/5.0 (Windows NT 10.0) AppleWebKit/537.36 '
+	. '(KHTML, like Gecko) Chrome/118.0.0.0 Mobile Safari/537.36'),
+	'chrome18', 'greedy safari and mobile');
+is(browser('Chrome/4.1'), 'chrome_low', 'less or equal');
+is(browser('Mozilla/5.0 (Macintosh) AppleWebKit/605.1.15 '
+	. '(KHTML, like Gecko) Version/17.0 Safari/605.1.15'),
+	'safari', 'greedy alone');
+is(browser('Mozilla/5.0 (compatible; MSIE 9.0; Windows NT 6.1)'),
+	'msie9', 'equal');
+is(browser('Mozilla/5.0 (compatible; MSIE 8.0; Windows NT 6.1)'),
+	'unknown', 'not equal');
+is(browser('Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Firefox/119.0'),
+	'firefox', 'any version');
+is(browser('Chrome/118.0.0.0 Safari/537.36 Edg/118.0.2088.69'),
+	'edge', 'last keyword');
+is(browser('Chrome/70.0 Safari/537.36 Edge/18.17763'),
+	'edge_legacy', 'overlapping keywords');
+is(browser('Bot7/1.0'), 'bot7', 'wide state');
+is(browser('crawler Bot42/2.1 Bot99'), 'bot99', 'wide state last');
+is(browser('qTail/3'), 'q_tail', 'shared suffix');
+is(browser('curl/8.4.0'), 'unknown', 'default');
+
+###############################################################################
+
+sub browser {
+	my ($ua) = @_;
+	my $r = http(<<EOF);
+GET / HTTP/1.0
+Host: localhost
+User-Agent: $ua
+
+EOF
+	return $1 if $r =~ /X-Browser: (.*)\r/;
+	return '';
+}
+
+###############################################################################
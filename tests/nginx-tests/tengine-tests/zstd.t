@@ -0,0 +1,135 @@
+#!/usr/bin/perl
+
+# Tests for zstd filter and zstd_static modules.
+
+###############################################################################
+
+use warnings;
+use strict;
+
+use Test::More;
+
+use Digest::SHA qw/ sha256 /;
+use MIME::Base64 qw/ encode_base64 /;
+use Socket qw/ CRLF /;
+
+BEGIN { use FindBin; chdir($FindBin::Bin); }
+
+use lib 'lib';
+use Test::Nginx;
+
+###############################################################################
+
+select STDERR; $| = 1;
+select STDOUT; $| = 1;
+
+my $t = Test::Nginx->new()->has(qw/http zstd/)->plan(12)
+	->write_file_expand('nginx.conf', <<'EOF');
+
+%%TEST_GLOBALS%%
+
+daemon         off;
+
+events {
+}
+
+http {
+    %%TEST_GLOBALS_HTTP%%
+
+    zstd_types text/plain;
+    gzip_types text/plain;
+    gzip_http_version 1.0;
+
+    server {
+        listen       127.0.0.1:8080;
+        server_name  localhost;
+
+        location / {
+            zstd on;
+            gzip on;
+        }
+
+        location /small/ {
+            zstd on;
+            zstd_buffers 2 64;
+            zstd_comp_level 9;
+            alias %%TESTDIR%%/;
+        }
+
+        location /static/ {
+            zstd_static on;
+            alias %%TESTDIR%%/;
+        }
+
+        location /always/ {
+            zstd_static always;
+            alias %%TESTDIR%%/;
+        }
+
+        location /dict/ {
+            zstd on;
+            zstd_dictionary %%TESTDIR%%/dict.txt;
+            alias %%TESTDIR%%/;
+        }
+    }
+}
+
+EOF
+
+my $dict = join '', map { "common phrase number $_\n" } (0 .. 99);
+
+$t->write_file('text.txt', $dict x 4);
+$t->write_file('tiny.txt', 'x');
+$t->write_file('dict.txt', $dict);
+$t->write_file('file.txt', 'plain');
+$t->write_file('file.txt.zst', 'compressed');
+$t->run();
+
+###############################################################################
+
+my $zstd = qr/\x0d\x0a\x0d\x0a\x28\xb5\x2f\xfd/;
+
+like(get('/text.txt', 'gzip, zstd'), qr/Content-Encoding: zstd.*$zstd/s,
+	'zstd');
+like(get('/text.txt', 'gzip, zstd;q=0'), qr/Content-Encoding: gzip/,
+	'zstd refused');
+unlike(get('/tiny.txt', 'zstd'), qr/Content-Encoding/, 'min length');
+like(get('/small/text.txt', 'zstd'), qr/Content-Encoding: zstd.*$zstd/s,
+	'small buffers');
+
+like(get('/static/file.txt', 'zstd'), qr/Content-Encoding: zstd.*compressed/s,
+	'static');
+unlike(get('/static/file.txt', 'gzip'), qr/Content-Encoding/,
+	'static not accepted');
+like(get('/always/file.txt'), qr/Content-Encoding: zstd.*compressed/s,
+	'static always');
+
+SKIP: {
+skip 'no OpenSSL', 5 unless $t->has_module('OpenSSL');
+
+my $hash = sha256($dict);
+my $id = ':' . encode_base64($hash, '') . ':';
+
+my $r = get('/dict/text.txt', 'zstd, dcz', $id);
+like($r, qr/Content-Encoding: dcz/, 'dictionary');
+like($r, qr/Vary: Available-Dictionary/, 'dictionary vary');
+like($r, qr/\x0d\x0a\x0d\x0a\x5e\x2a\x4d\x18\x20\x00\x00\x00\Q$hash\E/,
+	'dictionary header');
+like(get('/dict/text.txt', 'zstd, dcz', ':AAAA:'),
+	qr/Content-Encoding: zstd/, 'dictionary mismatch');
+like(get('/dict/text.txt', 'zstd', $id),
+	qr/Content-Encoding: zstd/, 'dictionary not accepted');
+
+}
+
+###############################################################################
+
+sub get {
+	my ($uri, $ae, $dict) = @_;
+	$ae = defined $ae ? "Accept-Encoding: $ae" . CRLF : '';
+	$dict = defined $dict ? "Available-Dictionary: $dict" . CRLF : '';
+	return http("GET $uri HTTP/1.0" . CRLF . "Host: localhost" . CRLF
+		. $ae . $dict . CRLF);
+}
+
+###############################################################################